@@ -37,6 +37,7 @@ type ..\src\template\lib\bigz.h >> %TEMPF%
 type ..\src\template\lib\printf.h >> %TEMPF%
 type ..\src\template\header.h >> %TEMPF%
 makecstr.exe %TEMPF% > ..\src\backend\header.c
+makecstr.exe -c %TEMPF% header_image >> ..\src\backend\header.c
 del %TEMPF%
 
 @echo Building a Kilite binary...
@@ -49,11 +50,20 @@ cl /nologo /O2 /I..\..\mir  /MT /DONIG_EXTERN=extern ^
     ..\src\frontend\dispast.c ^
     ..\src\frontend\mkkir.c ^
     ..\src\frontend\opt/type.c ^
+    ..\src\frontend\opt/pass.c ^
+    ..\src\frontend\opt/escape.c ^
+    ..\src\frontend\opt/inline.c ^
+    ..\src\frontend\opt/tailcall.c ^
+    ..\src\frontend\opt/loop.c ^
     ..\src\backend\dispkir.c ^
     ..\src\backend\translate.c ^
     ..\src\backend\resolver.c ^
     ..\src\backend\header.c ^
     ..\src\backend\cexec.c ^
+    ..\src\backend\cache.c ^
+    ..\src\backend\prune.c ^
+    ..\src\backend\profile.c ^
+    ..\src\backend\thread.c ^
     ..\bin\onig.lib ^
     ..\bin\libminizip.lib ^
     ..\bin\zlibstatic.lib ^
@@ -57,6 +57,7 @@ cat ../src/template/lib/bigz.h >> $TEMPF
 cat ../src/template/lib/printf.h >> $TEMPF
 cat ../src/template/header.h >> $TEMPF
 ./makecstr $TEMPF > ../src/backend/header.c
+./makecstr -c $TEMPF header_image >> ../src/backend/header.c
 rm $TEMPF
 
 echo Building a Kilite binary...
@@ -69,11 +70,20 @@ gcc -Wno-unused-result -Wno-stringop-overflow -O3 -I../submodules/mir -DONIG_EXT
     ../src/frontend/dispast.c \
     ../src/frontend/mkkir.c \
     ../src/frontend/opt/type.c \
+    ../src/frontend/opt/pass.c \
+    ../src/frontend/opt/escape.c \
+    ../src/frontend/opt/inline.c \
+    ../src/frontend/opt/tailcall.c \
+    ../src/frontend/opt/loop.c \
     ../src/backend/dispkir.c \
     ../src/backend/translate.c \
     ../src/backend/resolver.c \
     ../src/backend/header.c \
     ../src/backend/cexec.c \
+    ../src/backend/cache.c \
+    ../src/backend/prune.c \
+    ../src/backend/profile.c \
+    ../src/backend/thread.c \
     -L../bin \
     -lmir_static \
     -lminizip \
@@ -163,4 +173,8 @@ rm -f *.h
 rm -f makecstr
 echo Building Kilite modules successfully ended.
 
+# The profile-guided build is checked here because the spec test can't give a profile.
+echo Checking a profile-guided build...
+bash ../build/pgotest.sh ../kilite
+
 cd $CUR
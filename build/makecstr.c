@@ -1,9 +1,610 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void putc_cstr(int ch)
+{
+    if (ch == '"') {
+        printf("\\\"");
+    } else if (ch == '\\') {
+        printf("\\\\");
+    } else if (ch == '\t') {
+        printf("\\t");
+    } else if (ch == '\r') {
+        /* skip */
+    } else if (ch == '\n') {
+        printf("\\n\"\n\"");
+    } else {
+        printf("%c", ch);
+    }
+}
+
+typedef struct strbuf {
+    char *s;
+    int len;
+    int cap;
+} strbuf;
+
+static void putc_buf(strbuf *b, int ch)
+{
+    if (b->cap <= b->len + 1) {
+        b->cap = b->cap ? b->cap * 2 : 4096;
+        b->s = realloc(b->s, b->cap);
+    }
+    b->s[b->len++] = ch;
+    b->s[b->len] = 0;
+}
+
+/*
+ * The compact mode makes the pre-digested image of the header for c2mir.
+ * Comments, indentation, and redundant spaces are dropped, but all newlines are kept
+ * so that the line numbers in compile errors are the same as the original header.
+ */
+static void make_compact(FILE *f, strbuf *b)
+{
+    int ch, next;
+    int space = 0;      /* pending spaces */
+    int linetop = 1;    /* at the beginning of a line */
+    int cont = 0;       /* the previous line ended with a backslash */
+    int last = 0;       /* the last character written */
+    while ((ch = fgetc(f)) != EOF) {
+        if (ch == '\r') {
+            continue;
+        }
+        if (ch == ' ' || ch == '\t') {
+            space = 1;
+            continue;
+        }
+        if (ch == '\n') {
+            cont = last == '\\';
+            putc_buf(b, '\n');
+            space = 0;
+            linetop = 1;
+            last = '\n';
+            continue;
+        }
+        if (ch == '/') {
+            next = fgetc(f);
+            if (next == '/') {
+                while ((ch = fgetc(f)) != EOF && ch != '\n') {
+                    /* skip */
+                }
+                if (ch == '\n') {
+                    ungetc(ch, f);
+                }
+                continue;
+            }
+            if (next == '*') {
+                int prev = 0;
+                while ((ch = fgetc(f)) != EOF) {
+                    if (prev == '*' && ch == '/') {
+                        break;
+                    }
+                    if (ch == '\n') {
+                        putc_buf(b, '\n');
+                        linetop = 1;
+                        cont = 0;
+                    }
+                    prev = ch;
+                }
+                space = 1;
+                continue;
+            }
+            if (next != EOF) {
+                ungetc(next, f);
+            }
+        }
+        if (space && (!linetop || cont)) {
+            putc_buf(b, ' ');
+        }
+        space = 0;
+        linetop = 0;
+        putc_buf(b, ch);
+        last = ch;
+        if (ch == '"' || ch == '\'') {
+            int quote = ch;
+            while ((ch = fgetc(f)) != EOF) {
+                putc_buf(b, ch);
+                if (ch == '\\') {
+                    if ((ch = fgetc(f)) == EOF) {
+                        break;
+                    }
+                    putc_buf(b, ch);
+                } else if (ch == quote) {
+                    break;
+                } else if (ch == '\n') {
+                    linetop = 1;
+                    cont = 0;
+                    break;
+                }
+            }
+            last = ch;
+        }
+    }
+}
+
+/*
+ * The image is also split into items, each of which is a preprocessor directive or a C declaration.
+ * The names each item defines and the items each item depends on are resolved here,
+ * so that only the items a script really uses are passed to c2mir at runtime.
+ */
+#define NAME_HASH_SIZE (8192)
+
+typedef struct intbuf {
+    int *v;
+    int n;
+    int cap;
+} intbuf;
+
+typedef struct name_t {
+    char *str;
+    int id;             /* the index in the output table */
+    intbuf defs;        /* the items defining this name */
+    struct name_t *next;
+} name_t;
+
+typedef struct item_t {
+    int pos;
+    int len;
+    int lines;
+    int keep;           /* needed by any script */
+    intbuf defs;
+    intbuf refs;
+    intbuf deps;
+} item_t;
+
+static const char *keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "defined", "do", "double",
+    "else", "enum", "extern", "float", "for", "goto", "if", "inline", "INLINE", "int", "long",
+    "register", "restrict", "return", "short", "signed", "sizeof", "static", "struct", "switch",
+    "typedef", "union", "unsigned", "void", "volatile", "while", "_Bool",
+    NULL,
+};
+
+static name_t *name_hash[NAME_HASH_SIZE] = {0};
+static name_t **names = NULL;
+static int names_count = 0;
+static item_t *items = NULL;
+static int items_count = 0;
+
+static void push_int(intbuf *b, int v)
+{
+    for (int i = 0; i < b->n; ++i) {
+        if (b->v[i] == v) {
+            return;
+        }
+    }
+    if (b->cap <= b->n) {
+        b->cap = b->cap ? b->cap * 2 : 8;
+        b->v = realloc(b->v, sizeof(int) * b->cap);
+    }
+    b->v[b->n++] = v;
+}
+
+static int is_idtop(int ch)
+{
+    return ch == '_' || ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z');
+}
+
+static int is_idchar(int ch)
+{
+    return is_idtop(ch) || ('0' <= ch && ch <= '9');
+}
+
+static int is_keyword(const char *s, int len)
+{
+    for (int i = 0; keywords[i]; ++i) {
+        if (strlen(keywords[i]) == len && strncmp(keywords[i], s, len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static name_t *intern(const char *s, int len)
+{
+    unsigned int h = 0;
+    for (int i = 0; i < len; ++i) {
+        h = h * 31 + (unsigned char)s[i];
+    }
+    h %= NAME_HASH_SIZE;
+    for (name_t *n = name_hash[h]; n; n = n->next) {
+        if (strlen(n->str) == len && strncmp(n->str, s, len) == 0) {
+            return n;
+        }
+    }
+    name_t *n = calloc(1, sizeof(name_t));
+    n->str = calloc(len + 1, 1);
+    memcpy(n->str, s, len);
+    n->id = names_count;
+    n->next = name_hash[h];
+    name_hash[h] = n;
+    names = realloc(names, sizeof(name_t *) * (names_count + 1));
+    names[names_count++] = n;
+    return n;
+}
+
+/* Returns the next token from s[*pos] to s[end], skipping literals. A token is an identifier or a punctuation. */
+static int next_token(const char *s, int *pos, int end, int *len)
+{
+    int i = *pos;
+    while (i < end) {
+        int ch = s[i];
+        if (ch == '"' || ch == '\'') {
+            for (++i; i < end && s[i] != ch && s[i] != '\n'; ++i) {
+                if (s[i] == '\\') {
+                    ++i;
+                }
+            }
+            ++i;
+            continue;
+        }
+        if ('0' <= ch && ch <= '9') {
+            while (i < end && (is_idchar(s[i]) || s[i] == '.')) {
+                ++i;
+            }
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\\') {
+            ++i;
+            continue;
+        }
+        int top = i++;
+        if (is_idtop(ch)) {
+            while (i < end && is_idchar(s[i])) {
+                ++i;
+            }
+        }
+        *pos = i;
+        *len = i - top;
+        return top;
+    }
+    *pos = end;
+    return -1;
+}
+
+static int is_token(const char *s, int top, int len, const char *tok)
+{
+    return top >= 0 && strlen(tok) == len && strncmp(s + top, tok, len) == 0;
+}
+
+static void add_def(item_t *item, int index, const char *s, int len)
+{
+    name_t *n = intern(s, len);
+    push_int(&(item->defs), n->id);
+    push_int(&(n->defs), index);
+}
+
+static void add_refs(item_t *item, const char *s, int pos, int end)
+{
+    int len;
+    int top;
+    while ((top = next_token(s, &pos, end, &len)) >= 0) {
+        if (is_idtop(s[top])) {
+            push_int(&(item->refs), intern(s + top, len)->id);
+        }
+    }
+}
+
+/* Finds the names a C declaration defines, which are tags, enumerators, typedef names, functions, and variables. */
+static void add_decl_defs(item_t *item, int index, const char *s)
+{
+    int *tops = malloc(sizeof(int) * (item->len + 1));
+    int *lens = malloc(sizeof(int) * (item->len + 1));
+    int count = 0, pos = item->pos, end = item->pos + item->len, len, top;
+    while ((top = next_token(s, &pos, end, &len)) >= 0) {
+        tops[count] = top;
+        lens[count] = len;
+        ++count;
+    }
+
+    /* Tags and enumerators. */
+    for (int i = 0; i + 2 < count; ++i) {
+        int isenum = is_token(s, tops[i], lens[i], "enum");
+        if (!isenum && !is_token(s, tops[i], lens[i], "struct") && !is_token(s, tops[i], lens[i], "union")) {
+            continue;
+        }
+        int b = i + 1;
+        if (is_idtop(s[tops[b]])) {
+            if (is_token(s, tops[b + 1], lens[b + 1], "{")) {
+                add_def(item, index, s + tops[b], lens[b]);
+            }
+            ++b;
+        }
+        if (isenum && is_token(s, tops[b], lens[b], "{")) {
+            int depth = 0;
+            for (int k = b; k < count; ++k) {
+                if (s[tops[k]] == '(' || s[tops[k]] == '{') {
+                    ++depth;
+                } else if (s[tops[k]] == ')') {
+                    --depth;
+                } else if (s[tops[k]] == '}') {
+                    if (--depth == 0) {
+                        break;
+                    }
+                } else if (depth == 1 && is_idtop(s[tops[k]]) && (s[tops[k - 1]] == '{' || s[tops[k - 1]] == ',')) {
+                    add_def(item, index, s + tops[k], lens[k]);
+                }
+            }
+        }
+    }
+
+    /* Declarators are outside of any braces. */
+    int outer = 0, depth = 0;
+    for (int i = 0; i < count; ++i) {
+        if (s[tops[i]] == '{') {
+            ++depth;
+        } else if (s[tops[i]] == '}') {
+            --depth;
+        } else if (depth == 0) {
+            tops[outer] = tops[i];
+            lens[outer] = lens[i];
+            ++outer;
+        }
+    }
+    for (int i = 0; i + 3 < outer; ++i) {
+        if (s[tops[i]] == '(' && s[tops[i + 1]] == '*' && is_idtop(s[tops[i + 2]]) && s[tops[i + 3]] == ')') {
+            /* A function pointer. */
+            add_def(item, index, s + tops[i + 2], lens[i + 2]);
+            goto END;
+        }
+    }
+    int istypedef = outer > 0 && is_token(s, tops[0], lens[0], "typedef");
+    for (int i = 0; i + 1 < outer; ++i) {
+        if (is_idtop(s[tops[i]]) && s[tops[i + 1]] == '(') {
+            if (!istypedef && !is_keyword(s + tops[i], lens[i])) {
+                /* A function. */
+                add_def(item, index, s + tops[i], lens[i]);
+                goto END;
+            }
+            break;
+        }
+    }
+    int last = -1, skip = 0;
+    depth = 0;
+    for (int i = 0; i <= outer; ++i) {
+        int ch = i < outer ? s[tops[i]] : ';';
+        if (ch == '(' || ch == '[') {
+            ++depth;
+        } else if (ch == ')' || ch == ']') {
+            --depth;
+        } else if (depth == 0 && (ch == ',' || ch == ';')) {
+            if (last >= 0) {
+                add_def(item, index, s + tops[last], lens[last]);
+            }
+            last = -1;
+            skip = 0;
+        } else if (depth == 0 && ch == '=') {
+            skip = 1;
+        } else if (depth == 0 && !skip && is_idtop(ch) && !is_keyword(s + tops[i], lens[i])) {
+            last = i;
+        }
+    }
+
+END:
+    free(tops);
+    free(lens);
+}
+
+static item_t *add_item(int pos, int end, const char *s)
+{
+    items = realloc(items, sizeof(item_t) * (items_count + 1));
+    item_t *item = &(items[items_count++]);
+    memset(item, 0, sizeof(item_t));
+    item->pos = pos;
+    item->len = end - pos;
+    for (int i = pos; i < end; ++i) {
+        if (s[i] == '\n') {
+            ++item->lines;
+        }
+    }
+    return item;
+}
+
+static int line_end(const char *s, int pos, int len)
+{
+    while (pos < len && s[pos] != '\n') {
+        ++pos;
+    }
+    return pos < len ? pos + 1 : pos;
+}
+
+static void split_items(const char *s, int len)
+{
+    int start = 0, pos = 0;
+    while (pos < len) {
+        int p = pos;
+        while (p < len && s[p] == ' ') {
+            ++p;
+        }
+        if (s[p] == '\n') {
+            /* A blank line belongs to the next item. */
+            pos = p + 1;
+            continue;
+        }
+        int end;
+        if (s[p] == '#') {
+            end = line_end(s, p, len);
+            while (end < len && end >= 2 && s[end - 2] == '\\') {
+                end = line_end(s, end, len);
+            }
+            item_t *item = add_item(start, end, s);
+            int top, tlen, tp = p + 1;
+            top = next_token(s, &tp, end, &tlen);
+            if (is_token(s, top, tlen, "define")) {
+                top = next_token(s, &tp, end, &tlen);
+                add_def(item, items_count - 1, s + top, tlen);
+                add_refs(item, s, tp, end);
+            } else {
+                item->keep = 1;
+                add_refs(item, s, tp, end);
+            }
+        } else if (strncmp(s + p, "extern \"C\"", 10) == 0 || s[p] == '}') {
+            /* The linkage block for C++ is only a bracket. */
+            end = line_end(s, p, len);
+            add_item(start, end, s)->keep = 1;
+        } else {
+            int depth = 0, func = 0, last = 0;
+            for (end = p; end < len; ++end) {
+                int ch = s[end];
+                if (ch == '"' || ch == '\'') {
+                    for (++end; end < len && s[end] != ch && s[end] != '\n'; ++end) {
+                        if (s[end] == '\\') {
+                            ++end;
+                        }
+                    }
+                    last = ch;
+                    continue;
+                }
+                if (ch == '{') {
+                    if (depth++ == 0) {
+                        func = last == ')';
+                    }
+                } else if (ch == '}') {
+                    if (--depth == 0 && func) {
+                        break;
+                    }
+                } else if (ch == ';' && depth == 0) {
+                    break;
+                }
+                if (ch != ' ' && ch != '\n') {
+                    last = ch;
+                }
+            }
+            end = line_end(s, end, len);
+            item_t *item = add_item(start, end, s);
+            add_decl_defs(item, items_count - 1, s);
+            add_refs(item, s, item->pos, end);
+        }
+        start = pos = end;
+    }
+    if (start < len) {
+        add_item(start, len, s);
+    }
+}
+
+static void keep_item(int index)
+{
+    item_t *item = &(items[index]);
+    if (item->keep == 2) {
+        return;
+    }
+    item->keep = 2;
+    for (int i = 0; i < item->deps.n; ++i) {
+        keep_item(item->deps.v[i]);
+    }
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp((*(name_t **)a)->str, (*(name_t **)b)->str);
+}
+
+static void resolve_items(void)
+{
+    /* A reference to the name defined by other items is a dependency. */
+    for (int i = 0; i < items_count; ++i) {
+        item_t *item = &(items[i]);
+        for (int k = 0; k < item->refs.n; ++k) {
+            name_t *n = names[item->refs.v[k]];
+            for (int d = 0; d < n->defs.n; ++d) {
+                if (n->defs.v[d] != i) {
+                    push_int(&(item->deps), n->defs.v[d]);
+                }
+            }
+        }
+    }
+    /* The directives like #if and #include are always kept, so are the items they depend on. */
+    for (int i = 0; i < items_count; ++i) {
+        if (items[i].keep == 1) {
+            keep_item(i);
+        }
+    }
+}
+
+static void output_index(const char *name)
+{
+    printf("static const kl_image_item %s_items[] = {\n", name);
+    int dep = 0;
+    for (int i = 0; i < items_count; ++i) {
+        item_t *item = &(items[i]);
+        printf("    { %d, %d, %d, %d, %d, %d },\n", item->pos, item->len, item->lines, item->keep != 0, dep, item->deps.n);
+        dep += item->deps.n;
+    }
+    printf("};\n\n");
+
+    printf("static const int %s_deps[] = {\n", name);
+    for (int i = 0; i < items_count; ++i) {
+        item_t *item = &(items[i]);
+        if (item->deps.n > 0) {
+            printf("   ");
+            for (int k = 0; k < item->deps.n; ++k) {
+                printf(" %d,", item->deps.v[k]);
+            }
+            printf("\n");
+        }
+    }
+    printf("    -1,\n};\n\n");
+
+    /* Only defined names are looked up by the identifiers in a script. */
+    name_t **defined = calloc(names_count, sizeof(name_t *));
+    int count = 0;
+    for (int i = 0; i < names_count; ++i) {
+        if (names[i]->defs.n > 0) {
+            defined[count++] = names[i];
+        }
+    }
+    qsort(defined, count, sizeof(name_t *), compare_names);
+    printf("static const kl_image_name %s_names[] = {\n", name);
+    int def = 0;
+    for (int i = 0; i < count; ++i) {
+        printf("    { \"%s\", %d, %d },\n", defined[i]->str, def, defined[i]->defs.n);
+        def += defined[i]->defs.n;
+    }
+    printf("};\n\n");
+    printf("static const int %s_defs[] = {\n", name);
+    for (int i = 0; i < count; ++i) {
+        printf("   ");
+        for (int k = 0; k < defined[i]->defs.n; ++k) {
+            printf(" %d,", defined[i]->defs.v[k]);
+        }
+        printf("\n");
+    }
+    printf("};\n\n");
+    free(defined);
+
+    printf("static const kl_image_index %s_index = {\n", name);
+    printf("    .items = %s_items,\n", name);
+    printf("    .items_count = %d,\n", items_count);
+    printf("    .deps = %s_deps,\n", name);
+    printf("    .names = %s_names,\n", name);
+    printf("    .names_count = %d,\n", count);
+    printf("    .defs = %s_defs,\n", name);
+    printf("};\n\n");
+    printf("const kl_image_index *vm%s_index(void)\n", name);
+    printf("{\n");
+    printf("    return &%s_index;\n", name);
+    printf("}\n\n");
+}
+
+static void output_plain(FILE *f)
+{
+    int ch;
+    while ((ch = fgetc(f)) != EOF) {
+        putc_cstr(ch);
+    }
+}
 
 int main(int ac, char **av)
 {
+    int compact = 0;
+    if (ac > 1 && strcmp(av[1], "-c") == 0) {
+        compact = 1;
+        --ac;
+        ++av;
+    }
     if (ac < 2) {
-        printf("Usage: makecstr <file> [<name>]\n");
+        printf("Usage: makecstr [-c] <file> [<name>]\n");
         return 1;
     }
     const char *file = av[1];
@@ -14,29 +615,29 @@ int main(int ac, char **av)
         return 1;
     }
 
-    int ch;
-    printf("static const char *%s = \"", name);
-    while ((ch = fgetc(f)) != EOF) {
-        if (ch == '"') {
-            printf("\\\"");
-        } else if (ch == '\\') {
-            printf("\\\\");
-        } else if (ch == '\t') {
-            printf("\\t");
-        } else if (ch == '\r') {
-            /* skip */
-        } else if (ch == '\n') {
-            printf("\\n\"\n\"");
-        } else {
-            printf("%c", ch);
+    if (compact) {
+        strbuf b = {0};
+        make_compact(f, &b);
+        split_items(b.s, b.len);
+        resolve_items();
+        printf("#include \"header.h\"\n\n");
+        printf("static const char *%s = \"", name);
+        for (int i = 0; i < b.len; ++i) {
+            putc_cstr(b.s[i]);
         }
+    } else {
+        printf("static const char *%s = \"", name);
+        output_plain(f);
     }
     printf("\\n\";\n\n");
     printf("const char *vm%s(void)\n", name);
     printf("{\n");
     printf("    return %s;\n", name);
     printf("}\n\n");
+    if (compact) {
+        output_index(name);
+    }
     fclose(f);
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Checks that a profile-guided build prints the same as a normal build.
+# Usage: build/pgotest.sh [path/to/kilite]
+# A profile made by another input, a profile of an edited source, and a broken profile are also checked,
+# because a profile never changes the result but only adds guarded fast paths.
+
+CUR=$PWD
+cd `dirname $0`/..
+KILITE=${1:-./kilite}
+case $KILITE in
+    /*) ;;
+    *) KILITE=$CUR/$KILITE ;;
+esac
+[ -x "$KILITE" ] || KILITE=$PWD/kilite
+
+WORK=`mktemp -d`
+trap "rm -rf $WORK" EXIT
+
+# The first line selects the input, so the keys of sites are the same for every input.
+cat > $WORK/body.klt << 'EOF'
+function add(x, y) { return x + y; }
+function mul(x, y) { return x * y; }
+function work(v, w, f) {
+    var s = 0;
+    for (var i = 0; i < 1000; ++i) {
+        if (v < w) {
+            s = f(s, v);
+        } else {
+            s = s - w;
+        }
+    }
+    return s;
+}
+function fib(n) {
+    return n < 2 ? n : fib(n - 2) + fib(n - 1);
+}
+var fv = input.kind == 0 ? add : mul;
+System.println(work(input.v1, input.w1, fv));
+System.println(("" + work(input.v2, input.w2, add)).length());
+System.println(fib(input.n));
+EOF
+echo 'var input = { kind: 0, v1: 1.5, w1: 2.5, v2: 0.5, w2: 0.25, n: 20 };' > $WORK/dbl.klt
+echo 'var input = { kind: 1, v1: 2, w1: 3, v2: "a", w2: "b", n: 20.0 };' > $WORK/mix.klt
+echo 'var input = { kind: 0, v1: 3, w1: 2, v2: 1, w2: 2, n: 21 };' > $WORK/int.klt
+for f in dbl mix int; do
+    cat $WORK/body.klt >> $WORK/$f.klt
+done
+# The edited source moves all sites to other lines.
+(echo; cat $WORK/int.klt) > $WORK/edit.klt
+printf '# kilite profile\nkl003_work:6:T0 x y z -\nbroken\nkl003_work:7:C0 100 0 0 kl999_none\n' > $WORK/broken.prof
+
+NG=0
+check() {
+    local name=$1 src=$2
+    shift 2
+    local expect=`$KILITE --no-cache $WORK/$src.klt 2>&1`
+    local actual=`$KILITE --no-cache "$@" $WORK/$src.klt 2>&1`
+    if [ "$expect" == "$actual" ]; then
+        echo "ok: $name"
+    else
+        echo "NG: $name"
+        diff <(echo "$expect") <(echo "$actual") | head -10
+        NG=1
+    fi
+}
+
+check "dbl with --pgo-gen" dbl --pgo-gen=$WORK/dbl.prof
+check "int with --pgo-gen" int --pgo-gen=$WORK/int.prof
+check "dbl with its profile" dbl --pgo-use=$WORK/dbl.prof
+check "int with its profile" int --pgo-use=$WORK/int.prof
+check "mix with the profile of dbl" mix --pgo-use=$WORK/dbl.prof
+check "mix with the profile of int" mix --pgo-use=$WORK/int.prof
+check "int with the profile of dbl" int --pgo-use=$WORK/dbl.prof
+check "edited source with a stale profile" edit --pgo-use=$WORK/int.prof
+check "int with a broken profile" int --pgo-use=$WORK/broken.prof
+
+cd $CUR
+exit $NG
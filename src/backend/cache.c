@@ -0,0 +1,253 @@
+#include "cache.h"
+#include "header.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#define SEP '\\'
+#define getpid _getpid
+#define utime _utime
+#define make_dir(dir) _mkdir(dir)
+#define full_path(file) _fullpath(NULL, file, 0)
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#define SEP '/'
+#define make_dir(dir) mkdir(dir, 0755)
+#define full_path(file) realpath(file, NULL)
+#endif
+
+#define CACHE_EXT ".bmir"
+#define CACHE_TMP_EXT ".tmp"
+#define CACHE_TMP_EXPIRE (60 * 60)  /* A temporary file older than this is left by a crashed process. */
+
+typedef struct cache_hash {
+    uint64_t h1;
+    uint64_t h2;
+} cache_hash;
+
+typedef struct cache_entry {
+    char *name;
+    int64_t size;
+    time_t mtime;
+} cache_entry;
+
+static void hash_update(cache_hash *h, const void *data, size_t len)
+{
+    /* Two independent lanes, FNV-1a and a multiply-rotate one, make a 128 bit key. */
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h1 = h->h1;
+    uint64_t h2 = h->h2;
+    for (size_t i = 0; i < len; ++i) {
+        h1 = (h1 ^ p[i]) * 0x100000001b3ULL;
+        h2 = (h2 + p[i]) * 0x9e3779b97f4a7c15ULL;
+        h2 = (h2 << 27) | (h2 >> 37);
+    }
+    h->h1 = h1;
+    h->h2 = h2;
+}
+
+static void hash_update_str(cache_hash *h, const char *s)
+{
+    hash_update(h, s, strlen(s) + 1);
+}
+
+static void hash_update_path(cache_hash *h, const char *file)
+{
+    /* The file name is embedded into the stack trace, so the same source at another path is another module. */
+    char *path = full_path(file);
+    hash_update_str(h, path ? path : file);
+    hash_update_str(h, file);   /* The name as given is the one actually embedded. */
+    free(path);
+}
+
+const char *cache_default_dir(void)
+{
+    static char dir[CACHE_PATH_SIZE] = {0};
+    if (dir[0] == 0) {
+        const char *env = getenv("KILITE_CACHE_DIR");
+        if (env && env[0]) {
+            snprintf(dir, CACHE_PATH_SIZE - 1, "%s", env);
+            return dir;
+        }
+        #if defined(_WIN32) || defined(_WIN64)
+        const char *base = getenv("LOCALAPPDATA");
+        #else
+        const char *base = getenv("HOME");
+        #endif
+        if (!base || !base[0]) {
+            return NULL;
+        }
+        snprintf(dir, CACHE_PATH_SIZE - 1, "%s%c.kilite-cache", base, SEP);
+    }
+    return dir;
+}
+
+int cache_setup(kl_cache *c, const char *dir, int limit_mb, const char *ver, const char *file, const char *src, int len, int flags)
+{
+    if (!dir || !file || !src) {
+        return 1;
+    }
+    struct stat st;
+    if (stat(dir, &st) != 0) {
+        make_dir(dir);
+        if (stat(dir, &st) != 0) {
+            return 1;
+        }
+    }
+    if ((st.st_mode & S_IFMT) != S_IFDIR) {
+        return 1;
+    }
+
+    cache_hash h = { .h1 = 0xcbf29ce484222325ULL, .h2 = 0x84222325cbf29ce4ULL };
+    hash_update_str(&h, ver);
+    hash_update_str(&h, __DATE__ " " __TIME__);   /* Any rebuild of the compiler invalidates the cache. */
+    hash_update_str(&h, vmheader_image());
+    hash_update(&h, &flags, sizeof(flags));
+    hash_update_path(&h, file);
+    hash_update(&h, &len, sizeof(len));
+    hash_update(&h, src, len);
+
+    c->dir = dir;
+    c->limit = (int64_t)(limit_mb > 0 ? limit_mb : CACHE_DEFAULT_LIMIT_MB) * 1024 * 1024;
+    snprintf(c->key, CACHE_KEY_SIZE + 1, "%016llx%016llx", (unsigned long long)h.h1, (unsigned long long)h.h2);
+    int r = snprintf(c->path, CACHE_PATH_SIZE, "%s%c%s%s", dir, SEP, c->key, CACHE_EXT);
+    if (r < 0 || r >= CACHE_PATH_SIZE) {
+        return 1;
+    }
+    return 0;
+}
+
+int cache_lookup(kl_cache *c)
+{
+    struct stat st;
+    if (stat(c->path, &st) != 0 || st.st_size == 0) {
+        return 0;
+    }
+    /* Touch it for LRU. */
+    utime(c->path, NULL);
+    return 1;
+}
+
+FILE *cache_open_temp(const char *path, char *tmpname, int tmplen)
+{
+    int r = snprintf(tmpname, tmplen, "%s.%d%s", path, (int)getpid(), CACHE_TMP_EXT);
+    if (r < 0 || r >= tmplen) {
+        return NULL;
+    }
+    return fopen(tmpname, "wb");
+}
+
+int cache_commit(const char *tmpname, const char *path)
+{
+    /* rename() is atomic, so other processes never see a partially written module. */
+    #if defined(_WIN32) || defined(_WIN64)
+    if (!MoveFileExA(tmpname, path, MOVEFILE_REPLACE_EXISTING)) {
+    #else
+    if (rename(tmpname, path) != 0) {
+    #endif
+        remove(tmpname);
+        return 1;
+    }
+    return 0;
+}
+
+static int has_suffix(const char *name, const char *suffix)
+{
+    int nlen = strlen(name);
+    int slen = strlen(suffix);
+    return nlen > slen && strcmp(name + nlen - slen, suffix) == 0;
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+    const cache_entry *e1 = (const cache_entry *)a;
+    const cache_entry *e2 = (const cache_entry *)b;
+    return e1->mtime < e2->mtime ? -1 : (e1->mtime > e2->mtime ? 1 : 0);
+}
+
+static int64_t add_entry(kl_cache *c, cache_entry **list, int *count, int *cap, const char *name, time_t now)
+{
+    char path[CACHE_PATH_SIZE];
+    int r = snprintf(path, CACHE_PATH_SIZE, "%s%c%s", c->dir, SEP, name);
+    if (r < 0 || r >= CACHE_PATH_SIZE) {
+        return 0;
+    }
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    if (has_suffix(name, CACHE_TMP_EXT)) {
+        if (now - st.st_mtime > CACHE_TMP_EXPIRE) {
+            remove(path);
+        }
+        return 0;
+    }
+    if (!has_suffix(name, CACHE_EXT)) {
+        return 0;
+    }
+    if (*count >= *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *list = (cache_entry *)realloc(*list, sizeof(cache_entry) * (*cap));
+    }
+    cache_entry *e = &((*list)[(*count)++]);
+    e->name = strdup(path);
+    e->size = st.st_size;
+    e->mtime = st.st_mtime;
+    return st.st_size;
+}
+
+void cache_evict(kl_cache *c)
+{
+    int count = 0, cap = 0;
+    int64_t total = 0;
+    cache_entry *list = NULL;
+    time_t now = time(NULL);
+
+    #if defined(_WIN32) || defined(_WIN64)
+    char pattern[CACHE_PATH_SIZE];
+    snprintf(pattern, CACHE_PATH_SIZE, "%s\\*", c->dir);
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        total += add_entry(c, &list, &count, &cap, fd.cFileName, now);
+    } while (FindNextFileA(h, &fd));
+    FindClose(h);
+    #else
+    DIR *d = opendir(c->dir);
+    if (!d) {
+        return;
+    }
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        total += add_entry(c, &list, &count, &cap, de->d_name, now);
+    }
+    closedir(d);
+    #endif
+
+    if (total > c->limit) {
+        /* Remove the least recently used modules first. */
+        qsort(list, count, sizeof(cache_entry), entry_compare);
+        for (int i = 0; i < count && total > c->limit; ++i) {
+            if (strcmp(list[i].name, c->path) != 0 && remove(list[i].name) == 0) {
+                total -= list[i].size;
+            }
+        }
+    }
+    for (int i = 0; i < count; ++i) {
+        free(list[i].name);
+    }
+    free(list);
+}
@@ -0,0 +1,34 @@
+#ifndef KILITE_CACHE_H
+#define KILITE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CACHE_KEY_SIZE (32)
+#define CACHE_PATH_SIZE (512)
+#define CACHE_DEFAULT_LIMIT_MB (256)
+
+/* Flags to make a cache key, compiled code depends on these options. */
+#define CACHE_OPT_DISABLE_PURE  (0x01)
+#define CACHE_OPT_LAZY_OFF      (0x02)
+#define CACHE_OPT_PRINT_RESULT  (0x04)
+#define CACHE_OPT_VERBOSE       (0x08)
+#define CACHE_OPT_DISABLE_UNBOX (0x10)
+#define CACHE_OPT_LEVEL_SHIFT   (8)
+#define CACHE_OPT_INLINE_SHIFT  (16)
+
+typedef struct kl_cache {
+    const char *dir;                    //  The cache directory.
+    int64_t limit;                      //  Total size limit in bytes of the cache directory.
+    char key[CACHE_KEY_SIZE + 1];       //  The hash of the source code, its path, compiler version, and options.
+    char path[CACHE_PATH_SIZE];         //  The path of the cached module.
+} kl_cache;
+
+extern const char *cache_default_dir(void);
+extern int cache_setup(kl_cache *c, const char *dir, int limit_mb, const char *ver, const char *file, const char *src, int len, int flags);
+extern int cache_lookup(kl_cache *c);
+extern FILE *cache_open_temp(const char *path, char *tmpname, int tmplen);
+extern int cache_commit(const char *tmpname, const char *path);
+extern void cache_evict(kl_cache *c);
+
+#endif /* KILITE_CACHE_H */
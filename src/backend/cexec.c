@@ -1,4 +1,6 @@
 #include "cexec.h"
+#include "thread.h"
+#include "prune.h"
 #include "../../submodules/mir/c2mir/c2mir.h"
 #include "../../submodules/mir/mir-gen.h"
 #include <stdio.h>
@@ -10,7 +12,7 @@
 #define timer_elapsed SystemTimer_elapsed_impl
 #define SHOW_TIMER(msg) { \
     if (opts->cctime) { \
-        printf(">> %-25s: %f\n", msg, timer_elapsed(opts->timer)); \
+        printf(">> %-25s: %f (cpu: %f)\n", msg, timer_elapsed(opts->timer), thread_cputime_lap()); \
         timer_restart(opts->timer); \
     } \
 } \
@@ -35,6 +37,99 @@ static int getc_func(void *data)
     return EOF;
 }
 
+/*
+ * The parts of the code are compiled by the threads, and each part is compiled with its own context.
+ * The compiled module is written to the memory, and it's read into the main context in order.
+ */
+typedef struct part_data {
+    MIR_context_t ctx;
+    const char *fname;
+    const char *header;
+    const char *code;
+    int error;
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+    size_t pos;
+} part_data;
+
+/* The writer and the reader are called with only the context. */
+static part_data *parts = NULL;
+static int parts_count = 0;
+static part_data *part_reading = NULL;
+
+static int part_writer(MIR_context_t ctx, uint8_t byte)
+{
+    for (int i = 0; i < parts_count; ++i) {
+        part_data *pd = &(parts[i]);
+        if (pd->ctx == ctx) {
+            if (pd->len >= pd->cap) {
+                pd->cap = pd->cap == 0 ? 0x10000 : pd->cap * 2;
+                pd->buf = (uint8_t *)realloc(pd->buf, pd->cap);
+            }
+            pd->buf[pd->len++] = byte;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int part_reader(MIR_context_t ctx)
+{
+    part_data *pd = part_reading;
+    return pd->pos < pd->len ? pd->buf[pd->pos++] : EOF;
+}
+
+static void compile_part(void *data, int index)
+{
+    part_data *pd = &(((part_data *)data)[index]);
+    struct c2mir_options options = {0};
+    char *pruned = pd->header ? NULL : prune_header(pd->code);
+    struct data getc_data = { .code = pd->code, .p = pruned ? pruned : pd->header };
+    options.message_file = stderr;
+    c2mir_init(pd->ctx);
+    if (c2mir_compile(pd->ctx, &options, getc_func, &getc_data, pd->fname, NULL)) {
+        MIR_write_with_func(pd->ctx, part_writer);
+    } else {
+        pd->error = 1;
+    }
+    c2mir_finish(pd->ctx);
+    free(pruned);
+}
+
+static int compile_parts(MIR_context_t ctx, const char *fname, kl_opts *opts)
+{
+    int count = 0;
+    while (opts->parts[count]) {
+        ++count;
+    }
+    parts = (part_data *)calloc(count, sizeof(part_data));
+    parts_count = count;
+    for (int i = 0; i < count; ++i) {
+        parts[i].ctx = MIR_init();
+        parts[i].fname = fname;
+        parts[i].header = opts->full_header ? vmheader() : NULL;  /* NULL means the image pruned by the part. */
+        parts[i].code = opts->parts[i];
+    }
+    thread_parallel(opts->jobs, count, compile_part, parts);
+
+    int r = 1;
+    for (int i = 0; i < count; ++i) {
+        if (parts[i].error) {
+            r = 0;
+        } else if (r) {
+            part_reading = &(parts[i]);
+            MIR_read_with_func(ctx, part_reader);
+        }
+        free(parts[i].buf);
+        MIR_finish(parts[i].ctx);
+    }
+    free(parts);
+    parts = part_reading = NULL;
+    parts_count = 0;
+    return r;
+}
+
 static FILE *open_output_file(const char *fname, kl_opts *opts, int ismir)
 {
     if (opts->out_stdout && ismir) {
@@ -42,10 +137,17 @@ static FILE *open_output_file(const char *fname, kl_opts *opts, int ismir)
     }
     char buf[256] = {0};
     char *p = buf;
-    for (int i = 0; i < 240; ++i) {
-        if (*fname && *fname != '.') {
-            *p++ = *fname++;
+    char *dot = NULL;
+    for (int i = 0; i < 240 && *fname; ++i) {
+        if (*fname == '/' || *fname == '\\') {
+            dot = NULL;
+        } else if (*fname == '.') {
+            dot = p;
         }
+        *p++ = *fname++;
+    }
+    if (dot) {
+        p = dot;    /* The extension of the source file is replaced. */
     }
     const char *ext = ismir ? (opts->ext ? opts->ext : ".mir") : (opts->bext ? opts->bext : ".bmir");
     if (*ext != '.') {
@@ -67,6 +169,22 @@ static void load_additional_modules(MIR_context_t ctx, const char **modules)
     }
 }
 
+static void store_cache_module(MIR_context_t ctx, const char *path)
+{
+    char tmpname[CACHE_PATH_SIZE + 32] = {0};
+    FILE *f = cache_open_temp(path, tmpname, CACHE_PATH_SIZE + 30);
+    if (!f) {
+        return;
+    }
+    MIR_write(ctx, f);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err) {
+        remove(tmpname);
+        return;
+    }
+    cache_commit(tmpname, path);
+}
+
 static MIR_item_t load_main_modules(MIR_context_t ctx)
 {
     MIR_item_t main_func = NULL;
@@ -131,6 +249,10 @@ void load_additional_methods(MIR_context_t ctx)
     MIR_load_external(ctx, "mz_os_is_symlink", (void *)mz_os_is_symlink);
     MIR_load_external(ctx, "mz_os_make_symlink", (void *)mz_os_make_symlink);
     MIR_load_external(ctx, "mz_os_read_symlink", (void *)mz_os_read_symlink);
+    MIR_load_external(ctx, "File_map_impl", (void *)File_map_impl);
+    MIR_load_external(ctx, "File_unmap_impl", (void *)File_unmap_impl);
+    MIR_load_external(ctx, "Slab_alloc_impl", (void *)Slab_alloc_impl);
+    MIR_load_external(ctx, "Slab_free_impl", (void *)Slab_free_impl);
 
     MIR_load_external(ctx, "mz_zip_reader_create", (void *)mz_zip_reader_create);
     MIR_load_external(ctx, "mz_zip_reader_open_file", (void *)mz_zip_reader_open_file);
@@ -177,7 +299,8 @@ int run(int *ret, const char *fname, const char *src, int ac, char **av, char **
     int r = 1, lazy = 1;
     MIR_context_t ctx = MIR_init();
     struct c2mir_options options = {0};
-    struct data getc_data = { .code = src, .p = vmheader() };
+    char *pruned = NULL;
+    struct data getc_data = { .code = src };
 
     // options.verbose_p = 1;
     options.message_file = stderr;
@@ -195,11 +318,34 @@ int run(int *ret, const char *fname, const char *src, int ac, char **av, char **
     }
     c2mir_init(ctx);
     SHOW_TIMER("Run init");
-    if (!c2mir_compile(ctx, &options, getc_func, &getc_data, fname, outf)) {
-        fprintf(stderr, "Compile error\n");
-        goto END;
+    if (opts && opts->cache_hit) {
+        FILE *cf = fopen(opts->cache_file, "rb");
+        if (!cf) {
+            fprintf(stderr, "Can't open the cached module: %s\n", opts->cache_file);
+            goto END;
+        }
+        MIR_read(ctx, cf);
+        fclose(cf);
+        SHOW_TIMER("Load cached module");
+    } else {
+        if (!(opts && opts->parts)) {
+            /* The header image is pruned to the declarations the script uses, which is faster to be compiled. */
+            pruned = (opts && opts->full_header) ? NULL : prune_header(src);
+            getc_data.p = pruned ? pruned : vmheader();
+        }
+        int compiled = (opts && opts->parts)
+            ? compile_parts(ctx, fname, opts)
+            : c2mir_compile(ctx, &options, getc_func, &getc_data, fname, outf);
+        if (!compiled) {
+            fprintf(stderr, "Compile error\n");
+            goto END;
+        }
+        SHOW_TIMER("Compilation from C");
+        if (opts && opts->cache_file && !(options.asm_p || options.object_p)) {
+            store_cache_module(ctx, opts->cache_file);
+            SHOW_TIMER("Store cached module");
+        }
     }
-    SHOW_TIMER("Compilation from C");
 
     if (options.asm_p || options.object_p) {
         r = 0;  /* successful */
@@ -215,8 +361,10 @@ int run(int *ret, const char *fname, const char *src, int ac, char **av, char **
         }
         SHOW_TIMER("Load modules");
 
-        MIR_gen_init(ctx, 1);
-        MIR_link(ctx, lazy ? MIR_set_lazy_gen_interface : MIR_set_gen_interface, import_resolver);
+        /* All functions are generated by the threads at linking when the lazy generation is off. */
+        int gens = (!lazy && opts->jobs > 1) ? opts->jobs : 1;
+        MIR_gen_init(ctx, gens);
+        MIR_link(ctx, lazy ? MIR_set_lazy_gen_interface : (gens > 1 ? MIR_set_parallel_gen_interface : MIR_set_gen_interface), import_resolver);
         SHOW_TIMER("Link modules");
         main_t fun_addr = (main_t)(main_func->addr);
         int rc = fun_addr(ac, av, ev);
@@ -227,6 +375,7 @@ int run(int *ret, const char *fname, const char *src, int ac, char **av, char **
     }
 
 END:
+    free(pruned);
     if (outf) fclose(outf);
     c2mir_finish(ctx);
     MIR_finish(ctx);
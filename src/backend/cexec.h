@@ -3,6 +3,7 @@
 
 #include "resolver.h"
 #include "header.h"
+#include "cache.h"
 
 typedef struct kl_opts {
     int mir;
@@ -10,10 +11,15 @@ typedef struct kl_opts {
     int lazy_off;
     int out_stdout;
     int cctime;
+    int full_header;
+    int cache_hit;
+    int jobs;
     void *timer;
     const char *ext;
     const char *bext;
     const char **modules;
+    const char **parts;
+    const char *cache_file;
 } kl_opts;
 
 typedef int (*main_t)(int ac, char **av, char **ev);
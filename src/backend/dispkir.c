@@ -432,6 +432,31 @@ void disp_inst(kl_kir_program *p, kl_kir_inst *i)
     case KIR_ARYSIZE:
         disp_2op("arysize", i);
         break;
+    case KIR_CHKARY:
+        printf(IDT OP, "chkary");
+        disp_v(i, 1);
+        printf(", ");
+        disp_v(i, 2);
+        printf(", L%d\n", i->labelid);
+        break;
+    case KIR_IDXF:
+        disp_3op("idxf", i);
+        break;
+    case KIR_HEAPFRM:
+        disp_2op("heapfrm", i);
+        break;
+
+    case KIR_IMPORT:
+        disp_2op("import", i);
+        break;
+    case KIR_EXPORT:
+        disp_2op("export", i);
+        break;
+    case KIR_RUNMOD:
+        printf(IDT OP, "runmod");
+        disp_v(i, 1);
+        printf(", L%d\n", i->labelid);
+        break;
     }
 }
 
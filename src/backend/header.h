@@ -1,6 +1,37 @@
 #ifndef KILITE_HEADER_H
 #define KILITE_HEADER_H
 
+/*
+ * The index of the header image generated by makecstr -c.
+ * An item is a preprocessor directive or a C declaration in the image,
+ * and the items it depends on have been resolved at the build time.
+ */
+typedef struct kl_image_item {
+    int pos;            //  The offset in the image.
+    int len;            //  The length of the text.
+    int lines;          //  The number of newlines in the text.
+    int keep;           //  Needed by any script, like #if and #include and what they use.
+    int dep;            //  The first index of the dependencies in deps.
+    int deps_count;
+} kl_image_item;
+
+typedef struct kl_image_name {
+    const char *name;
+    int def;            //  The first index of the items defining the name in defs.
+    int defs_count;
+} kl_image_name;
+
+typedef struct kl_image_index {
+    const kl_image_item *items;
+    int items_count;
+    const int *deps;
+    const kl_image_name *names;     //  Sorted by the name.
+    int names_count;
+    const int *defs;
+} kl_image_index;
+
 extern const char *vmheader(void);
+extern const char *vmheader_image(void);
+extern const kl_image_index *vmheader_image_index(void);
 
 #endif /* KILITE_HEADER_H */
@@ -0,0 +1,91 @@
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/*
+ * The profile is a text file written by the instrumented code at the end of the program.
+ * Each line is `<key> <c0> <c1> <c2> <target>`, and `-` is used as the target when it's not a call site.
+ */
+
+static kl_pgo_site *pgo_append(kl_pgo *pgo, const char *key)
+{
+    if (pgo->count >= pgo->cap) {
+        pgo->cap = pgo->cap == 0 ? 256 : pgo->cap * 2;
+        pgo->site = (kl_pgo_site *)realloc(pgo->site, pgo->cap * sizeof(kl_pgo_site));
+    }
+    kl_pgo_site *s = &(pgo->site[pgo->count++]);
+    memset(s, 0, sizeof(kl_pgo_site));
+    s->key = strdup(key);
+    return s;
+}
+
+static int pgo_compare(const void *a, const void *b)
+{
+    return strcmp(((const kl_pgo_site *)a)->key, ((const kl_pgo_site *)b)->key);
+}
+
+static int pgo_load(kl_pgo *pgo)
+{
+    FILE *fp = fopen(pgo->file, "r");
+    if (!fp) {
+        return 0;
+    }
+    char line[PGO_KEY_SIZE * 2 + 128] = {0};
+    char key[PGO_KEY_SIZE] = {0};
+    char target[PGO_KEY_SIZE] = {0};
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        int64_t c[3] = {0};
+        if (sscanf(line, "%255s %" SCNd64 " %" SCNd64 " %" SCNd64 " %255s", key, &c[0], &c[1], &c[2], target) != 5) {
+            continue;
+        }
+        kl_pgo_site *s = pgo_append(pgo, key);
+        memcpy(s->c, c, sizeof(c));
+        if (strcmp(target, "-") != 0) {
+            s->target = strdup(target);
+        }
+    }
+    fclose(fp);
+    qsort(pgo->site, pgo->count, sizeof(kl_pgo_site), pgo_compare);
+    return 1;
+}
+
+kl_pgo *pgo_new(const char *file, int gen)
+{
+    kl_pgo *pgo = (kl_pgo *)calloc(1, sizeof(kl_pgo));
+    pgo->file = file;
+    pgo->gen = gen;
+    if (!gen && !pgo_load(pgo)) {
+        pgo_free(pgo);
+        return NULL;
+    }
+    return pgo;
+}
+
+void pgo_free(kl_pgo *pgo)
+{
+    if (!pgo) {
+        return;
+    }
+    for (int i = 0; i < pgo->count; ++i) {
+        free(pgo->site[i].key);
+        free(pgo->site[i].target);
+    }
+    free(pgo->site);
+    free(pgo);
+}
+
+int pgo_add_site(kl_pgo *pgo, const char *key)
+{
+    pgo_append(pgo, key);
+    return pgo->count - 1;
+}
+
+kl_pgo_site *pgo_find(kl_pgo *pgo, const char *key)
+{
+    kl_pgo_site k = { .key = (char *)key };
+    return (kl_pgo_site *)bsearch(&k, pgo->site, pgo->count, sizeof(kl_pgo_site), pgo_compare);
+}
@@ -0,0 +1,35 @@
+#ifndef KILITE_PROFILE_H
+#define KILITE_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PGO_KEY_SIZE (256)
+#define PGO_MIN_COUNT (64)      /* A site executed fewer times than this is not specialized. */
+#define PGO_DOMINANT (90)       /* The percentage of the observed case to be specialized. */
+
+/* The kind of a profiled site, which is a part of the key. */
+#define PGO_SITE_TYPE   'T'     /* c[0]: int/int, c[1]: double/double, c[2]: others. */
+#define PGO_SITE_BRANCH 'B'     /* c[0]: taken, c[1]: not taken. */
+#define PGO_SITE_CALL   'C'     /* c[0]: calls to the target, c[1]: calls to other functions, c[2]: not a function. */
+
+typedef struct kl_pgo_site {
+    char *key;                          //  <function>:<line>:<kind><n>, n is the sequence number of the kind in the function.
+    char *target;                       //  The C function name of the most called target at a call site.
+    int64_t c[3];                       //  The counters, which depend on the kind.
+} kl_pgo_site;
+
+typedef struct kl_pgo {
+    const char *file;                   //  The profile file to write, or read.
+    int gen;                            //  1 means an instrumented code is generated to write the profile.
+    int count;                          //  The number of sites.
+    int cap;
+    kl_pgo_site *site;                  //  The sites sorted by the key when it's loaded.
+} kl_pgo;
+
+extern kl_pgo *pgo_new(const char *file, int gen);
+extern void pgo_free(kl_pgo *pgo);
+extern int pgo_add_site(kl_pgo *pgo, const char *key);
+extern kl_pgo_site *pgo_find(kl_pgo *pgo, const char *key);
+
+#endif /* KILITE_PROFILE_H */
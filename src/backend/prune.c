@@ -0,0 +1,126 @@
+#include "prune.h"
+#include "header.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The header image is pruned by a script before passed to c2mir.
+ * The identifiers in the script are looked up in the index of the image,
+ * and only the items defining them and the items they depend on are kept.
+ * A dropped item is replaced by its newlines, so the line numbers are the same as the image.
+ */
+
+#define IS_IDTOP(ch) ((ch) == '_' || ('a' <= (ch) && (ch) <= 'z') || ('A' <= (ch) && (ch) <= 'Z'))
+#define IS_IDCHAR(ch) (IS_IDTOP(ch) || ('0' <= (ch) && (ch) <= '9'))
+
+static int find_name(const kl_image_index *index, const char *s, int len)
+{
+    int lo = 0, hi = index->names_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const char *name = index->names[mid].name;
+        int c = strncmp(name, s, len);
+        if (c == 0 && name[len] != 0) {
+            c = 1;
+        }
+        if (c == 0) {
+            return mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static void need_name(const kl_image_index *index, int n, char *need, int *stack, int *sp)
+{
+    const kl_image_name *name = &(index->names[n]);
+    for (int i = 0; i < name->defs_count; ++i) {
+        int k = index->defs[name->def + i];
+        if (!need[k]) {
+            need[k] = 1;
+            stack[(*sp)++] = k;
+        }
+    }
+}
+
+char *prune_header(const char *src)
+{
+    const kl_image_index *index = vmheader_image_index();
+    const char *image = vmheader_image();
+    int count = index->items_count;
+    char *need = (char *)calloc(count, 1);
+    char *seen = (char *)calloc(index->names_count, 1);
+    int *stack = (int *)malloc(sizeof(int) * count);
+    int sp = 0;
+
+    for (int i = 0; i < count; ++i) {
+        need[i] = index->items[i].keep;
+    }
+    for (const char *p = src; *p; ) {
+        int ch = *p;
+        if (ch == '"' || ch == '\'') {
+            for (++p; *p && *p != ch && *p != '\n'; ++p) {
+                if (*p == '\\' && p[1]) {
+                    ++p;
+                }
+            }
+            if (*p) {
+                ++p;
+            }
+        } else if (IS_IDTOP(ch)) {
+            const char *top = p;
+            while (IS_IDCHAR(*p)) {
+                ++p;
+            }
+            int n = find_name(index, top, p - top);
+            if (n >= 0 && !seen[n]) {
+                seen[n] = 1;
+                need_name(index, n, need, stack, &sp);
+            }
+        } else if ('0' <= ch && ch <= '9') {
+            while (IS_IDCHAR(*p) || *p == '.') {
+                ++p;
+            }
+        } else {
+            ++p;
+        }
+    }
+    while (sp > 0) {
+        const kl_image_item *item = &(index->items[stack[--sp]]);
+        for (int i = 0; i < item->deps_count; ++i) {
+            int k = index->deps[item->dep + i];
+            if (!need[k]) {
+                need[k] = 1;
+                stack[sp++] = k;
+            }
+        }
+    }
+
+    int size = 1;
+    for (int i = 0; i < count; ++i) {
+        size += need[i] ? index->items[i].len : index->items[i].lines;
+    }
+    char *header = (char *)malloc(size + 1);
+    char *h = header;
+    for (int i = 0; i < count; ++i) {
+        const kl_image_item *item = &(index->items[i]);
+        if (need[i]) {
+            memcpy(h, image + item->pos, item->len);
+            h += item->len;
+        } else {
+            memset(h, '\n', item->lines);
+            h += item->lines;
+        }
+    }
+    *h++ = '\n';
+    *h = 0;
+
+    free(stack);
+    free(seen);
+    free(need);
+    return header;
+}
@@ -0,0 +1,6 @@
+#ifndef KILITE_PRUNE_H
+#define KILITE_PRUNE_H
+
+extern char *prune_header(const char *src);
+
+#endif /* KILITE_PRUNE_H */
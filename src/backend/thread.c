@@ -0,0 +1,157 @@
+#include "thread.h"
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION thread_lock_t;
+#define thread_lock_init(m) InitializeCriticalSection(m)
+#define thread_lock_free(m) DeleteCriticalSection(m)
+#define thread_lock(m) EnterCriticalSection(m)
+#define thread_unlock(m) LeaveCriticalSection(m)
+#else
+#include <unistd.h>
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t thread_lock_t;
+#define thread_lock_init(m) pthread_mutex_init(m, NULL)
+#define thread_lock_free(m) pthread_mutex_destroy(m)
+#define thread_lock(m) pthread_mutex_lock(m)
+#define thread_unlock(m) pthread_mutex_unlock(m)
+#endif
+
+/*
+ * A job is run for each index from 0 to count - 1 by the threads, which take the next index one by one.
+ * The calling thread also takes the index, and this returns after all jobs have been done.
+ */
+
+typedef struct thread_pool {
+    thread_lock_t lock;
+    thread_job_t job;
+    void *data;
+    int count;
+    int next;
+} thread_pool;
+
+static void thread_work(thread_pool *pool)
+{
+    for ( ; ; ) {
+        thread_lock(&(pool->lock));
+        int index = pool->next < pool->count ? pool->next++ : -1;
+        thread_unlock(&(pool->lock));
+        if (index < 0) {
+            break;
+        }
+        pool->job(pool->data, index);
+    }
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static DWORD WINAPI thread_main(LPVOID p)
+{
+    thread_work((thread_pool *)p);
+    return 0;
+}
+
+static int thread_start(thread_t *t, thread_pool *pool)
+{
+    *t = CreateThread(NULL, 0, thread_main, pool, 0, NULL);
+    return *t != NULL;
+}
+
+static void thread_join(thread_t t)
+{
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+int thread_cpus(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+static double thread_cputime(void)
+{
+    FILETIME c, e, k, u;
+    if (!GetProcessTimes(GetCurrentProcess(), &c, &e, &k, &u)) {
+        return 0.0;
+    }
+    ULARGE_INTEGER kt, ut;
+    kt.LowPart = k.dwLowDateTime;
+    kt.HighPart = k.dwHighDateTime;
+    ut.LowPart = u.dwLowDateTime;
+    ut.HighPart = u.dwHighDateTime;
+    return (double)(kt.QuadPart + ut.QuadPart) * 1.0e-7;    /* in 100 nanoseconds */
+}
+#else
+static void *thread_main(void *p)
+{
+    thread_work((thread_pool *)p);
+    return NULL;
+}
+
+static int thread_start(thread_t *t, thread_pool *pool)
+{
+    return pthread_create(t, NULL, thread_main, pool) == 0;
+}
+
+static void thread_join(thread_t t)
+{
+    pthread_join(t, NULL);
+}
+
+int thread_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/* The clock function returns the CPU time of all threads in the process. */
+static double thread_cputime(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+#endif
+
+void thread_parallel(int jobs, int count, thread_job_t job, void *data)
+{
+    if (jobs > count) {
+        jobs = count;
+    }
+    if (jobs > THREAD_MAX_JOBS) {
+        jobs = THREAD_MAX_JOBS;
+    }
+    if (jobs <= 1) {
+        for (int i = 0; i < count; ++i) {
+            job(data, i);
+        }
+        return;
+    }
+
+    thread_pool pool = { .job = job, .data = data, .count = count };
+    thread_lock_init(&(pool.lock));
+    thread_t t[THREAD_MAX_JOBS];
+    int started = 0;
+    while (started < jobs - 1 && thread_start(&t[started], &pool)) {
+        ++started;
+    }
+    thread_work(&pool);
+    for (int i = 0; i < started; ++i) {
+        thread_join(t[i]);
+    }
+    thread_lock_free(&(pool.lock));
+}
+
+/* Returns the CPU time since the last call, which is shown with the elapsed time by --cctime. */
+double thread_cputime_lap(void)
+{
+    static double last = 0.0;
+    double now = thread_cputime();
+    double lap = now - last;
+    last = now;
+    return lap;
+}
@@ -0,0 +1,12 @@
+#ifndef KILITE_THREAD_H
+#define KILITE_THREAD_H
+
+#define THREAD_MAX_JOBS (16)
+
+typedef void (*thread_job_t)(void *data, int index);
+
+extern int thread_cpus(void);
+extern void thread_parallel(int jobs, int count, thread_job_t job, void *data);
+extern double thread_cputime_lap(void);
+
+#endif /* KILITE_THREAD_H */
@@ -1,6 +1,8 @@
 #include "../kir.h"
 #include "header.h"
 #include "translate.h"
+#include "profile.h"
+#include "thread.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -8,6 +10,8 @@
 #include <inttypes.h>
 
 #define XSTR_UNIT (64)
+#define TRANS_JOB_MIN_FUNCS (8)         /* The functions are translated by the threads when there are at least this number. */
+#define TRANS_PART_SIZE (128 * 1024)    /* The minimum size of the code to be a separated part. */
 #define xstra_inst(code, ...) xstra(code, "    ", 4), xstraf(code, __VA_ARGS__)
 #define is_escape_ch(c) ((c) == '\a') || ((c) == '\b') || ((c) == '\x1b') || ((c) == '\f') || ((c) == '\n') || ((c) == '\r') || ((c) == '\t') || ((c) == '\v')
 const char replace_escape_ch[256] = {
@@ -24,6 +28,8 @@ typedef struct xstr {
 
 typedef struct func_context {
     int has_frame;
+    int frame_on_stack;
+    int resumable;
     int total_vars;
     int local_vars;
     int argcount;
@@ -32,6 +38,11 @@ typedef struct func_context {
     int temp_count;
     int resume_start;
     int skip;
+    int prefix;
+    kl_kir_program *program;
+    const char *funcname;
+    kl_pgo *pgo;
+    int pgo_seq[3];
     xstr str;
 } func_context;
 
@@ -161,270 +172,658 @@ static inline int is_var(kl_kir_opr *rn)
     return rn->t == TK_VAR;
 }
 
-static const char *var_value_pure(char *buf, kl_kir_opr *rn)  /* buf should have at least 256 bytes. */
+/*
+ * A pure function is also translated to native C code working without vmvar, for each signature
+ * of int64_t and double arguments. The type of every variable is inferred at every instruction
+ * by a simple data flow analysis, so the same variable can have a different type at a different point.
+ * The value is held by n<idx> as int64_t, or by d<idx> as double.
+ * A signature is dropped when a value used could have conflicting types, or when an unsupported
+ * operation is found. An error like an overflow or dividing by zero is signalled through *e,
+ * and the caller falls back to the normal code then.
+*/
+
+#define PURE_T_BOT      (0)     /* No information yet. */
+#define PURE_T_UNDEF    (1)     /* Not assigned yet. */
+#define PURE_T_INT      (2)
+#define PURE_T_DBL      (3)
+#define PURE_T_BOOL     (4)
+#define PURE_T_ERR      (5)     /* Conflicted, or an invalid operation. */
+
+#define PURE_MIXED_ARGS (3)     /* Mixed signatures are tried up to this number of arguments. */
+
+typedef struct pure_context {
+    kl_kir_func *f;
+    int insts;
+    kl_kir_inst **inst;
+    int *target;                /* The index of the jump target. */
+    int *pushslot;              /* The slot of KIR_PUSHARG, or the first argument slot of KIR_CALL. */
+    int *reached;
+    int vars;
+    int pushes;
+    int slots;                  /* Local variables, the return value, and pushed arguments. */
+    uint8_t *in;                /* Types at the entry of each instruction. */
+    int sigs;
+    int mask[KIR_PURE_SIG_MAX];
+    int valid[KIR_PURE_SIG_MAX];
+    int ret[KIR_PURE_SIG_MAX];
+} pure_context;
+
+static int pure_join(int t1, int t2)
+{
+    if (t1 == t2 || t2 == PURE_T_BOT) {
+        return t1;
+    }
+    if (t1 == PURE_T_BOT) {
+        return t2;
+    }
+    return PURE_T_ERR;
+}
+
+static inline int pure_is_num(int t)
+{
+    return t == PURE_T_INT || t == PURE_T_DBL;
+}
+
+static inline int pure_slot(pure_context *pc, kl_kir_opr *rn)
+{
+    return rn->index < 0 ? pc->vars : rn->index;
+}
+
+static int pure_type(pure_context *pc, const uint8_t *ty, kl_kir_opr *rn)
 {
     switch (rn->t) {
-    case TK_VBOOL:
     case TK_VSINT:
-        sprintf(buf, "%" PRId64, rn->i64);
-        break;
+        return PURE_T_INT;
+    case TK_VBOOL:
+        return PURE_T_BOOL;
+    case TK_VDBL:
+        return PURE_T_DBL;
     case TK_VAR:
-        if (rn->index < 0) {
-            sprintf(buf, "(r)");
-        } else {
-            /* The level should be 0 */
-            sprintf(buf, "n%d", rn->index);
+        if (rn->level == 0 && rn->index < pc->vars) {
+            return ty[pure_slot(pc, rn)];
         }
         break;
-    default:
-        sprintf(buf, "<ERROR>");
-        /* TODO: error */
-        break;
     }
+    return PURE_T_ERR;
+}
 
+static int pure_sig_index(pure_context *pc, int mask)
+{
+    for (int s = 0; s < pc->sigs; ++s) {
+        if (pc->mask[s] == mask) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+static const char *pure_func_name(char *buf, kl_kir_func *f, int mask)
+{
+    if (mask == 0) {
+        sprintf(buf, "%s__pure", f->funcname);
+    } else {
+        int p = sprintf(buf, "%s__pure_", f->funcname);
+        for (int i = 0; i < f->argcount; ++i) {
+            buf[p++] = (mask & (1 << i)) ? 'd' : 'i';
+        }
+        buf[p] = 0;
+    }
     return buf;
 }
 
-static void translate_pusharg_pure(xstr *code, func_context *fctx, kl_kir_opr *rn)
+/*
+ * Computes the types after the instruction into `out`, and returns 0 if the instruction is valid.
+ * An operand without information yet is allowed unless `strict` is set, and the result has no information then.
+ */
+static int pure_step(pure_context *pc, int idx, const uint8_t *in, uint8_t *out, int strict)
 {
-    int pushed = fctx->push_count++;
-    const char *typestr = (fctx->push_max <= pushed) ? "int64_t " : "";
-    char buf1[256] = {0};
-    switch (rn->t) {
-    case TK_VBOOL:
-    case TK_VSINT:
-        xstra_inst(code, "%st%d = %" PRId64 ";\n", typestr, pushed, rn->i64);
+    kl_kir_inst *i = pc->inst[idx];
+    memcpy(out, in, pc->slots);
+    int def = -1;
+    int dt = PURE_T_ERR;
+    int t2 = PURE_T_BOT;
+    int t3 = PURE_T_INT;    /* Not used by an unary operator. */
+    switch (i->opcode) {
+    case KIR_NOP:
+    case KIR_ALOCAL:
+    case KIR_RLOCAL:
+    case KIR_SETARG:
+    case KIR_PURE:
+    case KIR_SVSTKP:
+    case KIR_RSSTKP:
+    case KIR_CHKEXCEPT:
+    case KIR_YIELDC:
+    case KIR_LABEL:
+    case KIR_JMP:
+        return 0;
+
+    case KIR_RET:
+        t2 = in[pc->vars];
+        if (t2 == PURE_T_BOT) {
+            return strict ? -1 : 0;
+        }
+        return (pure_is_num(t2) || t2 == PURE_T_BOOL) ? 0 : -1;
+
+    case KIR_JMPIFT:
+    case KIR_JMPIFF:
+        t2 = pure_type(pc, in, &(i->r1));
+        if (t2 == PURE_T_BOT) {
+            return strict ? -1 : 0;
+        }
+        return (pure_is_num(t2) || t2 == PURE_T_BOOL) ? 0 : -1;
+
+    case KIR_PUSHARG:
+        t2 = pure_type(pc, in, &(i->r1));
+        out[pc->vars + 1 + pc->pushslot[idx]] = t2;
+        if (t2 == PURE_T_BOT) {
+            return strict ? -1 : 0;
+        }
+        return pure_is_num(t2) ? 0 : -1;
+
+    case KIR_CALL: {
+        if (!i->r2.recursive || i->r2.args != pc->f->argcount) {
+            return -1;
+        }
+        int mask = 0;
+        int bot = 0;
+        for (int a = 0; a < pc->f->argcount; ++a) {
+            /* The last argument is pushed first. */
+            int ta = in[pc->vars + 1 + pc->pushslot[idx] + pc->f->argcount - 1 - a];
+            if (ta == PURE_T_BOT) {
+                bot = 1;
+            } else if (ta == PURE_T_DBL) {
+                mask |= 1 << a;
+            } else if (ta != PURE_T_INT) {
+                return -1;
+            }
+        }
+        def = pure_slot(pc, &(i->r1));
+        int s = bot ? -1 : pure_sig_index(pc, mask);
+        if (bot || (s >= 0 && pc->valid[s] && pc->ret[s] == PURE_T_BOT)) {
+            out[def] = PURE_T_BOT;
+            return strict ? -1 : 0;
+        }
+        if (s < 0 || !pc->valid[s]) {
+            out[def] = PURE_T_ERR;
+            return -1;
+        }
+        out[def] = pc->ret[s];
+        return 0;
+    }
+
+    case KIR_MOV:
+    case KIR_MOVA:
+        t2 = pure_type(pc, in, &(i->r2));
+        dt = (pure_is_num(t2) || t2 == PURE_T_BOOL) ? t2 : PURE_T_ERR;
         break;
-    case TK_VAR:
-        xstra_inst(code, "%st%d = %s;\n", typestr, pushed, var_value_pure(buf1, rn));
+
+    case KIR_NOT:
+        t2 = pure_type(pc, in, &(i->r2));
+        dt = (pure_is_num(t2) || t2 == PURE_T_BOOL) ? PURE_T_BOOL : PURE_T_ERR;
         break;
-    default:
-        xstra_inst(code, "<ERROR>;");
-        /* TODO: error */
+    case KIR_MINUS:
+        t2 = pure_type(pc, in, &(i->r2));
+        dt = (t2 == PURE_T_DBL) ? PURE_T_DBL : (t2 == PURE_T_INT || t2 == PURE_T_BOOL) ? PURE_T_INT : PURE_T_ERR;
+        break;
+    case KIR_BNOT:
+        t2 = pure_type(pc, in, &(i->r2));
+        dt = (t2 == PURE_T_INT) ? PURE_T_INT : PURE_T_ERR;
+        break;
+
+    case KIR_INC:
+    case KIR_INCP:
+    case KIR_DEC:
+    case KIR_DECP:
+        t2 = pure_type(pc, in, &(i->r2));
+        if (t2 == PURE_T_BOT) {
+            if (!i->r1.prevent) {
+                out[pure_slot(pc, &(i->r1))] = PURE_T_BOT;
+            }
+            return strict ? -1 : 0;
+        }
+        if (!pure_is_num(t2) || i->r2.t != TK_VAR) {
+            return -1;
+        }
+        if (!i->r1.prevent) {
+            out[pure_slot(pc, &(i->r1))] = t2;
+        }
+        return 0;
+
+    case KIR_ADD:
+    case KIR_SUB:
+    case KIR_MUL:
+    case KIR_MOD:
+    case KIR_POW:
+        t2 = pure_type(pc, in, &(i->r2));
+        t3 = pure_type(pc, in, &(i->r3));
+        dt = (!pure_is_num(t2) || !pure_is_num(t3)) ? PURE_T_ERR :
+            (t2 == PURE_T_DBL || t3 == PURE_T_DBL) ? PURE_T_DBL : PURE_T_INT;
         break;
+    case KIR_DIV:
+        t2 = pure_type(pc, in, &(i->r2));
+        t3 = pure_type(pc, in, &(i->r3));
+        dt = (pure_is_num(t2) && pure_is_num(t3)) ? PURE_T_DBL : PURE_T_ERR;
+        break;
+    case KIR_BSHL:
+    case KIR_BSHR:
+    case KIR_BAND:
+    case KIR_BOR:
+    case KIR_BXOR:
+        t2 = pure_type(pc, in, &(i->r2));
+        t3 = pure_type(pc, in, &(i->r3));
+        dt = (t2 == PURE_T_INT && t3 == PURE_T_INT) ? PURE_T_INT : PURE_T_ERR;
+        break;
+    case KIR_EQEQ:
+    case KIR_NEQ:
+    case KIR_LT:
+    case KIR_LE:
+    case KIR_GT:
+    case KIR_GE:
+        t2 = pure_type(pc, in, &(i->r2));
+        t3 = pure_type(pc, in, &(i->r3));
+        dt = (pure_is_num(t2) && pure_is_num(t3)) ? PURE_T_BOOL : PURE_T_ERR;
+        break;
+
+    default:
+        return -1;
     }
-    if (fctx->push_max < fctx->push_count) {
-        fctx->push_max = fctx->push_count;
+
+    if (i->r1.t != TK_VAR || i->r1.level > 0 || i->r1.index >= pc->vars) {
+        return -1;
     }
+    def = pure_slot(pc, &(i->r1));
+    if (t2 == PURE_T_BOT || t3 == PURE_T_BOT) {
+        out[def] = PURE_T_BOT;
+        return strict ? -1 : 0;
+    }
+    out[def] = dt;
+    return dt == PURE_T_ERR ? -1 : 0;
 }
 
-static void translate_call_pure(xstr *code, kl_kir_func *f, func_context *fctx, kl_kir_inst *i)
+static int pure_merge(pure_context *pc, int to, const uint8_t *ty)
 {
-    char buf1[256] = {0};
-    char buf2[256] = {0};
-    var_value_pure(buf1, &(i->r1));
-    if (i->r2.funcid > 0 && i->r2.recursive) {
-        xstra_inst(code, "%s = %s__pure(e", buf1, f->funcname);
-        if (f->argcount > 0) {
-            for (int i = f->argcount - 1; i >= 0; --i) {
-                xstraf(code, ", t%d", i);
-            }
-            fctx->push_count -= f->argcount;
+    if (to < 0 || pc->insts <= to) {
+        return 0;
+    }
+    uint8_t *in = pc->in + to * pc->slots;
+    if (!pc->reached[to]) {
+        pc->reached[to] = 1;
+        memcpy(in, ty, pc->slots);
+        return 1;
+    }
+    int changed = 0;
+    for (int k = 0; k < pc->slots; ++k) {
+        int t = pure_join(in[k], ty[k]);
+        if (t != in[k]) {
+            in[k] = t;
+            changed = 1;
         }
-        xstraf(code, ");\n");
-        int output_jump = 1;
-        if (i->next) {
-            kl_kir_inst *n = i->next;
-            while (n && (n->opcode == KIR_CHKEXCEPT || n->opcode == KIR_RSSTKP)) {
-                n = n->next;
+    }
+    return changed;
+}
+
+/* Infers the types of the signature, and returns the type of the return value, or PURE_T_ERR if it's invalid. */
+static int pure_infer(pure_context *pc, int s, int strict)
+{
+    uint8_t *out = (uint8_t *)calloc(pc->slots, sizeof(uint8_t));
+    memset(pc->reached, 0, pc->insts * sizeof(int));
+    memset(pc->in, PURE_T_UNDEF, pc->insts * pc->slots);
+    for (int a = 0; a < pc->f->argcount; ++a) {
+        pc->in[a] = (pc->mask[s] & (1 << a)) ? PURE_T_DBL : PURE_T_INT;
+    }
+    pc->reached[0] = 1;
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int idx = 0; idx < pc->insts; ++idx) {
+            if (!pc->reached[idx]) {
+                continue;
             }
-            if (n) {
-                if (n->opcode == KIR_JMP && n->labelid == f->funcend) {
-                    output_jump = 0;
-                } else if (n->opcode == KIR_LABEL && n->labelid == f->funcend) {
-                    output_jump = 0;
-                }
+            kl_kir_inst *i = pc->inst[idx];
+            pure_step(pc, idx, pc->in + idx * pc->slots, out, 0);
+            if (i->opcode == KIR_JMP || i->opcode == KIR_JMPIFT || i->opcode == KIR_JMPIFF) {
+                changed |= pure_merge(pc, pc->target[idx], out);
+            }
+            if (i->opcode != KIR_JMP && i->opcode != KIR_RET) {
+                changed |= pure_merge(pc, idx + 1, out);
             }
         }
-        if (output_jump) {
-            xstra_inst(code, "if (*e > 0) goto L%d;\n", f->funcend);
+    }
+
+    int ret = PURE_T_BOT;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        if (!pc->reached[idx]) {
+            continue;
+        }
+        uint8_t *in = pc->in + idx * pc->slots;
+        if (pure_step(pc, idx, in, out, strict) != 0) {
+
+            ret = PURE_T_ERR;
+            break;
+        }
+        if (pc->inst[idx]->opcode == KIR_RET) {
+            ret = pure_join(ret, in[pc->vars]);
         }
-    } else {
-        xstra_inst(code, "<ERROR:%d>", __LINE__);
-        /* TODO: error */
     }
+    free(out);
+    return ret;
 }
 
-static const char *get_min(kl_kir_func *f, char *buf)
+static void pure_check_sigs(pure_context *pc)
 {
-    sprintf(buf, "get_min%d(n0", f->argcount);
-    int p = strlen(buf);
-    for (int i = 1; i < f->argcount; ++i) {
-        sprintf(buf+p, ", n%d", i);
-        p = strlen(buf);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int s = 0; s < pc->sigs; ++s) {
+            if (!pc->valid[s]) {
+                continue;
+            }
+            int ret = pure_infer(pc, s, 0);
+            if (ret == PURE_T_ERR) {
+                pc->valid[s] = 0;
+                changed = 1;
+            } else if (ret != pc->ret[s]) {
+                pc->ret[s] = ret;
+                changed = 1;
+            }
+        }
+        if (!changed) {
+            /* Every value must have been fixed here. */
+            for (int s = 0; s < pc->sigs; ++s) {
+                if (pc->valid[s] && (pc->ret[s] == PURE_T_BOT || pure_infer(pc, s, 1) == PURE_T_ERR)) {
+                    pc->valid[s] = 0;
+                    changed = 1;
+                }
+            }
+        }
     }
-    sprintf(buf+p, ")");
-    return buf;
 }
 
-static void translate_op3_pure(func_context *fctx, xstr *code, kl_kir_func *f, const char *op, kl_kir_inst *i)
+static int pure_setup(pure_context *pc, kl_kir_func *f)
 {
-    kl_kir_opr *r1 = &(i->r1);
-    kl_kir_opr *r2 = &(i->r2);
-    kl_kir_opr *r3 = &(i->r3);
+    pc->f = f;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->opcode == KIR_ALOCAL) {
+            pc->vars = (int)i->r1.i64;
+        }
+        ++(pc->insts);
+    }
+    if (pc->insts == 0) {
+        return 0;
+    }
+    pc->inst = (kl_kir_inst **)calloc(pc->insts, sizeof(kl_kir_inst *));
+    pc->target = (int *)calloc(pc->insts, sizeof(int));
+    pc->pushslot = (int *)calloc(pc->insts, sizeof(int));
+    pc->reached = (int *)calloc(pc->insts, sizeof(int));
+
+    int idx = 0;
+    int pushed = 0;
+    for (kl_kir_inst *i = f->head; i; i = i->next, ++idx) {
+        pc->inst[idx] = i;
+        if (i->opcode == KIR_PUSHARG) {
+            pc->pushslot[idx] = pushed++;
+            if (pc->pushes < pushed) {
+                pc->pushes = pushed;
+            }
+        } else if (i->opcode == KIR_CALL) {
+            pushed -= f->argcount;
+            if (pushed < 0) {
+                return 0;
+            }
+            pc->pushslot[idx] = pushed;
+        }
+    }
+    for (idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        pc->target[idx] = -1;
+        if (i->opcode == KIR_JMP || i->opcode == KIR_JMPIFT || i->opcode == KIR_JMPIFF) {
+            for (int l = 0; l < pc->insts; ++l) {
+                if (pc->inst[l]->opcode == KIR_LABEL && pc->inst[l]->labelid == i->labelid) {
+                    pc->target[idx] = l;
+                    break;
+                }
+            }
+        }
+    }
+    pc->slots = pc->vars + 1 + pc->pushes;
+    pc->in = (uint8_t *)calloc(pc->insts * pc->slots, sizeof(uint8_t));
 
-    char buf1[256] = {0};
-    char buf2[256] = {0};
-    char buf3[256] = {0};
-    char buf4[256] = {0};
-    var_value_pure(buf1, r1);
-    var_value_pure(buf2, r2);
-    var_value_pure(buf3, r3);
-    if (f->argcount == 0) {
-        xstra_inst(code, "OP_N%s_I_I(e, 1, %s, %s, %s, L%d);\n", op, buf1, buf2, buf3, f->funcend);
-    } else if (f->argcount == 1) {
-        xstra_inst(code, "OP_N%s_I_I(e, n0, %s, %s, %s, L%d);\n", op, buf1, buf2, buf3, f->funcend);
+    int args = f->argcount;
+    pc->mask[pc->sigs++] = 0;
+    if (args <= PURE_MIXED_ARGS) {
+        for (int m = 1; m < (1 << args); ++m) {
+            pc->mask[pc->sigs++] = m;
+        }
     } else {
-        xstra_inst(code, "{ int64_t min = %s;\n", get_min(f, buf4));
-        xstra_inst(code, "  OP_N%s_I_I(e, min, %s, %s, %s, L%d); }\n", op, buf1, buf2, buf3, f->funcend);
+        pc->mask[pc->sigs++] = (1 << args) - 1;
     }
+    for (int s = 0; s < pc->sigs; ++s) {
+        pc->valid[s] = 1;
+        pc->ret[s] = PURE_T_BOT;
+    }
+    return 1;
 }
 
-static int translate_chkcnd_precheck_pure(func_context *fctx, xstr *code, kl_kir_func *f, const char *sop, kl_kir_inst *i)
+static void pure_cleanup(pure_context *pc)
 {
-    kl_kir_inst *n = i->next;
-    if (i->r1.level == n->r1.level && i->r1.index == n->r1.index) {
-        kl_kir_opr *r1 = &(i->r1);
-        kl_kir_opr *r2 = &(i->r2);
-        kl_kir_opr *r3 = &(i->r3);
-
-        char buf2[256] = {0};
-        char buf3[256] = {0};
-        var_value_pure(buf2, r2);
-        var_value_pure(buf3, r3);
-        xstra_inst(code, "if (%s((%s) %s (%s))) goto L%d;\n",
-            i->next->opcode == KIR_JMPIFT ? "" : "!",
-            buf2, sop, buf3, n->labelid);
-        fctx->skip = 1;
-        return 1;
-    }
-    return 0;
+    free(pc->inst);
+    free(pc->target);
+    free(pc->pushslot);
+    free(pc->reached);
+    free(pc->in);
 }
 
-static void translate_chkcnd_pure(func_context *fctx, xstr *code, kl_kir_func *f, const char *op, const char *sop, kl_kir_inst *i)
+static const char *pure_value(char *buf, pure_context *pc, kl_kir_opr *rn, int type)  /* buf should have at least 256 bytes. */
 {
-    if (sop && i->next && (i->next->opcode == KIR_JMPIFT || i->next->opcode == KIR_JMPIFF)) {
-        if (translate_chkcnd_precheck_pure(fctx, code, f, sop, i) > 0) {
-            return;
+    switch (rn->t) {
+    case TK_VBOOL:
+    case TK_VSINT:
+        sprintf(buf, "%" PRId64, rn->i64);
+        break;
+    case TK_VDBL:
+        sprintf(buf, "%s", rn->dbl);
+        break;
+    case TK_VAR:
+        if (rn->index < 0) {
+            sprintf(buf, type == PURE_T_DBL ? "(rd)" : "(r)");
+        } else {
+            /* The level should be 0 */
+            sprintf(buf, type == PURE_T_DBL ? "d%d" : "n%d", rn->index);
         }
+        break;
+    default:
+        sprintf(buf, "<ERROR>");
+        break;
     }
-    translate_op3_pure(fctx, code, f, op, i);
+
+    return buf;
 }
 
-static void translate_op3_direct_pure(func_context *fctx, xstr *code, kl_kir_func *f, const char *sop, kl_kir_inst *i)
+static void pure_errn(xstr *code, pure_context *pc, int s)
 {
-    kl_kir_opr *r1 = &(i->r1);
-    kl_kir_opr *r2 = &(i->r2);
-    kl_kir_opr *r3 = &(i->r3);
-
-    char buf1[256] = {0};
-    char buf2[256] = {0};
-    char buf3[256] = {0};
-    char buf4[256] = {0};
-    var_value_pure(buf1, r1);
-    var_value_pure(buf2, r2);
-    var_value_pure(buf3, r3);
-    xstra_inst(code, "%s = %s %s %s;\n", buf1, buf2, sop, buf3);
+    /*
+     * The error value of an overflow is the minimum argument of the integer signature, and the caller
+     * will not use it with the arguments greater than or equal to it. See translate_pure_hook.
+     */
+    kl_kir_func *f = pc->f;
+    if (pc->mask[s] != 0) {
+        xstra_inst(code, "int64_t en = 1;\n");
+    } else if (f->argcount == 1) {
+        xstra_inst(code, "int64_t en = n0 > 0 ? n0 : INT64_MAX;\n");
+    } else {
+        xstra_inst(code, "int64_t en = get_min%d(n0", f->argcount);
+        for (int i = 1; i < f->argcount; ++i) {
+            xstraf(code, ", n%d", i);
+        }
+        xstraf(code, ");\n");
+        xstra_inst(code, "if (en <= 0) en = INT64_MAX;\n");
+    }
 }
 
-static void translate_chkcnd_direct_pure(func_context *fctx, xstr *code, kl_kir_func *f, const char *sop, kl_kir_inst *i)
+static void translate_call_pure(xstr *code, pure_context *pc, int s, int idx, const uint8_t *ty, uint8_t *out)
 {
-    if (sop && i->next && (i->next->opcode == KIR_JMPIFT || i->next->opcode == KIR_JMPIFF)) {
-        if (translate_chkcnd_precheck_pure(fctx, code, f, sop, i) > 0) {
-            return;
+    kl_kir_func *f = pc->f;
+    kl_kir_inst *i = pc->inst[idx];
+    char buf1[256] = {0};
+    char name[256] = {0};
+    int mask = 0;
+    int base = pc->vars + 1 + pc->pushslot[idx];
+    for (int a = 0; a < f->argcount; ++a) {
+        if (ty[base + f->argcount - 1 - a] == PURE_T_DBL) {
+            mask |= 1 << a;
         }
     }
-    translate_op3_direct_pure(fctx, code, f, sop, i);
+    int rt = out[pure_slot(pc, &(i->r1))];
+    xstra_inst(code, "%s = %s(e", pure_value(buf1, pc, &(i->r1), rt), pure_func_name(name, f, mask));
+    for (int a = f->argcount - 1; a >= 0; --a) {
+        int slot = pc->pushslot[idx] + a;
+        xstraf(code, ty[base + a] == PURE_T_DBL ? ", td%d" : ", t%d", slot);
+    }
+    xstraf(code, ");\n");
+    int output_jump = 1;
+    kl_kir_inst *n = i->next;
+    while (n && (n->opcode == KIR_CHKEXCEPT || n->opcode == KIR_RSSTKP)) {
+        n = n->next;
+    }
+    if (n) {
+        if (n->opcode == KIR_JMP && n->labelid == f->funcend) {
+            output_jump = 0;
+        } else if (n->opcode == KIR_LABEL && n->labelid == f->funcend) {
+            output_jump = 0;
+        }
+    }
+    if (output_jump) {
+        xstra_inst(code, "if (*e > 0) goto L%d;\n", f->funcend);
+    }
 }
 
-static void translate_incdec_pure(func_context *fctx, xstr *code, const char *sop, int is_postfix, kl_kir_inst *i)
+static const char *pure_cond(char *buf, pure_context *pc, kl_kir_inst *i, const char *sop, int t2, int t3)
 {
-    kl_kir_opr *r1 = &(i->r1);
-    kl_kir_opr *r2 = &(i->r2);
-
-    char buf1[256] = {0};
     char buf2[256] = {0};
-
-    var_value_pure(buf1, r1);
-    var_value_pure(buf2, r2);
-    if (is_postfix) {
-        if (r1->prevent) {
-            xstra_inst(code, "(%s)%s;\n", buf2, sop);
-        }  else {
-            xstra_inst(code, "%s = (%s)%s;\n", buf1, buf2, sop);
-        }
+    char buf3[256] = {0};
+    pure_value(buf2, pc, &(i->r2), t2);
+    pure_value(buf3, pc, &(i->r3), t3);
+    if ((t2 == PURE_T_DBL || t3 == PURE_T_DBL) && (i->opcode == KIR_EQEQ || i->opcode == KIR_NEQ)) {
+        /* Same as the comparison of vmvar, which has a tolerance. */
+        sprintf(buf, "%s(%s, %s)", i->opcode == KIR_EQEQ ? "OP_NEQEQ_D" : "OP_NNEQ_D", buf2, buf3);
     } else {
-        if (r1->prevent) {
-            xstra_inst(code, "%s(%s);\n", sop, buf2);
-        }  else {
-            xstra_inst(code, "%s = %s(%s);\n", buf1, sop, buf2);
-        }
+        sprintf(buf, "(%s) %s (%s)", buf2, sop, buf3);
     }
+    return buf;
 }
 
-static void translate_bnot_pure(xstr *code, kl_kir_inst *i)
+static int pure_fuse_jump(pure_context *pc, kl_kir_inst *i)
 {
+    kl_kir_inst *n = i->next;
+    return n && (n->opcode == KIR_JMPIFT || n->opcode == KIR_JMPIFF) &&
+        i->r1.level == n->r1.level && i->r1.index == n->r1.index;
+}
+
+static void translate_op3_pure(xstr *code, pure_context *pc, kl_kir_inst *i,
+    const char *op, const char *sop, const uint8_t *ty, int dt)
+{
+    kl_kir_func *f = pc->f;
+    int t2 = pure_type(pc, ty, &(i->r2));
+    int t3 = pure_type(pc, ty, &(i->r3));
     char buf1[256] = {0};
-    var_value_pure(buf1, &(i->r1));
-    switch (i->r2.t) {
-    case TK_VAR: {
-        char buf2[256] = {0};
-        var_value_pure(buf2, &(i->r2));
-        xstra_inst(code, "%s = ~%s;\n", buf1, buf2);
-        break;
-    }
-    case TK_VBOOL:
-    case TK_VSINT:
-        xstra_inst(code, "%s = %" PRId64 ";\n", buf1, ~(i->r2.i64));
-        break;
-    default:
-        break;
+    char buf2[256] = {0};
+    char buf3[256] = {0};
+    pure_value(buf1, pc, &(i->r1), dt);
+    pure_value(buf2, pc, &(i->r2), t2);
+    pure_value(buf3, pc, &(i->r3), t3);
+    if (i->opcode == KIR_DIV || i->opcode == KIR_MOD) {
+        xstra_inst(code, "OP_N%s_%c_%c(e, %s, %s, %s, L%d);\n", op,
+            t2 == PURE_T_DBL ? 'D' : 'I', t3 == PURE_T_DBL ? 'D' : 'I', buf1, buf2, buf3, f->funcend);
+    } else if (t2 == PURE_T_INT && t3 == PURE_T_INT) {
+        xstra_inst(code, "OP_N%s_I_I(e, en, %s, %s, %s, L%d);\n", op, buf1, buf2, buf3, f->funcend);
+    } else if (i->opcode == KIR_POW) {
+        xstra_inst(code, "%s = pow(%s, %s);\n", buf1, buf2, buf3);
+    } else {
+        xstra_inst(code, "%s = %s %s %s;\n", buf1, buf2, sop, buf3);
     }
 }
 
-static void translate_not_pure(xstr *code, kl_kir_inst *i)
+static void translate_cmp_pure(xstr *code, pure_context *pc, func_context *fctx, kl_kir_inst *i, const char *sop, const uint8_t *ty)
 {
+    int t2 = pure_type(pc, ty, &(i->r2));
+    int t3 = pure_type(pc, ty, &(i->r3));
     char buf1[256] = {0};
-    var_value_pure(buf1, &(i->r1));
-    switch (i->r2.t) {
-    case TK_VAR: {
-        char buf2[256] = {0};
-        var_value_pure(buf2, &(i->r2));
-        xstra_inst(code, "%s = !%s;\n", buf1, buf2);
-        break;
-    }
-    case TK_VBOOL:
-    case TK_VSINT:
-        xstra_inst(code, "%s = %" PRId64 ";\n", buf1, i->r2.i64 == 0 ? 1 : 0);
-        break;
-    default:
-        break;
+    char cond[640] = {0};
+    pure_value(buf1, pc, &(i->r1), PURE_T_BOOL);
+    pure_cond(cond, pc, i, sop, t2, t3);
+    if (pure_fuse_jump(pc, i)) {
+        /* The result could be still used after the jump like the result of `&&`. */
+        xstra_inst(code, "if (%s(%s = %s)) goto L%d;\n", i->next->opcode == KIR_JMPIFT ? "" : "!", buf1, cond, i->next->labelid);
+        fctx->skip = 1;
+        return;
     }
+    xstra_inst(code, "%s = %s;\n", buf1, cond);
 }
 
-static void translate_mov_pure(xstr *code, kl_kir_inst *i)
+static void translate_unary_pure(xstr *code, pure_context *pc, kl_kir_inst *i, const uint8_t *ty, const uint8_t *out)
 {
     char buf1[256] = {0};
-    var_value_pure(buf1, &(i->r1));
-    switch (i->r2.t) {
-    case TK_VAR: {
-        char buf2[256] = {0};
-        var_value_pure(buf2, &(i->r2));
+    char buf2[256] = {0};
+    int t2 = pure_type(pc, ty, &(i->r2));
+    pure_value(buf1, pc, &(i->r1), out[pure_slot(pc, &(i->r1))]);
+    pure_value(buf2, pc, &(i->r2), t2);
+    switch (i->opcode) {
+    case KIR_MOV:
+    case KIR_MOVA:
         xstra_inst(code, "%s = %s;\n", buf1, buf2);
         break;
-    }
-    case TK_VBOOL:
-    case TK_VSINT:
-        xstra_inst(code, "%s = %" PRId64 ";\n", buf1, i->r2.i64);
+    case KIR_NOT:
+        if (t2 == PURE_T_DBL) {
+            xstra_inst(code, "%s = (%s) < DBL_EPSILON;\n", buf1, buf2);
+        } else {
+            xstra_inst(code, "%s = !(%s);\n", buf1, buf2);
+        }
+        break;
+    case KIR_BNOT:
+        xstra_inst(code, "%s = ~(%s);\n", buf1, buf2);
+        break;
+    case KIR_MINUS:
+        xstra_inst(code, "%s = -(%s);\n", buf1, buf2);
         break;
     default:
         break;
     }
 }
 
-static void translate_inst_pure(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_context *fctx, int blank)
+static void translate_incdec_pure(xstr *code, pure_context *pc, const char *sop, int is_postfix, kl_kir_inst *i, const uint8_t *ty)
 {
-    if (i->disabled) {
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    int t2 = pure_type(pc, ty, r2);
+
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+
+    pure_value(buf1, pc, r1, t2);
+    pure_value(buf2, pc, r2, t2);
+    if (is_postfix) {
+        if (r1->prevent) {
+            xstra_inst(code, "(%s)%s;\n", buf2, sop);
+        }  else {
+            xstra_inst(code, "%s = (%s)%s;\n", buf1, buf2, sop);
+        }
+    } else {
+        if (r1->prevent) {
+            xstra_inst(code, "%s(%s);\n", sop, buf2);
+        }  else {
+            xstra_inst(code, "%s = %s(%s);\n", buf1, sop, buf2);
+        }
+    }
+}
+
+static void translate_inst_pure(xstr *code, pure_context *pc, int s, int idx, func_context *fctx, int blank, uint8_t *out)
+{
+    kl_kir_inst *i = pc->inst[idx];
+    if (i->disabled || !pc->reached[idx]) {
+        if (i->opcode == KIR_LABEL) {
+            xstraf(code, "L%d:;\n", i->labelid);
+        }
         return;
     }
 
@@ -432,39 +831,57 @@ static void translate_inst_pure(xstr *code, kl_kir_func *f, kl_kir_inst *i, func
         xstra(code, "\n", 1);
     }
 
+    const uint8_t *ty = pc->in + idx * pc->slots;
+    pure_step(pc, idx, ty, out, 1);
     char buf1[256] = {0};
-    char buf2[256] = {0};
     switch (i->opcode) {
-    case KIR_ALOCAL:
-        fctx->total_vars = i->r1.i64;
-        fctx->local_vars = i->r2.i64;   // including arguments.
-        fctx->argcount = i->r3.i64;
+    case KIR_ALOCAL: {
+        int argcount = (int)i->r3.i64;
         xstra_inst(code, "int64_t r = 0;\n");
-        for (int idx = 0; idx < fctx->total_vars; ++idx) {
-            if (idx >= fctx->argcount) {
-                xstra_inst(code, "int64_t n%d = 0;\n", idx);
+        xstra_inst(code, "double rd = 0;\n");
+        for (int k = 0; k < pc->vars; ++k) {
+            int dbl = k < argcount && (pc->mask[s] & (1 << k));
+            if (k >= argcount || dbl) {
+                xstra_inst(code, "int64_t n%d = 0;\n", k);
             }
+            if (k >= argcount || !dbl) {
+                xstra_inst(code, "double d%d = 0;\n", k);
+            }
+        }
+        for (int k = 0; k < pc->pushes; ++k) {
+            xstra_inst(code, "int64_t t%d = 0;\n", k);
+            xstra_inst(code, "double td%d = 0;\n", k);
         }
+        pure_errn(code, pc, s);
         xstra_inst(code, "\n");
         break;
+    }
 
-    case KIR_PUSHARG:
-        translate_pusharg_pure(code, fctx, &(i->r1));
+    case KIR_PUSHARG: {
+        int t = pure_type(pc, ty, &(i->r1));
+        xstra_inst(code, t == PURE_T_DBL ? "td%d = %s;\n" : "t%d = %s;\n", pc->pushslot[idx], pure_value(buf1, pc, &(i->r1), t));
         break;
+    }
     case KIR_CALL:
-        translate_call_pure(code, f, fctx, i);
+        translate_call_pure(code, pc, s, idx, ty, out);
         break;
 
     case KIR_RET:
-        xstra_inst(code, "return r;\n");
+        xstra_inst(code, pc->ret[s] == PURE_T_DBL ? "return rd;\n" : "return r;\n");
         break;
 
     case KIR_JMPIFT:
-        xstra_inst(code, "if (%s) goto L%d;\n", var_value_pure(buf1, &(i->r1)), i->labelid);
-        break;
-    case KIR_JMPIFF:
-        xstra_inst(code, "if (!(%s)) goto L%d;\n", var_value_pure(buf1, &(i->r1)), i->labelid);
+    case KIR_JMPIFF: {
+        int t = pure_type(pc, ty, &(i->r1));
+        int ift = i->opcode == KIR_JMPIFT;
+        pure_value(buf1, pc, &(i->r1), t);
+        if (t == PURE_T_DBL) {
+            xstra_inst(code, "if ((%s) %s DBL_EPSILON) goto L%d;\n", buf1, ift ? ">=" : "<", i->labelid);
+        } else {
+            xstra_inst(code, ift ? "if (%s) goto L%d;\n" : "if (!(%s)) goto L%d;\n", buf1, i->labelid);
+        }
         break;
+    }
     case KIR_JMP:
         xstra_inst(code, "goto L%d;\n", i->labelid);
         break;
@@ -472,116 +889,135 @@ static void translate_inst_pure(xstr *code, kl_kir_func *f, kl_kir_inst *i, func
         xstraf(code, "L%d:;\n", i->labelid);
         break;
 
-    case KIR_NOT:
-        translate_not_pure(code, i);
-        break;
-
     case KIR_MOV:
     case KIR_MOVA:
-        translate_mov_pure(code, i);
+    case KIR_NOT:
+    case KIR_BNOT:
+    case KIR_MINUS:
+        translate_unary_pure(code, pc, i, ty, out);
         break;
 
     case KIR_ADD:
-        translate_chkcnd_pure(fctx, code, f, "ADD", "+", i);
+        translate_op3_pure(code, pc, i, "ADD", "+", ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_SUB:
-        translate_chkcnd_pure(fctx, code, f, "SUB", "-", i);
+        translate_op3_pure(code, pc, i, "SUB", "-", ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_MUL:
-        translate_chkcnd_pure(fctx, code, f, "MUL", "*", i);
+        translate_op3_pure(code, pc, i, "MUL", "*", ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_DIV:
+        translate_op3_pure(code, pc, i, "DIV", NULL, ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_MOD:
-        translate_chkcnd_pure(fctx, code, f, "MOD", "%", i);
+        translate_op3_pure(code, pc, i, "MOD", NULL, ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_POW:
-        translate_chkcnd_pure(fctx, code, f, "POW", NULL, i);
-        break;
-    case KIR_BNOT:
-        translate_bnot_pure(code, i);
+        translate_op3_pure(code, pc, i, "POW", NULL, ty, out[pure_slot(pc, &(i->r1))]);
         break;
     case KIR_BSHL:
-        translate_chkcnd_direct_pure(fctx, code, f, "<<", i);
+        translate_cmp_pure(code, pc, fctx, i, "<<", ty);
         break;
     case KIR_BSHR:
-        translate_chkcnd_direct_pure(fctx, code, f, ">>", i);
+        translate_cmp_pure(code, pc, fctx, i, ">>", ty);
         break;
     case KIR_BAND:
-        translate_chkcnd_direct_pure(fctx, code, f, "&", i);
+        translate_cmp_pure(code, pc, fctx, i, "&", ty);
         break;
     case KIR_BOR:
-        translate_chkcnd_direct_pure(fctx, code, f, "|", i);
+        translate_cmp_pure(code, pc, fctx, i, "|", ty);
         break;
     case KIR_BXOR:
-        translate_chkcnd_direct_pure(fctx, code, f, "^", i);
+        translate_cmp_pure(code, pc, fctx, i, "^", ty);
         break;
 
     case KIR_EQEQ:
-        translate_chkcnd_direct_pure(fctx, code, f, "==", i);
+        translate_cmp_pure(code, pc, fctx, i, "==", ty);
         break;
     case KIR_NEQ:
-        translate_chkcnd_direct_pure(fctx, code, f, "!=", i);
+        translate_cmp_pure(code, pc, fctx, i, "!=", ty);
         break;
     case KIR_LT:
-        translate_chkcnd_direct_pure(fctx, code, f, "<", i);
+        translate_cmp_pure(code, pc, fctx, i, "<", ty);
         break;
     case KIR_LE:
-        translate_chkcnd_direct_pure(fctx, code, f, "<=", i);
+        translate_cmp_pure(code, pc, fctx, i, "<=", ty);
         break;
     case KIR_GT:
-        translate_chkcnd_direct_pure(fctx, code, f, ">", i);
+        translate_cmp_pure(code, pc, fctx, i, ">", ty);
         break;
     case KIR_GE:
-        translate_chkcnd_direct_pure(fctx, code, f, ">=", i);
+        translate_cmp_pure(code, pc, fctx, i, ">=", ty);
         break;
 
     case KIR_INC:
-        translate_incdec_pure(fctx, code, "++", 0, i);
+        translate_incdec_pure(code, pc, "++", 0, i, ty);
         break;
     case KIR_INCP:
-        translate_incdec_pure(fctx, code, "++", 1, i);
+        translate_incdec_pure(code, pc, "++", 1, i, ty);
         break;
     case KIR_DEC:
-        translate_incdec_pure(fctx, code, "--", 0, i);
+        translate_incdec_pure(code, pc, "--", 0, i, ty);
         break;
     case KIR_DECP:
-        translate_incdec_pure(fctx, code, "--", 1, i);
+        translate_incdec_pure(code, pc, "--", 1, i, ty);
         break;
-    case KIR_MINUS:
+    default:
         break;
     }
 }
 
-void translate_pure_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
+static void translate_pure_sig(xstr *code, pure_context *pc, int s)
 {
+    kl_kir_func *f = pc->f;
     func_context fctx = {
         .has_frame = 0,
     };
+    char name[256] = {0};
 
+    pure_infer(pc, s, 1);
     xstraf(code, "/* pure function:%s */\n", f->name);
-    xstraf(code, "int64_t %s__pure(int64_t *e", f->funcname);
+    xstraf(code, "%s %s(int64_t *e", pc->ret[s] == PURE_T_DBL ? "double" : "int64_t", pure_func_name(name, f, pc->mask[s]));
     for (int i = 0; i < f->argcount; ++i) {
-        xstraf(code, ", int64_t n%d", i);
+        xstraf(code, (pc->mask[s] & (1 << i)) ? ", double d%d" : ", int64_t n%d", i);
     }
     xstraf(code, ")\n{\n");
 
-    kl_kir_inst *i = f->head;
-    kl_kir_inst *prev = NULL;
-    while (i) {
-        int blank = prev && prev->opcode != KIR_LABEL && i->opcode == KIR_LABEL;
-        translate_inst_pure(code, f, i, &fctx, blank);
+    uint8_t *out = (uint8_t *)calloc(pc->slots, sizeof(uint8_t));
+    int prev = -1;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        int blank = prev >= 0 && pc->inst[prev]->opcode != KIR_LABEL && i->opcode == KIR_LABEL;
+        translate_inst_pure(code, pc, s, idx, &fctx, blank, out);
         while (fctx.skip > 0) {
             fctx.skip--;
-            i = i->next;
+            ++idx;
         }
-        prev = i;
-        i = i->next;
+        prev = idx;
     }
+    free(out);
 
     xstraf(code, "}\n\n");
 }
 
+void translate_pure_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
+{
+    pure_context pc = {0};
+    f->pure_sigs = 0;
+    if (pure_setup(&pc, f)) {
+        pure_check_sigs(&pc);
+        for (int s = 0; s < pc.sigs; ++s) {
+            if (pc.valid[s]) {
+                translate_pure_sig(code, &pc, s);
+                f->pure_mask[f->pure_sigs] = pc.mask[s];
+                f->pure_ret[f->pure_sigs] = pc.ret[s];
+                ++(f->pure_sigs);
+            }
+        }
+    }
+    pure_cleanup(&pc);
+}
+
 static const char *var_value(char *buf, kl_kir_opr *rn)  /* buf should have at least 256 bytes. */
 {
     switch (rn->t) {
@@ -636,6 +1072,10 @@ static const char *var_value(char *buf, kl_kir_opr *rn)  /* buf should have at l
 
 static const char *int_value(char *buf, kl_kir_opr *rn)  /* buf should have at least 256 bytes. */
 {
+    if (rn->t == TK_VAR && rn->unboxed == TK_TSINT64) {
+        sprintf(buf, "i%d", rn->index);
+        return buf;
+    }
     var_value(buf, rn);
     if (rn->t == TK_VAR) {
         strcat(buf, "->i");
@@ -747,20 +1187,29 @@ static void translate_idxfrm(func_context *fctx, xstr *code, kl_kir_inst *i)
     xstra_inst(code, "OP_ARRAY_REF_IDXFRM(ctx, %s, %s, %s);\n", buf1, buf2, int_value(buf3, &(i->r3)));
 }
 
+static const char *lvalue_prefix(int lvalue)
+{
+    /* "S" is the store-only form which can write into a packed array directly. */
+    return lvalue == 2 ? "S" : (lvalue ? "L" : "");
+}
+
 static void translate_idx(func_context *fctx, xstr *code, kl_kir_inst *i, int r3typeid, int lvalue)
 {
     char buf1[256] = {0};
     char buf2[256] = {0};
     char buf3[256] = {0};
+    if (i->r3.t == TK_VAR && i->r3.unboxed == TK_TSINT64) {
+        r3typeid = TK_TSINT64;
+    }
     var_value(buf1, &(i->r1));
     var_value(buf2, &(i->r2));
     switch (i->r3.t) {
     case TK_VBOOL:
     case TK_VSINT:
-        xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, %" PRId64 ");\n", (lvalue ? "L" : ""), buf1, buf2, i->r3.i64);
+        xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, %" PRId64 ");\n", lvalue_prefix(lvalue), buf1, buf2, i->r3.i64);
         break;
     case TK_VDBL:
-        xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, ((int)%s));\n", (lvalue ? "L" : ""), buf1, buf2, i->r3.dbl);
+        xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, ((int)%s));\n", lvalue_prefix(lvalue), buf1, buf2, i->r3.dbl);
         break;
     case TK_VSTR:
         xstra_inst(code, "OP_HASH_APPLY%s(ctx, %s, %s, \"%s\");\n", (lvalue ? "L" : ""), buf1, buf2, escape(&(fctx->str), i->r3.str));
@@ -768,10 +1217,10 @@ static void translate_idx(func_context *fctx, xstr *code, kl_kir_inst *i, int r3
     case TK_VAR:
         switch (r3typeid) {
         case TK_TSINT64:
-            xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, %s);\n", (lvalue ? "L" : ""), buf1, buf2, int_value(buf3, &(i->r3)));
+            xstra_inst(code, "OP_ARRAY_REF%s_I(ctx, %s, %s, %s);\n", lvalue_prefix(lvalue), buf1, buf2, int_value(buf3, &(i->r3)));
             break;
         default:
-            xstra_inst(code, "OP_ARRAY_REF%s(ctx, %s, %s, %s);\n", (lvalue ? "L" : ""), buf1, buf2, var_value(buf3, &(i->r3)));
+            xstra_inst(code, "OP_ARRAY_REF%s(ctx, %s, %s, %s);\n", lvalue_prefix(lvalue), buf1, buf2, var_value(buf3, &(i->r3)));
             break;
         }
         break;
@@ -808,69 +1257,481 @@ static void translate_casev(func_context *fctx, xstr *code, kl_kir_inst *i)
     default:
         ;
     }
-    xstra_inst(code, "  OP_JMP_IF_TRUE(&sv, L%d);\n", i->labelid);
-    xstra_inst(code, "}\n");
+    xstra_inst(code, "  OP_JMP_IF_TRUE(&sv, L%d);\n", i->labelid);
+    xstra_inst(code, "}\n");
+}
+
+/*
+ * A local variable marked as unboxed by update_kir_type is held by i<idx> as int64_t or d<idx> as double.
+ * n<idx> is updated only just before it's used by the instruction which doesn't support a native value.
+ */
+static inline int is_unboxed(kl_kir_opr *rn)
+{
+    return rn->t == TK_VAR && rn->unboxed != TK_TANY;
+}
+
+/*
+ * Profile guided optimization.
+ *  With --pgo-gen, each site is given the counters kl_pgo[<index>] to be written to the profile at the end.
+ *  With --pgo-use, the site is found by the same key and a guarded fast path is added for the observed case.
+ *  The key is made by the sequence number of the kind in the function, so both must be made in the same order.
+ */
+static int pgo_kind_index(int kind)
+{
+    return kind == PGO_SITE_TYPE ? 0 : (kind == PGO_SITE_BRANCH ? 1 : 2);
+}
+
+static kl_pgo_site *pgo_peek(func_context *fctx, kl_kir_inst *i, int kind)
+{
+    if (!fctx->pgo || fctx->pgo->gen) {
+        return NULL;
+    }
+    char key[PGO_KEY_SIZE] = {0};
+    snprintf(key, PGO_KEY_SIZE - 1, "%s:%d:%c%d", fctx->funcname, i->line, kind, fctx->pgo_seq[pgo_kind_index(kind)]);
+    return pgo_find(fctx->pgo, key);
+}
+
+/* Returns the index of the counters when instrumenting, otherwise -1 and the site is set if it's in the profile. */
+static int pgo_site(func_context *fctx, kl_kir_inst *i, int kind, kl_pgo_site **site)
+{
+    *site = NULL;
+    if (!fctx->pgo) {
+        return -1;
+    }
+    if (!fctx->pgo->gen) {
+        *site = pgo_peek(fctx, i, kind);
+        fctx->pgo_seq[pgo_kind_index(kind)]++;
+        return -1;
+    }
+    char key[PGO_KEY_SIZE] = {0};
+    snprintf(key, PGO_KEY_SIZE - 1, "%s:%d:%c%d", fctx->funcname, i->line, kind, fctx->pgo_seq[pgo_kind_index(kind)]++);
+    return pgo_add_site(fctx->pgo, key);
+}
+
+static inline int pgo_dominant(int64_t count, int64_t total)
+{
+    return total >= PGO_MIN_COUNT && count * 100 >= total * PGO_DOMINANT;
+}
+
+/* Returns the C operator which can be used for the double values observed at the site. */
+static const char *pgo_dbl_operator(kl_kir_inst *i)
+{
+    switch (i->opcode) {
+    case KIR_ADD: return "+";
+    case KIR_SUB: return "-";
+    case KIR_MUL: return "*";
+    case KIR_LT:  return "<";
+    case KIR_LE:  return "<=";
+    case KIR_GT:  return ">";
+    case KIR_GE:  return ">=";
+    default:
+        break;
+    }
+    return NULL;
+}
+
+static void translate_branch(func_context *fctx, xstr *code, kl_kir_inst *i, const char *cond)
+{
+    kl_pgo_site *site = NULL;
+    int idx = pgo_site(fctx, i, PGO_SITE_BRANCH, &site);
+    int64_t total = site ? site->c[0] + site->c[1] : 0;
+    if (idx >= 0) {
+        xstra_inst(code, "if (%s) { ++kl_pgo[%d][0]; goto L%d; } ++kl_pgo[%d][1];\n", cond, idx, i->labelid, idx);
+    } else if (site && (pgo_dominant(site->c[0], total) || pgo_dominant(site->c[1], total))) {
+        /* The C compiler places the unlikely block out of the hot path. */
+        xstra_inst(code, "if (KL_EXPECT(%s, %d)) goto L%d;\n", cond, site->c[0] > site->c[1], i->labelid);
+    } else {
+        xstra_inst(code, "if (%s) goto L%d;\n", cond, i->labelid);
+    }
+}
+
+static void translate_jmpif(func_context *fctx, xstr *code, kl_kir_inst *i)
+{
+    char buf1[256] = {0};
+    kl_pgo_site *site = NULL;
+    int idx = pgo_site(fctx, i, PGO_SITE_BRANCH, &site);
+    const char *op = i->opcode == KIR_JMPIFT ? "JMP_IF_TRUE" : "JMP_IF_FALSE";
+    if (idx >= 0) {
+        xstra_inst(code, "PGO_%s(kl_pgo[%d], %s, L%d);\n", op, idx, var_value(buf1, &(i->r1)), i->labelid);
+    } else {
+        xstra_inst(code, "OP_%s(%s, L%d);\n", op, var_value(buf1, &(i->r1)), i->labelid);
+    }
+}
+
+/* The types of the operands are counted, or the fast path for double values is added before the generic operation. */
+static void translate_op3_pgo(func_context *fctx, xstr *code, kl_kir_inst *i, const char *buf1, const char *buf2, const char *buf3)
+{
+    kl_pgo_site *site = NULL;
+    int idx = pgo_site(fctx, i, PGO_SITE_TYPE, &site);
+    if (idx >= 0) {
+        xstra_inst(code, "PGO_TYPES(kl_pgo[%d], %s, %s);\n", idx, buf2, buf3);
+        return;
+    }
+    const char *dop = pgo_dbl_operator(i);
+    if (site && dop && pgo_dominant(site->c[1], site->c[0] + site->c[1] + site->c[2])) {
+        xstra_inst(code, "if ((%s)->t == VAR_DBL && (%s)->t == VAR_DBL) %s(%s, (%s)->d %s (%s)->d) else\n",
+            buf2, buf3, i->opcode == KIR_ADD || i->opcode == KIR_SUB || i->opcode == KIR_MUL ? "SET_DBL" : "SET_BOOL",
+            buf1, buf2, dop, buf3);
+    }
+}
+
+/*
+ * The comparison and the conditional jump with the operand types observed at the site.
+ * This returns 0 if the profile doesn't show the dominant types, and then nothing is consumed.
+ */
+static int translate_cmp_jmpif_pgo(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+{
+    kl_kir_inst *n = i->next;
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    kl_kir_opr *r3 = &(i->r3);
+    if (r2->t != TK_VAR || r3->t != TK_VAR || is_unboxed(r1) || is_unboxed(r2) || is_unboxed(r3)) {
+        return 0;
+    }
+    kl_pgo_site *site = pgo_peek(fctx, i, PGO_SITE_TYPE);
+    if (!site) {
+        return 0;
+    }
+    int64_t total = site->c[0] + site->c[1] + site->c[2];
+    const char *dop = pgo_dbl_operator(i);
+    const char *type;
+    const char *field;
+    if (pgo_dominant(site->c[0], total)) {
+        type = "VAR_INT64";
+        field = "i";
+    } else if (dop && pgo_dominant(site->c[1], total)) {
+        type = "VAR_DBL";
+        field = "d";
+    } else {
+        return 0;
+    }
+    fctx->pgo_seq[pgo_kind_index(PGO_SITE_TYPE)]++;
+
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    char buf3[256] = {0};
+    char cond[320] = {0};
+    var_value(buf1, r1);
+    var_value(buf2, r2);
+    var_value(buf3, r3);
+    xstra_inst(code, "if ((%s)->t == %s && (%s)->t == %s) {\n", buf2, type, buf3, type);
+    xstra_inst(code, "    SET_BOOL(%s, (%s)->%s %s (%s)->%s);\n", buf1, buf2, field, sop, buf3, field);
+    snprintf(cond, 318, "%s(%s)->i", n->opcode == KIR_JMPIFT ? "" : "!", buf1);
+    xstra(code, "    ", 4);
+    translate_branch(fctx, code, n, cond);
+    xstra_inst(code, "} else {\n");
+    xstra_inst(code, "    OP_%s(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
+        op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+    xstra_inst(code, "    OP_%s(%s, L%d);\n", n->opcode == KIR_JMPIFT ? "JMP_IF_TRUE" : "JMP_IF_FALSE", buf1, n->labelid);
+    xstra_inst(code, "}\n");
+    fctx->skip = 1;
+    return 1;
+}
+
+static void translate_op3(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+{
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    kl_kir_opr *r3 = &(i->r3);
+
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    char buf3[256] = {0};
+    var_value(buf1, r1);
+    if (sop && r2->typeid == TK_TSINT64 && r3->typeid == TK_TSINT64) {
+        int_value(buf2, r2);
+        int_value(buf3, r3);
+        xstra_inst(code, "SET_I64(%s, (%s) %s (%s));\n", buf1, buf2, sop, buf3);
+    } else {
+        var_value(buf2, r2);
+        var_value(buf3, r3);
+        int dbl = r2->t == TK_VDBL || r3->t == TK_VDBL;
+        if (dbl) {
+            /* A real literal is passed via a temporary variable. */
+            xstra_inst(code, "{ vmvar dv2 = {0}, dv3 = {0};");
+            if (r2->t == TK_VDBL) {
+                xstraf(code, " SET_DBL(&dv2, %s);", r2->dbl);
+                strcpy(buf2, "&dv2");
+            }
+            if (r3->t == TK_VDBL) {
+                xstraf(code, " SET_DBL(&dv3, %s);", r3->dbl);
+                strcpy(buf3, "&dv3");
+            }
+            xstraf(code, "\n");
+        }
+        if (r2->t == TK_VSINT) {
+            if (r3->t == TK_VSINT) {
+                xstra_inst(code, "OP_%s_I_I(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
+                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+            } else {
+                xstra_inst(code, "OP_%s_I_V(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
+                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+            }
+        } else {
+            if (r3->t == TK_VSINT) {
+                xstra_inst(code, "OP_%s_V_I(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
+                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+            } else {
+                if (fctx->pgo && r2->t == TK_VAR && r3->t == TK_VAR && pgo_dbl_operator(i)) {
+                    translate_op3_pgo(fctx, code, i, buf1, buf2, buf3);
+                }
+                xstra_inst(code, "OP_%s(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
+                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+            }
+        }
+        if (dbl) {
+            xstra_inst(code, "}\n");
+        }
+    }
+}
+
+static void translate_chkcnd(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+{
+    if (sop && i->next && (i->next->opcode == KIR_JMPIFT || i->next->opcode == KIR_JMPIFF)) {
+        kl_kir_inst *n = i->next;
+        if (i->r1.level == n->r1.level && i->r1.index == n->r1.index) {
+            kl_kir_opr *r1 = &(i->r1);
+            kl_kir_opr *r2 = &(i->r2);
+            kl_kir_opr *r3 = &(i->r3);
+            if (r1->typeid == TK_TSINT64 && r2->typeid == TK_TSINT64 && r3->typeid == TK_TSINT64) {
+                char buf2[256] = {0};
+                char buf3[256] = {0};
+                char cond[600] = {0};
+                int_value(buf2, r2);
+                int_value(buf3, r3);
+                snprintf(cond, 598, "%s((%s) %s (%s))", i->next->opcode == KIR_JMPIFT ? "" : "!", buf2, sop, buf3);
+                translate_branch(fctx, code, n, cond);
+                fctx->skip = 1;
+                return;
+            }
+            if (fctx->pgo && translate_cmp_jmpif_pgo(fctx, code, op, sop, i)) {
+                return;
+            }
+        }
+    }
+    translate_op3(fctx, code, op, sop, i);
+}
+
+static tk_typeid native_type(kl_kir_opr *rn)
+{
+    switch (rn->t) {
+    case TK_VSINT:
+        return TK_TSINT64;
+    case TK_VDBL:
+        return TK_TDBL;
+    case TK_VAR:
+        return rn->unboxed;
+    default:
+        break;
+    }
+    return TK_TANY;
+}
+
+static const char *native_value(char *buf, kl_kir_opr *rn)  /* buf should have at least 256 bytes. */
+{
+    switch (rn->t) {
+    case TK_VSINT:
+        sprintf(buf, "%" PRId64, rn->i64);
+        break;
+    case TK_VDBL:
+        sprintf(buf, "%s", rn->dbl);
+        break;
+    default:
+        sprintf(buf, "%c%d", rn->unboxed == TK_TDBL ? 'd' : 'i', rn->index);
+        break;
+    }
+    return buf;
+}
+
+static void sync_unboxed(xstr *code, kl_kir_inst *i)
+{
+    kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+    for (int pos = 0; pos < 3; ++pos) {
+        if (pos == 2 && (i->opcode == KIR_IDX || i->opcode == KIR_IDXF || i->opcode == KIR_IDXL) && rn[pos]->unboxed == TK_TSINT64) {
+            continue;   /* An index is used as an integer directly. */
+        }
+        if (is_unboxed(rn[pos])) {
+            char buf[256] = {0};
+            xstra_inst(code, "%s(n%d, %s);\n", rn[pos]->unboxed == TK_TDBL ? "SET_DBL" : "SET_I64",
+                rn[pos]->index, native_value(buf, rn[pos]));
+        }
+    }
+}
+
+static int translate_unboxed_op3(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+{
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    kl_kir_opr *r3 = &(i->r3);
+    tk_typeid t2 = native_type(r2);
+    tk_typeid t3 = native_type(r3);
+    if (t2 == TK_TANY || t3 == TK_TANY || (!is_unboxed(r1) && !is_unboxed(r2) && !is_unboxed(r3))) {
+        return 0;
+    }
+
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    char buf3[256] = {0};
+    native_value(buf2, r2);
+    native_value(buf3, r3);
+    kl_kir_inst *n = i->next;
+    if (r1->t == TK_VAR && r1->index < 0 && n && n->opcode == KIR_MOV && is_unboxed(&(n->r1)) &&
+            n->r2.t == TK_VAR && n->r2.index < 0) {
+        /* A compound assignment via the return register, which is still updated for the result. */
+        native_value(buf1, &(n->r1));
+        xstra_inst(code, "%s = (%s) %s (%s);\n", buf1, buf2, sop, buf3);
+        xstra_inst(code, "%s((r), %s);\n", n->r1.unboxed == TK_TDBL ? "SET_DBL" : "SET_I64", buf1);
+        fctx->skip = 1;
+    } else if (is_unboxed(r1)) {
+        xstra_inst(code, "%s = (%s) %s (%s);\n", native_value(buf1, r1), buf2, sop, buf3);
+    } else if (t2 == TK_TSINT64 && t3 == TK_TSINT64) {
+        xstra_inst(code, "OP_%s_I_I(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n", op, var_value(buf1, r1), buf2, buf3,
+            i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+    } else {
+        xstra_inst(code, "SET_DBL(%s, (%s) %s (%s));\n", var_value(buf1, r1), buf2, sop, buf3);
+    }
+    return 1;
+}
+
+static int translate_unboxed_cmp(func_context *fctx, xstr *code, const char *sop, kl_kir_inst *i)
+{
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    kl_kir_opr *r3 = &(i->r3);
+    tk_typeid t2 = native_type(r2);
+    tk_typeid t3 = native_type(r3);
+    if (t2 == TK_TANY || t3 == TK_TANY || (!is_unboxed(r2) && !is_unboxed(r3))) {
+        return 0;
+    }
+
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    char buf3[256] = {0};
+    var_value(buf1, r1);
+    native_value(buf2, r2);
+    native_value(buf3, r3);
+    if ((t2 == TK_TDBL || t3 == TK_TDBL) && (i->opcode == KIR_EQEQ || i->opcode == KIR_NEQ)) {
+        xstra_inst(code, "SET_BOOL(%s, %s(%s, %s));\n", buf1, i->opcode == KIR_EQEQ ? "OP_NEQEQ_D" : "OP_NNEQ_D", buf2, buf3);
+    } else {
+        xstra_inst(code, "SET_BOOL(%s, (%s) %s (%s));\n", buf1, buf2, sop, buf3);
+    }
+    kl_kir_inst *n = i->next;
+    if (n && (n->opcode == KIR_JMPIFT || n->opcode == KIR_JMPIFF) && r1->level == n->r1.level && r1->index == n->r1.index) {
+        char cond[300] = {0};
+        snprintf(cond, 298, "%s(%s)->i", n->opcode == KIR_JMPIFT ? "" : "!", buf1);
+        translate_branch(fctx, code, n, cond);
+        fctx->skip = 1;
+    }
+    return 1;
 }
 
-static void translate_op3(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+static int translate_unboxed_incdec(xstr *code, const char *sop, int is_postfix, kl_kir_inst *i)
 {
     kl_kir_opr *r1 = &(i->r1);
     kl_kir_opr *r2 = &(i->r2);
-    kl_kir_opr *r3 = &(i->r3);
+    if (!is_unboxed(r2)) {
+        return 0;
+    }
 
     char buf1[256] = {0};
     char buf2[256] = {0};
-    char buf3[256] = {0};
-    var_value(buf1, r1);
-    if (sop && r2->typeid == TK_TSINT64 && r3->typeid == TK_TSINT64) {
-        int_value(buf2, r2);
-        int_value(buf3, r3);
-        xstra_inst(code, "SET_I64(%s, (%s) %s (%s));\n", buf1, buf2, sop, buf3);
+    char expr[512] = {0};
+    native_value(buf2, r2);
+    if (is_postfix) {
+        sprintf(expr, "%s%s", buf2, sop);
     } else {
-        var_value(buf2, r2);
-        var_value(buf3, r3);
-        if (r2->t == TK_VSINT) {
-            if (r3->t == TK_VSINT) {
-                xstra_inst(code, "OP_%s_I_I(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
-                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
-            } else {
-                xstra_inst(code, "OP_%s_I_V(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
-                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
-            }
-        } else {
-            if (r3->t == TK_VSINT) {
-                xstra_inst(code, "OP_%s_V_I(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
-                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
-            } else {
-                xstra_inst(code, "OP_%s(ctx, %s, %s, %s, L%d, \"%s\", \"%s\", %d);\n",
-                    op, buf1, buf2, buf3, i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
-            }
-        }
+        sprintf(expr, "%s%s", sop, buf2);
+    }
+    if (r1->prevent) {
+        xstra_inst(code, "%s;\n", expr);
+    } else if (is_unboxed(r1)) {
+        xstra_inst(code, "%s = %s;\n", native_value(buf1, r1), expr);
+    } else {
+        xstra_inst(code, "%s(%s, %s);\n", r2->unboxed == TK_TDBL ? "SET_DBL" : "SET_I64", var_value(buf1, r1), expr);
     }
+    return 1;
 }
 
-static void translate_chkcnd(func_context *fctx, xstr *code, const char *op, const char *sop, kl_kir_inst *i)
+/* Returns 1 if the instruction has been translated with native values. */
+static int translate_unboxed(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
 {
-    if (sop && i->next && (i->next->opcode == KIR_JMPIFT || i->next->opcode == KIR_JMPIFF)) {
-        kl_kir_inst *n = i->next;
-        if (i->r1.level == n->r1.level && i->r1.index == n->r1.index) {
-            kl_kir_opr *r1 = &(i->r1);
-            kl_kir_opr *r2 = &(i->r2);
-            kl_kir_opr *r3 = &(i->r3);
-            if (r1->typeid == TK_TSINT64 && r2->typeid == TK_TSINT64 && r3->typeid == TK_TSINT64) {
-                char buf2[256] = {0};
-                char buf3[256] = {0};
-                int_value(buf2, r2);
-                int_value(buf3, r3);
-                xstra_inst(code, "if (%s((%s) %s (%s))) goto L%d;\n",
-                    i->next->opcode == KIR_JMPIFT ? "" : "!",
-                    buf2, sop, buf3, n->labelid);
-                fctx->skip = 1;
-                return;
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    kl_kir_opr *r1 = &(i->r1);
+    kl_kir_opr *r2 = &(i->r2);
+    switch (i->opcode) {
+    case KIR_MOV:
+        if (is_unboxed(r1)) {
+            xstra_inst(code, "%s = %s;\n", native_value(buf1, r1), native_value(buf2, r2));
+            return 1;
+        }
+        if (is_unboxed(r2)) {
+            xstra_inst(code, "%s(%s, %s);\n", r2->unboxed == TK_TDBL ? "SET_DBL" : "SET_I64", var_value(buf1, r1), native_value(buf2, r2));
+            return 1;
+        }
+        break;
+    case KIR_MINUS:
+        if (is_unboxed(r1)) {
+            xstra_inst(code, "%s = -(%s);\n", native_value(buf1, r1), native_value(buf2, r2));
+            return 1;
+        }
+        break;
+
+    case KIR_ADD:
+        return translate_unboxed_op3(fctx, code, "ADD", "+", i);
+    case KIR_SUB:
+        return translate_unboxed_op3(fctx, code, "SUB", "-", i);
+    case KIR_MUL:
+        return translate_unboxed_op3(fctx, code, "MUL", "*", i);
+
+    case KIR_EQEQ:
+        return translate_unboxed_cmp(fctx, code, "==", i);
+    case KIR_NEQ:
+        return translate_unboxed_cmp(fctx, code, "!=", i);
+    case KIR_LT:
+        return translate_unboxed_cmp(fctx, code, "<", i);
+    case KIR_LE:
+        return translate_unboxed_cmp(fctx, code, "<=", i);
+    case KIR_GT:
+        return translate_unboxed_cmp(fctx, code, ">", i);
+    case KIR_GE:
+        return translate_unboxed_cmp(fctx, code, ">=", i);
+
+    case KIR_INC:
+        return translate_unboxed_incdec(code, "++", 0, i);
+    case KIR_INCP:
+        return translate_unboxed_incdec(code, "++", 1, i);
+    case KIR_DEC:
+        return translate_unboxed_incdec(code, "--", 0, i);
+    case KIR_DECP:
+        return translate_unboxed_incdec(code, "--", 1, i);
+
+    case KIR_JMPIFT:
+    case KIR_JMPIFF:
+        if (is_unboxed(r1)) {
+            int ift = i->opcode == KIR_JMPIFT;
+            char cond[300] = {0};
+            native_value(buf1, r1);
+            if (r1->unboxed == TK_TDBL) {
+                snprintf(cond, 298, "%s %s DBL_EPSILON", buf1, ift ? ">=" : "<");
+            } else {
+                snprintf(cond, 298, "%s%s", ift ? "" : "!", buf1);
             }
+            translate_branch(fctx, code, i, cond);
+            return 1;
+        }
+        break;
+    case KIR_PUSHARG:
+        if (is_unboxed(r1)) {
+            xstra_inst(code, "{ %s(ctx, %s, L%d, \"%s\", \"%s\", %d); }\n", r1->unboxed == TK_TDBL ? "push_var_d" : "push_var_i",
+                native_value(buf1, r1), i->catchid > 0 ? i->catchid : f->funcend, i->funcname, escape(&(fctx->str), i->filename), i->line);
+            return 1;
         }
+        break;
+    default:
+        break;
     }
-    translate_op3(fctx, code, op, sop, i);
+    return 0;
 }
 
 static void translate_regexp(func_context *fctx, xstr *code, kl_kir_inst *i, const char *method, int str)
@@ -891,6 +1752,32 @@ static void translate_regexp(func_context *fctx, xstr *code, kl_kir_inst *i, con
     xstra_inst(code, "reduce_vstackp(ctx, 2);\n");
 }
 
+static int pgo_has_func(kl_kir_program *p, const char *name)
+{
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        if (strcmp(f->funcname, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The call target is recorded, or the direct call is added when the site always calls the same function. */
+static void translate_call_pgo(func_context *fctx, xstr *code, kl_kir_inst *i, const char *buf1, const char *buf2)
+{
+    kl_pgo_site *site = NULL;
+    int idx = pgo_site(fctx, i, PGO_SITE_CALL, &site);
+    if (idx >= 0) {
+        xstra_inst(code, "PGO_CALL(kl_pgo[%d], kl_pgo_target[%d], %s);\n", idx, idx, buf2);
+        return;
+    }
+    if (site && site->target && pgo_dominant(site->c[0], site->c[0] + site->c[1] + site->c[2]) &&
+            pgo_has_func(fctx->program, site->target)) {
+        xstra_inst(code, "if ((%s)->t == VAR_FNC && ((%s)->f)->f == (void *)%s) CALL_DIRECT(%s, (%s)->f, %s, %d + ad%d) else\n",
+            buf2, buf2, site->target, site->target, buf2, buf1, i->r2.args, i->r2.callcnt);
+    }
+}
+
 static void translate_call(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
 {
     char buf1[256] = {0};
@@ -909,12 +1796,30 @@ static void translate_call(func_context *fctx, xstr *code, kl_kir_func *f, kl_ki
         }
     } else {
         int tclabel = i->catchid > 0 ? i->catchid : f->funcend;
+        if (fctx->pgo) {
+            translate_call_pgo(fctx, code, i, buf1, buf2);
+        }
         xstra_inst(code, "CHECK_CALL(ctx, %s, L%d, %s, %d + ad%d, \"%s\", \"%s\", %d);\n",
             buf2, tclabel, buf1, i->r2.args, i->r2.callcnt,
             i->funcname, escape(&(fctx->str), i->filename), i->line);
     }
 }
 
+static void translate_heapfrm(func_context *fctx, xstr *code, kl_kir_inst *i)
+{
+    if (!fctx->frame_on_stack) {
+        return;
+    }
+    char buf1[256] = {0};
+    char buf2[256] = {0};
+    /* The local variables refer to the frame moved to the heap. */
+    xstra_inst(code, "CHECK_NATIVE_LOOP(ctx, %s, %s, frm, pstop, {", var_value(buf1, &(i->r1)), var_value(buf2, &(i->r2)));
+    for (int idx = 0; idx < fctx->local_vars; ++idx) {
+        xstraf(code, " n%d = frm->v[%d];", idx, idx);
+    }
+    xstraf(code, " });\n");
+}
+
 static void translate_yield(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
 {
     if (f->has_frame) {
@@ -943,16 +1848,16 @@ static void translate_yield_check(func_context *fctx, xstr *code, kl_kir_func *f
             /* There is the case when returned back by yield. */
             if (i->r2.funcid > 0) {
                 if (f->has_frame) {
-                    xstra_inst(code, "CHECK_YIELD_FRM(ctx, %s, frm, f%d, %d, %d, SAVE_LOCAL());\n",
-                        buf1, i->r2.funcid, i->labelid, fctx->temp_count);
+                    xstra_inst(code, "CHECK_YIELD_%s(ctx, %s, frm, f%d, %d, %d, SAVE_LOCAL());\n",
+                        f->frame_on_stack ? "SFRM" : "FRM", buf1, i->r2.funcid, i->labelid, fctx->temp_count);
                 } else {
                     xstra_inst(code, "CHECK_YIELD(ctx, %s, f%d, %d, %d, SAVE_LOCAL());\n",
                         buf1, i->r2.funcid, i->labelid, fctx->temp_count);
                 }
             } else {
                 if (f->has_frame) {
-                    xstra_inst(code, "CHECK_YIELD_FRM(ctx, %s, frm, (%s)->f, %d, %d, SAVE_LOCAL());\n",
-                        buf1, buf2, i->labelid, fctx->temp_count);
+                    xstra_inst(code, "CHECK_YIELD_%s(ctx, %s, frm, (%s)->f, %d, %d, SAVE_LOCAL());\n",
+                        f->frame_on_stack ? "SFRM" : "FRM", buf1, buf2, i->labelid, fctx->temp_count);
                 } else {
                     xstra_inst(code, "CHECK_YIELD(ctx, %s, (%s)->f, %d, %d, SAVE_LOCAL());\n",
                         buf1, buf2, i->labelid, fctx->temp_count);
@@ -1038,8 +1943,9 @@ static void translate_mov(func_context *fctx, xstr *code, kl_kir_inst *i)
     case TK_FUNC:
         xstra_inst(code, "vmfnc *f%d = alcfnc(ctx, %s, frm, \"%s\", 0);\n", i->r2.funcid, i->r2.name, i->r2.str);
         xstra_inst(code, "SET_FNC(%s, f%d);\n", buf1, i->r2.funcid);
-        /* 6 means kl000_xxxxx is an actual function name. See `make_func_name` function in parse.c */
-        if (strcmp(i->r2.name, "methodMissing") == 0 || strcmp(i->r2.name + 6, "methodMissing") == 0) {
+        /* The prefix is kl000_ or mod_kl000_ of an actual function name. See `make_func_name` function in parse.c */
+        if (strcmp(i->r2.name, "methodMissing") == 0 ||
+                (strlen(i->r2.name) > fctx->prefix && strcmp(i->r2.name + fctx->prefix, "methodMissing") == 0)) {
             xstra_inst(code, "ctx->methodmissing = f%d;\n", i->r2.funcid);
         }
         break;
@@ -1127,12 +2033,10 @@ static void translate_swapa(func_context *fctx, xstr *code, kl_kir_inst *i)
     char buf2[256] = {0};
     var_value(buf1, &(i->r1));
     var_value(buf2, &(i->r2));
-    xstra_inst(code, "{ vmvar tmp; SHCOPY_VAR_TO(ctx, (&tmp), (%s)->a); SHCOPY_VAR_TO(ctx, (%s)->a, (%s)->a); SHCOPY_VAR_TO(ctx, (%s)->a, (&tmp)); }\n",
-        buf1, buf1, buf2, buf2
-    );
-    xstra_inst(code, "SHMOVE_VAR_TO(ctx, (%s), (%s)->a); SHMOVE_VAR_TO(ctx, (%s), (%s)->a);\n",
-        buf1, buf1, buf2, buf2
-    );
+    xstra_inst(code, "{ vmvar *a1 = LVALUE_OF(%s); vmvar *a2 = LVALUE_OF(%s); vmvar tmp;\n", buf1, buf2);
+    xstra_inst(code, "SHCOPY_VAR_TO(ctx, (&tmp), a1); SHCOPY_VAR_TO(ctx, a1, a2); SHCOPY_VAR_TO(ctx, a2, (&tmp));\n");
+    xstra_inst(code, "GC_WRITE_BARRIER_VAR(ctx, a1); GC_WRITE_BARRIER_VAR(ctx, a2);\n");
+    xstra_inst(code, "SHMOVE_VAR_TO(ctx, (%s), a1); SHMOVE_VAR_TO(ctx, (%s), a2); }\n", buf1, buf2);
 }
 
 static void translate_pushn(func_context *fctx, xstr *code, kl_kir_inst *i)
@@ -1322,29 +2226,42 @@ static void set_last_args(xstr *code, kl_kir_func *f, int idx, int total)
 static void translate_pure_hook(xstr *code, kl_kir_func *f)
 {
     int args = f->argcount;
-    if (args > 0) {
-        xstra_inst(code, "if ((n0->t == VAR_INT64)");
+    if (args == 0) {
+        return;
+    }
+
+    char name[256] = {0};
+    for (int s = 0; s < f->pure_sigs; ++s) {
+        int mask = f->pure_mask[s];
+        const char *setter = f->pure_ret[s] == PURE_T_DBL ? "SET_DBL" : f->pure_ret[s] == PURE_T_BOOL ? "SET_BOOL" : "SET_I64";
+        xstra_inst(code, "if ((n0->t == %s)", (mask & 1) ? "VAR_DBL" : "VAR_INT64");
         for (int i = 1; i < args; ++i) {
-            xstraf(code, " && (n%d->t == VAR_INT64)", i);
+            xstraf(code, " && (n%d->t == %s)", i, (mask & (1 << i)) ? "VAR_DBL" : "VAR_INT64");
         }
-        xstraf(code, " && (ctx->callee->n == 0 || (n0->i < ctx->callee->n");
-        for (int i = 1; i < args; ++i) {
-            xstraf(code, " && n%d->i < ctx->callee->n", i);
+        if (mask == 0) {
+            /* The integer version is not used any more with arguments causing an overflow. */
+            xstraf(code, " && (ctx->callee->n == 0 || (n0->i < ctx->callee->n");
+            for (int i = 1; i < args; ++i) {
+                xstraf(code, " && n%d->i < ctx->callee->n", i);
+            }
+            xstraf(code, "))");
         }
-        xstraf(code, "))) {\n");
+        xstraf(code, ") {\n");
 
         xstra_inst(code, "    int64_t error = 0;\n");
-        xstra_inst(code, "    int64_t ret = %s__pure(&error, n0->i", f->funcname);
+        xstra_inst(code, "    %s ret = %s(&error, n0->%s", f->pure_ret[s] == PURE_T_DBL ? "double" : "int64_t",
+            pure_func_name(name, f, mask), (mask & 1) ? "d" : "i");
         for (int i = 1; i < args; ++i) {
-            xstraf(code, ", n%d->i", i);
+            xstraf(code, ", n%d->%s", i, (mask & (1 << i)) ? "d" : "i");
         }
         xstraf(code, ");\n");
         xstra_inst(code, "    if (error == 0) {\n");
-        xstra_inst(code, "        SET_I64((r), ret);\n");
+        xstra_inst(code, "        %s((r), ret);\n", setter);
         xstra_inst(code, "        goto L%d;\n", f->funcend);
         xstra_inst(code, "    }\n");
-
-        xstra_inst(code, "    ctx->callee->n = error;\n");
+        if (mask == 0) {
+            xstra_inst(code, "    ctx->callee->n = error;\n");
+        }
         xstra_inst(code, "}\n");
     }
 }
@@ -1397,6 +2314,30 @@ static void translate_resume_hook(func_context *fctx, xstr *code, kl_kir_func *f
     xstraf(code, "\nHEAD:;\n");
 }
 
+static void declare_unboxed(func_context *fctx, xstr *code, kl_kir_func *f)
+{
+    if (fctx->total_vars <= 0) {
+        return;
+    }
+    tk_typeid *unboxed = (tk_typeid *)calloc(fctx->total_vars, sizeof(tk_typeid));
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (is_unboxed(rn[pos]) && rn[pos]->level == 0 && rn[pos]->index < fctx->total_vars) {
+                unboxed[rn[pos]->index] = rn[pos]->unboxed;
+            }
+        }
+    }
+    for (int idx = 0; idx < fctx->total_vars; ++idx) {
+        if (unboxed[idx] == TK_TSINT64) {
+            xstra_inst(code, "int64_t i%d = 0;\n", idx);
+        } else if (unboxed[idx] == TK_TDBL) {
+            xstra_inst(code, "double d%d = 0;\n", idx);
+        }
+    }
+    free(unboxed);
+}
+
 static void translate_alocal(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
 {
     fctx->total_vars = i->r1.i64;
@@ -1434,10 +2375,64 @@ static void translate_alocal(func_context *fctx, xstr *code, kl_kir_func *f, kl_
     for (int idx = 0; idx < fctx->total_vars; ++idx) {
         xstra_inst(code, "n%d = local_var(ctx, %d);\n", idx, idx);
     }
+    declare_unboxed(fctx, code, f);
+}
+
+/*
+ * All variables are on the stack with the frame which refers to them, see escape.c.
+ * The frame is moved to the heap when yielding, and the resumed function uses it as usual.
+ */
+static void translate_stack_frm(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
+{
+    fctx->total_vars = i->r1.i64;
+    fctx->local_vars = i->r2.i64;   // including arguments.
+    fctx->temp_count = fctx->total_vars - fctx->local_vars;
+    fctx->resume_start = fctx->local_vars;
+
+    if (f->yield > 0) {
+        xstra_inst(code, "#define SAVE_LOCAL() {");
+        for (int i = fctx->local_vars; i < fctx->total_vars; ++i) {
+            xstraf(code, " SAVEN(%d, n%d);", i - fctx->local_vars, i);
+        }
+        xstraf(code, " }\n");
+        xstra_inst(code, "int yieldno = ctx->callee->yield;\n");
+    }
+    xstra_inst(code, "vmfrm *frm;\n");
+    xstra_inst(code, "STACK_FRM(frm, lex, %d);\n", fctx->local_vars > 0 ? fctx->local_vars : 1);
+    xstra_inst(code, "vmvar ");
+    for (int idx = 0; idx < fctx->total_vars; ++idx) {
+        if (idx != 0) xstraf(code, ", ");
+        xstraf(code, "*n%d", idx);
+    }
+    xstraf(code, ";\n");
+    xstra_inst(code, "vmvar yy = {0}; SET_UNDEF(&yy);\n");
+    xstra_inst(code, "int pstop = vstackp(ctx);\n");
+    xstra_inst(code, "const int allocated_local = %" PRId64 ";\n", fctx->total_vars);
+    xstra_inst(code, "alloc_var(ctx, allocated_local, L%d, \"%s\", \"%s\", %d);\n",
+        f->funcend, i->funcname, escape(&(fctx->str), i->filename), i->line);
+    if (f->yield > 0) {
+        xstra_inst(code, "if (yieldno > 0) {\n");
+        xstra_inst(code, "    frm = ctx->callee->frm;\n");
+        xstra_inst(code, "    push_frm(ctx, e, frm, L%d, \"%s\", \"%s\", %d);\n", f->funcend, i->funcname, escape(&(fctx->str), i->filename), i->line);
+        xstra_inst(code, "    goto RESUMEHOOK;\n");
+        xstra_inst(code, "}\n");
+    }
+    xstra_inst(code, "push_frm(ctx, e, frm, L%d, \"%s\", \"%s\", %d);\n", f->funcend, i->funcname, escape(&(fctx->str), i->filename), i->line);
+    for (int idx = 0; idx < fctx->local_vars; ++idx) {
+        xstra_inst(code, "n%d = frm->v[%d] = local_var(ctx, %d);\n", idx, idx, idx);
+    }
+    for (int idx = fctx->local_vars; idx < fctx->total_vars; ++idx) {
+        xstra_inst(code, "n%d = local_var(ctx, %d);\n", idx, idx);
+    }
+    declare_unboxed(fctx, code, f);
 }
 
 static void translate_mkfrm(func_context *fctx, xstr *code, kl_kir_func *f, kl_kir_inst *i)
 {
+    if (f->frame_on_stack) {
+        translate_stack_frm(fctx, code, f, i);
+        return;
+    }
     fctx->total_vars = i->r1.i64;
     fctx->local_vars = i->r2.i64;   // including arguments.
     fctx->temp_count = fctx->total_vars - fctx->local_vars;
@@ -1494,6 +2489,7 @@ static void translate_mkfrm(func_context *fctx, xstr *code, kl_kir_func *f, kl_k
     if (f->is_global) {
         xstra_inst(code, "SETUP_PROGRAM_ARGS(n0)\n");
     }
+    declare_unboxed(fctx, code, f);
 }
 
 static void translate_rlocal(func_context *fctx, xstr *code)
@@ -1505,12 +2501,35 @@ static void translate_rlocal(func_context *fctx, xstr *code)
 
 static void translate_popfrm(func_context *fctx, xstr *code)
 {
-    if (fctx->total_vars > 0 && fctx->temp_count > 0) {
+    if (fctx->total_vars > 0 && (fctx->temp_count > 0 || fctx->frame_on_stack)) {
         xstra_inst(code, "restore_vstackp(ctx, pstop);\n");
     }
     xstra_inst(code, "pop_frm(ctx);\n");
 }
 
+/*
+ * Returns 1 if the variable could have been promoted to the old generation.
+ * A temporary variable is on the stack, but it is saved in the function object for a resumable function.
+ */
+static int is_old_candidate(func_context *fctx, kl_kir_opr *rn)
+{
+    if (rn->t != TK_VAR || is_unboxed(rn)) {
+        return 0;
+    }
+    if (rn->index < 0 || rn->level > 0 || fctx->resumable) {
+        return 1;
+    }
+    return fctx->has_frame && rn->index < fctx->local_vars;
+}
+
+static void translate_write_barrier_opr(func_context *fctx, xstr *code, kl_kir_opr *rn)
+{
+    if (is_old_candidate(fctx, rn)) {
+        char buf[256] = {0};
+        xstra_inst(code, "GC_WRITE_BARRIER_VAR(ctx, %s);\n", var_value(buf, rn));
+    }
+}
+
 static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_context *fctx, int blank)
 {
     if (i->disabled) {
@@ -1524,6 +2543,12 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
     // if (i->line > 0) {
     //     xstraf(code, "#line %d\n", i->line);
     // }
+    if (is_unboxed(&(i->r1)) || is_unboxed(&(i->r2)) || is_unboxed(&(i->r3))) {
+        if (translate_unboxed(fctx, code, f, i)) {
+            return;
+        }
+        sync_unboxed(code, i);
+    }
     char buf1[256] = {0};
     char buf2[256] = {0};
     switch (i->opcode) {
@@ -1535,6 +2560,17 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
         }
         break;
 
+    case KIR_IMPORT:
+        xstra_inst(code, "IMPORT_VALUE(ctx, %s, \"%s\", L%d, \"%s\", \"%s\", %d);\n", var_value(buf1, &(i->r1)), i->r2.str,
+            i->catchid, i->funcname, escape(&(fctx->str), i->filename), i->line);
+        break;
+    case KIR_EXPORT:
+        xstra_inst(code, "EXPORT_VALUE(ctx, \"%s\", %s);\n", i->r2.str, var_value(buf1, &(i->r1)));
+        break;
+    case KIR_RUNMOD:
+        xstra_inst(code, "RUN_MODULE(ctx, %s, L%d);\n", i->r1.str, i->labelid);
+        break;
+
     case KIR_ALOCAL:
         translate_alocal(fctx, code, f, i);
         break;
@@ -1616,10 +2652,8 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
         break;
 
     case KIR_JMPIFT:
-        xstra_inst(code, "OP_JMP_IF_TRUE(%s, L%d);\n", var_value(buf1, &(i->r1)), i->labelid);
-        break;
     case KIR_JMPIFF:
-        xstra_inst(code, "OP_JMP_IF_FALSE(%s, L%d);\n", var_value(buf1, &(i->r1)), i->labelid);
+        translate_jmpif(fctx, code, i);
         break;
     case KIR_JMP:
         xstra_inst(code, "goto L%d;\n", i->labelid);
@@ -1752,9 +2786,13 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
     case KIR_IDX:
         translate_idx(fctx, code, i, i->r3.typeid, 0);
         break;
-    case KIR_IDXL:
-        translate_idx(fctx, code, i, i->r3.typeid, 1);
+    case KIR_IDXL: {
+        kl_kir_inst *n = i->next;
+        int storeonly = n && n->opcode == KIR_MOVA && n->r1.t == TK_VAR &&
+            n->r1.index == i->r1.index && n->r1.level == i->r1.level;
+        translate_idx(fctx, code, i, i->r3.typeid, storeonly ? 2 : 1);
         break;
+    }
 
     case KIR_APLY:
         translate_idx(fctx, code, i, TK_TSTR, 0);
@@ -1811,6 +2849,18 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
     case KIR_ARYSIZE:
         xstra_inst(code, "SET_I64(%s, (%s)->o->idxsz);\n", var_value(buf1, &(i->r1)), var_value(buf2, &(i->r2)));
         break;
+    case KIR_CHKARY:
+        xstra_inst(code, "CHECK_ARRAY_LOOP(ctx, %s, %s, \"%s\", L%d);\n", var_value(buf1, &(i->r1)), var_value(buf2, &(i->r2)),
+            i->r3.str, i->labelid);
+        break;
+    case KIR_HEAPFRM:
+        translate_heapfrm(fctx, code, i);
+        break;
+    case KIR_IDXF: {
+        char buf3[256] = {0};
+        xstra_inst(code, "OP_ARRAY_REF_F(ctx, %s, %s, %s);\n", var_value(buf1, &(i->r1)), var_value(buf2, &(i->r2)), int_value(buf3, &(i->r3)));
+        break;
+    }
     case KIR_GETITER:
         xstra_inst(code, "GET_ITERATOR(ctx, lex, %s, L%d, \"%s\", \"%s\", %d);\n", var_value(buf1, &(i->r1)),
             i->labelid, i->funcname, escape(&(fctx->str), i->filename), i->line);
@@ -1821,6 +2871,7 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
         break;
     case KIR_SWITCHS:
         xstra_inst(code, "COPY_VAR_TO(ctx, %s, %s);\n", var_value(buf1, &(i->r1)), var_value(buf2, &(i->r2)));
+        translate_write_barrier_opr(fctx, code, &(i->r1));
         xstra_inst(code, "if ((%s)->t != VAR_INT64) goto L%d;\n", var_value(buf1, &(i->r1)), i->labelid);
         xstra_inst(code, "switch ((%s)->i) {\n", var_value(buf1, &(i->r1)));
         break;
@@ -1839,6 +2890,46 @@ static void translate_inst(xstr *code, kl_kir_func *f, kl_kir_inst *i, func_cont
     }
 }
 
+/* The write barrier is put after the instruction which could store a reference to the variable. */
+static void translate_write_barrier(func_context *fctx, xstr *code, kl_kir_inst *i)
+{
+    if (i->disabled) {
+        return;
+    }
+    switch (i->opcode) {
+    case KIR_MOV:
+        if (i->r2.t == TK_VBOOL || i->r2.t == TK_VSINT || i->r2.t == TK_VDBL) {
+            return;
+        }
+        break;
+    case KIR_SWAP:
+    case KIR_SWAPA:
+    case KIR_INC:
+    case KIR_INCP:
+    case KIR_DEC:
+    case KIR_DECP:
+        translate_write_barrier_opr(fctx, code, &(i->r2));
+        break;
+    /* A comparison makes a boolean, and the result of an operator function has the barrier of CALL. */
+    case KIR_EQEQ: case KIR_NEQ: case KIR_LT: case KIR_LE: case KIR_GT: case KIR_GE: case KIR_LGE:
+    case KIR_REGEQ: case KIR_REGNE:
+    case KIR_TYPE: case KIR_ARYSIZE:
+    /* These only read the first operand, or update the object referred to by it via the setters. */
+    case KIR_EXPORT: case KIR_PUSHSYS: case KIR_PUSHARG: case KIR_THROWE: case KIR_JMPIFT: case KIR_JMPIFF:
+    case KIR_REMOVE: case KIR_CHKMATCH: case KIR_CHKRANGE: case KIR_CHKMATCHX: case KIR_CHKRANGEX:
+    case KIR_PUSH: case KIR_PUSHX: case KIR_PUSHN: case KIR_EXPAND: case KIR_SETBIN:
+    case KIR_CHKARY: case KIR_HEAPFRM: case KIR_CASEV: case KIR_JMPIFNE: case KIR_YIELD:
+    /* The barrier is put before the jump by itself. */
+    case KIR_SWITCHS:
+        return;
+    default:
+        break;
+    }
+    if (!i->r1.prevent) {
+        translate_write_barrier_opr(fctx, code, &(i->r1));
+    }
+}
+
 void translate_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
 {
     if (f->is_pure) {
@@ -1847,6 +2938,12 @@ void translate_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
 
     func_context fctx = {
         .has_frame = f->has_frame,
+        .frame_on_stack = f->frame_on_stack,
+        .resumable = !f->is_global && f->yield > 0,
+        .prefix = p->modname ? strlen(p->modname) + 7 : 6,
+        .program = p,
+        .funcname = f->funcname,
+        .pgo = p->pgo,
     };
     xstraf(code, "/* function:%s */\n", f->name);
     xstraf(code, "int %s(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)\n{\n", f->funcname);
@@ -1860,6 +2957,7 @@ void translate_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
     while (i) {
         int blank = prev && prev->opcode != KIR_LABEL && i->opcode == KIR_LABEL;
         translate_inst(code, f, i, &fctx, blank);
+        translate_write_barrier(&fctx, code, i);
         while (fctx.skip > 0) {
             fctx.skip--;
             i = i->next;
@@ -1882,38 +2980,177 @@ void translate_func(kl_kir_program *p, xstr *code, kl_kir_func *f)
     xstraf(code, "}\n\n");
 }
 
-char *translate(kl_kir_program *p, int mode)
+/* The counters are placed before all functions, and the tables to write the profile are placed after them. */
+static void translate_pgo_tables(kl_kir_program *p, xstr *str)
+{
+    kl_pgo *pgo = p->pgo;
+    int n = pgo->count > 0 ? pgo->count : 1;
+    xstr head = {0};
+    clear_xstr(&head);
+    xstraf(&head, "static int64_t kl_pgo[%d][3];\n", n);
+    xstraf(&head, "static void *kl_pgo_target[%d];\n\n", n);
+    xstra(&head, str->s, str->len);
+    free(str->s);
+    *str = head;
+
+    xstraf(str, "static const char *kl_pgo_key[%d] = {\n", n);
+    for (int i = 0; i < pgo->count; ++i) {
+        xstra_inst(str, "\"%s\",\n", pgo->site[i].key);
+    }
+    xstraf(str, "};\n");
+    int fn = 0;
+    xstraf(str, "static void *kl_pgo_fn[] = {\n");
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        xstra_inst(str, "(void *)%s,\n", f->funcname);
+        ++fn;
+    }
+    xstraf(str, "};\n");
+    xstraf(str, "static const char *kl_pgo_fname[] = {\n");
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        xstra_inst(str, "\"%s\",\n", f->funcname);
+    }
+    xstraf(str, "};\n");
+    xstr es = {0};
+    xstraf(str, "static void pgo_finalize(void)\n{\n");
+    xstra_inst(str, "pgo_write(\"%s\", %d, kl_pgo, kl_pgo_target, kl_pgo_key, %d, kl_pgo_fn, kl_pgo_fname);\n",
+        escape(&es, pgo->file), pgo->count, fn);
+    xstraf(str, "}\n");
+    free(es.s);
+}
+
+typedef struct trans_job {
+    kl_kir_program *p;
+    kl_kir_func **f;
+    xstr *code;
+} trans_job;
+
+static void translate_job(void *data, int index)
+{
+    trans_job *job = (trans_job *)data;
+    clear_xstr(&(job->code[index]));
+    translate_func(job->p, &(job->code[index]), job->f[index]);
+}
+
+/* The functions defined in the other parts are declared at the top of each part. */
+static void translate_prototypes(xstr *str, kl_kir_func **f, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        xstraf(str, "extern int %s(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);\n", f[i]->funcname);
+    }
+    xstraf(str, "\n");
+}
+
+static void translate_context(kl_kir_program *p, xstr *str, int pgogen)
+{
+    xstraf(str, "void setup_context(vmctx *ctx)\n{\n");
+    xstra_inst(str, "ctx->print_result = %d;\n", p->print_result);
+    xstra_inst(str, "ctx->verbose = %d;\n", p->verbose);
+    if (p->gctrace) {
+        xstr es = {0};
+        xstra_inst(str, "ctx->gcstat.tracefile = \"%s\";\n", escape(&es, p->gctrace));
+        free(es.s);
+    }
+    xstraf(str, "}\n");
+    xstraf(str, "void finalize_context(vmctx *ctx)\n{\n");
+    if (pgogen) {
+        xstra_inst(str, "pgo_finalize();\n");
+    }
+    xstra_inst(str, "finalize(ctx);\n");
+    xstraf(str, "}\n");
+}
+
+/*
+ * Each function is translated into its own buffer by the threads of p->jobs, and the buffers are joined in order.
+ * The code is split into the parts by the size, which can be compiled separately. The array is terminated by NULL,
+ * and the array and each part should be freed by the caller.
+ */
+char **translate_parts(kl_kir_program *p, int mode, int parts)
 {
     if (!p) {
         return NULL;
     }
 
-    int cap = 2048;
-    xstr str = {
-        .len = 0,
-        .cap = cap,
-        .s = (char *)calloc(cap, sizeof(char)),
+    int count = 0;
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        ++count;
+    }
+    trans_job job = {
+        .p = p,
+        .f = (kl_kir_func **)calloc(count + 1, sizeof(kl_kir_func *)),
+        .code = (xstr *)calloc(count + 1, sizeof(xstr)),
     };
-
-    kl_kir_func *f = p->head;
-    while (f) {
+    count = 0;
+    for (kl_kir_func *f = p->head; f; f = f->next) {
         if (f->is_global && mode == TRANS_LIB) {
-            f = f->next;
             continue;
         }
-        translate_func(p, &str, f);
-        f = f->next;
+        job.f[count++] = f;
     }
 
+    /* The profiled sites are numbered in order, and the counters are shared by all functions. */
+    int pgogen = p->pgo && p->pgo->gen;
+    int jobs = (pgogen || count < TRANS_JOB_MIN_FUNCS) ? 1 : p->jobs;
+    thread_parallel(jobs, count, translate_job, &job);
+
+    int total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += job.code[i].len;
+    }
+    int maxparts = pgogen ? 1 : total / TRANS_PART_SIZE;
+    if (parts > maxparts) {
+        parts = maxparts;
+    }
+    if (parts > count) {
+        parts = count;
+    }
+    if (parts < 1) {
+        parts = 1;
+    }
+
+    char **r = (char **)calloc(parts + 1, sizeof(char *));
+    int idx = 0, size = 0;
+    for (int n = 0; n < parts; ++n) {
+        int cap = 2048;
+        xstr str = {
+            .len = 0,
+            .cap = cap,
+            .s = (char *)calloc(cap, sizeof(char)),
+        };
+        if (parts > 1) {
+            translate_prototypes(&str, job.f, count);
+        }
+        /* Each part has at least one function, and the last part has all of the rest. */
+        int first = idx;
+        int limit = (int)((int64_t)total * (n + 1) / parts);
+        while (idx < count && (idx == first || n == parts - 1 || size < limit)) {
+            xstra(&str, job.code[idx].s, job.code[idx].len);
+            size += job.code[idx].len;
+            free(job.code[idx].s);
+            ++idx;
+        }
+        r[n] = str.s;
+    }
+    free(job.code);
+    free(job.f);
+
+    xstr last = { .len = strlen(r[parts - 1]), .cap = strlen(r[parts - 1]) + 1, .s = r[parts - 1] };
+    if (pgogen) {
+        translate_pgo_tables(p, &last);
+    }
     if (mode == TRANS_FULL) {
-        xstraf(&str, "void setup_context(vmctx *ctx)\n{\n");
-        xstra_inst(&str, "ctx->print_result = %d;\n", p->print_result);
-        xstra_inst(&str, "ctx->verbose = %d;\n", p->verbose);
-        xstraf(&str, "}\n");
-        xstraf(&str, "void finalize_context(vmctx *ctx)\n{\n");
-        xstra_inst(&str, "finalize(ctx);\n");
-        xstraf(&str, "}\n");
+        translate_context(p, &last, pgogen);
     }
+    r[parts - 1] = last.s;
+    return r;
+}
 
-    return str.s;   /* this should be freed by the caller. */
+char *translate(kl_kir_program *p, int mode)
+{
+    char **r = translate_parts(p, mode, 1);
+    if (!r) {
+        return NULL;
+    }
+    char *s = r[0];
+    free(r);
+    return s;   /* this should be freed by the caller. */
 }
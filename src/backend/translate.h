@@ -7,6 +7,8 @@
 #define TRANS_FULL (1)
 #define TRANS_LIB (2)
 #define TRANS_DEBUG (3)
+#define TRANS_MODULE (4)
 extern char *translate(kl_kir_program *p, int mode);
+extern char **translate_parts(kl_kir_program *p, int mode, int parts);
 
 #endif /* KILITE_TRANSLATE_H */
@@ -649,6 +649,11 @@ static void disp_stmt(kl_stmt *s, int indent)
         }
         printf("\n");
         break;
+    case TK_IMPORT:
+        printf("import: ");
+        disp_expr(s->e2, -1);
+        printf(" <- %s\n", s->e1->val.str);
+        break;
     case TK_ENUM:
         printf("enum\n");
         if (s->e1) {
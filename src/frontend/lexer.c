@@ -207,6 +207,15 @@ kl_lexer *lexer_new_string(const char *s)
     return l;
 }
 
+kl_lexer *lexer_new_buffer(char *s)
+{
+    /* The buffer is owned by the lexer and freed with it. */
+    kl_lexer *l = lexer_new();
+    l->s = l->p = s;
+    l->f = NULL;
+    return l;
+}
+
 void lexer_free(kl_lexer *l)
 {
     if (l->f) {
@@ -56,6 +56,7 @@ extern const char *tokenname(int tok);
 extern const char *typeidname(int tid);
 extern kl_lexer *lexer_new_file(const char *f);
 extern kl_lexer *lexer_new_string(const char *s);
+extern kl_lexer *lexer_new_buffer(char *s);
 extern void lexer_free(kl_lexer *l);
 extern tk_token lexer_fetch(kl_lexer *l);
 extern void lexer_raw(kl_lexer *l, char *p, int max, int lastch);
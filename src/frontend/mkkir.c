@@ -3048,9 +3048,44 @@ static kl_kir_func *gen_class(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
     return gen_function(ctx, sym, s, sym->initer);
 }
 
+static kl_kir_inst *gen_exports(kl_context *ctx, kl_symbol *sym, kl_stmt *s, kl_kir_inst *last)
+{
+    /* All functions, classes, modules, and namespaces at the top level are exported from the module. */
+    for ( ; s; s = s->next) {
+        kl_symbol *f = s->sym;
+        int nodetype = s->nodetype;
+        kl_expr *e1 = s->e1;
+        if (nodetype == TK_EXPR && e1 && e1->nodetype == TK_CALL && e1->lhs && e1->lhs->nodetype == TK_FUNC &&
+                e1->lhs->s && e1->lhs->s->nodetype == TK_NAMESPACE) {
+            /* The namespace statement is the call to the namespace function. See parse_statement. */
+            f = e1->lhs->sym;
+            nodetype = TK_NAMESPACE;
+        }
+        if (!f || !f->name) {
+            continue;
+        }
+        switch (nodetype) {
+        case TK_FUNC:
+        case TK_CLASS:
+        case TK_MODULE:
+        case TK_NAMESPACE: {
+            kl_kir_opr r1 = make_var_index(ctx, f->ref ? f->ref->index : f->index, 0, TK_TANY);
+            kl_kir_opr r2 = make_lit_str(ctx, f->name);
+            last->next = new_inst_op2(ctx->program, s->line, s->pos, KIR_EXPORT, &r1, &r2);
+            KIR_MOVE_LAST(last);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return last;
+}
+
 static kl_kir_func *gen_namespace(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
 {
-    if (!s) return NULL;
+    if (!s && !sym->is_global) return NULL;   /* The global code is always needed even if empty. */
+    kl_stmt *top = s;
     kl_kir_func *func = new_func(ctx, sym->line, sym->pos, sym->name);
     kl_kir_inst *last = NULL;
 
@@ -3068,6 +3103,14 @@ static kl_kir_func *gen_namespace(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
         KIR_MOVE_LAST(last);
         set_file_func(ctx, sym, last);
         last->labelid = sym->yield;
+    } else if (ctx->modules) {
+        /* The global code of each module runs before the main program. */
+        for (const char **m = ctx->modules; *m; ++m) {
+            kl_kir_opr r1 = make_lit_str(ctx, *m);
+            last->next = new_inst_op1(ctx->program, sym->line, sym->pos, KIR_RUNMOD, &r1);
+            KIR_MOVE_LAST(last);
+            last->labelid = func->funcend;
+        }
     }
 
     while (s) {
@@ -3090,6 +3133,9 @@ static kl_kir_func *gen_namespace(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
     func->head->r2 = (kl_kir_opr){ .t = TK_VSINT, .i64 = localvars, .typeid = TK_TSINT64 };
     func->head->r3 = (kl_kir_opr){ .t = TK_VSINT, .i64 = sym->argcount, .typeid = TK_TSINT64 };
 
+    if (sym->is_global && ctx->modname) {
+        last = gen_exports(ctx, sym, top, last);
+    }
     last->next = new_inst_label(ctx->program, sym->line, sym->pos, sym->funcend, last, 0);
     KIR_MOVE_LAST(last);
     kl_kir_inst *out = new_inst(ctx->program, sym->line, sym->pos, KIR_POPFRM);
@@ -3294,6 +3340,17 @@ static kl_kir_inst *gen_stmt(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
         }
         break;
     }
+    case TK_IMPORT: {
+        kl_expr *e2 = s->e2;
+        kl_symbol *vsym = e2 ? e2->sym : NULL;
+        if (vsym) {
+            kl_kir_opr r1 = make_var_index(ctx, vsym->index, vsym->level, s->typeid);
+            kl_kir_opr r2 = make_lit_str(ctx, s->e1->val.str);
+            head = new_inst_op2(ctx->program, s->line, s->pos, KIR_IMPORT, &r1, &r2);
+            set_file_func(ctx, sym, head);
+        }
+        break;
+    }
     case TK_ENUM:
     case TK_CONST:
     case TK_LET:
@@ -3336,7 +3393,7 @@ static kl_kir_inst *gen_stmt(kl_context *ctx, kl_symbol *sym, kl_stmt *s)
 
 static void gen_program(kl_context *ctx, kl_kir_program *p, kl_stmt *s)
 {
-    if (s->nodetype != TK_NAMESPACE || !s->s1) {
+    if (s->nodetype != TK_NAMESPACE) {
         return;
     }
     kl_kir_func *func = gen_namespace(ctx, s->sym, s->s1);
@@ -3346,6 +3403,7 @@ static void gen_program(kl_context *ctx, kl_kir_program *p, kl_stmt *s)
 int make_kir(kl_context *ctx)
 {
     ctx->program = (kl_kir_program*)calloc(1, sizeof(kl_kir_program));
+    ctx->program->modname = ctx->modname;
     gen_program(ctx, ctx->program, ctx->head);
     return ctx->errors;
 }
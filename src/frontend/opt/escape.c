@@ -0,0 +1,220 @@
+#include "pass.h"
+
+/*
+ * Escape analysis for a frame.
+ *  A function which has an inner function makes its frame by KIR_MKFRM, and the frame is allocated
+ *  in the heap because a closure could hold it after returning. The frame is placed on the stack
+ *  instead when it is proved that no closure holding the frame outlives the call, which is when
+ *      - a closure is only assigned to a local variable, or called directly as an anonymous function,
+ *      - the variable holding a closure is only used as a callee, which includes the closure itself,
+ *      - a closure does not have yield, and does not make any other closure.
+ *  When yielding in a fiber through the function, the frame is moved to the heap before returning.
+ *  Passing a closure to another function is regarded as escaping, because even a method of an array
+ *  can be replaced by the user's function which stores it. The exception is a callback of the native
+ *  loop method of an array like `a.each(closure)`, which never holds the callback after returning.
+ *  KIR_HEAPFRM is put before that call, and it moves the frame to the heap at runtime unless the receiver
+ *  is a plain array and the method is the builtin one.
+ */
+
+/* The methods run by array_loop in libstd.c. */
+static const char *escape_loop_methods[] = {
+    "each", "map", "flatMap", "filter", "reject", "reduce", "all", "any", "partition", "takeWhile", "dropWhile", NULL
+};
+
+typedef struct escape_context {
+    kl_context *ctx;
+    kl_kir_func *f;
+    int vars;
+    char *slot;                 /* 1 if the variable in the frame holds a closure. */
+} escape_context;
+
+static kl_kir_func *escape_find_func(escape_context *ec, int funcid)
+{
+    for (kl_kir_func *f = ec->ctx->program->head; f; f = f->next) {
+        if (f->funcid == funcid) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/* KIR_YIELDC has the same callee as KIR_CALL, which is saved when yielding. */
+static inline int escape_is_callee(kl_kir_inst *i, int pos)
+{
+    return pos == 1 && (i->opcode == KIR_CALL || i->opcode == KIR_YIELDC);
+}
+
+static inline int escape_is_slot(escape_context *ec, kl_kir_opr *rn, int level)
+{
+    return rn->t == TK_VAR && rn->level == level && 0 <= rn->index && rn->index < ec->vars && ec->slot[rn->index];
+}
+
+/* The function with yield is a fiber, which could be resumed after the caller returned. */
+static int escape_has_yield(kl_kir_func *f)
+{
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (!i->disabled && (i->opcode == KIR_YIELD || i->opcode == KIR_RESUME)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Returns 1 if the closure could hold the frame of the outer function beyond the call. */
+static int escape_closure(escape_context *ec, kl_kir_func *c)
+{
+    if (!c || c == ec->f || escape_has_yield(c)) {
+        return 1;
+    }
+    for (kl_kir_inst *i = c->head; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (rn[pos]->t == TK_FUNC) {
+                return 1;
+            }
+            if (escape_is_slot(ec, rn[pos], 1) && !escape_is_callee(i, pos)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline kl_kir_inst *escape_next(kl_kir_inst *i)
+{
+    for (i = i->next; i && i->disabled; i = i->next) {
+        ;
+    }
+    return i;
+}
+
+static inline int escape_same_var(kl_kir_opr *r1, kl_kir_opr *r2)
+{
+    return r1->t == TK_VAR && r2->t == TK_VAR && r1->index == r2->index && r1->level == r2->level;
+}
+
+/*
+ * Returns the call if the argument pushed by i is the callback of the native loop method of an array,
+ * which is `pusharg cb; aply m, a, "each"; pushsys a; call m`. The callback is the 1st argument,
+ * so it's the last one pushed and the other arguments like the initial value of reduce are not.
+ */
+static kl_kir_inst *escape_loop_call(kl_kir_inst *i)
+{
+    if (i->opcode != KIR_PUSHARG || i->r1.has_dot3) {
+        return NULL;
+    }
+    kl_kir_inst *aply = escape_next(i);
+    if (!aply || aply->opcode != KIR_APLY || aply->r1.t != TK_VAR || aply->r1.level != 0 || aply->r3.t != TK_VSTR) {
+        return NULL;
+    }
+    kl_kir_inst *sys = escape_next(aply);
+    if (!sys || sys->opcode != KIR_PUSHSYS || sys->r1.callcnt != i->r1.callcnt || !escape_same_var(&(sys->r1), &(aply->r2))) {
+        return NULL;
+    }
+    kl_kir_inst *call = escape_next(sys);
+    if (!call || call->opcode != KIR_CALL || call->r2.callcnt != i->r1.callcnt || call->r2.funcid > 0 || !escape_same_var(&(call->r2), &(aply->r1))) {
+        return NULL;
+    }
+    for (const char **m = escape_loop_methods; *m; ++m) {
+        if (strcmp(aply->r3.str, *m) == 0) {
+            return call;
+        }
+    }
+    return NULL;
+}
+
+/* The check is put between pushsys and call, where the receiver and the method are ready. */
+static void escape_add_heapfrm(escape_context *ec, kl_kir_inst *sys, kl_kir_inst *call)
+{
+    kl_kir_program *p = ec->ctx->program;
+    kl_kir_inst *i = (kl_kir_inst *)calloc(1, sizeof(kl_kir_inst));
+    *i = *call;
+    i->chn = p->ichn;
+    p->ichn = i;
+    i->opcode = KIR_HEAPFRM;
+    i->gcable = 0;
+    i->r1 = sys->r1;
+    i->r2 = call->r2;
+    memset(&(i->r3), 0, sizeof(kl_kir_opr));
+    i->next = sys->next;
+    sys->next = i;
+}
+
+static int escape_is_method_missing(kl_kir_opr *rn)
+{
+    /* 6 means kl000_xxxxx is an actual function name. See `make_func_name` function in parse.c */
+    return strcmp(rn->name, "methodMissing") == 0 || (strlen(rn->name) > 6 && strcmp(rn->name + 6, "methodMissing") == 0);
+}
+
+static int escape_frame(escape_context *ec)
+{
+    kl_kir_func *f = ec->f;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->disabled || i->r2.t != TK_FUNC) {
+            continue;
+        }
+        if (i->opcode == KIR_MOV && i->r1.t == TK_VAR && i->r1.level == 0 && 0 <= i->r1.index && i->r1.index < ec->vars) {
+            ec->slot[i->r1.index] = 1;
+        }
+    }
+
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (rn[pos]->t == TK_FUNC) {
+                if (pos != 1 || escape_is_method_missing(rn[pos])) {
+                    return 1;
+                }
+                if (i->opcode == KIR_MOV) {
+                    if (!escape_is_slot(ec, &(i->r1), 0)) {
+                        return 1;
+                    }
+                } else if (!escape_is_callee(i, pos)) {
+                    return 1;
+                }
+                if (escape_closure(ec, escape_find_func(ec, rn[pos]->funcid))) {
+                    return 1;
+                }
+            } else if (escape_is_slot(ec, rn[pos], 0)) {
+                int assign = i->opcode == KIR_MOV && pos == 0 && i->r2.t == TK_FUNC;
+                int loop = pos == 0 && escape_loop_call(i);
+                if (!escape_is_callee(i, pos) && !assign && !loop) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void escape_analysis(kl_context *ctx)
+{
+    for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+        kl_kir_inst *head = f->head;
+        if (!head || f->is_global || head->opcode != KIR_MKFRM || escape_has_yield(f)) {
+            continue;
+        }
+        escape_context ec = {
+            .ctx = ctx,
+            .f = f,
+            .vars = (int)head->r1.i64,
+        };
+        ec.slot = (char *)calloc(ec.vars > 0 ? ec.vars : 1, sizeof(char));
+        f->frame_on_stack = !escape_frame(&ec);
+        if (f->frame_on_stack) {
+            for (kl_kir_inst *i = head; i; i = i->next) {
+                kl_kir_inst *call = (!i->disabled && escape_is_slot(&ec, &(i->r1), 0)) ? escape_loop_call(i) : NULL;
+                if (call) {
+                    escape_add_heapfrm(&ec, escape_next(escape_next(i)), call);
+                }
+            }
+        }
+        free(ec.slot);
+    }
+}
@@ -0,0 +1,446 @@
+#include "pass.h"
+
+/*
+ * Inlining a small leaf function.
+ *  The call to the function known by its funcid, or to the closure held by a local variable assigned
+ *  only once, is replaced by the body of the callee when the callee
+ *      - has no frame, no yield, no rest argument, and no argument with a type check,
+ *      - does not call any other function, and so it's never recursive,
+ *      - has instructions not more than the limit, which is changed by --inline-limit.
+ *  The callee's variables are moved to the end of the caller's local area, and the pushed arguments
+ *  become the assignments to them. The return value `(*r)` is the destination of the call.
+ *  The variable in an outer frame is referred to from the caller by the level recalculated, and the
+ *  call is not inlined when the frame is not reachable from the caller.
+ *
+ *  The exit of the callee, which is both for returning and for an exception, is a new label placed
+ *  before KIR_CHKEXCEPT of the call, and so an exception is traced as if the function was called.
+ *  Each instruction keeps the function name and the line of the callee for the stack trace.
+ */
+
+#define INLINE_MAX_ROUND    (3)
+#define INLINE_MAX_LEVEL    (16)
+
+typedef struct inline_context {
+    kl_context *ctx;
+    int limit;
+    int maxid;
+    kl_kir_func **func;         /* The function by its funcid. */
+    kl_kir_func **parent;       /* The function which makes the function as a closure, by its funcid. */
+    int maxlabel;
+    int *label;                 /* The new label id by the callee's label id. */
+} inline_context;
+
+static inline kl_kir_func *inline_parent(inline_context *ic, kl_kir_func *f)
+{
+    return (0 < f->funcid && f->funcid <= ic->maxid) ? ic->parent[f->funcid] : NULL;
+}
+
+static void inline_setup(inline_context *ic)
+{
+    kl_kir_program *p = ic->ctx->program;
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        if (ic->maxid < f->funcid) {
+            ic->maxid = f->funcid;
+        }
+    }
+    ic->func = (kl_kir_func **)calloc(ic->maxid + 1, sizeof(kl_kir_func *));
+    ic->parent = (kl_kir_func **)calloc(ic->maxid + 1, sizeof(kl_kir_func *));
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        if (f->funcid > 0) {
+            ic->func[f->funcid] = f;
+        }
+    }
+    for (kl_kir_func *f = p->head; f; f = f->next) {
+        for (kl_kir_inst *i = f->head; i; i = i->next) {
+            if (i->r2.t == TK_FUNC && 0 < i->r2.funcid && i->r2.funcid <= ic->maxid) {
+                ic->parent[i->r2.funcid] = f;
+            }
+        }
+    }
+}
+
+static int inline_is_denied(kl_kir op)
+{
+    switch (op) {
+    case KIR_EXTERN:
+    case KIR_IMPORT:
+    case KIR_EXPORT:
+    case KIR_RUNMOD:
+    case KIR_FUNC:
+    case KIR_ALOCAL:
+    case KIR_MKFRM:
+    case KIR_POPFRM:
+    case KIR_SETARGL:
+    case KIR_SVSTKP:
+    case KIR_PUSHSYS:
+    case KIR_PUSHARG:
+    case KIR_CALL:
+    case KIR_YIELDC:
+    case KIR_YIELD:
+    case KIR_RESUME:
+        return 1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* Returns the size of the callee, or -1 if it can't be inlined. */
+static int inline_size(inline_context *ic, kl_kir_func *g)
+{
+    kl_kir_inst *head = g->head;
+    if (!head || head->opcode != KIR_ALOCAL || g->is_global || g->has_dot3 || g->has_frame) {
+        return -1;
+    }
+    int size = 0;
+    int ended = 0;
+    for (kl_kir_inst *i = head->next; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (ended) {
+            if (i->opcode != KIR_RLOCAL && i->opcode != KIR_RET) {
+                return -1;
+            }
+            continue;
+        }
+        if (inline_is_denied(i->opcode) || i->opcode == KIR_RLOCAL || i->opcode == KIR_RET) {
+            return -1;
+        }
+        if (i->opcode == KIR_SETARG && i->r2.typestr != NULL) {
+            return -1;
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (rn[pos]->t == TK_FUNC || rn[pos]->has_dot3 || rn[pos]->level >= INLINE_MAX_LEVEL) {
+                return -1;
+            }
+        }
+        if (i->opcode == KIR_LABEL) {
+            ended = i->labelid == g->funcend;
+        } else if (i->opcode != KIR_SETARG && i->opcode != KIR_PURE) {
+            ++size;
+        }
+    }
+    return ended ? size : -1;
+}
+
+/*
+ * The level in the caller for the level in the callee, by walking up the function which made the closure.
+ * Returns -1 if the frame is not reachable from the caller.
+ */
+static int inline_level(inline_context *ic, kl_kir_func *caller, kl_kir_func *g, int level)
+{
+    kl_kir_func *target = inline_parent(ic, g);
+    for (int l = 1; target && l < level; ++l) {
+        target = inline_parent(ic, target);
+    }
+    if (!target) {
+        return -1;
+    }
+    int d = 0;
+    for (kl_kir_func *f = caller; f; f = inline_parent(ic, f)) {
+        if (f == target) {
+            return (d == 0 && caller->head->opcode != KIR_MKFRM) ? -1 : d;
+        }
+        ++d;
+    }
+    return -1;
+}
+
+static int inline_map_label(inline_context *ic, int labelid)
+{
+    if (labelid < 0 || ic->maxlabel <= labelid) {
+        return labelid;
+    }
+    if (ic->label[labelid] < 0) {
+        ic->label[labelid] = ic->ctx->labelid++;
+    }
+    return ic->label[labelid];
+}
+
+static void inline_map_opr(kl_kir_opr *rn, kl_kir_opr *ret, int base, int *levels)
+{
+    if (rn->t != TK_VAR) {
+        return;
+    }
+    if (rn->level == 0) {
+        if (rn->index < 0) {
+            *rn = *ret;
+        } else {
+            rn->index += base;
+        }
+    } else {
+        rn->level = levels[rn->level];
+    }
+}
+
+static kl_kir_inst *inline_new_inst(inline_context *ic, kl_kir_inst *src)
+{
+    kl_kir_program *p = ic->ctx->program;
+    kl_kir_inst *i = (kl_kir_inst *)calloc(1, sizeof(kl_kir_inst));
+    *i = *src;
+    i->chn = p->ichn;
+    p->ichn = i;
+    i->next = NULL;
+    return i;
+}
+
+/* Inserts the copy after the last instruction, and returns the new last one. */
+static kl_kir_inst *inline_copy(inline_context *ic, kl_kir_func *g, kl_kir_inst *last, kl_kir_inst *src, kl_kir_opr *ret, int base, int *levels, int endlabel)
+{
+    kl_kir_inst *i = inline_new_inst(ic, src);
+    i->next = last->next;
+    last->next = i;
+    if (i->labelid == g->funcend) {
+        i->labelid = endlabel;
+    } else if (i->labelid > 0) {
+        i->labelid = inline_map_label(ic, i->labelid);
+    }
+    if (i->catchid == 0 || i->catchid == g->funcend) {
+        i->catchid = endlabel;
+    } else {
+        i->catchid = inline_map_label(ic, i->catchid);
+    }
+    if (i->opcode == KIR_MOV && i->r1.t == TK_VAR && i->r1.index < 0 && i->r2.t == TK_VAR && i->r2.index < 0) {
+        /* Making undefined works only with the return value, which is copied to the destination after that. */
+        if (ret->t == TK_VAR && ret->index < 0) {
+            return i;
+        }
+        kl_kir_inst *n = inline_new_inst(ic, i);
+        n->r1 = *ret;
+        n->next = i->next;
+        i->next = n;
+        return n;
+    }
+    inline_map_opr(&(i->r1), ret, base, levels);
+    inline_map_opr(&(i->r2), ret, base, levels);
+    inline_map_opr(&(i->r3), ret, base, levels);
+    return i;
+}
+
+static kl_kir_inst *inline_find_setarg(kl_kir_func *g, int idx)
+{
+    for (kl_kir_inst *i = g->head; i; i = i->next) {
+        if (!i->disabled && i->opcode == KIR_SETARG && i->r2.i64 == idx) {
+            return i;
+        }
+    }
+    return NULL;
+}
+
+static inline int inline_is_callee(kl_kir_inst *i, int pos)
+{
+    return pos == 1 && (i->opcode == KIR_CALL || i->opcode == KIR_YIELDC);
+}
+
+/*
+ * Returns the closure held by the variable, which must be assigned once before any branch, and
+ * otherwise only called. The variable in the frame must be only called by any other function, too.
+ */
+static kl_kir_func *inline_closure(inline_context *ic, kl_kir_func *f, int index)
+{
+    kl_kir_inst *def = NULL;
+    int straight = 1;
+    for (kl_kir_inst *i = f->head->next; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (rn[pos]->t != TK_VAR || rn[pos]->level != 0 || rn[pos]->index != index || inline_is_callee(i, pos)) {
+                continue;
+            }
+            if (def || !straight || pos != 0 || i->opcode != KIR_MOV || i->r2.t != TK_FUNC) {
+                return NULL;
+            }
+            def = i;
+        }
+        if (!def && i->opcode != KIR_PURE && (i->opcode == KIR_LABEL || i->labelid > 0 || (i->catchid > 0 && i->catchid != f->funcend))) {
+            straight = 0;
+        }
+    }
+    if (!def || def->r2.funcid <= 0 || ic->maxid < def->r2.funcid) {
+        return NULL;
+    }
+    if (f->head->opcode == KIR_MKFRM && index < f->head->r2.i64) {
+        for (kl_kir_func *g = ic->ctx->program->head; g; g = g->next) {
+            for (kl_kir_inst *i = g->head; g != f && i; i = i->next) {
+                kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+                for (int pos = 0; pos < 3; ++pos) {
+                    if (rn[pos]->t == TK_VAR && rn[pos]->level > 0 && rn[pos]->index == index && !inline_is_callee(i, pos)) {
+                        return NULL;
+                    }
+                }
+            }
+        }
+    }
+    return ic->func[def->r2.funcid];
+}
+
+static kl_kir_func *inline_callee(inline_context *ic, kl_kir_func *f, kl_kir_inst *call)
+{
+    kl_kir_opr *r2 = &(call->r2);
+    if (r2->funcid > 0) {
+        return r2->funcid <= ic->maxid ? ic->func[r2->funcid] : NULL;
+    }
+    if (r2->t == TK_VAR && r2->level == 0 && r2->index >= 0) {
+        return inline_closure(ic, f, r2->index);
+    }
+    return NULL;
+}
+
+/* Returns 1 if the call has been replaced by the body of the callee. */
+static int inline_call(inline_context *ic, kl_kir_func *f, kl_kir_inst *call, kl_kir_func *g)
+{
+    if (!g || g == f || call->r2.has_dot3 || call->r2.args != g->argcount) {
+        return 0;
+    }
+    int size = inline_size(ic, g);
+    if (size < 0 || ic->limit < size) {
+        return 0;
+    }
+
+    /* The call must be followed by restoring the stack pointer and checking an exception. */
+    int cc = call->r2.callcnt;
+    kl_kir_inst *rs = call->next;
+    kl_kir_inst *chk = rs ? rs->next : NULL;
+    if (!rs || rs->opcode != KIR_RSSTKP || rs->r1.i64 != cc || !chk || chk->opcode != KIR_CHKEXCEPT) {
+        return 0;
+    }
+    kl_kir_inst *yc = chk->next && chk->next->opcode == KIR_YIELDC ? chk->next : NULL;
+
+    int levels[INLINE_MAX_LEVEL] = {0};
+    for (kl_kir_inst *i = g->head; i; i = i->next) {
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            int level = rn[pos]->level;
+            if (rn[pos]->t == TK_VAR && level > 0 && levels[level] == 0) {
+                levels[level] = inline_level(ic, f, g, level);
+                if (levels[level] < 0) {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    kl_kir_inst *sv = NULL;
+    int pushes = 0;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_SVSTKP && i->r1.i64 == cc) {
+            sv = i;
+        } else if (i->opcode == KIR_PUSHSYS && i->r1.callcnt == cc) {
+            return 0;
+        } else if (i->opcode == KIR_PUSHARG && i->r1.callcnt == cc) {
+            if (i->r1.has_dot3) {
+                return 0;
+            }
+            ++pushes;
+        }
+    }
+    if (!sv || pushes != g->argcount) {
+        return 0;
+    }
+
+    kl_kir_inst *head = f->head;
+    int base = (int)head->r1.i64;
+    head->r1.i64 += g->head->r1.i64;
+
+    /* The arguments are pushed from the last one. */
+    sv->disabled = 1;
+    int idx = pushes;
+    for (kl_kir_inst *i = sv->next; i && idx > 0; i = i->next) {
+        if (i->disabled || i->opcode != KIR_PUSHARG || i->r1.callcnt != cc) {
+            continue;
+        }
+        kl_kir_inst *sa = inline_find_setarg(g, --idx);
+        if (!sa) {
+            i->disabled = 1;
+            continue;
+        }
+        kl_kir_opr r2 = i->r1;
+        r2.callcnt = 0;
+        i->opcode = KIR_MOV;
+        i->r2 = r2;
+        /* The type of a pushed variable is not always trusted, and so the argument is any. */
+        i->r1 = (kl_kir_opr){
+            .t = TK_VAR,
+            .index = base + (int)sa->r1.i64,
+            .typeid = TK_TANY,
+        };
+    }
+
+    memset(ic->label, 0xff, ic->maxlabel * sizeof(int));
+    int endlabel = ic->ctx->labelid++;
+    kl_kir_inst *last = call;
+    for (kl_kir_inst *i = g->head->next; i; i = i->next) {
+        if (i->disabled || i->opcode == KIR_SETARG || i->opcode == KIR_PURE) {
+            continue;
+        }
+        if (i->opcode == KIR_RLOCAL || i->opcode == KIR_RET) {
+            break;
+        }
+        last = inline_copy(ic, g, last, i, &(call->r1), base, levels, endlabel);
+    }
+    call->disabled = 1;
+    rs->disabled = 1;
+    if (yc) {
+        yc->disabled = 1;
+    }
+    return 1;
+}
+
+static int inline_func(inline_context *ic, kl_kir_func *f)
+{
+    kl_kir_inst *head = f->head;
+    if (!head || (head->opcode != KIR_ALOCAL && head->opcode != KIR_MKFRM)) {
+        return 0;
+    }
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled && (i->opcode == KIR_YIELD || i->opcode == KIR_RESUME)) {
+            return 0;
+        }
+    }
+
+    int changed = 0;
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled && i->opcode == KIR_CALL) {
+            if (ic->maxlabel < ic->ctx->labelid) {
+                ic->maxlabel = ic->ctx->labelid;
+                ic->label = (int *)realloc(ic->label, ic->maxlabel * sizeof(int));
+            }
+            changed |= inline_call(ic, f, i, inline_callee(ic, f, i));
+        }
+    }
+    if (changed && !f->is_global) {
+        pass_renumber_yield(f);
+    }
+    return changed;
+}
+
+void inline_kir(kl_context *ctx)
+{
+    if (ctx->inline_limit <= 0) {
+        return;
+    }
+    inline_context ic = {
+        .ctx = ctx,
+        .limit = ctx->inline_limit,
+    };
+    inline_setup(&ic);
+    for (int round = 0; round < INLINE_MAX_ROUND; ++round) {
+        int changed = 0;
+        for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+            changed |= inline_func(&ic, f);
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    free(ic.label);
+    free(ic.parent);
+    free(ic.func);
+}
@@ -0,0 +1,322 @@
+#include "pass.h"
+
+/*
+ * Loop versioning for a counted loop over an array.
+ *  The loop like `for (var i = 0; i < a.size(); ++i) { ... a[i] ... }` calls the size method in every
+ *  iteration, and each `a[i]` checks the type of `a`, the index operator, and a negative index.
+ *  The loop is duplicated, and the fast version is used when KIR_CHKARY before the loop confirms
+ *  that `a` is an array with the builtin size method and no index operator, and `i` is a non-negative
+ *  integer. The fast version reads the size directly, and `a[i]` becomes KIR_IDXF which checks only
+ *  the upper bound because the body could still change the size of the array.
+ *  The original loop is used as it is when the check fails. The target loop must be
+ *      - `jmp Lc; Lb: <body>; Lc: <a.size() or a.length()>; lt t, i, n; jmpift t, Lb`,
+ *      - not in a try block, and without any catch clause in the body,
+ *  and `a` and `i` must be local variables not in a frame, which the body never writes except `++i`.
+ */
+
+#define LOOP_MAX_BODY   (128)
+
+typedef struct loop_context {
+    kl_context *ctx;
+    kl_kir_func *f;
+    int first;                  /* The first variable which is not in a frame. */
+    int maxlabel;
+    int *label;                 /* The new label id by the original label id. */
+} loop_context;
+
+typedef struct loop_info {
+    kl_kir_inst *entry;         /* jmp Lc */
+    kl_kir_inst *body;          /* Lb */
+    kl_kir_inst *cond;          /* Lc */
+    kl_kir_inst *cmp;           /* lt t, i, n */
+    kl_kir_inst *jmp;           /* jmpift t, Lb */
+    kl_kir_opr *ary;
+    kl_kir_opr *idx;
+    const char *name;           /* "size" or "length" */
+} loop_info;
+
+static kl_kir_inst *loop_new_inst(loop_context *lc, kl_kir_inst *src, kl_kir_inst *last)
+{
+    kl_kir_program *p = lc->ctx->program;
+    kl_kir_inst *i = (kl_kir_inst *)calloc(1, sizeof(kl_kir_inst));
+    *i = *src;
+    i->chn = p->ichn;
+    p->ichn = i;
+    i->next = last->next;
+    last->next = i;
+    return i;
+}
+
+static kl_kir_inst *loop_new_op(loop_context *lc, kl_kir_inst *src, kl_kir_inst *last, kl_kir op, int labelid)
+{
+    kl_kir_inst *i = loop_new_inst(lc, src, last);
+    i->opcode = op;
+    i->labelid = labelid;
+    i->gcable = 0;
+    memset(&(i->r1), 0, sizeof(kl_kir_opr));
+    memset(&(i->r2), 0, sizeof(kl_kir_opr));
+    memset(&(i->r3), 0, sizeof(kl_kir_opr));
+    return i;
+}
+
+static inline kl_kir_inst *loop_next(kl_kir_inst *i)
+{
+    for (i = i->next; i && i->disabled; i = i->next) {
+        ;
+    }
+    return i;
+}
+
+static inline int loop_is_local(loop_context *lc, kl_kir_opr *rn)
+{
+    return rn->t == TK_VAR && rn->level == 0 && lc->first <= rn->index && !rn->has_dot3;
+}
+
+static inline int loop_is_same(kl_kir_opr *r1, kl_kir_opr *r2)
+{
+    return r1->t == TK_VAR && r2->t == TK_VAR && r1->level == r2->level && r1->index == r2->index;
+}
+
+static inline int loop_in_try(kl_kir_func *f, kl_kir_inst *i)
+{
+    return i->catchid > 0 && i->catchid != f->funcend;
+}
+
+/* Returns the method name if the condition is `a.size()` or `a.length()` to the variable n. */
+static const char *loop_size_call(kl_kir_inst *i, kl_kir_inst *cmp, kl_kir_opr *n, kl_kir_opr **ary)
+{
+    if (i->opcode == KIR_ARYSIZE && loop_next(i) == cmp && loop_is_same(&(i->r1), n)) {
+        *ary = &(i->r2);
+        return "size";
+    }
+    /* savestkp, apply, pushsys, call, restorestkp, chkexcept, and yieldcheck if any. */
+    kl_kir_inst *ap = loop_next(i);
+    kl_kir_inst *ps = ap ? loop_next(ap) : NULL;
+    kl_kir_inst *call = ps ? loop_next(ps) : NULL;
+    kl_kir_inst *rs = call ? loop_next(call) : NULL;
+    kl_kir_inst *chk = rs ? loop_next(rs) : NULL;
+    kl_kir_inst *last = chk && loop_next(chk) && loop_next(chk)->opcode == KIR_YIELDC ? loop_next(chk) : chk;
+    if (i->opcode != KIR_SVSTKP || !last || loop_next(last) != cmp) {
+        return NULL;
+    }
+    int cc = (int)i->r1.i64;
+    if (ap->opcode != KIR_APLY || ap->r3.t != TK_VSTR ||
+            (strcmp(ap->r3.str, "size") != 0 && strcmp(ap->r3.str, "length") != 0)) {
+        return NULL;
+    }
+    if (ps->opcode != KIR_PUSHSYS || ps->r1.callcnt != cc || !loop_is_same(&(ps->r1), &(ap->r2))) {
+        return NULL;
+    }
+    if (call->opcode != KIR_CALL || call->r2.callcnt != cc || call->r2.args != 0 || call->r2.has_dot3 ||
+            !loop_is_same(&(call->r2), &(ap->r1)) || !loop_is_same(&(call->r1), n)) {
+        return NULL;
+    }
+    if (rs->opcode != KIR_RSSTKP || rs->r1.i64 != cc || chk->opcode != KIR_CHKEXCEPT) {
+        return NULL;
+    }
+    *ary = &(ap->r2);
+    return ap->r3.str;
+}
+
+/* Returns 1 if the instruction in the body could change the variable other than incrementing it. */
+static int loop_writes(kl_kir_inst *i, kl_kir_opr *rn, int inc)
+{
+    switch (i->opcode) {
+    case KIR_INC: case KIR_INCP:
+        if (loop_is_same(&(i->r2), rn)) {
+            return !inc;
+        }
+        break;
+    case KIR_DEC: case KIR_DECP: case KIR_SWAP: case KIR_SWAPA:
+        if (loop_is_same(&(i->r2), rn)) {
+            return 1;
+        }
+        break;
+    case KIR_PUSHARG: case KIR_PUSHSYS: case KIR_JMPIFT: case KIR_JMPIFF:
+        return 0;
+    default:
+        break;
+    }
+    return loop_is_same(&(i->r1), rn);
+}
+
+static int loop_find(loop_context *lc, kl_kir_inst *jmp, loop_info *li)
+{
+    kl_kir_func *f = lc->f;
+    if (jmp->opcode != KIR_JMPIFT || loop_in_try(f, jmp) || lc->maxlabel <= jmp->labelid) {
+        return 0;
+    }
+
+    /* jmp Lc; Lb: <body>; Lc: <cond>; lt t, i, n; jmpift t, Lb */
+    kl_kir_inst *prev = NULL, *entry = NULL, *body = NULL, *cond = NULL, *cmp = NULL;
+    for (kl_kir_inst *i = f->head; i && i != jmp; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_LABEL && i->labelid == jmp->labelid) {
+            entry = prev;
+            body = i;
+            cond = NULL;
+        } else if (i->opcode == KIR_LABEL) {
+            cond = i;
+        }
+        prev = cmp = i;
+    }
+    if (!body || !entry || !cond || entry->opcode != KIR_JMP || entry->labelid != cond->labelid) {
+        return 0;
+    }
+    if (cmp->opcode != KIR_LT || !loop_is_same(&(cmp->r1), &(jmp->r1))) {
+        return 0;
+    }
+    li->name = loop_size_call(loop_next(cond), cmp, &(cmp->r3), &(li->ary));
+    if (!li->name || !loop_is_local(lc, li->ary) || !loop_is_local(lc, &(cmp->r2))) {
+        return 0;
+    }
+    li->entry = entry;
+    li->body = body;
+    li->cond = cond;
+    li->cmp = cmp;
+    li->jmp = jmp;
+    li->idx = &(cmp->r2);
+
+    int count = 0;
+    for (kl_kir_inst *i = loop_next(body); i && i != cond; i = loop_next(i)) {
+        if (++count > LOOP_MAX_BODY || i->opcode == KIR_CATCH || loop_in_try(f, i)) {
+            return 0;
+        }
+        if (loop_writes(i, li->ary, 0) || loop_writes(i, li->idx, 1)) {
+            return 0;
+        }
+        if (i->opcode == KIR_LABEL && lc->maxlabel <= i->labelid) {
+            /* This loop has an inner loop which has been already duplicated. */
+            return 0;
+        }
+    }
+    return count > 0;
+}
+
+/* The call count number identifies the variables to save the stack, and so each copy has its own one. */
+static int loop_next_callcnt(kl_kir_func *f)
+{
+    int callcnt = 0;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (!i->disabled && i->opcode == KIR_SVSTKP && callcnt <= i->r1.i64) {
+            callcnt = (int)i->r1.i64 + 1;
+        }
+    }
+    return callcnt;
+}
+
+static void loop_map_callcnt(kl_kir_inst *i, int offset)
+{
+    switch (i->opcode) {
+    case KIR_SVSTKP: case KIR_RSSTKP:
+        i->r1.i64 += offset;
+        break;
+    case KIR_PUSHARG: case KIR_PUSHSYS:
+        i->r1.callcnt += offset;
+        break;
+    case KIR_CALL:
+        i->r2.callcnt += offset;
+        break;
+    default:
+        break;
+    }
+}
+
+static int loop_map_label(loop_context *lc, int labelid)
+{
+    if (0 < labelid && labelid < lc->maxlabel && lc->label[labelid] > 0) {
+        return lc->label[labelid];
+    }
+    return labelid;
+}
+
+/* The original jump to the condition becomes the check, and the fast version is placed after it. */
+static void loop_version(loop_context *lc, loop_info *li)
+{
+    memset(lc->label, 0, lc->maxlabel * sizeof(int));
+    for (kl_kir_inst *i = li->body; i != li->jmp; i = loop_next(i)) {
+        if (i->opcode == KIR_LABEL) {
+            lc->label[i->labelid] = lc->ctx->labelid++;
+        }
+    }
+
+    /* The exit of the loop is shared by both versions. */
+    kl_kir_inst *exit = loop_next(li->jmp);
+    if (!exit || exit->opcode != KIR_LABEL) {
+        exit = loop_new_op(lc, li->jmp, li->jmp, KIR_LABEL, lc->ctx->labelid++);
+    }
+    int generic = lc->ctx->labelid++;
+
+    int offset = loop_next_callcnt(lc->f);
+    kl_kir_inst *entry = li->entry;
+    kl_kir_inst *last = loop_new_op(lc, entry, entry, KIR_JMP, loop_map_label(lc, li->cond->labelid));
+    for (kl_kir_inst *i = li->body; i != li->cond; i = loop_next(i)) {
+        last = loop_new_inst(lc, i, last);
+        last->labelid = loop_map_label(lc, i->labelid);
+        loop_map_callcnt(last, offset);
+        if (last->opcode == KIR_IDX && loop_is_same(&(last->r2), li->ary) && loop_is_same(&(last->r3), li->idx)) {
+            last->opcode = KIR_IDXF;
+        }
+    }
+    last = loop_new_inst(lc, li->cond, last);
+    last->labelid = loop_map_label(lc, li->cond->labelid);
+    last = loop_new_op(lc, li->cmp, last, KIR_ARYSIZE, 0);
+    last->r1 = li->cmp->r3;
+    last->r2 = *(li->ary);
+    last = loop_new_inst(lc, li->cmp, last);
+    last = loop_new_inst(lc, li->jmp, last);
+    last->labelid = loop_map_label(lc, li->jmp->labelid);
+    last = loop_new_op(lc, li->jmp, last, KIR_JMP, exit->labelid);
+    last = loop_new_op(lc, entry, last, KIR_LABEL, generic);
+    last = loop_new_op(lc, entry, last, KIR_JMP, entry->labelid);
+
+    entry->opcode = KIR_CHKARY;
+    entry->labelid = generic;
+    entry->r1 = *(li->ary);
+    entry->r2 = *(li->idx);
+    entry->r3 = (kl_kir_opr){ .t = TK_VSTR, .str = li->name };
+}
+
+static void loop_func(loop_context *lc)
+{
+    kl_kir_func *f = lc->f;
+    kl_kir_inst *head = f->head;
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled && (i->opcode == KIR_YIELD || i->opcode == KIR_RESUME)) {
+            return;
+        }
+    }
+
+    int changed = 0;
+    lc->maxlabel = lc->ctx->labelid;
+    lc->label = (int *)calloc(lc->maxlabel + 1, sizeof(int));
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        loop_info li = {0};
+        if (!i->disabled && loop_find(lc, i, &li)) {
+            loop_version(lc, &li);
+            changed = 1;
+        }
+    }
+    free(lc->label);
+    if (changed && !f->is_global) {
+        pass_renumber_yield(f);
+    }
+}
+
+void loop_kir(kl_context *ctx)
+{
+    for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+        kl_kir_inst *head = f->head;
+        if (!head || (head->opcode != KIR_ALOCAL && head->opcode != KIR_MKFRM)) {
+            continue;
+        }
+        loop_context lc = {
+            .ctx = ctx,
+            .f = f,
+            .first = head->opcode == KIR_MKFRM ? (int)head->r2.i64 : 0,
+        };
+        loop_func(&lc);
+    }
+}
@@ -0,0 +1,861 @@
+#include "pass.h"
+#include "type.h"
+#include <math.h>
+
+/*
+ * KIR optimization passes.
+ *  These passes run between make_kir and translate for each function, and the instruction removed is
+ *  unlinked from the list of the function. The level is selected by -O<n>.
+ *      -O0     No optimization.
+ *      -O1     Self tail call elimination, inlining a small leaf function, constant folding, jump
+ *              threading, removing unreachable code and unused labels, and a frame on the stack by
+ *              the escape analysis.
+ *      -O2     In addition to -O1, versioning a counted loop over an array, copy propagation, dead
+ *              store elimination, adding to a variable in place, compacting temporary variables, and
+ *              unboxed local variables.
+ *  A variable in a frame is never a target because it could be touched by a closure. A function
+ *  with yield is not a target either, because its variables are saved and restored by the resume hook.
+ *  Only adding to a variable in place and removing the store to (*r) not used are done for it.
+ */
+
+#define PASS_EFF_R1     (0x01)
+#define PASS_EFF_R2     (0x02)
+#define PASS_EFF_R3     (0x04)
+
+#define PASS_LIT_INT    (0x01)
+#define PASS_LIT_DBL    (0x02)
+#define PASS_LIT_BOOL   (0x04)
+#define PASS_LIT_VAR    (0x08)  /* A local variable. */
+#define PASS_LIT_NUM    (PASS_LIT_INT | PASS_LIT_DBL)
+#define PASS_LIT_ANY    (PASS_LIT_INT | PASS_LIT_DBL | PASS_LIT_BOOL)
+
+#define PASS_INT_FOLD_LIMIT (((int64_t)1) << 31)
+
+typedef struct pass_context {
+    kl_context *ctx;
+    kl_kir_func *f;
+    int insts;
+    kl_kir_inst **inst;
+    int vars;
+    int first;                  /* The first variable which is not in a frame. */
+    int maxlabel;
+    int *label;                 /* The index of the label instruction by its label id. */
+    int *refs;                  /* The reference count of the label by its label id. */
+} pass_context;
+
+static void pass_remove_disabled(kl_kir_func *f)
+{
+    kl_kir_inst *prev = NULL;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->disabled) {
+            if (prev) {
+                prev->next = i->next;
+            } else {
+                f->head = i->next;
+            }
+        } else {
+            prev = i;
+        }
+    }
+    f->last = prev;
+}
+
+static void pass_cleanup(pass_context *pc)
+{
+    free(pc->inst);
+    free(pc->label);
+    free(pc->refs);
+    pc->inst = NULL;
+    pc->label = NULL;
+    pc->refs = NULL;
+}
+
+static void pass_ref_label(pass_context *pc, int labelid)
+{
+    if (0 <= labelid && labelid <= pc->maxlabel) {
+        pc->refs[labelid]++;
+    }
+}
+
+/* The instruction list is made again after disabled instructions are removed. */
+static void pass_setup(pass_context *pc)
+{
+    pass_cleanup(pc);
+    kl_kir_func *f = pc->f;
+    pass_remove_disabled(f);
+    pc->insts = 0;
+    pc->maxlabel = f->funcend;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        ++(pc->insts);
+        if (pc->maxlabel < i->labelid) {
+            pc->maxlabel = i->labelid;
+        }
+        if (pc->maxlabel < i->catchid) {
+            pc->maxlabel = i->catchid;
+        }
+    }
+    pc->inst = (kl_kir_inst **)calloc(pc->insts + 1, sizeof(kl_kir_inst *));
+    pc->label = (int *)calloc(pc->maxlabel + 1, sizeof(int));
+    pc->refs = (int *)calloc(pc->maxlabel + 1, sizeof(int));
+    for (int l = 0; l <= pc->maxlabel; ++l) {
+        pc->label[l] = -1;
+    }
+    pass_ref_label(pc, f->funcend);
+    int idx = 0;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        pc->inst[idx] = i;
+        if (i->opcode == KIR_LABEL) {
+            if (0 <= i->labelid && i->labelid <= pc->maxlabel) {
+                pc->label[i->labelid] = idx;
+            }
+        } else {
+            pass_ref_label(pc, i->labelid);
+        }
+        if (i->catchid > 0) {
+            pass_ref_label(pc, i->catchid);
+        }
+        ++idx;
+    }
+}
+
+static inline int pass_is_local(pass_context *pc, kl_kir_opr *rn)
+{
+    return rn->t == TK_VAR && rn->level == 0 && pc->first <= rn->index && rn->index < pc->vars && !rn->has_dot3;
+}
+
+static inline int pass_is_var(pass_context *pc, kl_kir_opr *rn)
+{
+    return rn->t == TK_VAR && rn->level == 0 && 0 <= rn->index && rn->index < pc->vars;
+}
+
+/* The return value (*r) has the slot after all variables in the liveness. */
+static inline int pass_live_index(pass_context *pc, kl_kir_opr *rn)
+{
+    if (pass_is_var(pc, rn)) {
+        return rn->index;
+    }
+    if (rn->t == TK_VAR && rn->level == 0 && rn->index == -1) {
+        return pc->vars;
+    }
+    return -1;
+}
+
+static inline int pass_is_same_var(kl_kir_opr *r1, kl_kir_opr *r2)
+{
+    return r1->t == TK_VAR && r2->t == TK_VAR && r1->index == r2->index && r1->level == r2->level;
+}
+
+static inline int pass_is_op3(kl_kir op)
+{
+    switch (op) {
+    case KIR_ADD: case KIR_SUB: case KIR_MUL: case KIR_DIV: case KIR_MOD: case KIR_POW:
+    case KIR_BSHL: case KIR_BSHR: case KIR_BAND: case KIR_BOR: case KIR_BXOR:
+    case KIR_EQEQ: case KIR_NEQ: case KIR_LT: case KIR_LE: case KIR_GT: case KIR_GE: case KIR_LGE:
+        return 1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/*
+ * Returns 1 if the effect of the instruction is known, and then the operands read are set to *uses,
+ * and the operands written are set to *defs. The instruction not known is regarded as reading all variables.
+ */
+static int pass_effect(kl_kir_inst *i, int *uses, int *defs)
+{
+    *uses = 0;
+    *defs = 0;
+    if (pass_is_op3(i->opcode)) {
+        *uses = PASS_EFF_R2 | PASS_EFF_R3;
+        *defs = PASS_EFF_R1;
+        return 1;
+    }
+    switch (i->opcode) {
+    case KIR_NOP:
+    case KIR_LABEL:
+    case KIR_JMP:
+    case KIR_RET:
+    case KIR_RLOCAL:
+    case KIR_POPFRM:
+    case KIR_SVSTKP:
+    case KIR_RSSTKP:
+    case KIR_CHKEXCEPT:
+        return 1;
+    case KIR_MOV:
+    case KIR_NOT:
+    case KIR_MINUS:
+    case KIR_BNOT:
+        *uses = PASS_EFF_R2;
+        *defs = PASS_EFF_R1;
+        return 1;
+    case KIR_INC:
+    case KIR_INCP:
+    case KIR_DEC:
+    case KIR_DECP:
+        *uses = PASS_EFF_R2;
+        *defs = (i->r1.prevent ? 0 : PASS_EFF_R1) | PASS_EFF_R2;
+        return 1;
+    case KIR_JMPIFT:
+    case KIR_JMPIFF:
+    case KIR_PUSHARG:
+    case KIR_PUSHSYS:
+        *uses = PASS_EFF_R1;
+        return 1;
+    case KIR_CALL:
+        *uses = PASS_EFF_R2;
+        *defs = PASS_EFF_R1;
+        return 1;
+    case KIR_IDX:
+    case KIR_IDXF:
+    case KIR_APLY:
+        *uses = PASS_EFF_R2 | PASS_EFF_R3;
+        *defs = PASS_EFF_R1;
+        return 1;
+    case KIR_ARYSIZE:
+        *uses = PASS_EFF_R2;
+        *defs = PASS_EFF_R1;
+        return 1;
+    case KIR_CHKARY:
+        *uses = PASS_EFF_R1 | PASS_EFF_R2;
+        return 1;
+    default:
+        break;
+    }
+    return 0;
+}
+
+/* Returns 1 if the value of the operand is a numeric literal, which is directly or via the known copy. */
+static kl_kir_opr *pass_const(pass_context *pc, kl_kir_opr **known, kl_kir_opr *rn)
+{
+    if (rn->t == TK_VSINT || rn->t == TK_VDBL) {
+        return rn;
+    }
+    if (pass_is_local(pc, rn) && known[rn->index]) {
+        kl_kir_opr *k = known[rn->index];
+        if (k->t == TK_VSINT || k->t == TK_VDBL) {
+            return k;
+        }
+    }
+    return NULL;
+}
+
+static inline double pass_dbl(kl_kir_opr *rn)
+{
+    return rn->t == TK_VDBL ? strtod(rn->dbl, NULL) : (double)rn->i64;
+}
+
+static void pass_set_mov(kl_kir_inst *i, kl_kir_opr *r2)
+{
+    i->opcode = KIR_MOV;
+    i->r2 = *r2;
+    memset(&(i->r3), 0, sizeof(kl_kir_opr));
+}
+
+/* Returns 1 if the instruction has been folded to KIR_MOV with a literal. */
+static int pass_fold(pass_context *pc, kl_kir_opr **known, kl_kir_inst *i)
+{
+    kl_kir_opr *c2 = pass_const(pc, known, &(i->r2));
+    kl_kir_opr *c3 = pass_const(pc, known, &(i->r3));
+    if (!c2 || !c3) {
+        return 0;
+    }
+
+    kl_kir_opr lit = {0};
+    if (c2->t == TK_VSINT && c3->t == TK_VSINT) {
+        int64_t i2 = c2->i64;
+        int64_t i3 = c3->i64;
+        if (i2 < -PASS_INT_FOLD_LIMIT || PASS_INT_FOLD_LIMIT < i2 || i3 < -PASS_INT_FOLD_LIMIT || PASS_INT_FOLD_LIMIT < i3) {
+            return 0;
+        }
+        lit.t = TK_VSINT;
+        lit.typeid = TK_TSINT64;
+        switch (i->opcode) {
+        case KIR_ADD: lit.i64 = i2 + i3; break;
+        case KIR_SUB: lit.i64 = i2 - i3; break;
+        case KIR_MUL: lit.i64 = i2 * i3; break;
+        default:
+            lit.t = TK_VBOOL;
+            lit.typeid = TK_TBOOL;
+            switch (i->opcode) {
+            case KIR_EQEQ: lit.i64 = i2 == i3; break;
+            case KIR_NEQ:  lit.i64 = i2 != i3; break;
+            case KIR_LT:   lit.i64 = i2 <  i3; break;
+            case KIR_LE:   lit.i64 = i2 <= i3; break;
+            case KIR_GT:   lit.i64 = i2 >  i3; break;
+            case KIR_GE:   lit.i64 = i2 >= i3; break;
+            default:
+                return 0;
+            }
+            break;
+        }
+    } else {
+        /* A comparison of real numbers is not folded because it has the tolerance by DBL_EPSILON. */
+        double d2 = pass_dbl(c2);
+        double d3 = pass_dbl(c3);
+        double d;
+        switch (i->opcode) {
+        case KIR_ADD: d = d2 + d3; break;
+        case KIR_SUB: d = d2 - d3; break;
+        case KIR_MUL: d = d2 * d3; break;
+        default:
+            return 0;
+        }
+        if (!isfinite(d)) {
+            return 0;
+        }
+        char buf[64] = {0};
+        snprintf(buf, 60, "%.17g", d);
+        if (!strpbrk(buf, ".e")) {
+            strcat(buf, ".0");
+        }
+        lit.t = TK_VDBL;
+        lit.typeid = TK_TDBL;
+        lit.dbl = const_str(pc->ctx, buf);
+    }
+    pass_set_mov(i, &lit);
+    return 1;
+}
+
+/* Replaces the operand by the known value, with keeping the type information at this place. */
+static void pass_replace(pass_context *pc, kl_kir_opr **known, kl_kir_opr *rn, int allowed)
+{
+    if (!pass_is_local(pc, rn) || !known[rn->index]) {
+        return;
+    }
+    kl_kir_opr *k = known[rn->index];
+    switch (k->t) {
+    case TK_VAR:
+        if (!(allowed & PASS_LIT_VAR)) return;
+        break;
+    case TK_VSINT:
+        if (!(allowed & PASS_LIT_INT)) return;
+        break;
+    case TK_VDBL:
+        if (!(allowed & PASS_LIT_DBL)) return;
+        break;
+    case TK_VBOOL:
+        if (!(allowed & PASS_LIT_BOOL)) return;
+        break;
+    default:
+        return;
+    }
+    tk_typeid typeid = rn->typeid;
+    const char *typestr = rn->typestr;
+    *rn = *k;
+    rn->typeid = typeid;
+    rn->typestr = typestr;
+}
+
+static void pass_kill(pass_context *pc, kl_kir_opr **known, kl_kir_opr *rn)
+{
+    if (!pass_is_var(pc, rn)) {
+        return;
+    }
+    known[rn->index] = NULL;
+    for (int k = 0; k < pc->vars; ++k) {
+        if (known[k] && known[k]->t == TK_VAR && known[k]->index == rn->index) {
+            known[k] = NULL;
+        }
+    }
+}
+
+/*
+ * Constant folding and copy propagation in a basic block.
+ *  The known value is a literal or a local variable copied by KIR_MOV, and it's forgotten at a label
+ *  or by the instruction which effect is not known.
+ */
+static int pass_propagate(pass_context *pc, int copy)
+{
+    int changed = 0;
+    kl_kir_opr **known = (kl_kir_opr **)calloc(pc->vars + 1, sizeof(kl_kir_opr *));
+    int var = copy ? PASS_LIT_VAR : 0;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        int uses, defs;
+        if (!pass_effect(i, &uses, &defs) || i->opcode == KIR_LABEL) {
+            memset(known, 0, sizeof(kl_kir_opr *) * pc->vars);
+            continue;
+        }
+
+        if (copy) {
+            if (pass_is_op3(i->opcode)) {
+                pass_replace(pc, known, &(i->r2), PASS_LIT_NUM | var);
+                pass_replace(pc, known, &(i->r3), PASS_LIT_NUM | var);
+            } else if (i->opcode == KIR_MOV) {
+                pass_replace(pc, known, &(i->r2), PASS_LIT_ANY | var);
+            } else if (i->opcode == KIR_PUSHARG) {
+                pass_replace(pc, known, &(i->r1), PASS_LIT_ANY | var);
+            }
+        }
+        if (i->opcode == KIR_JMPIFT || i->opcode == KIR_JMPIFF) {
+            pass_replace(pc, known, &(i->r1), PASS_LIT_INT | PASS_LIT_BOOL | var);
+        }
+        if (pass_is_op3(i->opcode) && pass_fold(pc, known, i)) {
+            changed = 1;
+        }
+        if ((i->opcode == KIR_JMPIFT || i->opcode == KIR_JMPIFF) && (i->r1.t == TK_VSINT || i->r1.t == TK_VBOOL)) {
+            if ((i->r1.i64 != 0) == (i->opcode == KIR_JMPIFT)) {
+                i->opcode = KIR_JMP;
+                memset(&(i->r1), 0, sizeof(kl_kir_opr));
+            } else {
+                i->disabled = 1;
+            }
+            changed = 1;
+            continue;
+        }
+
+        if (defs & PASS_EFF_R1) {
+            pass_kill(pc, known, &(i->r1));
+        }
+        if (defs & PASS_EFF_R2) {
+            pass_kill(pc, known, &(i->r2));
+        }
+        if (i->opcode == KIR_MOV && pass_is_local(pc, &(i->r1))) {
+            kl_kir_opr *r2 = &(i->r2);
+            if (r2->t == TK_VSINT || r2->t == TK_VDBL || r2->t == TK_VBOOL ||
+                    (copy && pass_is_local(pc, r2) && r2->index != i->r1.index)) {
+                known[i->r1.index] = r2;
+            }
+        }
+    }
+    free(known);
+    return changed;
+}
+
+/* Returns the index of the instruction which is the actual destination of jumping to the label. */
+static int pass_thread_target(pass_context *pc, int labelid)
+{
+    for (int count = 0; count < pc->insts; ++count) {
+        if (labelid < 0 || pc->maxlabel < labelid || pc->label[labelid] < 0) {
+            break;
+        }
+        int idx = pc->label[labelid];
+        while (idx < pc->insts && pc->inst[idx]->opcode == KIR_LABEL) {
+            if (pc->inst[idx]->gcable) {
+                /* Jumping over the label for GC check could make a loop without GC. */
+                return labelid;
+            }
+            ++idx;
+        }
+        if (idx >= pc->insts || pc->inst[idx]->opcode != KIR_JMP || pc->inst[idx]->labelid == labelid) {
+            break;
+        }
+        labelid = pc->inst[idx]->labelid;
+    }
+    return labelid;
+}
+
+/* Jump threading, and removing a jump to the next. */
+static int pass_jump(pass_context *pc)
+{
+    int changed = 0;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        if (i->disabled || (i->opcode != KIR_JMP && i->opcode != KIR_JMPIFT && i->opcode != KIR_JMPIFF)) {
+            continue;
+        }
+        int labelid = pass_thread_target(pc, i->labelid);
+        if (labelid != i->labelid) {
+            i->labelid = labelid;
+            changed = 1;
+        }
+        int next = idx + 1;
+        while (next < pc->insts && pc->inst[next]->opcode == KIR_LABEL) {
+            if (pc->inst[next]->labelid == i->labelid) {
+                i->disabled = 1;
+                changed = 1;
+                break;
+            }
+            ++next;
+        }
+    }
+    return changed;
+}
+
+static inline int pass_is_removable(kl_kir_inst *i)
+{
+    int uses, defs;
+    switch (i->opcode) {
+    case KIR_SVSTKP:    /* This has a declaration. */
+    case KIR_RET:
+    case KIR_RLOCAL:
+    case KIR_POPFRM:
+        return 0;
+    case KIR_MOV:
+        return i->r2.t != TK_FUNC;  /* This has a declaration. */
+    default:
+        break;
+    }
+    return pass_effect(i, &uses, &defs);
+}
+
+/* Removing unreachable code after an unconditional jump, and labels not referenced. */
+static int pass_unreachable(pass_context *pc)
+{
+    int changed = 0;
+    int reachable = 1;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        if (i->disabled) {
+            continue;
+        }
+        switch (i->opcode) {
+        case KIR_LABEL:
+            if (i->labelid >= 0 && i->labelid <= pc->maxlabel && pc->refs[i->labelid] > 0) {
+                reachable = 1;
+            } else {
+                i->disabled = 1;
+                changed = 1;
+            }
+            continue;
+        case KIR_CASEI:
+        case KIR_DEFAULT:
+        case KIR_SWITCHE:
+            reachable = 1;
+            continue;
+        default:
+            break;
+        }
+        if (!reachable) {
+            if (pass_is_removable(i)) {
+                i->disabled = 1;
+                changed = 1;
+            }
+            continue;
+        }
+        switch (i->opcode) {
+        case KIR_JMP:
+        case KIR_RET:
+        case KIR_THROW:
+        case KIR_THROWE:
+        case KIR_THROWX:
+            reachable = 0;
+            break;
+        default:
+            break;
+        }
+    }
+    return changed;
+}
+
+/*
+ * Dead store elimination by the liveness of variables.
+ *  An exception from the instruction in a try block goes to its catch label, and the instruction
+ *  of which the effect is not known is regarded as reading all variables. The return value (*r) is
+ *  read by KIR_RET, and only it is a target when retonly is 1.
+ */
+static int pass_add_succ(pass_context *pc, int *succ, int n, int labelid)
+{
+    if (0 <= labelid && labelid <= pc->maxlabel) {
+        if (pc->label[labelid] < 0) {
+            return -1;
+        }
+        succ[n++] = pc->label[labelid];
+    }
+    return n;
+}
+
+static int pass_dead_store(pass_context *pc, int retonly)
+{
+    int words = (pc->vars + 1 + 63) / 64;
+    int cases = 0;
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir op = pc->inst[idx]->opcode;
+        if (op == KIR_CASEI || op == KIR_DEFAULT) {
+            ++cases;
+        }
+    }
+
+    int changed = 0;
+    int *succ = (int *)calloc(cases + 4, sizeof(int));
+    uint64_t *in = (uint64_t *)calloc((size_t)pc->insts * words, sizeof(uint64_t));
+    uint64_t *use = (uint64_t *)calloc((size_t)pc->insts * words, sizeof(uint64_t));
+    uint64_t *def = (uint64_t *)calloc((size_t)pc->insts * words, sizeof(uint64_t));
+    uint64_t *out = (uint64_t *)calloc(words, sizeof(uint64_t));
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        uint64_t *u = use + (size_t)idx * words;
+        uint64_t *d = def + (size_t)idx * words;
+        int uses, defs;
+        if (!pass_effect(i, &uses, &defs)) {
+            for (int w = 0; w < words; ++w) {
+                u[w] = ~(uint64_t)0;
+            }
+            continue;
+        }
+        if (i->opcode == KIR_RET) {
+            u[pc->vars / 64] |= (uint64_t)1 << (pc->vars % 64);
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            int k = pass_live_index(pc, rn[pos]);
+            if (k < 0) {
+                continue;
+            }
+            if (uses & (1 << pos)) {
+                u[k / 64] |= (uint64_t)1 << (k % 64);
+            } else if (defs & (1 << pos)) {
+                d[k / 64] |= (uint64_t)1 << (k % 64);
+            }
+        }
+    }
+
+    int fend = pc->label[pc->f->funcend];
+    int failed = 0;
+    int updated = 1;
+    while (updated && !failed) {
+        updated = 0;
+        for (int idx = pc->insts - 1; idx >= 0; --idx) {
+            kl_kir_inst *i = pc->inst[idx];
+            int n = 0;
+            switch (i->opcode) {
+            case KIR_JMP: case KIR_RET: case KIR_THROW: case KIR_THROWE: case KIR_THROWX:
+                break;
+            default:
+                if (idx + 1 < pc->insts) {
+                    succ[n++] = idx + 1;
+                }
+                break;
+            }
+            /* The successors from xs are by an exception, which doesn't use (*r) at the end of the function. */
+            int xs = -1;
+            switch (i->opcode) {
+            case KIR_CHKEXCEPT: case KIR_THROW: case KIR_THROWE: case KIR_THROWX:
+                xs = n;
+                /* fall through */
+            case KIR_JMP: case KIR_JMPIFT: case KIR_JMPIFF: case KIR_JMPIFNE:
+            case KIR_CHKMATCHX: case KIR_CHKRANGEX: case KIR_CASEV: case KIR_CHKARY: case KIR_SWITCHS:
+                n = pass_add_succ(pc, succ, n, i->labelid);
+                break;
+            default:
+                break;
+            }
+            if (xs < 0) {
+                xs = n;
+            }
+            if (n >= 0 && i->catchid > 0) {
+                n = pass_add_succ(pc, succ, n, i->catchid);
+            }
+            if (n < 0) {
+                failed = 1;
+                break;
+            }
+            memset(out, 0, sizeof(uint64_t) * words);
+            for (int s = 0; s < n; ++s) {
+                uint64_t *si = in + (size_t)succ[s] * words;
+                int thrown = s >= xs && succ[s] == fend;
+                for (int w = 0; w < words; ++w) {
+                    out[w] |= (thrown && w == pc->vars / 64) ? (si[w] & ~((uint64_t)1 << (pc->vars % 64))) : si[w];
+                }
+            }
+            if (i->opcode == KIR_SWITCHS) {
+                for (int c = 0; c < pc->insts; ++c) {
+                    if (pc->inst[c]->opcode == KIR_CASEI || pc->inst[c]->opcode == KIR_DEFAULT) {
+                        uint64_t *si = in + (size_t)c * words;
+                        for (int w = 0; w < words; ++w) {
+                            out[w] |= si[w];
+                        }
+                    }
+                }
+            }
+            uint64_t *ii = in + (size_t)idx * words;
+            uint64_t *u = use + (size_t)idx * words;
+            uint64_t *d = def + (size_t)idx * words;
+            for (int w = 0; w < words; ++w) {
+                uint64_t v = u[w] | (out[w] & ~d[w]);
+                if (v != ii[w]) {
+                    ii[w] = v;
+                    updated = 1;
+                }
+            }
+        }
+    }
+
+    if (!failed) {
+        for (int idx = 0; idx < pc->insts; ++idx) {
+            kl_kir_inst *i = pc->inst[idx];
+            if (i->opcode != KIR_MOV || i->r2.t == TK_FUNC) {
+                continue;
+            }
+            int k = pass_live_index(pc, &(i->r1));
+            if (k < 0 || (k < pc->vars && (retonly || !pass_is_local(pc, &(i->r1))))) {
+                continue;
+            }
+            /* KIR_MOV always falls through to the next instruction, and it doesn't throw. */
+            uint64_t live = 0;
+            if (idx + 1 < pc->insts) {
+                live = in[(size_t)(idx + 1) * words + k / 64] & ((uint64_t)1 << (k % 64));
+            }
+            if (i->catchid > 0 && i->catchid <= pc->maxlabel && pc->label[i->catchid] >= 0 &&
+                    (k < pc->vars || pc->label[i->catchid] != fend)) {
+                live |= in[(size_t)pc->label[i->catchid] * words + k / 64] & ((uint64_t)1 << (k % 64));
+            }
+            if (!live) {
+                i->disabled = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    free(out);
+    free(def);
+    free(use);
+    free(in);
+    free(succ);
+    return changed;
+}
+
+/*
+ * `v += x` is made as `add t, v, x; mov v, t`, and it is changed to `add v, v, x; mov t, v`. Then the string
+ * of v is appended in place by the runtime, and the copy to t is removed by the dead store elimination
+ * when it's not used, like (*r) of an expression statement.
+ */
+static void pass_add_in_place(pass_context *pc)
+{
+    for (int idx = 0; idx + 1 < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        kl_kir_inst *n = pc->inst[idx + 1];
+        if (i->opcode != KIR_ADD || n->opcode != KIR_MOV) {
+            continue;
+        }
+        if (pass_live_index(pc, &(i->r1)) < 0 || !pass_is_var(pc, &(i->r2)) || i->r2.has_dot3 ||
+                pass_is_same_var(&(i->r1), &(i->r2))) {
+            continue;
+        }
+        if (!pass_is_same_var(&(n->r1), &(i->r2)) || !pass_is_same_var(&(n->r2), &(i->r1))) {
+            continue;
+        }
+        kl_kir_opr t = i->r1;
+        i->r1 = i->r2;
+        n->r1 = t;
+        n->r2 = i->r2;
+    }
+}
+
+/* Temporary variables not used anymore are removed, and the rest are renumbered to shrink the local area. */
+static void pass_compact_vars(pass_context *pc)
+{
+    kl_kir_inst *head = pc->f->head;
+    int start = (int)head->r2.i64;
+    if (pc->vars <= start) {
+        return;
+    }
+    int *map = (int *)calloc(pc->vars, sizeof(int));
+    for (int idx = 0; idx < pc->insts; ++idx) {
+        kl_kir_inst *i = pc->inst[idx];
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (pass_is_var(pc, rn[pos])) {
+                map[rn[pos]->index] = 1;
+            }
+        }
+    }
+    int next = start;
+    for (int k = start; k < pc->vars; ++k) {
+        map[k] = map[k] ? next++ : -1;
+    }
+    if (next < pc->vars) {
+        for (int idx = 0; idx < pc->insts; ++idx) {
+            kl_kir_inst *i = pc->inst[idx];
+            kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+            for (int pos = 0; pos < 3; ++pos) {
+                if (pass_is_var(pc, rn[pos]) && rn[pos]->index >= start) {
+                    rn[pos]->index = map[rn[pos]->index];
+                }
+            }
+        }
+        head->r1.i64 = next;
+        pc->vars = next;
+    }
+    free(map);
+}
+
+/* The yield number is renumbered because the resume hook jumps to each of them. */
+void pass_renumber_yield(kl_kir_func *f)
+{
+    int yield = 0;
+    kl_kir_inst *hook = NULL;
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_PURE) {
+            hook = i;
+        } else if (i->opcode == KIR_YIELDC && i->labelid > 0) {
+            i->labelid = ++yield;
+        }
+    }
+    if (hook) {
+        hook->labelid = yield;
+    }
+    f->yield = yield;
+}
+
+static void optimize_func(kl_context *ctx, kl_kir_func *f, int level)
+{
+    kl_kir_inst *head = f->head;
+    if (!head || (head->opcode != KIR_ALOCAL && head->opcode != KIR_MKFRM)) {
+        return;
+    }
+
+    pass_context pc = {
+        .ctx = ctx,
+        .f = f,
+        .vars = (int)head->r1.i64,
+        .first = head->opcode == KIR_MKFRM ? (int)head->r2.i64 : 0,
+    };
+    if (level >= 2) {
+        pass_setup(&pc);
+        pass_add_in_place(&pc);
+    }
+    if (f->yield > 0) {
+        /* The yield check reads all variables, so the store to (*r) not used is still removable. */
+        if (level >= 2) {
+            pass_setup(&pc);
+            pass_dead_store(&pc, 1);
+        }
+        pass_cleanup(&pc);
+        return;
+    }
+    for (int count = 0; count < 4; ++count) {
+        int changed = 0;
+        pass_setup(&pc);
+        changed |= pass_propagate(&pc, level >= 2);
+        pass_setup(&pc);
+        changed |= pass_jump(&pc);
+        changed |= pass_unreachable(&pc);
+        if (level >= 2) {
+            pass_setup(&pc);
+            changed |= pass_dead_store(&pc, 0);
+        }
+        if (!changed) {
+            break;
+        }
+    }
+    pass_setup(&pc);
+    if (level >= 2) {
+        pass_compact_vars(&pc);
+    }
+    pass_cleanup(&pc);
+}
+
+void optimize_kir(kl_context *ctx)
+{
+    int level = ctx->optlevel;
+    if (level <= 0) {
+        return;
+    }
+    tailcall_kir(ctx);
+    inline_kir(ctx);
+    if (level >= 2) {
+        loop_kir(ctx);
+    }
+    for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+        optimize_func(ctx, f, level);
+    }
+    escape_analysis(ctx);
+    if (level >= 2) {
+        update_kir_type(ctx);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef KILITE_OPT_PASS_H
+#define KILITE_OPT_PASS_H
+
+#include "../error.h"
+#include "../parser.h"
+
+#define PASS_OPT_LEVEL_MAX      (2)
+#define PASS_OPT_LEVEL_DEFAULT  (2)
+#define PASS_INLINE_LIMIT_DEFAULT   (16)
+#define PASS_INLINE_LIMIT_MAX       (255)
+
+extern void optimize_kir(kl_context *ctx);
+extern void escape_analysis(kl_context *ctx);
+extern void inline_kir(kl_context *ctx);
+extern void tailcall_kir(kl_context *ctx);
+extern void loop_kir(kl_context *ctx);
+extern void pass_renumber_yield(kl_kir_func *f);
+
+#endif /* KILITE_OPT_PASS_H */
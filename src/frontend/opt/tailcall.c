@@ -0,0 +1,269 @@
+#include "pass.h"
+
+/*
+ * Self tail call elimination.
+ *  The call to the function itself at a tail position is replaced by assignments to the arguments
+ *  and a jump to the head of the function, and so a deep recursion never causes the stack overflow.
+ *  The call is at a tail position when its result is the return value and nothing but jumps and
+ *  labels are placed between the call and the end of the function, and when it is not in a try
+ *  block. A finally clause is never skipped because a return statement jumps to it instead.
+ *  The function must
+ *      - have no frame, because a closure could hold the frame made by each call,
+ *      - have no yield, no rest argument, and no argument with a type check,
+ *  and the call must have the same number of arguments as the function.
+ *  The pushed arguments become the assignments to new variables first, and then they are copied
+ *  to the arguments because the argument could be used by the other argument. A local variable
+ *  which could be used before assigned is made undefined again at the head.
+ */
+
+static kl_kir_inst *tailcall_new_inst(kl_context *ctx, kl_kir_inst *src, kl_kir_inst *last)
+{
+    kl_kir_program *p = ctx->program;
+    kl_kir_inst *i = (kl_kir_inst *)calloc(1, sizeof(kl_kir_inst));
+    *i = *src;
+    i->chn = p->ichn;
+    p->ichn = i;
+    i->next = last->next;
+    last->next = i;
+    memset(&(i->r1), 0, sizeof(kl_kir_opr));
+    memset(&(i->r2), 0, sizeof(kl_kir_opr));
+    memset(&(i->r3), 0, sizeof(kl_kir_opr));
+    i->labelid = 0;
+    return i;
+}
+
+/* The type of a pushed variable is not always trusted, and so a new variable is any. */
+static inline kl_kir_opr tailcall_var(int index)
+{
+    return (kl_kir_opr){
+        .t = TK_VAR,
+        .index = index,
+        .typeid = TK_TANY,
+    };
+}
+
+static kl_kir_inst *tailcall_find_setarg(kl_kir_func *f, int idx)
+{
+    for (kl_kir_inst *i = f->head; i; i = i->next) {
+        if (!i->disabled && i->opcode == KIR_SETARG && i->r2.i64 == idx) {
+            return i;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the place to jump to, which is after setting the arguments and the hook of a pure function. */
+static kl_kir_inst *tailcall_entry(kl_kir_func *f)
+{
+    kl_kir_inst *entry = f->head;
+    for (kl_kir_inst *i = f->head->next; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_SETARGL || (i->opcode == KIR_SETARG && i->r2.typestr != NULL)) {
+            return NULL;
+        }
+        if (i->opcode != KIR_SETARG && i->opcode != KIR_PURE) {
+            break;
+        }
+        entry = i;
+    }
+    return entry;
+}
+
+/* Returns 1 if the call is followed by only jumps and labels until the end of the function. */
+static int tailcall_is_tail(kl_kir_func *f, kl_kir_inst *next)
+{
+    int count = 0;
+    for (kl_kir_inst *i = next; i; i = i->next) {
+        if (i->disabled || i->opcode == KIR_LABEL) {
+            if (!i->disabled && i->labelid == f->funcend) {
+                return 1;
+            }
+            continue;
+        }
+        if (i->opcode != KIR_JMP || ++count > 16) {
+            return 0;
+        }
+        kl_kir_inst *l = f->head;
+        while (l && (l->disabled || l->opcode != KIR_LABEL || l->labelid != i->labelid)) {
+            l = l->next;
+        }
+        if (!l) {
+            return 0;
+        }
+        i = l;
+        if (i->labelid == f->funcend) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int tailcall_call(kl_context *ctx, kl_kir_func *f, kl_kir_inst *call, int headlabel)
+{
+    if (call->r2.funcid != f->funcid || !call->r2.recursive || call->r2.has_dot3 || call->r2.args != f->argcount) {
+        return 0;
+    }
+    if (call->r1.t != TK_VAR || call->r1.index >= 0 || call->catchid != f->funcend) {
+        return 0;
+    }
+    int cc = call->r2.callcnt;
+    kl_kir_inst *rs = call->next;
+    kl_kir_inst *chk = rs ? rs->next : NULL;
+    if (!rs || rs->opcode != KIR_RSSTKP || rs->r1.i64 != cc || !chk || chk->opcode != KIR_CHKEXCEPT || chk->labelid != f->funcend) {
+        return 0;
+    }
+    kl_kir_inst *yc = chk->next && chk->next->opcode == KIR_YIELDC ? chk->next : NULL;
+    if (!tailcall_is_tail(f, yc ? yc->next : chk->next)) {
+        return 0;
+    }
+
+    kl_kir_inst *sv = NULL;
+    int pushes = 0;
+    for (kl_kir_inst *i = f->head; i && i != call; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_SVSTKP && i->r1.i64 == cc) {
+            sv = i;
+            pushes = 0;
+        } else if (i->opcode == KIR_PUSHSYS && i->r1.callcnt == cc) {
+            return 0;
+        } else if (i->opcode == KIR_PUSHARG && i->r1.callcnt == cc) {
+            if (i->r1.has_dot3) {
+                return 0;
+            }
+            ++pushes;
+        }
+    }
+    if (!sv || pushes != f->argcount) {
+        return 0;
+    }
+
+    kl_kir_inst *head = f->head;
+    int base = (int)head->r1.i64;
+    head->r1.i64 += pushes;
+
+    /* The arguments are pushed from the last one. */
+    sv->disabled = 1;
+    int idx = pushes;
+    for (kl_kir_inst *i = sv->next; i && idx > 0; i = i->next) {
+        if (i->disabled || i->opcode != KIR_PUSHARG || i->r1.callcnt != cc) {
+            continue;
+        }
+        kl_kir_opr r2 = i->r1;
+        r2.callcnt = 0;
+        i->opcode = KIR_MOV;
+        i->r2 = r2;
+        i->r1 = tailcall_var(base + --idx);
+    }
+
+    kl_kir_inst *last = call;
+    for (idx = 0; idx < pushes; ++idx) {
+        kl_kir_inst *sa = tailcall_find_setarg(f, idx);
+        if (sa) {
+            last = tailcall_new_inst(ctx, call, last);
+            last->opcode = KIR_MOV;
+            last->r1 = tailcall_var((int)sa->r1.i64);
+            last->r2 = tailcall_var(base + idx);
+        }
+    }
+    last = tailcall_new_inst(ctx, call, last);
+    last->opcode = KIR_JMP;
+    last->labelid = headlabel;
+    call->disabled = 1;
+    rs->disabled = 1;
+    chk->disabled = 1;
+    if (yc) {
+        yc->disabled = 1;
+    }
+    return 1;
+}
+
+/* Returns 1 if the local variable is assigned before any branch and before it is used. */
+static int tailcall_is_assigned(kl_kir_inst *entry, int index)
+{
+    for (kl_kir_inst *i = entry->next; i; i = i->next) {
+        if (i->disabled) {
+            continue;
+        }
+        if (i->opcode == KIR_LABEL || i->labelid > 0) {
+            return 0;
+        }
+        /* The source operands are checked first. */
+        kl_kir_opr *rn[3] = { &(i->r2), &(i->r3), &(i->r1) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (rn[pos]->t == TK_VAR && rn[pos]->level == 0 && rn[pos]->index == index) {
+                return pos == 2 && i->opcode == KIR_MOV;
+            }
+        }
+    }
+    return 0;
+}
+
+/* The local variables are made undefined at the head, which is done for the return value first. */
+static void tailcall_reset_locals(kl_context *ctx, kl_kir_func *f, kl_kir_inst *label)
+{
+    kl_kir_inst *last = label;
+    kl_kir_opr ret = tailcall_var(-1);
+    int locals = (int)f->head->r2.i64;
+    for (int idx = f->argcount; idx < locals; ++idx) {
+        if (tailcall_is_assigned(label, idx)) {
+            continue;
+        }
+        if (last == label) {
+            last = tailcall_new_inst(ctx, label, last);
+            last->opcode = KIR_MOV;
+            last->r1 = last->r2 = ret;
+        }
+        last = tailcall_new_inst(ctx, label, last);
+        last->opcode = KIR_MOV;
+        last->r1 = tailcall_var(idx);
+        last->r2 = ret;
+    }
+}
+
+static void tailcall_func(kl_context *ctx, kl_kir_func *f)
+{
+    kl_kir_inst *head = f->head;
+    if (!head || f->is_global || head->opcode != KIR_ALOCAL) {
+        return;
+    }
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled && (i->opcode == KIR_YIELD || i->opcode == KIR_RESUME)) {
+            return;
+        }
+    }
+    kl_kir_inst *entry = tailcall_entry(f);
+    if (!entry) {
+        return;
+    }
+
+    int headlabel = ctx->labelid++;
+    int changed = 0;
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled && i->opcode == KIR_CALL) {
+            changed |= tailcall_call(ctx, f, i, headlabel);
+        }
+    }
+    if (!changed) {
+        return;
+    }
+
+    /* The jump back to the head makes a loop, and so the label is a point to check GC. */
+    kl_kir_inst *label = tailcall_new_inst(ctx, head, entry);
+    label->opcode = KIR_LABEL;
+    label->labelid = headlabel;
+    label->gcable = 1;
+    label->catchid = f->funcend;
+    tailcall_reset_locals(ctx, f, label);
+    pass_renumber_yield(f);
+}
+
+void tailcall_kir(kl_context *ctx)
+{
+    for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+        tailcall_func(ctx, f);
+    }
+}
@@ -92,6 +92,8 @@ static int check_pure(tk_token tk)
     switch (tk) {
     // Literals
     case TK_VSINT: /* 1 */
+    case TK_VDBL: /* 1 */
+    case TK_VBOOL: /* 1 */
     // Keywords
     case TK_CONST: /* 1 */
     case TK_LET: /* 1 */
@@ -134,6 +136,7 @@ static int check_pure(tk_token tk)
     case TK_ADD: /* 1 */
     case TK_SUB: /* 1 */
     case TK_MUL: /* 1 */
+    case TK_DIV: /* 1 */
     case TK_MOD: /* 1 */
     case TK_AND: /* 1 */
     case TK_OR: /* 1 */
@@ -254,3 +257,396 @@ int check_pure_function(kl_context *ctx, kl_stmt *stmt)
     }
     return pure;
 }
+
+/*
+ * Unboxed local variables.
+ *  A local variable is held by a native C variable of int64_t or double instead of vmvar,
+ *  when every assignment to it produces the same type and it's never read before the assignment.
+ *  The variable in a frame is not a target because it could be captured by a closure.
+ */
+
+#define UNBOX_T_BOT     (0)     /* No information yet. */
+#define UNBOX_T_INT     (1)
+#define UNBOX_T_DBL     (2)
+#define UNBOX_T_NO      (3)     /* Not a target. */
+
+#define UNBOX_R_NONE    (0)
+#define UNBOX_R_READ    (1)
+#define UNBOX_R_WRITE   (2)
+#define UNBOX_R_UNSAFE  (3)
+
+/*
+ * An integer variable is updated only by a literal of this range. It means the value grows linearly
+ * and an overflow to a big integer will not happen in a realistic time.
+ */
+#define UNBOX_INT_LIMIT (1 << 20)
+#define UNBOX_MAX_VARS  (64)
+
+typedef struct unbox_context {
+    kl_kir_func *f;
+    int insts;
+    kl_kir_inst **inst;
+    int *target;                /* The index of the jump target. */
+    int vars;
+    int first;                  /* The first variable which can be a target. */
+    int *type;
+    int *bit;                   /* The bit for the definite assignment check. */
+    uint64_t *in;               /* Definitely assigned variables at the entry of each instruction. */
+} unbox_context;
+
+static int unbox_role(kl_kir_inst *i, int pos)
+{
+    switch (pos) {
+    case 1:
+        switch (i->opcode) {
+        case KIR_INC: case KIR_INCP: case KIR_DEC: case KIR_DECP:
+            return i->r1.prevent ? UNBOX_R_NONE : UNBOX_R_WRITE;
+        case KIR_MOV: case KIR_NOT: case KIR_MINUS: case KIR_CONV:
+        case KIR_ADD: case KIR_SUB: case KIR_MUL: case KIR_DIV: case KIR_MOD: case KIR_POW:
+        case KIR_BSHL: case KIR_BSHR: case KIR_BNOT: case KIR_BAND: case KIR_BOR: case KIR_BXOR:
+        case KIR_EQEQ: case KIR_NEQ: case KIR_LT: case KIR_LE: case KIR_GT: case KIR_GE: case KIR_LGE:
+        case KIR_REGEQ: case KIR_REGNE:
+        case KIR_NEWBIN: case KIR_NEWOBJ: case KIR_NEWREGEX: case KIR_OBJCPY: case KIR_MKSUPER:
+        case KIR_IDXFRM: case KIR_IDX: case KIR_IDXF: case KIR_IDXL: case KIR_APLY: case KIR_APLYL:
+        case KIR_TYPE: case KIR_CALL: case KIR_CATCH: case KIR_RESUME: case KIR_EXPAND:
+        case KIR_RANGEF: case KIR_RANGET: case KIR_ARYSIZE: case KIR_SWITCHS:
+            return UNBOX_R_WRITE;
+        case KIR_PUSHARG: case KIR_PUSHSYS: case KIR_JMPIFT: case KIR_JMPIFF: case KIR_THROWE:
+        case KIR_CASEV: case KIR_CHKMATCH: case KIR_CHKRANGE: case KIR_CHKMATCHX: case KIR_CHKRANGEX:
+        case KIR_CHKARY: case KIR_HEAPFRM:
+            return UNBOX_R_READ;
+        default:
+            break;
+        }
+        return UNBOX_R_UNSAFE;
+    case 2:
+        /* The 2nd operand of inc/dec is also written, and it's checked separately. */
+        return (i->opcode == KIR_SWAP || i->opcode == KIR_SWAPA) ? UNBOX_R_UNSAFE : UNBOX_R_READ;
+    default:
+        break;
+    }
+    return UNBOX_R_READ;
+}
+
+static inline int unbox_is_var(unbox_context *uc, kl_kir_opr *rn)
+{
+    return rn->t == TK_VAR && rn->level == 0 && rn->index >= 0 && rn->index < uc->vars;
+}
+
+static int unbox_join(int t1, int t2)
+{
+    if (t1 == t2 || t2 == UNBOX_T_BOT) {
+        return t1;
+    }
+    if (t1 == UNBOX_T_BOT) {
+        return t2;
+    }
+    return UNBOX_T_NO;
+}
+
+static inline int unbox_small_int(kl_kir_opr *rn)
+{
+    return rn->t == TK_VSINT && -UNBOX_INT_LIMIT <= rn->i64 && rn->i64 <= UNBOX_INT_LIMIT;
+}
+
+/* An integer literal out of the small range is never held natively to keep the bigint promotion. */
+static int unbox_opr_type(unbox_context *uc, kl_kir_opr *rn)
+{
+    switch (rn->t) {
+    case TK_VSINT:
+        return unbox_small_int(rn) ? UNBOX_T_INT : UNBOX_T_NO;
+    case TK_VDBL:
+        return UNBOX_T_DBL;
+    case TK_VAR:
+        if (unbox_is_var(uc, rn)) {
+            return uc->type[rn->index];
+        }
+        break;
+    }
+    return UNBOX_T_NO;
+}
+
+/*
+ * A compound assignment like `x += 1` is done via the return register as below,
+ * and it's translated as one native operation.
+ *      add     (*r), x, 1
+ *      mov     x, (*r)
+ */
+static inline int unbox_is_fused(kl_kir_inst *prev, kl_kir_inst *i)
+{
+    return (prev->opcode == KIR_ADD || prev->opcode == KIR_SUB || prev->opcode == KIR_MUL) &&
+        prev->next == i && prev->r1.t == TK_VAR && prev->r1.index < 0 &&
+        i->opcode == KIR_MOV && i->r2.t == TK_VAR && i->r2.index < 0;
+}
+
+/* Returns the type of the value written to r1. */
+static int unbox_result_type(unbox_context *uc, kl_kir_inst *i, kl_kir_inst *prev)
+{
+    int t2 = unbox_opr_type(uc, &(i->r2));
+    int t3 = unbox_opr_type(uc, &(i->r3));
+    switch (i->opcode) {
+    case KIR_MOV:
+        if (prev && unbox_is_fused(prev, i)) {
+            return unbox_result_type(uc, prev, NULL);
+        }
+        return t2;
+    case KIR_MINUS:
+        return t2;
+    case KIR_INC:
+    case KIR_INCP:
+    case KIR_DEC:
+    case KIR_DECP:
+        return t2;
+    case KIR_ADD:
+    case KIR_SUB:
+    case KIR_MUL:
+        if (t2 == UNBOX_T_NO || t3 == UNBOX_T_NO) {
+            return UNBOX_T_NO;
+        }
+        if (t2 == UNBOX_T_BOT || t3 == UNBOX_T_BOT) {
+            return UNBOX_T_BOT;
+        }
+        if (t2 == UNBOX_T_DBL || t3 == UNBOX_T_DBL) {
+            return UNBOX_T_DBL;
+        }
+        if (i->opcode != KIR_MUL && (unbox_small_int(&(i->r2)) || unbox_small_int(&(i->r3)))) {
+            return UNBOX_T_INT;
+        }
+        return UNBOX_T_NO;
+    default:
+        break;
+    }
+    return UNBOX_T_NO;
+}
+
+/* Returns 1 if some variable has been dropped, and then the inference should be done again. */
+static int unbox_infer_types(unbox_context *uc)
+{
+    for (int k = 0; k < uc->vars; ++k) {
+        if (uc->type[k] != UNBOX_T_NO) {
+            uc->type[k] = UNBOX_T_BOT;
+        }
+    }
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int idx = 0; idx < uc->insts; ++idx) {
+            kl_kir_inst *i = uc->inst[idx];
+            if (unbox_is_var(uc, &(i->r1)) && unbox_role(i, 1) == UNBOX_R_WRITE) {
+                int k = i->r1.index;
+                int t = unbox_join(uc->type[k], unbox_result_type(uc, i, idx > 0 ? uc->inst[idx - 1] : NULL));
+                if (t != uc->type[k]) {
+                    uc->type[k] = t;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    int dropped = 0;
+    for (int k = 0; k < uc->vars; ++k) {
+        if (uc->type[k] == UNBOX_T_BOT) {
+            uc->type[k] = UNBOX_T_NO;
+            dropped = 1;
+        }
+    }
+    return dropped;
+}
+
+/* Returns the number of target variables, or -1 if there were too many variables and some have been dropped. */
+static int unbox_assign_bits(unbox_context *uc)
+{
+    int targets = 0;
+    int dropped = 0;
+    for (int k = 0; k < uc->vars; ++k) {
+        if (uc->type[k] != UNBOX_T_NO && targets == UNBOX_MAX_VARS) {
+            uc->type[k] = UNBOX_T_NO;
+            dropped = 1;
+        }
+        uc->bit[k] = uc->type[k] == UNBOX_T_NO ? -1 : targets++;
+    }
+    return dropped ? -1 : targets;
+}
+
+static inline uint64_t unbox_bit(unbox_context *uc, kl_kir_opr *rn)
+{
+    return (unbox_is_var(uc, rn) && uc->bit[rn->index] >= 0) ? ((uint64_t)1 << uc->bit[rn->index]) : 0;
+}
+
+static int unbox_merge(unbox_context *uc, int to, uint64_t assigned)
+{
+    if (to < 0 || uc->insts <= to) {
+        return 0;
+    }
+    uint64_t in = uc->in[to] & assigned;
+    if (in != uc->in[to]) {
+        uc->in[to] = in;
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns 1 if some variable has been dropped because it could be read before the assignment. */
+static int unbox_check_assigned(unbox_context *uc)
+{
+    for (int idx = 0; idx < uc->insts; ++idx) {
+        kl_kir_inst *i = uc->inst[idx];
+        /* A catch clause or a case label of switch could be reached from anywhere. */
+        int entry = idx == 0 || i->opcode == KIR_CASEI || i->opcode == KIR_DEFAULT;
+        uc->in[idx] = entry ? 0 : ~(uint64_t)0;
+    }
+    for (int idx = 0; idx < uc->insts; ++idx) {
+        int catchid = uc->inst[idx]->catchid;
+        for (int l = 0; catchid > 0 && l < uc->insts; ++l) {
+            if (uc->inst[l]->opcode == KIR_LABEL && uc->inst[l]->labelid == catchid) {
+                uc->in[l] = 0;
+            }
+        }
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int idx = 0; idx < uc->insts; ++idx) {
+            kl_kir_inst *i = uc->inst[idx];
+            uint64_t out = uc->in[idx];
+            if (unbox_role(i, 1) == UNBOX_R_WRITE) {
+                out |= unbox_bit(uc, &(i->r1));
+            }
+            changed |= unbox_merge(uc, uc->target[idx], out);
+            switch (i->opcode) {
+            case KIR_JMP: case KIR_RET: case KIR_THROW: case KIR_THROWE: case KIR_THROWX:
+                break;
+            default:
+                changed |= unbox_merge(uc, idx + 1, out);
+                break;
+            }
+        }
+    }
+
+    int dropped = 0;
+    for (int idx = 0; idx < uc->insts; ++idx) {
+        kl_kir_inst *i = uc->inst[idx];
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            uint64_t b = unbox_bit(uc, rn[pos]);
+            if (b && unbox_role(i, pos + 1) == UNBOX_R_READ && (uc->in[idx] & b) == 0) {
+                uc->type[rn[pos]->index] = UNBOX_T_NO;
+                dropped = 1;
+            }
+        }
+    }
+    return dropped;
+}
+
+static void unbox_setup(unbox_context *uc)
+{
+    kl_kir_func *f = uc->f;
+    kl_kir_inst *head = f->head;
+    uc->vars = (int)head->r1.i64;
+    uc->first = head->opcode == KIR_MKFRM ? (int)head->r2.i64 : f->argcount;
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled) {
+            ++(uc->insts);
+        }
+    }
+    uc->inst = (kl_kir_inst **)calloc(uc->insts, sizeof(kl_kir_inst *));
+    uc->target = (int *)calloc(uc->insts, sizeof(int));
+    uc->in = (uint64_t *)calloc(uc->insts, sizeof(uint64_t));
+    uc->type = (int *)calloc(uc->vars, sizeof(int));
+    uc->bit = (int *)calloc(uc->vars, sizeof(int));
+    int idx = 0;
+    for (kl_kir_inst *i = head; i; i = i->next) {
+        if (!i->disabled) {
+            uc->inst[idx++] = i;
+        }
+    }
+
+    for (int k = 0; k < uc->vars && k < uc->first; ++k) {
+        uc->type[k] = UNBOX_T_NO;
+    }
+    for (idx = 0; idx < uc->insts; ++idx) {
+        kl_kir_inst *i = uc->inst[idx];
+        if (i->opcode == KIR_SETARG || i->opcode == KIR_SETARGL) {
+            if (0 <= i->r1.i64 && i->r1.i64 < uc->vars) {
+                uc->type[i->r1.i64] = UNBOX_T_NO;
+            }
+        }
+        kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+        for (int pos = 0; pos < 3; ++pos) {
+            if (unbox_is_var(uc, rn[pos]) && (rn[pos]->has_dot3 || unbox_role(i, pos + 1) == UNBOX_R_UNSAFE)) {
+                uc->type[rn[pos]->index] = UNBOX_T_NO;
+            }
+        }
+        uc->target[idx] = -1;
+        switch (i->opcode) {
+        case KIR_JMP: case KIR_JMPIFT: case KIR_JMPIFF: case KIR_JMPIFNE:
+        case KIR_CHKMATCHX: case KIR_CHKRANGEX: case KIR_CASEV: case KIR_CHKARY:
+            for (int l = 0; l < uc->insts; ++l) {
+                if (uc->inst[l]->opcode == KIR_LABEL && uc->inst[l]->labelid == i->labelid) {
+                    uc->target[idx] = l;
+                    break;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void unbox_cleanup(unbox_context *uc)
+{
+    free(uc->inst);
+    free(uc->target);
+    free(uc->in);
+    free(uc->type);
+    free(uc->bit);
+}
+
+static void update_func_unboxed(kl_kir_func *f)
+{
+    if (!f->head || f->yield > 0 || (f->head->opcode != KIR_ALOCAL && f->head->opcode != KIR_MKFRM)) {
+        return;
+    }
+
+    unbox_context uc = { .f = f };
+    unbox_setup(&uc);
+    int targets = 0;
+    for ( ; ; ) {
+        if (unbox_infer_types(&uc)) {
+            continue;
+        }
+        targets = unbox_assign_bits(&uc);
+        if (targets < 0) {
+            continue;
+        }
+        if (targets == 0 || !unbox_check_assigned(&uc)) {
+            break;
+        }
+    }
+
+    if (targets > 0) {
+        for (int idx = 0; idx < uc.insts; ++idx) {
+            kl_kir_inst *i = uc.inst[idx];
+            kl_kir_opr *rn[3] = { &(i->r1), &(i->r2), &(i->r3) };
+            for (int pos = 0; pos < 3; ++pos) {
+                if (unbox_is_var(&uc, rn[pos])) {
+                    int t = uc.type[rn[pos]->index];
+                    rn[pos]->unboxed = t == UNBOX_T_INT ? TK_TSINT64 : t == UNBOX_T_DBL ? TK_TDBL : TK_TANY;
+                }
+            }
+        }
+    }
+    unbox_cleanup(&uc);
+}
+
+void update_kir_type(kl_context *ctx)
+{
+    if ((ctx->options & PARSER_OPT_DISABLE_UNBOX) == PARSER_OPT_DISABLE_UNBOX) {
+        return;
+    }
+    for (kl_kir_func *f = ctx->program->head; f; f = f->next) {
+        update_func_unboxed(f);
+    }
+}
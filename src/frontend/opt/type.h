@@ -6,5 +6,6 @@
 
 extern void update_ast_type(kl_context *ctx);
 extern int check_pure_function(kl_context *ctx, kl_stmt *stmt);
+extern void update_kir_type(kl_context *ctx);
 
 #endif /* KILITE_OPT_TYPE_H */
@@ -147,13 +147,18 @@ static char *make_func_name(kl_context *ctx, kl_lexer *l, const char *str, tk_to
     char buf[1024] = {0};
     int pos = 0;
     int len = strlen(str);
-    if (pos + len > 1016) {
+    int mlen = ctx->modname ? strlen(ctx->modname) + 1 : 0;
+    if (pos + mlen + len > 1016) {
         parse_error(ctx, __LINE__, l, "Internal error with allocation failed");
     } else {
         kl_nsstack *n = ctx->ns;
         if (!makelib_opt) {
-            sprintf(buf, "kl%03d_", id);
-            pos = 6;
+            /* The function in a module has the module name as a prefix not to conflict with other modules. */
+            if (ctx->modname) {
+                sprintf(buf, "%s_", ctx->modname);
+            }
+            sprintf(buf + mlen, "kl%03d_", id);
+            pos = mlen + 6;
         }
         int added = copy_func_name(buf + pos, str);
         if (makelib_opt && added != len) {
@@ -3189,6 +3194,23 @@ static kl_stmt *parse_statement(kl_context *ctx, kl_lexer *l)
         }
         lexer_fetch(l);
         break;
+    case TK_IMPORT:
+        lexer_fetch(l);
+        if (l->tok != TK_NAME) {
+            parse_error(ctx, __LINE__, l, "Function/Object name is needed after 'import'");
+            return panic_mode_stmt(r, ';', ctx, l);
+        }
+        r = make_stmt(ctx, l, TK_IMPORT);
+        r->e1 = make_str_expr(ctx, l, l->str);
+        r->e2 = parse_expr_varname(ctx, l, l->str, TK_CONST);
+        r->typeid = TK_TANY;
+        lexer_fetch(l);
+        if (l->tok != TK_SEMICOLON) {
+            parse_error(ctx, __LINE__, l, "The ';' is missing");
+            return panic_mode_stmt(r, ';', ctx, l);
+        }
+        lexer_fetch(l);
+        break;
     case TK_ENUM:
         lexer_fetch(l);
         r = parse_enum(ctx, l);
@@ -3252,6 +3274,12 @@ int parse(kl_context *ctx, kl_lexer *l)
     kl_symbol *sym = make_symbol(ctx, l, TK_NAMESPACE, 0);
     sym->is_global = 1;
     sym->name = parse_const_str(ctx, l, "run_global");
+    if (ctx->modname) {
+        /* The global code of a module is run by this name before the main program. */
+        char buf[256] = {0};
+        snprintf(buf, 255, "%s_run_global", ctx->modname);
+        sym->funcname = parse_const_str(ctx, l, buf);
+    }
     s->sym = sym;
 
     ctx->scope = ctx->global = sym;
@@ -125,6 +125,10 @@ typedef struct kl_context {
     int errors;                     //  Total error count.
     int error_limit;                //  If the error count exceeds this value, stop parsing and exit the program.
     int options;                    //  Options for parser.
+    int optlevel;                   //  The optimization level of KIR.
+    int inline_limit;               //  The max size of a function to be inlined.
+    const char *modname;            //  The module name when compiling a module, which is the prefix of the function names.
+    const char **modules;           //  The names of the modules to be run before the program, ended by NULL.
     int in_lvalue;                  //  The decltype in parsing l-value.
     int in_finally;                 //  To check if the statement is a finally clause.
     int in_catch;                   //  To check if the statement is a catch clause.
@@ -163,9 +167,10 @@ extern kl_stmt *copy_tree(kl_context *ctx, kl_lexer *l, kl_stmt *src);
 extern int parse(kl_context *ctx, kl_lexer *l);
 extern void free_context(kl_context *ctx);
 
-#define PARSER_OPT_PHASE        (0x01)
-#define PARSER_OPT_DISABLE_PURE (0x02)
-#define PARSER_OPT_ERR_STDOUT   (0x04)
-#define PARSER_OPT_MAKELIB      (0x08)
+#define PARSER_OPT_PHASE         (0x01)
+#define PARSER_OPT_DISABLE_PURE  (0x02)
+#define PARSER_OPT_ERR_STDOUT    (0x04)
+#define PARSER_OPT_MAKELIB       (0x08)
+#define PARSER_OPT_DISABLE_UNBOX (0x10)
 
 #endif /* KILITE_PARSER_H */
@@ -5,6 +5,8 @@
 #include <stdint.h>
 #include <ctype.h>
 
+#define KIR_PURE_SIG_MAX (8)    /* The maximum number of native signatures of a pure function. */
+
 #define SHOW_BIGINT(b) do {char *bs = BzToString(b, 10, 0); printf("%s\n", bs); BzFreeString(bs);} while(0)
 // printf("%s:%d -> %s\n", __FILE__, __LINE__, __func__);
 
@@ -304,6 +306,13 @@ typedef enum kl_kir {
     KIR_RANGEF,     //  <r1>, <r2>, <r3>        ;   <r1>  <-  new Range(<r2>, <r3>, true)
     KIR_RANGET,     //  <r1>, <r2>, <r3>        ;   <r1>  <-  new Range(<r2>, <r3>, false)
     KIR_ARYSIZE,    //  <r1>, <r2>              ;   <r1>  <-  <r2>.size()
+    KIR_CHKARY,     //  <r1>, <r2>, <label>     ;   goto label unless <r1> is a plain array and <r2> is a non-negative integer.
+    KIR_IDXF,       //  <r1>, <r2>, <r3>        ;   <r1>  <-  <r2>[<r3>] when <r2> is checked by KIR_CHKARY.
+    KIR_HEAPFRM,    //  <r1>, <r2>              ;   move the frame to the heap unless <r2> is a native loop method of a plain array <r1>.
+
+    KIR_IMPORT,     //  <r1>, <name>            ;   <r1>  <-  the value exported by a module with the name.
+    KIR_EXPORT,     //  <r1>, <name>            ;   export <r1> with the name from the module.
+    KIR_RUNMOD,     //  <name>                  ;   run the global code of the module, <name> is its function.
 } kl_kir;
 
 /* These should be the same as the one in the template/header.h */
@@ -333,6 +342,7 @@ typedef struct kl_kir_opr {
                                 //      the variable has to be expanded to multiple aruguments for function call.
     int callcnt;                //  The call count number to identify the call.
     int prevent;                //  Prevent an assignment to the variable.
+    tk_typeid unboxed;          //  The variable is held by a native C variable of this type.
     int64_t i64;
     const char *dbl;
     const char *str;
@@ -363,8 +373,12 @@ typedef struct kl_kir_func {
     const char *funcname;
     int is_global;
     int is_pure;
+    int pure_sigs;                      //  The number of native signatures of a pure function.
+    int pure_mask[KIR_PURE_SIG_MAX];    //  The bit is set when the argument is a double.
+    int pure_ret[KIR_PURE_SIG_MAX];     //  The type of the return value.
     int argcount;
     int has_frame;
+    int frame_on_stack;                 //  The frame does not outlive the call, see escape.c.
     int has_dot3;
     int funcid;
     int funcend;
@@ -384,6 +398,10 @@ typedef struct kl_kir_program {
     kl_kir_func *last;
     int verbose;
     int print_result;
+    int jobs;
+    const char *gctrace;
+    const char *modname;
+    struct kl_pgo *pgo;
 
     struct kl_kir_inst *ichn;
     struct kl_kir_func *fchn;
@@ -1,15 +1,19 @@
 #include "frontend/parser.h"
 #include "frontend/mkkir.h"
 #include "frontend/opt/type.h"
+#include "frontend/opt/pass.h"
 #include "frontend/dispast.h"
 #include "backend/cexec.h"
 #include "backend/dispkir.h"
 #include "backend/translate.h"
+#include "backend/profile.h"
+#include "backend/thread.h"
 
 #define PROGNAME "kilite"
 #define VER_MAJOR "0"
 #define VER_MINOR "0"
 #define VER_PATCH "1"
+#define VER VER_MAJOR "." VER_MINOR "." VER_PATCH
 
 #define OPT_ERROR (1)
 #define OPT_ERROR_USAGE (2)
@@ -33,7 +37,7 @@ extern double SystemTimer_elapsed_impl(void *p);
 #define timer_elapsed SystemTimer_elapsed_impl
 #define SHOW_TIMER(msg) { \
     if (opts.cctime) { \
-        printf(">> %-25s: %f\n", msg, timer_elapsed(ctx->timer)); \
+        printf(">> %-25s: %f (cpu: %f)\n", msg, timer_elapsed(ctx->timer), thread_cputime_lap()); \
         timer_restart(ctx->timer); \
     } \
 } \
@@ -51,17 +55,30 @@ typedef struct kl_argopts {
     int in_stdin;
     int out_src;
     int disable_pure;
+    int disable_unbox;
+    int optlevel;
+    int inline_limit;
+    int jobs;
     int error_stdout;
     int error_limit;
     int print_result;
     int lazy_off;
     int verbose;
     int argstart;
+    int modstart;
+    int modcount;
     int cctime;
+    int full_header;
+    int no_cache;
+    int cache_limit;
     int cc;
     const char *ccname;
     const char *ccopt;
     const char *ext;
+    const char *cache_dir;
+    const char *gc_trace;
+    const char *pgo_gen;
+    const char *pgo_use;
     const char *file;
 } kl_argopts;
 
@@ -153,24 +170,37 @@ char* get_actual_exe_path(void)
 
 static void version(void)
 {
-    printf(PROGNAME " version %s.%s.%s\n", VER_MAJOR, VER_MINOR, VER_PATCH);
+    printf(PROGNAME " version %s\n", VER);
 }
 
 static void usage(void)
 {
-    printf("Usage: " PROGNAME " -[hvcxSX]\n");
+    printf("Usage: " PROGNAME " -[hvcxSXO]\n");
     printf("Main Options:\n");
     printf("    -h                  Display this help.\n");
     printf("    -v, --version       Display the version number.\n");
-    printf("    -c                  Output .bmir for library.\n");
+    printf("    -c                  Compile the script as a module and output .kc to be run with others.\n");
     printf("    -x                  Execute the code and print the result.\n");
     printf("    -S                  Output .mir code.\n");
     printf("    -X                  Generate an executable. (need another compiler)\n");
+    printf("    -O<n>               Change the optimization level of the internal code. (0-%d, default: %d)\n", PASS_OPT_LEVEL_MAX, PASS_OPT_LEVEL_DEFAULT);
     printf("    --stdout            Change the distination of the output to stdout.\n");
     printf("    --verbose           Show some infrmation when running.\n");
+    printf("    --gc-trace=<file>   Write a line per garbage collection to the file.\n");
     printf("    --disable-pure      Disable the code optimization for a pure function.\n");
+    printf("    --disable-unbox     Disable native C variables for integer and real local variables.\n");
+    printf("    --inline-limit=<n>  Change the max size of a function to be inlined. (0-%d, default: %d)\n", PASS_INLINE_LIMIT_MAX, PASS_INLINE_LIMIT_DEFAULT);
     printf("    --lazy-off          Disable lazy code generation mode.\n");
-    printf("    --ext=<ext>         Change the extension of the output file.\n");
+    printf("    --jobs=<n>          Change the number of threads to compile. (1-%d, default: the number of CPUs)\n", THREAD_MAX_JOBS);
+    printf("    --full-header       Compile with the full runtime header instead of its image.\n");
+    printf("    --pgo-gen=<file>    Run the instrumented code and write the profile to the file.\n");
+    printf("    --pgo-use=<file>    Specialize the code with the profile, which is also used with -X.\n");
+    printf("    --ext=<ext>         Change the extension of the output file. (default with -c: .kc)\n");
+    printf("\n");
+    printf("Compile Cache:\n");
+    printf("    --no-cache          Disable the compile cache.\n");
+    printf("    --cache-dir=<dir>   Change the cache directory. (default: ~/.kilite-cache)\n");
+    printf("    --cache-limit=<mb>  Change the size limit of the cache directory. (default: %d)\n", CACHE_DEFAULT_LIMIT_MB);
     printf("\n");
     printf("Show Process:\n");
     printf("    --cctime            Display various time in compilation.\n");
@@ -241,12 +271,18 @@ static int parse_long_options(int ac, char **av, int *i, kl_argopts *opts)
         opts->out_cfull = 1;
     } else if (strcmp(av[*i], "--lazy-off") == 0) {
         opts->lazy_off = 1;
+    } else if (strcmp(av[*i], "--full-header") == 0) {
+        opts->full_header = 1;
+    } else if (strcmp(av[*i], "--no-cache") == 0) {
+        opts->no_cache = 1;
     } else if (strcmp(av[*i], "--stdout") == 0) {
         opts->out_stdout = 1;
     } else if (strcmp(av[*i], "--cctime") == 0) {
         opts->cctime = 1;
     } else if (strcmp(av[*i], "--disable-pure") == 0) {
         opts->disable_pure = 1;
+    } else if (strcmp(av[*i], "--disable-unbox") == 0) {
+        opts->disable_unbox = 1;
     } else if (strcmp(av[*i], "--error-stdout") == 0) {
         opts->error_stdout = 1;
     } else if (parse_long_options_with_sparam(ac, av, i, "--ccopt", &(opts->ccopt))) {
@@ -272,8 +308,32 @@ static int parse_long_options(int ac, char **av, int *i, kl_argopts *opts)
         return 0;
     } else if (parse_long_options_with_iparam(ac, av, i, "--error-limit", &(opts->error_limit))) {
         return 0;
+    } else if (parse_long_options_with_iparam(ac, av, i, "--inline-limit", &(opts->inline_limit))) {
+        if (opts->inline_limit < 0) {
+            opts->inline_limit = 0;
+        } else if (opts->inline_limit > PASS_INLINE_LIMIT_MAX) {
+            opts->inline_limit = PASS_INLINE_LIMIT_MAX;
+        }
+        return 0;
+    } else if (parse_long_options_with_iparam(ac, av, i, "--jobs", &(opts->jobs))) {
+        if (opts->jobs < 1) {
+            opts->jobs = 1;
+        } else if (opts->jobs > THREAD_MAX_JOBS) {
+            opts->jobs = THREAD_MAX_JOBS;
+        }
+        return 0;
     } else if (parse_long_options_with_sparam(ac, av, i, "--ext", &(opts->ext))) {
         return 0;
+    } else if (parse_long_options_with_sparam(ac, av, i, "--cache-dir", &(opts->cache_dir))) {
+        return 0;
+    } else if (parse_long_options_with_sparam(ac, av, i, "--gc-trace", &(opts->gc_trace))) {
+        return 0;
+    } else if (parse_long_options_with_sparam(ac, av, i, "--pgo-gen", &(opts->pgo_gen))) {
+        return 0;
+    } else if (parse_long_options_with_sparam(ac, av, i, "--pgo-use", &(opts->pgo_use))) {
+        return 0;
+    } else if (parse_long_options_with_iparam(ac, av, i, "--cache-limit", &(opts->cache_limit))) {
+        return 0;
     } else {
         fprintf(stderr, "Error unknown option: %s\n", av[*i]);
         return OPT_ERROR_USAGE;
@@ -281,6 +341,12 @@ static int parse_long_options(int ac, char **av, int *i, kl_argopts *opts)
     return 0;
 }
 
+static int is_module_file(const char *file)
+{
+    int len = strlen(file);
+    return len > 3 && strcmp(file + len - 3, ".kc") == 0;
+}
+
 static int parse_arg_options(int ac, char **av, kl_argopts *opts)
 {
     if (ac < 1) {
@@ -319,6 +385,16 @@ static int parse_arg_options(int ac, char **av, kl_argopts *opts)
                         opts->cc = 1;
                     }
                     break;
+                case 'O':
+                    if ('0' <= av[i][j+1] && av[i][j+1] <= '9') {
+                        opts->optlevel = av[i][++j] - '0';
+                        if (opts->optlevel > PASS_OPT_LEVEL_MAX) {
+                            opts->optlevel = PASS_OPT_LEVEL_MAX;
+                        }
+                    } else {
+                        opts->optlevel = PASS_OPT_LEVEL_DEFAULT;
+                    }
+                    break;
                 case 'v':
                     return OPT_DISPLAY_VERSION;
                 case 'h':
@@ -328,6 +404,13 @@ static int parse_arg_options(int ac, char **av, kl_argopts *opts)
                     return OPT_ERROR_USAGE;
                 }
             }
+        } else if (is_module_file(av[i])) {
+            /* The compiled modules are placed before the main script. */
+            if (opts->modcount == 0) {
+                opts->modstart = i;
+            }
+            opts->modcount++;
+            opts->argstart = i;
         } else {
             opts->file = av[i];
             opts->argstart = i;
@@ -453,11 +536,120 @@ int make_executable(kl_argopts *opts, const char *s)
     return r;
 }
 
+static char *load_source_file(const char *file, int *len)
+{
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    int cap = 4096, n = 0, r;
+    char *buf = (char *)malloc(cap);
+    while ((r = fread(buf + n, 1, cap - n, fp)) > 0) {
+        n += r;
+        if (n == cap) {
+            cap *= 2;
+            buf = (char *)realloc(buf, cap);
+        }
+    }
+    fclose(fp);
+    buf[n] = 0;     /* There is always a room for this because the buffer is extended when it's full. */
+    *len = n;
+    return buf;
+}
+
+static int setup_cache(kl_argopts *opts, kl_cache *cache, const char *src, int len)
+{
+    if (opts->no_cache || opts->out_src || opts->out_bmir || opts->cc || opts->in_stdin || !opts->file || opts->gc_trace || opts->modcount > 0 || opts->pgo_gen || opts->pgo_use) {
+        return 0;
+    }
+    if (!src) {
+        return 0;
+    }
+    int flags = (opts->disable_pure ? CACHE_OPT_DISABLE_PURE : 0) |
+                (opts->disable_unbox ? CACHE_OPT_DISABLE_UNBOX : 0) |
+                (opts->lazy_off ? CACHE_OPT_LAZY_OFF : 0) |
+                (opts->print_result ? CACHE_OPT_PRINT_RESULT : 0) |
+                (opts->verbose ? CACHE_OPT_VERBOSE : 0) |
+                (opts->optlevel << CACHE_OPT_LEVEL_SHIFT) |
+                (opts->inline_limit << CACHE_OPT_INLINE_SHIFT);
+    const char *dir = opts->cache_dir ? opts->cache_dir : cache_default_dir();
+    int r = cache_setup(cache, dir, opts->cache_limit, VER, opts->file, src, len, flags);
+    return r == 0;
+}
+
+/* The module name is the base name of the file, which is used as the prefix of the function names. */
+static const char *make_module_name(char *buf, int size, const char *file)
+{
+    const char *base = file;
+    for (const char *p = file; *p; ++p) {
+        if (*p == '/' || *p == SEP) {
+            base = p + 1;
+        }
+    }
+    int i = 0;
+    if ('0' <= *base && *base <= '9') {
+        buf[i++] = '_';
+    }
+    for ( ; *base && *base != '.' && i < size - 1; ++base) {
+        int ch = *base;
+        buf[i++] = (('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z') || ('0' <= ch && ch <= '9')) ? ch : '_';
+    }
+    buf[i] = 0;
+    return buf;
+}
+
+/* Different files can have the same module name like `a-b.kc` and `a_b.kc`, and their function names would conflict. */
+static int check_module_names(kl_argopts *opts, char **av)
+{
+    char name1[128] = {0};
+    char name2[128] = {0};
+    for (int i = 1; i < opts->modcount; ++i) {
+        const char *file1 = av[opts->modstart + i];
+        make_module_name(name1, 64, file1);
+        for (int j = 0; j < i; ++j) {
+            const char *file2 = av[opts->modstart + j];
+            if (strcmp(name1, make_module_name(name2, 64, file2)) == 0) {
+                fprintf(stderr, "Error: the module name '%s' is the same between %s and %s, rename either file.\n", name1, file2, file1);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int run_script(kl_argopts *opts, const char *s, const char **parts, void *timer, const char *cache_file, int cache_hit, int ac, char **av)
+{
+    int ri = 1;
+    char kilite[384] = {0};
+    snprintf(kilite, 380, "%s%ckilite.bmir", get_actual_exe_path(), SEP);
+    /* must be ended by NULL */
+    const char **modules = (const char **)calloc(opts->modcount + 2, sizeof(const char *));
+    modules[0] = kilite;
+    for (int i = 0; i < opts->modcount; ++i) {
+        modules[i + 1] = av[opts->modstart + i];
+    }
+    kl_opts runopts = {
+        .modules = modules,
+        .parts = parts,
+        .jobs = opts->jobs,
+        .timer = timer,
+        .cctime = opts->cctime,
+        .lazy_off = opts->lazy_off,
+        .full_header = opts->full_header,
+        .cache_file = cache_file,
+        .cache_hit = cache_hit,
+    };
+    run(&ri, opts->file, s, ac - opts->argstart, av + opts->argstart, NULL, &runopts);
+    free(modules);
+    return ri;
+}
+
 int main(int ac, char **av)
 {
     int ri = 1;
     char *s = NULL;
-    kl_argopts opts = {0};
+    char **parts = NULL;
+    kl_argopts opts = { .optlevel = PASS_OPT_LEVEL_DEFAULT, .inline_limit = PASS_INLINE_LIMIT_DEFAULT };
     switch (parse_arg_options(ac, av, &opts)) {
     case OPT_ERROR:
         return 1;
@@ -471,8 +663,33 @@ int main(int ac, char **av)
         version();
         return 0;
     }
+    if (opts.modcount > 1 && !check_module_names(&opts, av)) {
+        return 1;
+    }
+    if (opts.jobs == 0) {
+        int cpus = thread_cpus();
+        opts.jobs = cpus < THREAD_MAX_JOBS ? cpus : THREAD_MAX_JOBS;
+    }
+
+    /* The source is read only once, for both the cache key and the lexer. */
+    int srclen = 0;
+    char *src = (opts.file && !opts.in_stdin) ? load_source_file(opts.file, &srclen) : NULL;
+
+    /* The compiled module is reused when the same source has already been compiled with the same options. */
+    kl_cache cache = {0};
+    int use_cache = setup_cache(&opts, &cache, src, srclen);
+    if (use_cache && cache_lookup(&cache)) {
+        free(src);
+        void *timer = timer_init();
+        thread_cputime_lap();
+        ri = run_script(&opts, NULL, NULL, timer, cache.path, 1, ac, av);
+        free(timer);
+        return ri;
+    }
 
-    kl_lexer *l = lexer_new_file(opts.in_stdin ? NULL : opts.file);
+    /* The main script is empty when only the modules are given. */
+    int modonly = !opts.file && !opts.in_stdin && opts.modcount > 0;
+    kl_lexer *l = modonly ? lexer_new_string("") : (src ? lexer_new_buffer(src) : lexer_new_file(opts.in_stdin ? NULL : opts.file));
     l->precode = "let $$;"
                 /* `$$` is a program argument passed by a user. */
                 /* This must be a 1st variable because compiler is expecting it's an index 0 variable. */
@@ -480,7 +697,7 @@ int main(int ac, char **av)
         "extern True; extern False;"
         "extern System; extern SystemTimer; extern Math; extern Fiber; extern Range;"
         "extern RuntimeException();"
-        "extern Integer; extern Double; extern String; extern Binary; extern Array;"
+        "extern Integer; extern Double; extern String; extern StringBuilder; extern Binary; extern Array;"
         "const Object = Array;"
         "extern Regex;"
         "extern File; extern Zip;"
@@ -488,13 +705,30 @@ int main(int ac, char **av)
         "\n";
 
     kl_context *ctx = parser_new_context();
-    l->filename = ctx->filename = opts.file ? opts.file : "stdin";
+    l->filename = ctx->filename = opts.file ? opts.file : (modonly ? av[opts.argstart] : "stdin");
     if (opts.out_lib) {
         ctx->options |= PARSER_OPT_MAKELIB;
     }
     if (opts.disable_pure) {
         ctx->options |= PARSER_OPT_DISABLE_PURE;
     }
+    if (opts.disable_unbox) {
+        ctx->options |= PARSER_OPT_DISABLE_UNBOX;
+    }
+    ctx->optlevel = opts.optlevel;
+    ctx->inline_limit = opts.inline_limit;
+    char modname[128] = {0};
+    if (opts.out_bmir) {
+        ctx->modname = make_module_name(modname, 64, ctx->filename);
+    } else if (opts.modcount > 0) {
+        ctx->modules = (const char **)calloc(opts.modcount + 1, sizeof(const char *));
+        for (int i = 0; i < opts.modcount; ++i) {
+            char buf[128] = {0};
+            make_module_name(modname, 64, av[opts.modstart + i]);
+            snprintf(buf, 127, "%s_run_global", modname);
+            ctx->modules[i] = strdup(buf);
+        }
+    }
     if (opts.error_stdout) {
         l->error_stdout = 1;
         ctx->options |= PARSER_OPT_ERR_STDOUT;
@@ -504,6 +738,7 @@ int main(int ac, char **av)
     }
 
     ctx->timer = timer_init();
+    thread_cputime_lap();
     int r = parse(ctx, l);
     SHOW_TIMER("Parsing source code");
     if (r > 0) {
@@ -519,12 +754,24 @@ int main(int ac, char **av)
     if (r > 0) {
         goto END;
     }
+    optimize_kir(ctx);
+    SHOW_TIMER("Optimizing KIR");
     if (opts.out_src && opts.out_kir) {
         disp_program(ctx->program);
         goto END;
     }
     ctx->program->print_result = opts.print_result;
     ctx->program->verbose = opts.verbose;
+    ctx->program->jobs = opts.jobs;
+    ctx->program->gctrace = opts.gc_trace;
+    if (opts.pgo_gen) {
+        ctx->program->pgo = pgo_new(opts.pgo_gen, 1);
+    } else if (opts.pgo_use) {
+        ctx->program->pgo = pgo_new(opts.pgo_use, 0);
+        if (!ctx->program->pgo) {
+            fprintf(stderr, "Warning: the profile can't be read, %s\n", opts.pgo_use);
+        }
+    }
     if (opts.out_src && (opts.out_csrc || opts.out_cfull)) {
         s = translate(ctx->program, TRANS_SRC);
         SHOW_TIMER("Translating from KIR to C");
@@ -544,33 +791,52 @@ int main(int ac, char **av)
         goto END;
     }
 
-    s = translate(ctx->program, TRANS_FULL);
-    SHOW_TIMER("Translating from KIR to C");
-    if (opts.out_mir || opts.out_bmir) {
-        ri = output(opts.file, s, opts.out_bmir, (opts.out_stdout || opts.out_lib) ? NULL : (opts.out_mir ? ".mir" : ".bmir"));
+    if (opts.out_bmir) {
+        s = translate(ctx->program, TRANS_MODULE);
+        SHOW_TIMER("Translating from KIR to C");
+        ri = output(ctx->filename, s, 1, opts.ext ? opts.ext : ".kc");
+        goto END;
+    }
+    if (opts.out_mir) {
+        s = translate(ctx->program, TRANS_FULL);
+        SHOW_TIMER("Translating from KIR to C");
+        ri = output(opts.file, s, 0, opts.out_stdout ? NULL : ".mir");
         goto END;
     }
 
-    /* run the code */
+    /* run the code, which is compiled in parts by the threads when it's large. */
     if (!opts.out_src) {
-        char kilite[384] = {0};
-        snprintf(kilite, 380, "%s%ckilite.bmir", get_actual_exe_path(), SEP);
-        const char *modules[] = {
-            kilite,
-            NULL,   /* must be ended by NULL */
-        };
-        kl_opts runopts = {
-            .modules = modules,
-            .timer = ctx->timer,
-            .cctime = opts.cctime,
-            .lazy_off = opts.lazy_off,
-        };
-        run(&ri, opts.file, s, ac - opts.argstart, av + opts.argstart, NULL, &runopts);
+        parts = translate_parts(ctx->program, TRANS_FULL, opts.jobs);
+        SHOW_TIMER("Translating from KIR to C");
+        if (!parts[1]) {
+            s = parts[0];
+            free(parts);
+            parts = NULL;
+        }
+        ri = run_script(&opts, s, (const char **)parts, ctx->timer, use_cache ? cache.path : NULL, 0, ac, av);
+        if (use_cache) {
+            cache_evict(&cache);
+        }
     }
 
 END:
     SHOW_TIMER("Finalization");
+    if (ctx->modules) {
+        for (const char **m = ctx->modules; *m; ++m) {
+            free((char *)*m);
+        }
+        free(ctx->modules);
+    }
     if (s) free(s);
+    if (parts) {
+        for (char **p = parts; *p; ++p) {
+            free(*p);
+        }
+        free(parts);
+    }
+    if (ctx->program) {
+        pgo_free(ctx->program->pgo);
+    }
     free_context(ctx);
     lexer_free(l);
     return ri;
@@ -13,6 +13,109 @@ static int alloc_force_gc_check(int fre, int alc)
     return (fre * 100 / alc) < ALLOC_GC_FORCE_RATIO;
 }
 
+int slab_ctz(uint64_t x)
+{
+#if defined(__GNUC__) && !defined(__MIRC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    if ((x & 0xFFFFFFFF) == 0) { n += 32; x >>= 32; }
+    if ((x & 0xFFFF) == 0) { n += 16; x >>= 16; }
+    if ((x & 0xFF) == 0) { n += 8; x >>= 8; }
+    if ((x & 0xF) == 0) { n += 4; x >>= 4; }
+    if ((x & 0x3) == 0) { n += 2; x >>= 2; }
+    if ((x & 0x1) == 0) { n += 1; }
+    return n;
+#endif
+}
+
+int slab_popcount(uint64_t x)
+{
+#if defined(__GNUC__) && !defined(__MIRC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/* The memory of a slab is zero-cleared by the platform layer. */
+static vmslab *alloc_slab(vmslab **slab, int size)
+{
+    vmslab *sl = (vmslab *)Slab_alloc_impl(SLAB_SIZE);
+    int hd = (sizeof(vmslab) + 15) & ~15;
+    sl->objs = (char *)sl + hd;
+    sl->inv = (((uint64_t)1 << 32) + size - 1) / size;
+    sl->size = size;
+    sl->n = sl->fre = (SLAB_SIZE - hd) / size;
+    sl->words = (sl->n + 63) / 64;
+    sl->next = *slab;
+    *slab = sl;
+    return sl;
+}
+
+/* Slabs are added for n objects at least, and the allocation restarts from the first slab. */
+#define ALLOC_SLABS(mem, n) { \
+    for (int k = 0; k < n; ) { \
+        vmslab *sl = alloc_slab(&(ctx->slab.mem), sizeof(vm##mem)); \
+        vm##mem *objs = (vm##mem *)sl->objs; \
+        for (int i = 0; i < sl->n; ++i) { \
+            IN_SLAB(&(objs[i])); \
+        } \
+        ctx->cnt.mem += sl->n; \
+        ctx->fre.mem += sl->n; \
+        k += sl->n; \
+    } \
+    ctx->alc.mem = ctx->slab.mem; \
+} \
+/**/
+
+/*
+ * The first free object is taken from the slab at the cursor, or NULL is returned when all slabs are full.
+ * The free bits of the last word are never after the end because the lowest one is taken.
+*/
+static void *slab_take(vmslab **cur)
+{
+    vmslab *sl = *cur;
+    while (sl && sl->fre == 0) {
+        sl = sl->next;
+    }
+    *cur = sl;
+    if (!sl) {
+        return NULL;
+    }
+    int w = sl->hint;
+    while (sl->used[w] == ~(uint64_t)0) {
+        ++w;
+    }
+    int b = slab_ctz(~(sl->used[w]));
+    sl->used[w] |= (uint64_t)1 << b;
+    sl->hint = w;
+    sl->fre--;
+    return sl->objs + (size_t)(w * 64 + b) * sl->size;
+}
+
+/* The object is returned to the slab, and 0 is returned when it has been already free. */
+static int slab_give(void *obj)
+{
+    vmslab *sl = SLAB_OF(obj);
+    int i = SLAB_INDEX(sl, obj);
+    int w = i >> 6;
+    uint64_t bit = (uint64_t)1 << (i & 63);
+    if ((sl->used[w] & bit) == 0) {
+        return 0;
+    }
+    sl->used[w] &= ~bit;
+    sl->old[w] &= ~bit;
+    sl->fre++;
+    if (w < sl->hint) {
+        sl->hint = w;
+    }
+    return 1;
+}
+
 static void setfrmvars(vmfrm *m, int vars)
 {
     if (vars < VARS_MIN_IN_FRAME) vars = VARS_MIN_IN_FRAME;
@@ -33,31 +136,17 @@ static void setfrmvars(vmfrm *m, int vars)
 // funcs
 static void alloc_fncs(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmfnc *v = (vmfnc *)calloc(1, sizeof(vmfnc));
-        v->nxt = ctx->alc.fnc.nxt;
-        v->chn = ctx->alc.fnc.chn;
-        ctx->alc.fnc.nxt = ctx->alc.fnc.chn = v;
-    }
+    ALLOC_SLABS(fnc, n);
 }
 
 vmfnc *alcfnc(vmctx *ctx, void *f, vmfrm *lex, const char *name, int args)
 {
-    if (ctx->alc.fnc.nxt == &(ctx->alc.fnc)) {
+    vmfnc *v = (vmfnc *)slab_take(&(ctx->alc.fnc));
+    if (!v) {
         alloc_fncs(ctx, ALC_UNIT);
-        ctx->cnt.fnc += ALC_UNIT;
-        ctx->fre.fnc += ALC_UNIT;
+        v = (vmfnc *)slab_take(&(ctx->alc.fnc));
     }
-    vmfnc *v = ctx->alc.fnc.nxt;
-    ctx->alc.fnc.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
     v->name = name;
-    v->liv = ctx->alc.fnc.liv;
-    ctx->alc.fnc.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
-    }
 
     v->f = f;
     v->lex = lex;
@@ -71,54 +160,30 @@ vmfnc *alcfnc(vmctx *ctx, void *f, vmfrm *lex, const char *name, int args)
 
 void pbakfnc(vmctx *ctx, vmfnc *p)
 {
-    if (p && !p->nxt) {
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
         if (p->vars) {
             free(p->vars);
             p->vars = NULL;
             p->varcnt = 0;
         }
 
-        p->nxt = ctx->alc.fnc.nxt;
-        ctx->alc.fnc.nxt = p;
+        RESET_GEN(p);
         ctx->fre.fnc++;
-
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.fnc.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
     }
 }
 
 // frames
 static void alloc_frms(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmfrm *v = (vmfrm *)calloc(1, sizeof(vmfrm));
-        v->nxt = ctx->alc.frm.nxt;
-        v->chn = ctx->alc.frm.chn;
-        ctx->alc.frm.nxt = ctx->alc.frm.chn = v;
-    }
+    ALLOC_SLABS(frm, n);
 }
 
 vmfrm *alcfrm(vmctx *ctx, vmfrm *lex, int args)
 {
-    if (ctx->alc.frm.nxt == &(ctx->alc.frm)) {
+    vmfrm *v = (vmfrm *)slab_take(&(ctx->alc.frm));
+    if (!v) {
         alloc_frms(ctx, ALC_UNIT_FRM);
-        ctx->cnt.frm += ALC_UNIT_FRM;
-        ctx->fre.frm += ALC_UNIT_FRM;
-    }
-    vmfrm *v = ctx->alc.frm.nxt;
-    ctx->alc.frm.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.frm.liv;
-    ctx->alc.frm.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmfrm *)slab_take(&(ctx->alc.frm));
     }
 
     v->lex = lex;
@@ -134,48 +199,83 @@ vmfrm *alcfrm(vmctx *ctx, vmfrm *lex, int args)
 
 void pbakfrm(vmctx *ctx, vmfrm *p)
 {
-    if (p && !p->nxt) {
-        p->nxt = ctx->alc.frm.nxt;
-        ctx->alc.frm.nxt = p;
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
+        RESET_GEN(p);
         ctx->fre.frm++;
+    }
+}
 
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.frm.liv = p->liv;
+static void relink_frm(vmctx *ctx, vmvar *v, vmfrm *s, vmfrm *m)
+{
+    if (v && v->t == VAR_FNC && v->f->lex == s) {
+        GC_WRITE_BARRIER_FNC(ctx, v->f);
+        v->f->lex = m;
+    }
+}
+
+static vmfrm *copy_frm(vmctx *ctx, vmfrm *s)
+{
+    vmfrm *m = alcfrm(ctx, s->lex, s->vars);
+    for (int i = 0; i < s->vars; ++i) {
+        m->v[i] = alcvar_initial(ctx);
+        if (s->v[i]) {
+            SHCOPY_VAR_TO(ctx, m->v[i], s->v[i]);
         }
-        if (p->liv) {
-            p->liv->prv = p->prv;
+        relink_frm(ctx, m->v[i], s, m);
+    }
+    return m;
+}
+
+static void relink_yfnc(vmctx *ctx, vmfnc *f, vmfrm *s, vmfrm *m)
+{
+    if (f->yfnc && f->yfnc->lex == s) {
+        GC_WRITE_BARRIER_FNC(ctx, f->yfnc);
+        f->yfnc->lex = m;
+    }
+}
+
+/* The frame on the stack is moved to the heap, and closures referring to it refer to the new frame. */
+vmfrm *heap_frm(vmctx *ctx, vmfrm *s, vmfnc *f)
+{
+    vmfrm *m = copy_frm(ctx, s);
+    for (int i = 0; i < f->varcnt; ++i) {
+        relink_frm(ctx, f->vars[i], s, m);
+    }
+    relink_yfnc(ctx, f, s, m);
+    vmfnc *y = f->yfnc;
+    if (y && y != f) {
+        /* The native loop of an array method holds the callback while it's yielding, see escape.c. */
+        for (int i = 0; i < y->varcnt; ++i) {
+            relink_frm(ctx, y->vars[i], s, m);
         }
+        relink_yfnc(ctx, y, s, m);
     }
+    return m;
+}
+
+/* The frame on the stack is moved to the heap before a closure referring to it is passed to unknown code. */
+vmfrm *escape_frm(vmctx *ctx, vmfrm *s, int sp)
+{
+    vmfrm *m = copy_frm(ctx, s);
+    for (int i = sp; i < ctx->vstkp; ++i) {
+        relink_frm(ctx, &(ctx->vstk[i]), s, m);
+    }
+    ctx->fstk[ctx->fstkp - 1] = m;
+    return m;
 }
 
 // string
 static void alloc_strs(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmstr *s = (vmstr *)calloc(1, sizeof(vmstr));
-        s->nxt = ctx->alc.str.nxt;
-        s->chn = ctx->alc.str.chn;
-        ctx->alc.str.nxt = ctx->alc.str.chn = s;
-    }
+    ALLOC_SLABS(str, n);
 }
 
 static vmstr *alcstr_pure(vmctx *ctx)
 {
-    if (ctx->alc.str.nxt == &(ctx->alc.str)) {
+    vmstr *v = (vmstr *)slab_take(&(ctx->alc.str));
+    if (!v) {
         alloc_strs(ctx, ALC_UNIT);
-        ctx->cnt.str += ALC_UNIT;
-        ctx->fre.str += ALC_UNIT;
-    }
-    vmstr *v = ctx->alc.str.nxt;
-    ctx->alc.str.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.str.liv;
-    ctx->alc.str.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmstr *)slab_take(&(ctx->alc.str));
     }
 
     ctx->fre.str--;
@@ -230,56 +330,69 @@ vmstr *alcstr_str(vmctx *ctx, const char *s)
     return alcstr_str_len(ctx, s, s ? strlen(s) : -1);
 }
 
+vmstr *alcstr_map(vmctx *ctx, vmmap *m, int64_t off)
+{
+    vmstr *v = alcstr_pure(ctx);
+    if (v->cap > 0) {
+        free(v->s);
+    }
+    v->cap = 0;
+    v->len = (int)(m->size - off);
+    v->s = v->hd = (char *)m->addr + off;
+    v->map = m;
+    m->ref++;
+    return v;
+}
+
 void pbakstr(vmctx *ctx, vmstr *p)
 {
-    if (p && !p->nxt) {
-        if (STR_UNIT < p->cap) {
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
+        if (p->map) {
+            pbakmap(p->map);
+            p->map = NULL;
+            p->s = p->hd = NULL;
+            p->len = p->cap = 0;
+        } else if (STR_UNIT < p->cap) {
             free(p->s);
             p->s = p->hd = NULL;
             p->len = p->cap = 0;
         }
 
-        p->nxt = ctx->alc.str.nxt;
-        ctx->alc.str.nxt = p;
+        RESET_GEN(p);
+        UNSHARE(p);
         ctx->fre.str++;
+    }
+}
 
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.str.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
+// mapped file
+vmmap *alcmap(void *addr, int64_t size)
+{
+    vmmap *m = (vmmap *)calloc(1, sizeof(vmmap));
+    m->addr = addr;
+    m->size = size;
+    return m;
+}
+
+void pbakmap(vmmap *m)
+{
+    if (--m->ref <= 0) {
+        File_unmap_impl(m->addr, m->size);
+        free(m);
     }
 }
 
 // binary
 static void alloc_bins(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmbin *s = (vmbin *)calloc(1, sizeof(vmbin));
-        s->nxt = ctx->alc.bin.nxt;
-        s->chn = ctx->alc.bin.chn;
-        ctx->alc.bin.nxt = ctx->alc.bin.chn = s;
-    }
+    ALLOC_SLABS(bin, n);
 }
 
 static vmbin *alcbin_pure(vmctx *ctx)
 {
-    if (ctx->alc.bin.nxt == &(ctx->alc.bin)) {
+    vmbin *v = (vmbin *)slab_take(&(ctx->alc.bin));
+    if (!v) {
         alloc_bins(ctx, ALC_UNIT);
-        ctx->cnt.bin += ALC_UNIT;
-        ctx->fre.bin += ALC_UNIT;
-    }
-    vmbin *v = ctx->alc.bin.nxt;
-    ctx->alc.bin.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.bin.liv;
-    ctx->alc.bin.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmbin *)slab_take(&(ctx->alc.bin));
     }
 
     ctx->fre.bin--;
@@ -337,56 +450,51 @@ vmbin *alcbin(vmctx *ctx)
     return alcbin_bin(ctx, NULL, 0);
 }
 
+vmbin *alcbin_map(vmctx *ctx, vmmap *m, int64_t off, int len)
+{
+    vmbin *v = alcbin_pure(ctx);
+    if (v->cap > 0) {
+        free(v->s);
+    }
+    v->cap = 0;
+    v->len = len;
+    v->s = v->hd = (uint8_t *)m->addr + off;
+    v->map = m;
+    m->ref++;
+    return v;
+}
+
 void pbakbin(vmctx *ctx, vmbin *p)
 {
-    if (p && !p->nxt) {
-        if (BIN_UNIT < p->cap) {
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
+        if (p->map) {
+            pbakmap(p->map);
+            p->map = NULL;
+            p->s = p->hd = NULL;
+            p->len = p->cap = 0;
+        } else if (BIN_UNIT < p->cap) {
             free(p->s);
             p->s = p->hd = NULL;
             p->len = p->cap = 0;
         }
 
-        p->nxt = ctx->alc.bin.nxt;
-        ctx->alc.bin.nxt = p;
+        RESET_GEN(p);
         ctx->fre.bin++;
-
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.bin.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
     }
 }
 
 // bgint
 static void alloc_bgis(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmbgi *bi = (vmbgi *)calloc(1, sizeof(vmbgi));
-        bi->nxt = ctx->alc.bgi.nxt;
-        bi->chn = ctx->alc.bgi.chn;
-        ctx->alc.bgi.nxt = ctx->alc.bgi.chn = bi;
-    }
+    ALLOC_SLABS(bgi, n);
 }
 
 static vmbgi *alcbgi_pure(vmctx *ctx)
 {
-    if (ctx->alc.bgi.nxt == &(ctx->alc.bgi)) {
+    vmbgi *v = (vmbgi *)slab_take(&(ctx->alc.bgi));
+    if (!v) {
         alloc_bgis(ctx, ALC_UNIT);
-        ctx->cnt.bgi += ALC_UNIT;
-        ctx->fre.bgi += ALC_UNIT;
-    }
-    vmbgi *v = ctx->alc.bgi.nxt;
-    ctx->alc.bgi.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.bgi.liv;
-    ctx->alc.bgi.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmbgi *)slab_take(&(ctx->alc.bgi));
     }
 
     ctx->fre.bgi--;
@@ -405,51 +513,27 @@ vmbgi *alcbgi_bigz(vmctx *ctx, BigZ bz)
 
 void pbakbgi(vmctx *ctx, vmbgi *p)
 {
-    if (p && !p->nxt) {
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
         BzFree(p->b);
         p->b = NULL;
 
-        p->nxt = ctx->alc.bgi.nxt;
-        ctx->alc.bgi.nxt = p;
+        RESET_GEN(p);
         ctx->fre.bgi++;
-
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.bgi.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
     }
 }
 
 // object
 static void alloc_objs(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmobj *h = (vmobj *)calloc(1, sizeof(vmobj));
-        h->nxt = ctx->alc.obj.nxt;
-        h->chn = ctx->alc.obj.chn;
-        ctx->alc.obj.nxt = ctx->alc.obj.chn = h;
-    }
+    ALLOC_SLABS(obj, n);
 }
 
 vmobj *alcobj(vmctx *ctx)
 {
-    if (ctx->alc.obj.nxt == &(ctx->alc.obj)) {
+    vmobj *v = (vmobj *)slab_take(&(ctx->alc.obj));
+    if (!v) {
         alloc_objs(ctx, ALC_UNIT);
-        ctx->cnt.obj += ALC_UNIT;
-        ctx->fre.obj += ALC_UNIT;
-    }
-    vmobj *v = ctx->alc.obj.nxt;
-    ctx->alc.obj.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.obj.liv;
-    ctx->alc.obj.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmobj *)slab_take(&(ctx->alc.obj));
     }
 
     v->idxsz = 0;
@@ -462,57 +546,40 @@ vmobj *alcobj(vmctx *ctx)
 
 void pbakobj(vmctx *ctx, vmobj *p)
 {
-    if (p && !p->nxt) {
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
         free(p->map);
         p->map = NULL;
-        p->hsz = 0;
+        p->hsz = p->hcap = p->hcnt = p->icap = 0;
+        free(p->hidx);
+        p->hidx = NULL;
+        p->ctrl = NULL;
         free(p->ary);
         p->ary = NULL;
+        free(p->ai);
+        p->ai = NULL;
+        p->akind = ARRAY_KIND_GENERIC;
         p->asz = 0;
         p->idxsz = 0;
         p->is_sysobj = 0;
+        p->spkey = 0;
 
-        p->nxt = ctx->alc.obj.nxt;
-        ctx->alc.obj.nxt = p;
+        RESET_GEN(p);
         ctx->fre.obj++;
-
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.obj.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
     }
 }
 
 // vars
 static void alloc_vars(vmctx *ctx, int n)
 {
-    while (n--) {
-        vmvar *v = (vmvar *)calloc(1, sizeof(vmvar));
-        v->nxt = ctx->alc.var.nxt;
-        v->chn = ctx->alc.var.chn;
-        ctx->alc.var.nxt = ctx->alc.var.chn = v;
-    }
+    ALLOC_SLABS(var, n);
 }
 
 static vmvar *alcvar_pure(vmctx *ctx, vartype t)
 {
-    if (ctx->alc.var.nxt == &(ctx->alc.var)) {
+    vmvar *v = (vmvar *)slab_take(&(ctx->alc.var));
+    if (!v) {
         alloc_vars(ctx, ALC_UNIT);
-        ctx->cnt.var += ALC_UNIT;
-        ctx->fre.var += ALC_UNIT;
-    }
-    vmvar *v = ctx->alc.var.nxt;
-    ctx->alc.var.nxt = v->nxt;
-    v->nxt = NULL;
-    v->prv = NULL;
-    v->liv = ctx->alc.var.liv;
-    ctx->alc.var.liv = v;
-    if (v->liv) {
-        v->liv->prv = v;
+        v = (vmvar *)slab_take(&(ctx->alc.var));
     }
 
     v->t = t;
@@ -600,6 +667,15 @@ vmvar *alcvar_bin(vmctx *ctx, const uint8_t *s, int len)
     return v;
 }
 
+vmvar *alcvar_voidp(vmctx *ctx, void *p, freep_func freep)
+{
+    vmvar *v = alcvar_pure(ctx, VAR_VOIDP);
+    v->vp = (vmptr *)calloc(1, sizeof(vmptr));
+    v->vp->p = p;
+    v->vp->freep = freep;
+    return v;
+}
+
 vmvar *alcvar_bgistr(vmctx *ctx, const char *s, int radix)
 {
     vmvar *v = alcvar_pure(ctx, VAR_BIG);
@@ -610,33 +686,22 @@ vmvar *alcvar_bgistr(vmctx *ctx, const char *s, int radix)
 
 void pbakvar(vmctx *ctx, vmvar *p)
 {
-    if (p && !p->nxt) {
-        if (p->o) {
-            p->o = NULL;
-        }
-        if (p->p) {
-            if (p->freep) {
-                p->freep(p->p);
-                p->freep = NULL;
-            } else {
-                free(p->p);
+    if (p && IS_IN_SLAB(p) && slab_give(p)) {
+        if (p->t == VAR_VOIDP && p->vp) {
+            if (p->vp->p) {
+                if (p->vp->freep) {
+                    p->vp->freep(p->vp->p);
+                } else {
+                    free(p->vp->p);
+                }
             }
-            p->p = NULL;
+            free(p->vp);
         }
+        p->o = NULL;    /* The payload including vp is cleared. */
 
-        p->nxt = ctx->alc.var.nxt;
-        ctx->alc.var.nxt = p;
+        RESET_GEN(p);
         UNHOLD(p);
         ctx->fre.var++;
-
-        if (p->prv) {
-            p->prv->liv = p->liv;
-        } else {
-            ctx->alc.var.liv = p->liv;
-        }
-        if (p->liv) {
-            p->liv->prv = p->prv;
-        }
     }
 }
 
@@ -691,21 +756,79 @@ vmvar *copy_var(vmctx *ctx, vmvar *src, int hold)
     return v;
 }
 
-// init
-void initialize_allocators(vmctx *ctx)
-{
-    ctx->alc.var.nxt = &(ctx->alc.var);
-    HOLD(ctx->alc.var.nxt);
-    ctx->alc.fnc.nxt = &(ctx->alc.fnc);
-    HOLD(ctx->alc.fnc.nxt);
-    ctx->alc.frm.nxt = &(ctx->alc.frm);
-    HOLD(ctx->alc.frm.nxt);
-    ctx->alc.str.nxt = &(ctx->alc.str);
-    HOLD(ctx->alc.str.nxt);
-    ctx->alc.bin.nxt = &(ctx->alc.bin);
-    HOLD(ctx->alc.bin.nxt);
-    ctx->alc.bgi.nxt = &(ctx->alc.bgi);
-    HOLD(ctx->alc.bgi.nxt);
-    ctx->alc.obj.nxt = &(ctx->alc.obj);
-    HOLD(ctx->alc.obj.nxt);
+// slabs
+#define ALLOC_GROW_RATIO (40)
+#define ALLOC_RELEASE_RATIO (60)
+
+/*
+ * The number of objects to be added so that the free objects will be ALLOC_GROW_RATIO percent at least.
+ * Without this, the live objects would be always over (100 - ALLOC_GC_FORCE_RATIO) percent
+ * and the GC would run at every check.
+*/
+static int alloc_grow_size(int fre, int alc, int unit)
+{
+    if (alc == 0 || (fre * 100 / alc) >= ALLOC_GROW_RATIO) {
+        return 0;
+    }
+    int n = (ALLOC_GROW_RATIO * alc - 100 * fre) / (100 - ALLOC_GROW_RATIO) + 1;
+    return ((n + unit - 1) / unit) * unit;
+}
+
+/*
+ * An empty slab is returned to the system only when the free ratio is still over ALLOC_RELEASE_RATIO without it.
+ * The buffers kept by free objects for reuse are released with it.
+*/
+#define ALLOC_RELEASE_EMPTY_SLABS(mem, blk) { \
+    vmslab **pp = &(ctx->slab.mem); \
+    while (*pp) { \
+        vmslab *sl = *pp; \
+        int n = sl->n; \
+        int rest = ctx->cnt.mem - n; \
+        if (sl->fre < n || rest <= 0 || (ctx->fre.mem - n) * 100 < ALLOC_RELEASE_RATIO * rest) { \
+            pp = &(sl->next); \
+            continue; \
+        } \
+        vm##mem *objs = (vm##mem *)sl->objs; \
+        for (int i = 0; i < n; ++i) { \
+            vm##mem *v = &(objs[i]); \
+            blk; \
+        } \
+        *pp = sl->next; \
+        Slab_free_impl(sl, SLAB_SIZE); \
+        ctx->cnt.mem -= n; \
+        ctx->fre.mem -= n; \
+    } \
+} \
+/**/
+
+void adjust_allocators(vmctx *ctx, int major)
+{
+    if (major) {
+        ALLOC_RELEASE_EMPTY_SLABS(var, {});
+        ALLOC_RELEASE_EMPTY_SLABS(fnc, {});
+        ALLOC_RELEASE_EMPTY_SLABS(frm, { free(v->v); });
+        ALLOC_RELEASE_EMPTY_SLABS(str, { free(v->s); });
+        ALLOC_RELEASE_EMPTY_SLABS(bin, { free(v->s); });
+        ALLOC_RELEASE_EMPTY_SLABS(bgi, { if (v->b) BzFree(v->b); });
+        ALLOC_RELEASE_EMPTY_SLABS(obj, {});
+    }
+
+    int n;
+    if ((n = alloc_grow_size(ctx->fre.var, ctx->cnt.var, ALC_UNIT)) > 0) alloc_vars(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.fnc, ctx->cnt.fnc, ALC_UNIT)) > 0) alloc_fncs(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.frm, ctx->cnt.frm, ALC_UNIT_FRM)) > 0) alloc_frms(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.str, ctx->cnt.str, ALC_UNIT)) > 0) alloc_strs(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.bin, ctx->cnt.bin, ALC_UNIT)) > 0) alloc_bins(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.bgi, ctx->cnt.bgi, ALC_UNIT)) > 0) alloc_bgis(ctx, n);
+    if ((n = alloc_grow_size(ctx->fre.obj, ctx->cnt.obj, ALC_UNIT)) > 0) alloc_objs(ctx, n);
+
+    /* The objects freed by the collection are taken again from the first slab. */
+    ctx->alc.var = ctx->slab.var;
+    ctx->alc.fnc = ctx->slab.fnc;
+    ctx->alc.frm = ctx->slab.frm;
+    ctx->alc.str = ctx->slab.str;
+    ctx->alc.bin = ctx->slab.bin;
+    ctx->alc.bgi = ctx->slab.bgi;
+    ctx->alc.obj = ctx->slab.obj;
 }
+
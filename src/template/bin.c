@@ -2,6 +2,18 @@
 #include "common.h"
 #endif
 
+/* The content of File.mmap() is copied out to the own buffer before it's modified. */
+void bin_unmap(vmbin *vs)
+{
+    int cap = (vs->len < BIN_UNIT) ? BIN_UNIT : ((vs->len / BIN_UNIT) * (BIN_UNIT << 1));
+    uint8_t *ns = (uint8_t *)calloc(cap, sizeof(uint8_t));
+    memcpy(ns, vs->hd, vs->len);
+    pbakmap(vs->map);
+    vs->map = NULL;
+    vs->s = vs->hd = ns;
+    vs->cap = cap;
+}
+
 static inline void bin_expand(vmbin *vs, int len)
 {
     int cap = (len < BIN_UNIT) ? BIN_UNIT : ((len / BIN_UNIT) * (BIN_UNIT << 1));
@@ -14,6 +26,9 @@ static inline void bin_expand(vmbin *vs, int len)
 
 static inline vmbin *bin_append_impl(vmctx *ctx, vmbin *vs, const uint8_t *s, int l)
 {
+    if (vs->map) {
+        bin_unmap(vs);
+    }
     if (vs->s < vs->hd) {
         memmove(vs->s, vs->hd, vs->len);
         vs->hd = vs->s;
@@ -41,6 +56,9 @@ static inline vmbin *bin_append_impl(vmctx *ctx, vmbin *vs, const uint8_t *s, in
 
 int bin_set_i(vmbin *vs, int idx, int64_t i)
 {
+    if (vs->map) {
+        bin_unmap(vs);
+    }
     if (vs->cap <= idx) {
         bin_expand(vs, idx);
     }
@@ -53,6 +71,9 @@ int bin_set_i(vmbin *vs, int idx, int64_t i)
 
 int bin_set_d(vmbin *vs, int idx, double *d)
 {
+    if (vs->map) {
+        bin_unmap(vs);
+    }
     if (vs->cap <= idx) {
         bin_expand(vs, idx);
     }
@@ -65,6 +86,9 @@ int bin_set_d(vmbin *vs, int idx, double *d)
 
 int bin_set(vmbin *vs, int idx, vmvar *v)
 {
+    if (vs->map) {
+        bin_unmap(vs);
+    }
     if (vs->cap <= idx) {
         bin_expand(vs, idx);
     }
@@ -108,6 +132,9 @@ vmbin *bin_append_ch(vmctx *ctx, vmbin *vs, const uint8_t ch)
 
 vmbin *bin_clear(vmbin *vs)
 {
+    if (vs->map) {
+        bin_unmap(vs);
+    }
     vs->s[0] = 0;
     vs->len = 0;
     return vs;
@@ -818,6 +818,7 @@ static const char *parse_fmt(const char *fmt, int *num, int *prec, int *sign, in
 
 static void format_impl(vmctx *ctx, vmstr *r, vmobj *o, const char *fmt)
 {
+    array_generic(ctx, o);
     int vallen = o->asz;
     int pos = 0;
 
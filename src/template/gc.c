@@ -4,364 +4,498 @@
 
 /***************************************************************************
  * Garbage Collection
+ *
+ * The collector is generational and non-moving.
+ * Objects are allocated in slabs, and each slab has the bitmaps of allocated, marked, and old objects.
+ * Every object surviving a collection is promoted to the old generation, and a minor collection
+ * scans and sweeps only the allocated objects which are not old. The sweep walks the bitmaps word by word,
+ * so that it touches only the objects to be freed or promoted.
+ * A variable and a frame on the stack are not in a slab, and they are marked by the flag.
+ *
+ * Old objects are treated as alive in a minor collection. The references from old objects
+ * to young objects are found only from the remembered ones, which are registered by the write barrier.
+ *  - Old vmvar: the barrier is emitted by the translator after a store to a variable which could be old,
+ *    that is a variable of a frame, a lexical variable, or the return value. The store to an element
+ *    in place, the result of a call, and the increment to a big integer have it in the macros.
+ *  - Old vmobj/vmfnc: the barrier is in array/hashmap setters and yield operations.
+ * vmfrm needs nothing because its slots are filled only right after the frame is created.
+ * A minor collection can run only at the top of a function or a loop, so a native function calls a function
+ * by NATIVE_CALL, which remembers the result of the native function before the call.
+ * With GC_DEBUG, a collection runs very often and it aborts after a minor mark when an old object
+ * refers to a young one which is not marked, that is, a write barrier is missing.
+ *
+ * A major collection is the full mark and sweep as before.
+ *
+ * Every collection is timed per phase for the telemetry. The pause time goes to the histogram,
+ * and a line is written to the trace file when --gc-trace is specified.
 */
-void mark_frm(vmfrm *m);
-void mark_var(vmvar *v);
+void mark_fnc(vmfnc *f, int minor);
+void mark_frm(vmfrm *m, int minor);
+void mark_var(vmvar *v, int minor);
 
-void unmark_all(vmctx *ctx)
+#define GC_SKIP(minor, obj) ((minor) && IS_OLD(obj))
+#define GC_MARK(obj) (IS_IN_SLAB(obj) ? gc_mark_slab(obj) : (IS_MARKED(obj) ? 1 : (MARK(obj), 0)))
+
+/* Runs blk for each allocated object v, which is only a young one in a minor collection. */
+#define GC_EACH_OBJECT(mem, minor, blk) \
+    for (vmslab *sl = ctx->slab.mem; sl; sl = sl->next) { \
+        vm##mem *objs = (vm##mem *)sl->objs; \
+        for (int w = 0; w < sl->words; ++w) { \
+            uint64_t bits = (minor) ? (sl->used[w] & ~(sl->old[w])) : sl->used[w]; \
+            while (bits) { \
+                vm##mem *v = &(objs[w * 64 + slab_ctz(bits)]); \
+                bits &= bits - 1; \
+                blk; \
+            } \
+        } \
+    } \
+/**/
+
+/* The object in a slab is marked, and 1 is returned when it has been already marked. */
+static int gc_mark_slab(void *obj)
 {
-    int vstkp = ctx->vstkp;
-    vmvar *vstk = ctx->vstk;
-    while (vstkp--) {
-        UNMARK(vstk);
-        ++vstk;
-    }
+    vmslab *sl = SLAB_OF(obj);
+    int i = SLAB_INDEX(sl, obj);
+    uint64_t bit = (uint64_t)1 << (i & 63);
+    uint64_t *w = &(sl->mark[i >> 6]);
+    if (*w & bit) {
+        return 1;
+    }
+    *w |= bit;
+    return 0;
+}
 
-    vmstr *s = ctx->alc.str.liv;
-    while (s) {
-        UNMARK(s);
-        s = s->liv;
-    }
-    vmbin *bn = ctx->alc.bin.liv;
-    while (bn) {
-        UNMARK(bn);
-        bn = bn->liv;
+void gc_remember_obj(vmctx *ctx, vmobj *o)
+{
+    if (ctx->gc.robjn >= ctx->gc.robjsz) {
+        ctx->gc.robjsz = ctx->gc.robjsz ? (ctx->gc.robjsz << 1) : ALC_UNIT;
+        ctx->gc.robj = (vmobj **)realloc(ctx->gc.robj, ctx->gc.robjsz * sizeof(vmobj *));
     }
-    vmbgi *bi = ctx->alc.bgi.liv;
-    while (bi) {
-        UNMARK(bi);
-        bi = bi->liv;
+    REMEMBER(o);
+    ctx->gc.robj[ctx->gc.robjn++] = o;
+}
+
+void gc_remember_fnc(vmctx *ctx, vmfnc *f)
+{
+    if (ctx->gc.rfncn >= ctx->gc.rfncsz) {
+        ctx->gc.rfncsz = ctx->gc.rfncsz ? (ctx->gc.rfncsz << 1) : ALC_UNIT;
+        ctx->gc.rfnc = (vmfnc **)realloc(ctx->gc.rfnc, ctx->gc.rfncsz * sizeof(vmfnc *));
     }
-    vmobj *h = ctx->alc.obj.liv;
-    while (h) {
-        UNMARK(h);
-        h = h->liv;
+    REMEMBER(f);
+    ctx->gc.rfnc[ctx->gc.rfncn++] = f;
+}
+
+void gc_remember_var(vmctx *ctx, vmvar *v)
+{
+    if (ctx->gc.rvarn >= ctx->gc.rvarsz) {
+        ctx->gc.rvarsz = ctx->gc.rvarsz ? (ctx->gc.rvarsz << 1) : ALC_UNIT;
+        ctx->gc.rvar = (vmvar **)realloc(ctx->gc.rvar, ctx->gc.rvarsz * sizeof(vmvar *));
     }
-    vmvar *v = ctx->alc.var.liv;
-    while (v) {
-        UNMARK(v);
-        v = v->liv;
+    REMEMBER(v);
+    ctx->gc.rvar[ctx->gc.rvarn++] = v;
+}
+
+static void forget_all(vmctx *ctx)
+{
+    for (int i = 0; i < ctx->gc.robjn; ++i) {
+        FORGET(ctx->gc.robj[i]);
     }
-    vmfnc *f = ctx->alc.fnc.liv;
-    while (f) {
-        UNMARK(f);
-        f = f->liv;
+    ctx->gc.robjn = 0;
+    for (int i = 0; i < ctx->gc.rfncn; ++i) {
+        FORGET(ctx->gc.rfnc[i]);
     }
-    vmfrm *m = ctx->alc.frm.liv;
-    while (m) {
-        UNMARK(m);
-        m = m->liv;
+    ctx->gc.rfncn = 0;
+    for (int i = 0; i < ctx->gc.rvarn; ++i) {
+        FORGET(ctx->gc.rvar[i]);
     }
+    ctx->gc.rvarn = 0;
 }
 
-void mark_fnc(vmfnc *f)
+void unmark_all(vmctx *ctx, int minor)
 {
-    if (!f) {
-        return;
+    int vstkp = ctx->vstkp;
+    vmvar *vstk = ctx->vstk;
+    while (vstkp--) {
+        UNMARK(vstk);
+        ++vstk;
     }
-    if (IS_MARKED(f)) {
-        return;
+
+    /* The marks of old objects are also cleared because it's just a bitmap. */
+    #define GC_UNMARK_SLABS(mem) \
+        for (vmslab *sl = ctx->slab.mem; sl; sl = sl->next) { \
+            memset(sl->mark, 0x00, sl->words * sizeof(uint64_t)); \
+        } \
+    /**/
+    GC_UNMARK_SLABS(str)
+    GC_UNMARK_SLABS(bin)
+    GC_UNMARK_SLABS(bgi)
+    GC_UNMARK_SLABS(obj)
+    GC_UNMARK_SLABS(var)
+    GC_UNMARK_SLABS(fnc)
+    GC_UNMARK_SLABS(frm)
+    #undef GC_UNMARK_SLABS
+    /* A frame on the stack is not in a slab. */
+    for (int i = 0; i < ctx->fstkp; ++i) {
+        UNMARK(ctx->fstk[i]);
     }
+}
 
-    MARK(f);
+static void mark_fnc_refs(vmfnc *f, int minor)
+{
     if (f->yfnc) {
-        mark_fnc(f->yfnc);
+        mark_fnc(f->yfnc, minor);
     }
     if (f->frm) {
-        mark_frm(f->frm);
+        mark_frm(f->frm, minor);
     }
     if (f->lex) {
-        mark_frm(f->lex);
+        mark_frm(f->lex, minor);
     }
     if (f->varcnt > 0) {
         for (int i = 0; i < f->varcnt; ++i) {
-            mark_var(f->vars[i]);
+            mark_var(f->vars[i], minor);
         }
     }
 }
 
-void mark_obj(vmobj *h)
+void mark_fnc(vmfnc *f, int minor)
 {
-    if (!h) {
+    if (!f) {
+        return;
+    }
+    if (GC_SKIP(minor, f) || GC_MARK(f)) {
         return;
     }
-    MARK(h);
 
-    vmvar *v = h->map;
+    mark_fnc_refs(f, minor);
+}
+
+static void mark_obj_refs(vmobj *h, int minor)
+{
+    vmhent *v = h->map;
     if (v) {
         for (int i = 0; i < h->hsz; ++i) {
-            if (v[i].s) {
-                MARK(v[i].s);
-            }
             if (v[i].a) {
-                mark_var(v[i].a);
+                mark_var(v[i].a, minor);
             }
         }
     }
+    /* Packed elements have no reference, and ary is NULL then. */
     vmvar **a = h->ary;
     if (a) {
         for (int i = 0; i < h->idxsz; ++i) {
             if (a[i]) {
-                mark_var(a[i]);
+                mark_var(a[i], minor);
             }
         }
     }
 }
 
-void mark_var(vmvar *v)
+void mark_obj(vmobj *h, int minor)
 {
-    if (!v) {
+    if (!h) {
         return;
     }
-    if (IS_MARKED(v)) {
+    if (GC_SKIP(minor, h) || GC_MARK(h)) {
         return;
     }
+    mark_obj_refs(h, minor);
+}
 
-    MARK(v);
-    if (v->f) {
-        if (v->t == VAR_FNC) {
-            mark_fnc(v->f);
-        } else {
-            v->f = NULL;
+static void mark_var_refs(vmvar *v, int minor)
+{
+    switch (v->t) {
+    case VAR_FNC:
+        if (v->f) {
+            mark_fnc(v->f, minor);
         }
-    }
-    if (v->o) {
-        if (v->t == VAR_OBJ) {
-            mark_obj(v->o);
-        } else {
-            v->o = NULL;
+        break;
+    case VAR_OBJ:
+    case VAR_ARYREF:
+        if (v->o) {
+            mark_obj(v->o, minor);
         }
-    }
-    if (v->s) {
-        if (v->t == VAR_STR) {
-            MARK(v->s);
-        } else {
-            v->s = NULL;
+        break;
+    case VAR_STR:
+    case VAR_STRREF:
+        if (v->s) {
+            (void)GC_MARK(v->s);
         }
-    }
-    if (v->bn) {
-        if (v->t == VAR_BIN) {
-            MARK(v->bn);
-        } else {
-            v->bn = NULL;
+        break;
+    case VAR_BIN:
+    case VAR_BINREF:
+        if (v->bn) {
+            (void)GC_MARK(v->bn);
         }
-    }
-    if (v->bi) {
-        if (v->t == VAR_BIG) {
-            MARK(v->bi);
-        } else {
-            v->bi = NULL;
+        break;
+    case VAR_BIG:
+        if (v->bi) {
+            (void)GC_MARK(v->bi);
         }
-    }
-    if (v->p) {
-        if (v->t != VAR_VOIDP) {
-            if (v->freep) {
-                v->freep(v->p);
-                v->freep = NULL;
-            } else {
-                free(v->p);
-            }
-            v->p = NULL;
+        break;
+    case VAR_LVALUE:
+        if (v->a) {
+            mark_var(v->a, minor);
         }
+        break;
+    default:
+        break;
     }
-    if (v->a) {
-        mark_var(v->a);
+}
+
+void mark_var(vmvar *v, int minor)
+{
+    if (!v) {
+        return;
     }
+    if (GC_SKIP(minor, v) || GC_MARK(v)) {
+        return;
+    }
+
+    mark_var_refs(v, minor);
 }
 
-void mark_frm(vmfrm *m)
+void mark_frm(vmfrm *m, int minor)
 {
     if (!m) {
         return;
     }
-    if (IS_MARKED(m)) {
+    if (GC_SKIP(minor, m) || GC_MARK(m)) {
         return;
     }
-    MARK(m);
 
     if (m->lex) {
-        mark_frm(m->lex);
+        mark_frm(m->lex, minor);
     }
 
     if (m->v) {
         for (int i = 0; i < m->vars; ++i) {
-            mark_var(m->v[i]);
+            mark_var(m->v[i], minor);
         }
     }
 }
 
-void premark_all(vmctx *ctx)
+void premark_all(vmctx *ctx, int minor)
 {
-    vmstr *s = ctx->alc.str.liv;
-    while (s) {
-        vmstr *n = s->liv;
-        if (IS_HELD(s)) {
-            MARK(s);
-        }
-        s = n;
-    }
-    vmbin *bn = ctx->alc.bin.liv;
-    while (bn) {
-        vmbin *n = bn->liv;
-        if (IS_HELD(bn)) {
-            MARK(bn);
-        }
-        bn = n;
-    }
-    vmbgi *bi = ctx->alc.bgi.liv;
-    while (bi) {
-        vmbgi *n = bi->liv;
-        if (IS_HELD(bi)) {
-            MARK(bi);
-        }
-        bi = n;
-    }
-    vmobj *h = ctx->alc.obj.liv;
-    while (h) {
-        vmobj *n = h->liv;
-        if (IS_HELD(h)) {
-            mark_obj(h);
-        }
-        h = n;
-    }
-    vmvar *v = ctx->alc.var.liv;
-    while (v) {
-        vmvar *n = v->liv;
-        if (IS_HELD(v)) {
-            mark_var(v);
-        }
-        v = n;
+    GC_EACH_OBJECT(str, minor, { if (IS_HELD(v)) (void)GC_MARK(v); });
+    GC_EACH_OBJECT(bin, minor, { if (IS_HELD(v)) (void)GC_MARK(v); });
+    GC_EACH_OBJECT(bgi, minor, { if (IS_HELD(v)) (void)GC_MARK(v); });
+    GC_EACH_OBJECT(obj, minor, { if (IS_HELD(v)) mark_obj(v, minor); });
+    GC_EACH_OBJECT(var, minor, { if (IS_HELD(v)) mark_var(v, minor); });
+    GC_EACH_OBJECT(fnc, minor, { if (IS_HELD(v)) mark_fnc(v, minor); });
+    GC_EACH_OBJECT(frm, minor, { if (IS_HELD(v)) mark_frm(v, minor); });
+}
+
+static void mark_old_to_young(vmctx *ctx)
+{
+    for (int i = 0; i < ctx->gc.rvarn; ++i) {
+        mark_var_refs(ctx->gc.rvar[i], 1);
     }
-    vmfnc *f = ctx->alc.fnc.liv;
-    while (f) {
-        vmfnc *n = f->liv;
-        if (IS_HELD(f)) {
-            mark_fnc(f);
-        }
-        f = n;
+    for (int i = 0; i < ctx->gc.robjn; ++i) {
+        mark_obj_refs(ctx->gc.robj[i], 1);
     }
-    vmfrm *m = ctx->alc.frm.liv;
-    while (m) {
-        vmfrm *n = m->liv;
-        if (IS_HELD(m)) {
-            mark_frm(m);
-        }
-        m = n;
+    for (int i = 0; i < ctx->gc.rfncn; ++i) {
+        mark_fnc_refs(ctx->gc.rfnc[i], 1);
     }
 }
 
-void mark_all(vmctx *ctx)
+void mark_all(vmctx *ctx, int minor)
 {
-    premark_all(ctx);
-    mark_var(ctx->except);
-    mark_fnc(ctx->callee);
-    mark_fnc(ctx->methodmissing);
+    if (minor) {
+        mark_old_to_young(ctx);
+    }
+    mark_var(ctx->except, minor);
+    mark_fnc(ctx->callee, minor);
+    mark_fnc(ctx->methodmissing, minor);
+    mark_obj(ctx->exports, minor);
 
     int fstkp = ctx->fstkp;
     vmfrm **m = ctx->fstk;
     while (fstkp--) {
-        mark_frm(*m);
+        mark_frm(*m, minor);
         ++m;
     }
 
     int vstkp = ctx->vstkp;
     vmvar *v = ctx->vstk;
     while (vstkp--) {
-        if (v) mark_var(v);
+        if (v) mark_var(v, minor);
         ++v;
     }
 }
 
-void sweep(vmctx *ctx)
+#ifdef GC_DEBUG
+/*
+ * Every young object referred to by an old one should have been marked through the remembered set
+ * after the mark phase of a minor collection. An unmarked one means a missing write barrier.
+*/
+#define GC_IS_LOST(obj) ((obj) && IS_IN_SLAB(obj) && !IS_OLD(obj) && !gc_is_marked_slab(obj))
+
+static int gc_is_marked_slab(void *obj)
 {
-    int sliv = 0;
-    int sc = 0;
-    vmstr *s = ctx->alc.str.liv;
-    while (s) {
-        ++sliv;
-        vmstr *n = s->liv;
-        if (!IS_MARKED(s)) {
-            ++sc;
-            pbakstr(ctx, s);
+    vmslab *sl = SLAB_OF(obj);
+    int i = SLAB_INDEX(sl, obj);
+    return (sl->mark[i >> 6] & ((uint64_t)1 << (i & 63))) != 0;
+}
+
+static int gc_var_is_lost(vmvar *v)
+{
+    switch (v->t) {
+    case VAR_FNC:
+        return GC_IS_LOST(v->f);
+    case VAR_OBJ:
+    case VAR_ARYREF:
+        return GC_IS_LOST(v->o);
+    case VAR_STR:
+    case VAR_STRREF:
+        return GC_IS_LOST(v->s);
+    case VAR_BIN:
+    case VAR_BINREF:
+        return GC_IS_LOST(v->bn);
+    case VAR_BIG:
+        return GC_IS_LOST(v->bi);
+    case VAR_LVALUE:
+        return GC_IS_LOST(v->a);
+    default:
+        break;
+    }
+    return 0;
+}
+
+static int gc_obj_is_lost(vmobj *h)
+{
+    for (int i = 0; h->map && i < h->hsz; ++i) {
+        if (GC_IS_LOST(h->map[i].a)) {
+            return 1;
         }
-        s = n;
     }
-    int bnliv = 0;
-    int bnc = 0;
-    vmbin *bn = ctx->alc.bin.liv;
-    while (bn) {
-        ++bnliv;
-        vmbin *n = bn->liv;
-        if (!IS_MARKED(bn)) {
-            ++bnc;
-            pbakbin(ctx, bn);
+    for (int i = 0; h->ary && i < h->idxsz; ++i) {
+        if (GC_IS_LOST(h->ary[i])) {
+            return 1;
         }
-        bn = n;
     }
-    int biliv = 0;
-    int bic = 0;
-    vmbgi *bi = ctx->alc.bgi.liv;
-    while (bi) {
-        ++biliv;
-        vmbgi *n = bi->liv;
-        if (!IS_MARKED(bi)) {
-            ++bic;
-            pbakbgi(ctx, bi);
+    return 0;
+}
+
+static int gc_fnc_is_lost(vmfnc *f)
+{
+    if (GC_IS_LOST(f->yfnc) || GC_IS_LOST(f->frm) || GC_IS_LOST(f->lex)) {
+        return 1;
+    }
+    for (int i = 0; i < f->varcnt; ++i) {
+        if (GC_IS_LOST(f->vars[i])) {
+            return 1;
         }
-        bi = n;
     }
-    int hliv = 0;
-    int hc = 0;
-    vmobj *h = ctx->alc.obj.liv;
-    while (h) {
-        ++hliv;
-        vmobj *n = h->liv;
-        if (!IS_MARKED(h)) {
-            ++hc;
-            pbakobj(ctx, h);
+    return 0;
+}
+
+static int gc_frm_is_lost(vmfrm *m)
+{
+    if (GC_IS_LOST(m->lex)) {
+        return 1;
+    }
+    for (int i = 0; m->v && i < m->vars; ++i) {
+        if (GC_IS_LOST(m->v[i])) {
+            return 1;
         }
-        h = n;
     }
+    return 0;
+}
+
+static void gc_verify_old_to_young(vmctx *ctx)
+{
+    #define GC_VERIFY_OLD(mem, check) \
+        GC_EACH_OBJECT(mem, 0, { \
+            if (IS_OLD(v) && check(v)) { \
+                fprintf(stderr, "GC_DEBUG: an old " #mem " %p refers to a young object not marked in minor GC %d\n", \
+                    (void *)v, ctx->gc.minor + 1); \
+                abort(); \
+            } \
+        }) \
+    /**/
+    GC_VERIFY_OLD(var, gc_var_is_lost)
+    GC_VERIFY_OLD(obj, gc_obj_is_lost)
+    GC_VERIFY_OLD(fnc, gc_fnc_is_lost)
+    GC_VERIFY_OLD(frm, gc_frm_is_lost)
+    #undef GC_VERIFY_OLD
+}
+#endif
+
+/*
+ * The objects allocated and not marked are freed, and the marked ones are promoted to the old generation.
+ * The old objects are out of the scan in a minor collection.
+*/
+#define GC_SWEEP_SLABS(mem, liv, cnt) \
+    for (vmslab *sl = ctx->slab.mem; sl; sl = sl->next) { \
+        vm##mem *objs = (vm##mem *)sl->objs; \
+        for (int w = 0; w < sl->words; ++w) { \
+            uint64_t young = minor ? (sl->used[w] & ~(sl->old[w])) : sl->used[w]; \
+            if (!young) { \
+                continue; \
+            } \
+            uint64_t dead = young & ~(sl->mark[w]); \
+            uint64_t promoted = young & sl->mark[w] & ~(sl->old[w]); \
+            liv += slab_popcount(young); \
+            cnt += slab_popcount(dead); \
+            sl->old[w] |= promoted; \
+            while (promoted) { \
+                OLD(&(objs[w * 64 + slab_ctz(promoted)])); \
+                promoted &= promoted - 1; \
+            } \
+            while (dead) { \
+                pbak##mem(ctx, &(objs[w * 64 + slab_ctz(dead)])); \
+                dead &= dead - 1; \
+            } \
+        } \
+    } \
+/**/
+
+void sweep(vmctx *ctx, int minor)
+{
+    int sliv = 0;
+    int sc = 0;
+    GC_SWEEP_SLABS(str, sliv, sc);
+    int bnliv = 0;
+    int bnc = 0;
+    GC_SWEEP_SLABS(bin, bnliv, bnc);
+    int biliv = 0;
+    int bic = 0;
+    GC_SWEEP_SLABS(bgi, biliv, bic);
+    int hliv = 0;
+    int hc = 0;
+    GC_SWEEP_SLABS(obj, hliv, hc);
     int vliv = 0;
     int vc = 0;
-    vmvar *v = ctx->alc.var.liv;
-    while (v) {
-        ++vliv;
-        vmvar *n = v->liv;
-        if (!IS_MARKED(v)) {
-            ++vc;
-            pbakvar(ctx, v);
-        }
-        v = n;
-    }
+    GC_SWEEP_SLABS(var, vliv, vc);
     int fliv = 0;
     int fc = 0;
-    vmfnc *f = ctx->alc.fnc.liv;
-    while (f) {
-        ++fliv;
-        vmfnc *n = f->liv;
-        if (!IS_MARKED(f)) {
-            ++fc;
-            pbakfnc(ctx, f);
-        }
-        f = n;
-    }
+    GC_SWEEP_SLABS(fnc, fliv, fc);
     int mliv = 0;
     int mc = 0;
-    vmfrm *m = ctx->alc.frm.liv;
-    while (m) {
-        ++mliv;
-        vmfrm *n = m->liv;
-        if (!IS_MARKED(m)) {
-            ++mc;
-            pbakfrm(ctx, m);
-        }
-        m = n;
-    }
-    ctx->sweep = sc + bic + hc + vc + fc + mc;
+    GC_SWEEP_SLABS(frm, mliv, mc);
+    int scanned = sliv + bnliv + biliv + hliv + vliv + fliv + mliv;
+    ctx->sweep = sc + bnc + bic + hc + vc + fc + mc;
+    ctx->gcstat.swept.str = sc;
+    ctx->gcstat.swept.bin = bnc;
+    ctx->gcstat.swept.bgi = bic;
+    ctx->gcstat.swept.obj = hc;
+    ctx->gcstat.swept.var = vc;
+    ctx->gcstat.swept.fnc = fc;
+    ctx->gcstat.swept.frm = mc;
     ++(ctx->gccnt);
+    if (minor) {
+        ++(ctx->gc.minor);
+        ++(ctx->gc.since_major);
+        ctx->gc.promoted += scanned - ctx->sweep;
+    } else {
+        ++(ctx->gc.major);
+        ctx->gc.since_major = 0;
+        ctx->gc.promoted = 0;
+        ctx->gc.oldbase = scanned - ctx->sweep;
+    }
     if (ctx->verbose && ctx->sweep > 0) {
-        printf("GC %d done, vstk(%d), ", ctx->gccnt, ctx->vstkp);
+        printf("%s GC %d done, vstk(%d), ", minor ? "Minor" : "Major", minor ? ctx->gc.minor : ctx->gc.major, ctx->vstkp);
         if (sc > 0) {
             printf("(str:%d,scan:%d)", sc, sliv);
         }
@@ -385,13 +519,127 @@ void sweep(vmctx *ctx)
         }
         printf("\n");
     }
+    adjust_allocators(ctx, !minor);
+}
+
+/* Upper bounds of the histogram buckets in milliseconds, the last bucket has no bound. */
+static const double gc_hist_bounds[GC_HIST_SIZE - 1] = { 0.1, 0.5, 1, 5, 10, 50, 100 };
+
+double gc_hist_bound(int i)
+{
+    return (0 <= i && i < GC_HIST_SIZE - 1) ? gc_hist_bounds[i] : -1;
+}
+
+static double gc_now(vmctx *ctx)
+{
+    return SystemTimer_elapsed_impl(ctx->gcstat.timer) * 1000.0;
+}
+
+static void gc_trace(vmctx *ctx, int minor, double *t)
+{
+    if (!ctx->gcstat.trace) {
+        ctx->gcstat.trace = fopen(ctx->gcstat.tracefile, "w");
+        if (!ctx->gcstat.trace) {
+            ctx->gcstat.tracefile = NULL;
+            return;
+        }
+    }
+    fprintf(ctx->gcstat.trace,
+        "gc=%d kind=%s time=%.3f unmark=%.3f premark=%.3f mark=%.3f sweep=%.3f total=%.3f "
+        "str=%d bin=%d bgi=%d obj=%d var=%d fnc=%d frm=%d\n",
+        ctx->gccnt, minor ? "minor" : "major", t[0],
+        t[1] - t[0], t[2] - t[1], t[3] - t[2], t[4] - t[3], t[4] - t[0],
+        ctx->gcstat.swept.str, ctx->gcstat.swept.bin, ctx->gcstat.swept.bgi, ctx->gcstat.swept.obj,
+        ctx->gcstat.swept.var, ctx->gcstat.swept.fnc, ctx->gcstat.swept.frm);
+}
+
+static void gc_run(vmctx *ctx, int minor)
+{
+    double t[5];
+    t[0] = gc_now(ctx);
+    unmark_all(ctx, minor);
+    t[1] = gc_now(ctx);
+    premark_all(ctx, minor);
+    t[2] = gc_now(ctx);
+    mark_all(ctx, minor);
+#ifdef GC_DEBUG
+    if (minor) {
+        gc_verify_old_to_young(ctx);
+    }
+#endif
+    t[3] = gc_now(ctx);
+    sweep(ctx, minor);
+    t[4] = gc_now(ctx);
+
+    double pause = t[4] - t[0];
+    int h = 0;
+    while (h < GC_HIST_SIZE - 1 && gc_hist_bounds[h] < pause) {
+        ++h;
+    }
+    ++(ctx->gcstat.hist[h]);
+    ctx->gcstat.total += pause;
+    if (ctx->gcstat.max < pause) {
+        ctx->gcstat.max = pause;
+    }
+    if (ctx->gcstat.tracefile) {
+        gc_trace(ctx, minor, t);
+    }
+}
+
+void gc_snapshot(vmctx *ctx, vmgcstat *st)
+{
+    st->count = ctx->gccnt;
+    st->minor = ctx->gc.minor;
+    st->major = ctx->gc.major;
+    st->total = ctx->gcstat.total;
+    st->max = ctx->gcstat.max;
+    for (int i = 0; i < GC_HIST_SIZE; ++i) {
+        st->hist[i] = ctx->gcstat.hist[i];
+    }
+    st->strbytes = 0;
+    GC_EACH_OBJECT(str, 0, { st->strbytes += v->cap; });
+    st->binbytes = 0;
+    GC_EACH_OBJECT(bin, 0, { st->binbytes += v->cap; });
+    #define GC_SNAPSHOT_COUNT(type) \
+        st->live.type = ctx->cnt.type - ctx->fre.type; \
+        st->fre.type = ctx->fre.type; \
+    /**/
+    GC_SNAPSHOT_COUNT(var)
+    GC_SNAPSHOT_COUNT(fnc)
+    GC_SNAPSHOT_COUNT(frm)
+    GC_SNAPSHOT_COUNT(str)
+    GC_SNAPSHOT_COUNT(bin)
+    GC_SNAPSHOT_COUNT(bgi)
+    GC_SNAPSHOT_COUNT(obj)
+    #undef GC_SNAPSHOT_COUNT
+}
+
+void minor_gc(vmctx *ctx)
+{
+    ctx->tick = TICK_UNIT;
+    ctx->sweep = 0;
+    gc_run(ctx, 1);
+    forget_all(ctx);
 }
 
 void mark_and_sweep(vmctx *ctx)
 {
     ctx->tick = TICK_UNIT;
     ctx->sweep = 0;
-    unmark_all(ctx);
-    mark_all(ctx);
-    sweep(ctx);
+    forget_all(ctx);
+    gc_run(ctx, 0);
+}
+
+void collect_garbage(vmctx *ctx)
+{
+    /*
+     * A major collection is done when minor collections have been repeated for a while,
+     * or when the old generation has grown too much since the last major collection.
+     */
+    if (ctx->gc.since_major >= GC_MINOR_MAX ||
+            ctx->gc.promoted > (ctx->gc.oldbase + ALC_UNIT) * GC_PROMOTE_RATIO / 100) {
+        mark_and_sweep(ctx);
+    } else {
+        minor_gc(ctx);
+    }
 }
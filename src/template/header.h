@@ -44,15 +44,21 @@ extern FILE *get_stdio_stderr(void);
 
 extern FILE *fopen(const char *, const char *);
 extern int fclose(FILE *);
+extern size_t fread(void *, size_t, size_t, FILE *);
+extern int fputc(int, FILE *);
 extern int fprintf(FILE *, const char *, ...);
 extern int printf(const char *, ...);
 extern int sprintf(const char *, const char *, ...);
 extern int64_t strtoll(const char*, char**, int);
 extern double strtod(const char *, char **);
+extern double fmod(double, double);
+extern double pow(double, double);
 extern void *malloc(size_t);
 extern void *calloc(size_t, size_t);
 extern void *memset(void *, int, size_t);
 extern void *memcpy(void *, const void *, size_t);
+extern void *memmove(void *, const void *, size_t);
+extern void *memchr(const void *, int, size_t);
 extern void free(void *);
 extern char *strcpy(char *, const char *);
 extern char *strncpy(char *, const char *, size_t);
@@ -96,32 +102,51 @@ enum {
 #define VAR_STACK_SIZE (1024*16)
 #define ALC_UNIT (1024)
 #define ALC_UNIT_FRM (1024)
+#ifdef GC_DEBUG
+#define TICK_UNIT (97)         /* A collection runs very often to check the write barrier. */
+#else
 #define TICK_UNIT (1024*64)
+#endif
 #define STR_UNIT (64)
 #define BIN_UNIT (64)
-#define HASH_SIZE (23)
+#define HASH_SIZE (8)            /* This must be a power of 2. */
 #define ARRAY_UNIT (64)
-#define HASHITEM_EMPTY(h) ((h)->hasht = 0x00)
-#define HASHITEM_EXIST(h) ((h)->hasht = 0x01)
-#define HASHITEM_REMVD(h) ((h)->hasht = 0x02)
-#define IS_HASHITEM_EMPTY(h) ((h)->hasht == 0x00)
-#define IS_HASHITEM_EXIST(h) ((h)->hasht == 0x01)
-#define IS_HASHITEM_REMVD(h) ((h)->hasht == 0x02)
 #define VARS_MIN_IN_FRAME (32)
-#define GC_CHECK(ctx) do { if (--((ctx)->tick) == 0) mark_and_sweep(ctx); } while(0)
-
-#define MARK(obj) ((obj)->flags |= 0x01)
+#define GC_MINOR_MAX (16)
+#define GC_PROMOTE_RATIO (50)
+#define GC_HIST_SIZE (8)        /* Buckets of the pause time histogram, see gc_hist_bound(). */
+#define GC_CHECK(ctx) do { if (--((ctx)->tick) == 0) collect_garbage(ctx); } while(0)
+#define GC_WRITE_BARRIER(ctx, obj) do { if (IS_OLD(obj) && !IS_REMEMBERED(obj)) gc_remember_obj(ctx, obj); } while(0)
+#define GC_WRITE_BARRIER_FNC(ctx, fnc) do { if (IS_OLD(fnc) && !IS_REMEMBERED(fnc)) gc_remember_fnc(ctx, fnc); } while(0)
+#define GC_WRITE_BARRIER_VAR(ctx, var) do { if (IS_OLD(var) && !IS_REMEMBERED(var)) gc_remember_var(ctx, var); } while(0)
+
+#define MARK(obj) ((obj)->flags |= 0x01)      /* The mark of an object in a slab is in the bitmap of the slab. */
 #define HOLD(obj) ((obj)->flags |= 0x02)
+#define OLD(obj) ((obj)->flags |= 0x04)
+#define REMEMBER(obj) ((obj)->flags |= 0x08)
+#define SHARE(obj) ((obj)->flags |= 0x10)
+#define IN_SLAB(obj) ((obj)->flags |= 0x20)
+#define PUSHED(obj) ((obj)->flags |= 0x40)    /* Only for a variable, see push_var_sys. */
 #define UNMARK(obj) ((obj)->flags &= 0xFE)
 #define UNHOLD(obj) ((obj)->flags &= 0xFD)
+#define FORGET(obj) ((obj)->flags &= 0xF7)
+#define RESET_GEN(obj) ((obj)->flags &= 0xF3)
+#define UNSHARE(obj) ((obj)->flags &= 0xEF)
+#define UNPUSH(obj) ((obj)->flags &= 0xBF)
 #define IS_MARKED(obj) (((obj)->flags & 0x01) == 0x01)
 #define IS_HELD(obj) (((obj)->flags & 0x02) == 0x02)
+#define IS_OLD(obj) (((obj)->flags & 0x04) == 0x04)
+#define IS_REMEMBERED(obj) (((obj)->flags & 0x08) == 0x08)
+#define IS_SHARED(obj) (((obj)->flags & 0x10) == 0x10)   /* A string referred by more than one variable. */
+#define IS_IN_SLAB(obj) (((obj)->flags & 0x20) == 0x20)  /* Not a variable on the stack nor a frame on the stack. */
+#define IS_PUSHED(obj) (((obj)->flags & 0x40) == 0x40)   /* A host object pushed as the first argument of a method. */
 
 /***************************************************************************
  * Basic structures
 */
 
 #define IS_VMINT(x) ((x) <= VAR_BIG)
+#define LVALUE_OF(v) ((v)->t == VAR_LVALUE ? (v)->a : (v))
 typedef enum vartype {
     VAR_UNDEF = 0x00,
     VAR_BOOL,
@@ -135,6 +160,7 @@ typedef enum vartype {
     VAR_LVALUE,
     VAR_STRREF,
     VAR_BINREF,
+    VAR_ARYREF,
     VAR_VOIDP,
 } vartype;
 
@@ -144,91 +170,134 @@ struct vmfnc;
 struct vmfrm;
 
 typedef struct vmbgi {
-    struct vmbgi *prv;  /* The link to the previous item in alive list. */
-    struct vmbgi *liv;  /* The link to the next item in alive list. */
-    struct vmbgi *nxt;  /* The link to the next item in free list. */
-    struct vmbgi *chn;  /* The link in allocated object list */
-
     int32_t flags;
     BigZ b;
 } vmbgi;
 
-typedef struct vmstr {
-    struct vmstr *prv;  /* The link to the previous item in alive list. */
-    struct vmstr *liv;  /* The link to the next item in alive list. */
-    struct vmstr *nxt;  /* The link to the next item in free list. */
-    struct vmstr *chn;  /* The link in allocated object list */
+/*
+ * The mapped file shared by the strings and binaries made by File.mmap().
+ * They have cap of 0 and never own s, and the content is copied out before it's modified.
+ */
+typedef struct vmmap {
+    int ref;            /* The number of strings and binaries viewing this mapping. */
+    int64_t size;
+    void *addr;
+} vmmap;
 
+typedef struct vmstr {
     int32_t flags;
     int cap;
     int len;
     char *s;
     char *hd;
+    vmmap *map;         /* The mapping which s points into, or NULL. */
 } vmstr;
 
 typedef struct vmbin {
-    struct vmbin *prv;  /* The link to the previous item in alive list. */
-    struct vmbin *liv;  /* The link to the next item in alive list. */
-    struct vmbin *nxt;  /* The link to the next item in free list. */
-    struct vmbin *chn;  /* The link in allocated object list */
-
     int32_t flags;
     int cap;
     int len;
     uint8_t *s;
     uint8_t *hd;
+    vmmap *map;         /* The mapping which s points into, or NULL. */
 } vmbin;
 
-typedef struct vmobj {
-    struct vmobj *prv;  /* The link to the previous item in alive list. */
-    struct vmobj *liv;  /* The link to the next item in alive list. */
-    struct vmobj *nxt;  /* The link to the next item in free list. */
-    struct vmobj *chn;  /* The link in allocated object list */
+typedef struct vmhent {
+    const char *k;      /* Constant string as a hash key, or NULL if removed. */
+    struct vmvar *a;    /* The value. */
+} vmhent;
+
+/*
+ * The inline cache at the place where a property is accessed by a constant key.
+ * The key is interned, so the entry at the cached index is the one when its key pointer is the same.
+ * Objects created by the same literal or class have the same layout of entries, and they share the cache.
+*/
+typedef struct vmic {
+    const char *k;      /* The interned key, which is set at the first lookup. */
+    int32_t idx[2];     /* The entry indexes in the map recently hit. */
+} vmic;
+
+/*
+ * Special keys which an object could have.
+ * An object keeps them as bits so that operators can skip looking up the hashmap for a plain object or array.
+*/
+#define SPKEY_FALSE     (0x00000001)    /* "_False" */
+#define SPKEY_MMISSING  (0x00000002)    /* "methodMissing" */
+#define SPKEY_CALL      (0x00000004)    /* "()" */
+#define SPKEY_INDEX     (0x00000008)    /* "[]" */
+#define SPKEY_ADD       (0x00000010)    /* "+" */
+#define SPKEY_SUB       (0x00000020)    /* "-" */
+#define SPKEY_MUL       (0x00000040)    /* "*" */
+#define SPKEY_DIV       (0x00000080)    /* "/" */
+#define SPKEY_MOD       (0x00000100)    /* "%" */
+#define SPKEY_EQEQ      (0x00000200)    /* "==" */
+#define SPKEY_NEQ       (0x00000400)    /* "!=" */
+#define SPKEY_LT        (0x00000800)    /* "<" */
+#define SPKEY_LE        (0x00001000)    /* "<=" */
+#define SPKEY_GT        (0x00002000)    /* ">" */
+#define SPKEY_GE        (0x00004000)    /* ">=" */
+#define SPKEY_LGE       (0x00008000)    /* "<=>" */
+#define SPKEY_LSH       (0x00010000)    /* "<<" */
+#define SPKEY_RSH       (0x00020000)    /* ">>" */
+
+/* The kind of array elements. */
+#define ARRAY_KIND_GENERIC  (0)     /* vmvar elements in ary */
+#define ARRAY_KIND_I64      (1)     /* int64_t elements packed in ai */
+#define ARRAY_KIND_DBL      (2)     /* double elements packed in ad */
 
+typedef struct vmobj {
     int32_t flags;
     int32_t is_checked; /* Almighty flag to check this object. */
     int32_t is_sysobj;  /* This is the mark for the system object and automatically passed to the function. */
     int32_t is_formatter;
-    int64_t is_false;
+    int32_t spkey;      /* The bits of special keys defined in this object. */
+    int32_t akind;      /* The kind of array elements, see ARRAY_KIND_XXX. */
     int64_t value;      /* Almighty value to identify this object. */
     int64_t idxsz;
     int64_t asz;
-    int64_t hsz;
+    int64_t hsz;        /* The number of used entries in map including removed ones. */
+    int64_t hcap;       /* The capacity of map, which is followed by the hash of each entry. */
+    int64_t hcnt;       /* The number of keys. */
+    int64_t icap;       /* The number of slots in the index table. */
     struct vmvar **ary; /* Array holder */
-    struct vmvar *map;  /* Hashmap holder */
+    union {             /* Packed array holder */
+        int64_t *ai;
+        double *ad;
+    };
+    vmhent *map;        /* Hashmap entries in the inserted order */
+    int32_t *hidx;      /* The index table from a slot to an entry */
+    uint64_t *ctrl;     /* Control bytes of the index table, which is placed right after hidx. */
 } vmobj;
 
 typedef void (*freep_func)(void *);
-typedef struct vmvar {
-    struct vmvar *prv;  /* The link to the previous item in alive list. */
-    struct vmvar *liv;  /* The link to the next item in alive list. */
-    struct vmvar *nxt;  /* The link to the next item in free list. */
-    struct vmvar *chn;  /* The link in allocated object list */
-
-    int32_t flags;
-    int32_t hasht;
-    int32_t push;
-    vartype t;
-    int64_t i;
-    double d;
-    vmbgi *bi;
-    vmbin *bn;
-    vmstr *s;
-    vmobj *o;           /* The hashmap from string to object */
+typedef struct vmptr {
     void *p;            /* almighty holder */
     freep_func freep;   /* if set this, freep(p) will be called instead of free(). */
-    const char *k;      /* Constant string as a hash key. */
-    struct vmfnc *f;
-    struct vmvar *a;    /* an object */
+} vmptr;
+
+/*
+ * A value is 16 bytes, which is the type, the GC flags, and one payload.
+ * A native pointer of VAR_VOIDP is held by vmptr outside the value, see alcvar_voidp().
+*/
+typedef struct vmvar {
+    uint16_t flags;
+    uint16_t t;         /* The type of the value in vartype. */
+    int32_t ri;         /* The index of VAR_STRREF/VAR_BINREF/VAR_ARYREF. */
+    union {             /* Only the member for the type t is valid. */
+        int64_t i;      /* The value of VAR_BOOL/VAR_INT64 */
+        double d;
+        vmbgi *bi;
+        vmbin *bn;      /* The target of VAR_BIN/VAR_BINREF */
+        vmstr *s;       /* The target of VAR_STR/VAR_STRREF */
+        vmobj *o;       /* The hashmap from string to object, or the target of VAR_ARYREF */
+        struct vmfnc *f;
+        struct vmvar *a;    /* The variable referred by VAR_LVALUE */
+        vmptr *vp;      /* The native pointer of VAR_VOIDP */
+    };
 } vmvar;
 
 typedef int (*vmfunc_t)(struct vmctx *ctx, struct vmfrm *lex, struct vmvar *r, int ac);
 typedef struct vmfnc {
-    struct vmfnc *prv;  /* The link to the previous item in alive list. */
-    struct vmfnc *liv;  /* The link to the next item in alive list. */
-    struct vmfnc *nxt;  /* The link to the next item in free list. */
-    struct vmfnc *chn;  /* The link in allocated object list */
-
     int32_t flags;
     int32_t args;
     int64_t n;          /* The minimum of n */
@@ -244,17 +313,39 @@ typedef struct vmfnc {
 } vmfnc;
 
 typedef struct vmfrm {
-    struct vmfrm *prv;  /* The link to the previous item in alive list. */
-    struct vmfrm *liv;  /* The link to the next item in alive list. */
-    struct vmfrm *nxt;  /* The link to the next item in free list. */
-    struct vmfrm *chn;  /* The link in allocated object list */
-
     int32_t flags;
     int32_t vars;
     struct vmvar **v;
     struct vmfrm *lex;  /* chain to a lexical frame */
 } vmfrm;
 
+/*
+ * Objects are allocated in a slab, which is a block of SLAB_SIZE bytes aligned by its size.
+ * The objects of the same type are laid out after this header, and the slab of an object
+ * is found by masking the address of it.
+ * The bitmaps have a bit for each object.
+ *  - used: the object is allocated.
+ *  - mark: the object is reached in the current collection.
+ *  - old:  the object is in the old generation.
+*/
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_WORDS (SLAB_SIZE / 16 / 64)    /* The smallest object is 16 bytes. */
+#define SLAB_OF(obj) ((vmslab *)((size_t)(obj) & ~((size_t)SLAB_SIZE - 1)))
+#define SLAB_INDEX(sl, obj) ((int)(((uint64_t)((char *)(obj) - (sl)->objs) * (sl)->inv) >> 32))
+typedef struct vmslab {
+    struct vmslab *next;    /* The link to the next slab of the same type. */
+    char *objs;             /* The first object. */
+    uint64_t inv;           /* 2^32 / size rounded up, to get the index of an object without division. */
+    int size;               /* The size of an object. */
+    int n;                  /* The number of objects in this slab. */
+    int words;              /* The number of words used in each bitmap. */
+    int fre;                /* The number of free objects in this slab. */
+    int hint;               /* No free object is in the words before this. */
+    uint64_t used[SLAB_WORDS];
+    uint64_t mark[SLAB_WORDS];
+    uint64_t old[SLAB_WORDS];
+} vmslab;
+
 /***************************************************************************
  * Context
 */
@@ -266,10 +357,64 @@ typedef struct vmconst {
     struct vmconst *chn;        /*  For memory allocation control. */
 } vmconst;
 
+/* Counters of the GC telemetry, which System.gcStats() and System.gc() report. */
+typedef struct vmgcstat {
+    int count;                  /* The count of all collections. */
+    int minor;
+    int major;
+    double total;               /* Cumulative pause time in milliseconds. */
+    double max;                 /* The longest pause time in milliseconds. */
+    int hist[GC_HIST_SIZE];
+    int64_t strbytes;           /* Bytes held by alive strings. */
+    int64_t binbytes;           /* Bytes held by alive binaries. */
+    struct {
+        int var;
+        int fnc;
+        int frm;
+        int str;
+        int bin;
+        int bgi;
+        int obj;
+    } live, fre;
+} vmgcstat;
+
 typedef struct vmctx {
     int tick;
     int sweep;
     int gccnt;
+    struct {
+        int minor;              /* The count of minor collections. */
+        int major;              /* The count of major collections. */
+        int since_major;        /* The count of minor collections after the last major collection. */
+        int promoted;           /* The number of objects promoted after the last major collection. */
+        int oldbase;            /* The number of objects alive right after the last major collection. */
+        int robjsz;
+        int robjn;
+        struct vmobj **robj;    /* Remembered old objects which could refer to young objects. */
+        int rfncsz;
+        int rfncn;
+        struct vmfnc **rfnc;    /* Remembered old functions which could refer to young objects. */
+        int rvarsz;
+        int rvarn;
+        struct vmvar **rvar;    /* Remembered old variables which could refer to young objects. */
+    } gc;
+    struct {
+        void *timer;            /* The clock of pause times, started with the context. */
+        const char *tracefile;  /* The file specified by --gc-trace. */
+        FILE *trace;
+        double total;           /* Cumulative pause time in milliseconds. */
+        double max;             /* The longest pause time in milliseconds. */
+        int hist[GC_HIST_SIZE]; /* Pause time histogram. */
+        struct {
+            int var;
+            int fnc;
+            int frm;
+            int str;
+            int bin;
+            int bgi;
+            int obj;
+        } swept;                /* Reclaimed objects in the last collection. */
+    } gcstat;
     int verbose;
     int print_result;
     const char *msgbuf;         /* Temporary used for the exception message, etc. */
@@ -290,6 +435,7 @@ typedef struct vmctx {
     int exceptl;                /* The line where the exception occurred. */
 
     vmobj *args;                /* Holder of the program arguments. */
+    vmobj *exports;             /* The values exported from the modules by the name. */
     vmobj *i;                   /* Special object for integer. */
     vmobj *d;                   /* Special object for double. */
     vmobj *s;                   /* Special object for string. */
@@ -304,14 +450,23 @@ typedef struct vmctx {
     vmconst *hash[VMCONSTSZ];   /* Hashtable of constant string. */
 
     struct {
-        vmvar var;
-        vmfnc fnc;
-        vmfrm frm;
-        vmstr str;
-        vmbin bin;
-        vmbgi bgi;
-        vmobj obj;
-    } alc;
+        vmslab *var;
+        vmslab *fnc;
+        vmslab *frm;
+        vmslab *str;
+        vmslab *bin;
+        vmslab *bgi;
+        vmslab *obj;
+    } alc;                      /* The slab to allocate the next object from. */
+    struct {
+        vmslab *var;
+        vmslab *fnc;
+        vmslab *frm;
+        vmslab *str;
+        vmslab *bin;
+        vmslab *bgi;
+        vmslab *obj;
+    } slab;                     /* All slabs of each type. */
     struct {
         int var;
         int fnc;
@@ -357,6 +512,16 @@ typedef struct vmctx {
 /**/
 #define pop_frm(ctx) (--((ctx)->fstkp))
 
+/* The frame which does not outlive the call, and it is not in a slab. */
+#define STACK_FRM(frm, lex, n) \
+    vmvar *frm##_v[n] = {0}; \
+    vmfrm frm##_s = {0}; \
+    frm##_s.vars = n; \
+    frm##_s.v = frm##_v; \
+    frm##_s.lex = lex; \
+    frm = &frm##_s; \
+/**/
+
 #define alloc_var(ctx, n, label, func, file, line) do { \
     if ((ctx)->vstksz <= ((ctx)->vstkp + n)) { \
         e = throw_system_exception(__LINE__, ctx, EXCEPT_STACK_OVERFLOW, NULL); \
@@ -406,9 +571,9 @@ typedef struct vmctx {
             ++fn; \
         } \
     } \
-    if (v->push) { \
+    if (IS_PUSHED(v)) { \
         ++fn; \
-        v->push = 0; \
+        UNPUSH(v); \
     } \
 /**/
 #define push_var_a(ctx, v, fn, label, func, file, line) \
@@ -422,7 +587,8 @@ typedef struct vmctx {
         } \
         for (int i = idxsz - 1; i >= 0; --i) { \
             vmvar *px = &(((ctx)->vstk)[((ctx)->vstkp)++]); \
-            vmvar *item = (v)->o->ary[i]; \
+            vmvar tmp; \
+            vmvar *item = array_at((v)->o, i, &tmp); \
             if (item) { \
                 SHCOPY_VAR_TO(ctx, px, item); \
             } else { \
@@ -488,6 +654,12 @@ typedef struct vmctx {
     hashmap_set(ctx, o, #name, alcvar_int64(ctx, i64, 0)); \
 /**/
 
+#define KL_SET_PROPERTY_D(o, name, dbl) { \
+    double dv = dbl; \
+    hashmap_set(ctx, o, #name, alcvar_double(ctx, &dv)); \
+} \
+/**/
+
 #define KL_SET_METHOD(o, name, fname, lex, args) \
     hashmap_set(ctx, o, #name, alcvar_fnc(ctx, alcfnc(ctx, fname, lex, #name, args))); \
 /**/
@@ -515,11 +687,94 @@ typedef struct vmctx {
 } \
 /**/
 
+/* module */
+#define RUN_MODULE(ctx, name, label) { \
+    extern int name(vmctx *ctx, vmfrm *lex, vmvar *r, int ac); \
+    vmvar *rm = alcvar_initial(ctx); \
+    e = name(ctx, NULL, rm, 0); \
+    if (e) goto label; \
+} \
+/**/
+
+#define EXPORT_VALUE(ctx, name, v) { \
+    module_export(ctx, name, v); \
+} \
+/**/
+
+#define IMPORT_VALUE(ctx, r, name, label, func, file, line) { \
+    e = module_import(ctx, r, name); \
+    if (e) { \
+        exception_addtrace(ctx, ctx->except, func, file, line); \
+        goto label; \
+    } \
+} \
+/**/
+
+/* profile */
+#if defined(__GNUC__) && !defined(__MIRC__) && !defined(__TINYC__)
+#define KL_EXPECT(x, v) __builtin_expect(!!(x), (v))
+#else
+#define KL_EXPECT(x, v) (x)
+#endif
+
+#define PGO_TYPES(p, v0, v1) { \
+    if ((v0)->t == VAR_INT64 && (v1)->t == VAR_INT64) { \
+        ++(p)[0]; \
+    } else if ((v0)->t == VAR_DBL && (v1)->t == VAR_DBL) { \
+        ++(p)[1]; \
+    } else { \
+        ++(p)[2]; \
+    } \
+} \
+/**/
+
+#define PGO_JMP_IF_TRUE(p, r, label) { \
+    ++(p)[0]; \
+    OP_JMP_IF_TRUE(r, label); \
+    --(p)[0]; \
+    ++(p)[1]; \
+} \
+/**/
+
+#define PGO_JMP_IF_FALSE(p, r, label) { \
+    ++(p)[0]; \
+    OP_JMP_IF_FALSE(r, label); \
+    --(p)[0]; \
+    ++(p)[1]; \
+} \
+/**/
+
+#define PGO_CALL(p, tgt, v) { \
+    if ((v)->t == VAR_FNC) { \
+        if (!(tgt)) (tgt) = ((v)->f)->f; \
+        if ((tgt) == ((v)->f)->f) { \
+            ++(p)[0]; \
+        } else { \
+            ++(p)[1]; \
+        } \
+    } else { \
+        ++(p)[2]; \
+    } \
+} \
+/**/
+
+/* The call to the function observed at the call site, which is checked by the caller. */
+#define CALL_DIRECT(fn, f1, r, ac) { \
+    extern int fn(vmctx *, vmfrm *, vmvar *, int); \
+    ctx->lastapply = NULL; \
+    ctx->hostObject = NULL; \
+    vmfnc *callee = ctx->callee; \
+    ctx->callee = (f1); \
+    e = fn(ctx, (f1)->lex, (r), (ac)); \
+    ctx->callee = callee; \
+} \
+/**/
+
 /* call special function */
 #define OP_ACT_LABEL(prefix, label) prefix##label
 #define OP_LABEL(prefix, label) OP_ACT_LABEL(prefix, label)
-#define OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_intf, a, endblk, altblk) { \
-    vmvar *fv = hashmap_search((v)->o, op); \
+#define OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_intf, a, endblk, altblk) { \
+    vmvar *fv = ((v)->o && ((v)->o->spkey & (bit))) ? hashmap_search((v)->o, op) : NULL; \
     if (fv && fv->t == VAR_FNC) { \
         int e = 0; \
         int p = vstackp(ctx); \
@@ -534,22 +789,22 @@ typedef struct vmctx {
     } \
 } \
 /**/
-#define OP_CALL_SPECIAL_OPERATOR_I_ALT(ctx, op, label, r, v, i, endblk, altblk) \
-    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_var_i, i, endblk, altblk) \
+#define OP_CALL_SPECIAL_OPERATOR_I_ALT(ctx, op, bit, label, r, v, i, endblk, altblk) \
+    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_var_i, i, endblk, altblk) \
 /**/
-#define OP_CALL_SPECIAL_OPERATOR_S_ALT(ctx, op, label, r, v, s, endblk, altblk) \
-    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_var_s, s, endblk, altblk) \
+#define OP_CALL_SPECIAL_OPERATOR_S_ALT(ctx, op, bit, label, r, v, s, endblk, altblk) \
+    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_var_s, s, endblk, altblk) \
 /**/
-#define OP_CALL_SPECIAL_OPERATOR_ALT(ctx, op, label, r, v, a, endblk, altblk) \
-    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_var, a, endblk, altblk) \
+#define OP_CALL_SPECIAL_OPERATOR_ALT(ctx, op, bit, label, r, v, a, endblk, altblk) \
+    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_var, a, endblk, altblk) \
 /**/
-#define OP_CALL_SPECIAL_OPERATOR_I(ctx, op, label, r, v, i) \
-    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_var_i, i, { return e; }, { \
+#define OP_CALL_SPECIAL_OPERATOR_I(ctx, op, bit, label, r, v, i) \
+    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_var_i, i, { return e; }, { \
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL); \
     }) \
 /**/
-#define OP_CALL_SPECIAL_OPERATOR(ctx, op, label, r, v, a) \
-    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, label, r, v, push_var, a, { return e; }, { \
+#define OP_CALL_SPECIAL_OPERATOR(ctx, op, bit, label, r, v, a) \
+    OP_CALL_SPECIAL_OPERATOR_X(ctx, op, bit, label, r, v, push_var, a, { return e; }, { \
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL); \
     }) \
 /**/
@@ -560,6 +815,17 @@ typedef struct vmctx {
     ctx->callee = (f1); \
     e = ((vmfunc_t)((f1)->f))(ctx, lex, (r), (ac)); \
     ctx->callee = callee; \
+    GC_WRITE_BARRIER_VAR(ctx, (r)); \
+} \
+/**/
+
+/*
+ * A native function calls a function by this instead of CALL, with its own result as r0.
+ * r0 is remembered before each call because a minor collection can run in the callee after r0 was updated.
+ */
+#define NATIVE_CALL(r0, f1, r, ac) { \
+    GC_WRITE_BARRIER_VAR(ctx, (r0)); \
+    CALL(f1, (f1)->lex, r, ac) \
 } \
 /**/
 
@@ -573,14 +839,14 @@ typedef struct vmctx {
         CALL((v)->f, ((v)->f)->lex, r, ac) \
     } else { \
         int done = 0; \
-        if ((v)->t == VAR_OBJ) { \
+        if ((v)->t == VAR_OBJ && (v)->o && ((v)->o->spkey & SPKEY_CALL)) { \
             vmvar *fv = hashmap_search((v)->o, "()"); \
             if (fv && fv->t == VAR_FNC) { \
                 CALL((fv)->f, ((fv)->f)->lex, r, ac) \
                 done = 1; \
             } \
         } \
-        if (!done && host && lastapply) { \
+        if (!done && host && lastapply && (host->spkey & SPKEY_MMISSING)) { \
             vmvar *mm = hashmap_search(host, "methodMissing"); \
             if (mm && mm->t == VAR_FNC) { \
                 { push_var_s(ctx, lastapply, label, func, file, line); } \
@@ -687,6 +953,7 @@ typedef struct vmctx {
 
 #define YIELD_FRM(ctx, cur, ynum, total, copyblock) { \
     vmfnc *f = ctx->callee; \
+    GC_WRITE_BARRIER_FNC(ctx, f); \
     f->yield = ynum; \
     f->frm = cur; \
     if (f->vars == NULL) { \
@@ -704,6 +971,7 @@ typedef struct vmctx {
 
 #define YIELD(ctx, ynum, total, copyblock) { \
     vmfnc *f = ctx->callee; \
+    GC_WRITE_BARRIER_FNC(ctx, f); \
     f->yield = ynum; \
     if (f->vars == NULL) { \
         f->vars = (vmvar**)calloc(total, sizeof(vmvar*)); \
@@ -721,6 +989,7 @@ typedef struct vmctx {
 #define CHECK_YIELD_FRM(ctx, ret, cur, fnc, ynum, total, copyblock) \
     if (e == FLOW_YIELD) { \
         vmfnc *f = ctx->callee; \
+        GC_WRITE_BARRIER_FNC(ctx, f); \
         f->yield = ynum; \
         f->yfnc = fnc; \
         f->frm = cur; \
@@ -739,9 +1008,23 @@ typedef struct vmctx {
     } \
 /**/
 
+/* The frame on the stack is moved to the heap after the local variables are saved, unless it has been already moved. */
+#define CHECK_YIELD_SFRM(ctx, ret, cur, fnc, ynum, total, copyblock) \
+    CHECK_YIELD_FRM(ctx, ret, cur, fnc, ynum, total, copyblock; if ((cur) == &(cur##_s)) f->frm = heap_frm(ctx, cur, f)) \
+/**/
+
+/* The closure referring to the frame on the stack is passed to the method, which could hold it. */
+#define CHECK_NATIVE_LOOP(ctx, a, m, cur, sp, rebind) \
+    if ((cur) == &(cur##_s) && !array_is_native_loop(ctx, a, m)) { \
+        cur = escape_frm(ctx, cur, sp); \
+        rebind; \
+    } \
+/**/
+
 #define CHECK_YIELD(ctx, ret, fnc, ynum, total, copyblock) \
     if (e == FLOW_YIELD) { \
         vmfnc *f = ctx->callee; \
+        GC_WRITE_BARRIER_FNC(ctx, f); \
         f->yield = ynum; \
         f->yfnc = fnc; \
         if (f->vars == NULL) { \
@@ -1005,14 +1288,15 @@ typedef struct vmctx {
 /**/
 
 #define SET_APPLY_I(ctx, r, iv, label, func, file, line) { \
-    vmvar *dst = (r)->a; \
+    vmvar *dst = LVALUE_OF(r); \
     if ((dst)->t == VAR_STRREF) { \
         vmstr *s = (dst)->s; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += s->len; } while (ii < 0); \
         } \
         if (ii < s->len) { \
+            if (s->map) str_unmap(s); \
             s->s[ii] = iv; \
         } else { \
             e = throw_system_exception(__LINE__, ctx, EXCEPT_OUT_OF_RANGE_ERROR, NULL); \
@@ -1020,32 +1304,34 @@ typedef struct vmctx {
             goto label; \
         } \
         SET_I64(r, iv) \
-        (r)->a = NULL; \
     } else if ((dst)->t == VAR_BINREF) { \
         vmbin *bn = (dst)->bn; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += bn->len; } while (ii < 0); \
         } \
         bin_set_i(bn, ii, iv); \
         SET_I64(r, iv) \
-        (r)->a = NULL; \
+    } else if ((dst)->t == VAR_ARYREF) { \
+        array_set_i(ctx, (dst)->o, (dst)->ri, iv); \
+        SET_I64(r, iv) \
     } else { \
         SET_I64(dst, iv) \
-        SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+        SHMOVE_VAR_TO(ctx, (r), dst) \
     } \
 } \
 /**/
 
 #define SET_APPLY_D(ctx, r, dv, label, func, file, line) { \
-    vmvar *dst = (r)->a; \
+    vmvar *dst = LVALUE_OF(r); \
     if ((dst)->t == VAR_STRREF) { \
         vmstr *s = (dst)->s; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += s->len; } while (ii < 0); \
         } \
         if (ii < s->len) { \
+            if (s->map) str_unmap(s); \
             s->s[ii] = (int)dv; \
         } else { \
             e = throw_system_exception(__LINE__, ctx, EXCEPT_OUT_OF_RANGE_ERROR, NULL); \
@@ -1053,33 +1339,38 @@ typedef struct vmctx {
             goto label; \
         } \
         SET_I64(r, (int)dv) \
-        (r)->a = NULL; \
     } else if ((dst)->t == VAR_BINREF) { \
         vmbin *bn = (dst)->bn; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += bn->len; } while (ii < 0); \
         } \
         double dvv = dv; \
         bin_set_d(bn, ii, &dvv); \
         SET_I64(r, (int)dv) \
-        (r)->a = NULL; \
+    } else if ((dst)->t == VAR_ARYREF) { \
+        array_set_d(ctx, (dst)->o, (dst)->ri, dv); \
+        SET_DBL(r, dv) \
     } else { \
         SET_DBL(dst, dv) \
-        SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+        SHMOVE_VAR_TO(ctx, (r), dst) \
     } \
 } \
 /**/
 
 #define SET_APPLY_S(ctx, r, str, label, func, file, line) { \
-    vmvar *dst = (r)->a; \
+    vmvar *dst = LVALUE_OF(r); \
+    if ((dst)->t == VAR_ARYREF) { \
+        dst = array_ref_var(ctx, dst); \
+    } \
     if ((dst)->t == VAR_STRREF) { \
         vmstr *s = (dst)->s; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += s->len; } while (ii < 0); \
         } \
         if (ii < s->len) { \
+            if (s->map) str_unmap(s); \
             s->s[ii] = (int)(str[0]); \
         } else { \
             e = throw_system_exception(__LINE__, ctx, EXCEPT_OUT_OF_RANGE_ERROR, NULL); \
@@ -1087,32 +1378,35 @@ typedef struct vmctx {
             goto label; \
         } \
         SET_I64(r, (int)(str[0])) \
-        (r)->a = NULL; \
     } else if ((dst)->t == VAR_BINREF) { \
         vmbin *bn = (dst)->bn; \
-        int ii = (int)((dst)->i); \
+        int ii = (dst)->ri; \
         if (ii < 0) { \
             do { ii += bn->len; } while (ii < 0); \
         } \
         bin_set_i(bn, ii, str[0]); \
         SET_I64(r, (int)(str[0])) \
-        (r)->a = NULL; \
     } else { \
         SET_STR(dst, str) \
-        SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+        GC_WRITE_BARRIER_VAR(ctx, dst); \
+        SHMOVE_VAR_TO(ctx, (r), dst) \
     } \
 } \
 /**/
 
 #define SET_APPLY_F(ctx, r, f, label, func, file, line) { \
-    vmvar *dst = (r)->a; \
+    vmvar *dst = LVALUE_OF(r); \
+    if ((dst)->t == VAR_ARYREF) { \
+        dst = array_ref_var(ctx, dst); \
+    } \
     if ((dst)->t == VAR_STRREF || (dst)->t == VAR_BINREF) { \
         e = throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL); \
         exception_addtrace(ctx, ctx->except, func, file, line); \
         goto label; \
     } else { \
         SET_FNC(dst, f) \
-        SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+        GC_WRITE_BARRIER_VAR(ctx, dst); \
+        SHMOVE_VAR_TO(ctx, (r), dst) \
     } \
 } \
 /**/
@@ -1128,17 +1422,22 @@ typedef struct vmctx {
         const char *str = (v)->s->hd; \
         SET_APPLY_S(ctx, r, str, label, func, file, line); \
     } else { \
-        vmvar *dst = (r)->a; \
+        vmvar *dst = LVALUE_OF(r); \
+        if ((dst)->t == VAR_ARYREF) { \
+            dst = array_ref_var(ctx, dst); \
+        } \
         if ((dst)->t == VAR_STRREF || (dst)->t == VAR_BINREF) { \
             e = throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL); \
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
         } else if ((v)->t == VAR_FNC) { \
             SET_FNC(dst, (v)->f) \
-            SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+            GC_WRITE_BARRIER_VAR(ctx, dst); \
+            SHMOVE_VAR_TO(ctx, (r), dst) \
         } else { \
             COPY_VAR_TO(ctx, dst, v) \
-            SHMOVE_VAR_TO(ctx, (r), (r)->a) \
+            GC_WRITE_BARRIER_VAR(ctx, dst); \
+            SHMOVE_VAR_TO(ctx, (r), dst) \
         } \
     } \
 } \
@@ -1158,7 +1457,7 @@ typedef struct vmctx {
 
 #define VALUE_PUSH(ctx, r, v, label, func, file, line) { \
     if ((r)->t == VAR_OBJ) { \
-        array_push(ctx, (r)->o, copy_var(ctx, v, 0)); \
+        array_push_v(ctx, (r)->o, v); \
     } else if ((r)->t == VAR_BIN) { \
         if ((v)->t == VAR_INT64 || (v)->t == VAR_BOOL) { \
             bin_append_ch(ctx, r->bn, (uint8_t)((v)->i)); \
@@ -1194,7 +1493,7 @@ typedef struct vmctx {
 
 #define VALUE_PUSH_I(ctx, r, i, label, func, file, line) { \
     if ((r)->t == VAR_OBJ) { \
-        array_push(ctx, (r)->o, alcvar_int64(ctx, i, 0)); \
+        array_push_i(ctx, (r)->o, i); \
     } else if ((r)->t == VAR_BIN) { \
         bin_append_ch(ctx, r->bn, (uint8_t)i); \
     } else { \
@@ -1207,8 +1506,7 @@ typedef struct vmctx {
 
 #define VALUE_PUSH_D(ctx, r, d, label, func, file, line) { \
     if ((r)->t == VAR_OBJ) { \
-        double dbl = d; \
-        array_push(ctx, (r)->o, alcvar_double(ctx, &dbl)); \
+        array_push_d(ctx, (r)->o, d); \
     } else if ((r)->t == VAR_BIN) { \
         bin_append_ch(ctx, (r)->bn, (uint8_t)d); \
     } else { \
@@ -1236,8 +1534,18 @@ typedef struct vmctx {
     if ((r)->t == VAR_OBJ) { \
         if ((v)->t == VAR_OBJ) { \
             vmobj *o = (v)->o; \
-            for (int i = 0; i < o->idxsz; ++i) { \
-                array_push(ctx, (r)->o, o->ary[i]); \
+            if (o->akind == ARRAY_KIND_I64) { \
+                for (int i = 0; i < o->idxsz; ++i) { \
+                    array_push_i(ctx, (r)->o, o->ai[i]); \
+                } \
+            } else if (o->akind == ARRAY_KIND_DBL) { \
+                for (int i = 0; i < o->idxsz; ++i) { \
+                    array_push_d(ctx, (r)->o, o->ad[i]); \
+                } \
+            } else { \
+                for (int i = 0; i < o->idxsz; ++i) { \
+                    array_push(ctx, (r)->o, o->ary[i]); \
+                } \
             } \
         } else if ((v)->t == VAR_BIN) { \
             vmbin *bn = (v)->bn; \
@@ -1258,7 +1566,8 @@ typedef struct vmctx {
         if ((v)->t == VAR_OBJ) { \
             vmobj *o = (v)->o; \
             for (int i = 0; i < o->idxsz; ++i) { \
-                vmvar *aryi = o->ary[i]; \
+                vmvar tmp; \
+                vmvar *aryi = array_at(o, i, &tmp); \
                 if (aryi) { \
                     if (aryi->t == VAR_INT64 || aryi->t == VAR_BOOL) { \
                         bin_append_ch(ctx, (r)->bn, (uint8_t)aryi->i); \
@@ -1346,6 +1655,7 @@ typedef struct vmctx {
     case VAR_STR: \
         (dst)->t = VAR_STR; \
         (dst)->s = (src)->s; \
+        SHARE((dst)->s); \
         break; \
     case VAR_BIN: \
         (dst)->t = VAR_BIN; \
@@ -1480,7 +1790,7 @@ typedef struct vmctx {
     case VAR_FNC: \
         goto label; \
     case VAR_OBJ: \
-        if (!((r)->o->is_false)) goto label; \
+        if (!((r)->o->spkey & SPKEY_FALSE)) goto label; \
         break; \
     default: \
         /* TODO */ \
@@ -1511,7 +1821,7 @@ typedef struct vmctx {
     case VAR_FNC: \
         break; \
     case VAR_OBJ: \
-        if ((r)->o->is_false) goto label; \
+        if ((r)->o->spkey & SPKEY_FALSE) goto label; \
         break; \
     default: \
         /* TODO */ \
@@ -1525,7 +1835,7 @@ typedef struct vmctx {
 
 #define OP_HASH_APPLY_OBJ_X(ctx, r, t1, str, prefix, label) { \
     if ((t1)->t ==VAR_OBJ) { \
-        OP_CALL_SPECIAL_OPERATOR_S_ALT(ctx, "[]", OP_LABEL(prefix, label), r, t1, str, {}, { \
+        OP_CALL_SPECIAL_OPERATOR_S_ALT(ctx, "[]", SPKEY_INDEX, OP_LABEL(prefix, label), r, t1, str, {}, { \
             ctx->lastapply = str; \
             if ((t1)->o) { \
                 vmvar *t2 = hashmap_search((t1)->o, str); \
@@ -1548,7 +1858,9 @@ typedef struct vmctx {
 } \
 /**/
 
+/* OP_HASH_APPLY and OP_HASH_APPLYL have an inline cache, so str must be a constant string. */
 #define OP_HASH_APPLY(ctx, r, v, str) { \
+    static vmic ic = {0}; \
     vmvar *t1 = (v); \
     vmvar *t2 = NULL; \
     int done = 0; \
@@ -1556,28 +1868,28 @@ typedef struct vmctx {
     case VAR_BOOL: \
     case VAR_INT64: \
     case VAR_BIG: \
-        t2 = hashmap_search(ctx->i, str); \
+        t2 = hashmap_search_ic(ctx->i, str, &ic); \
         break; \
     case VAR_DBL: \
-        t2 = hashmap_search(ctx->d, str); \
+        t2 = hashmap_search_ic(ctx->d, str, &ic); \
         break; \
     case VAR_STR: \
-        t2 = hashmap_search(ctx->s, str); \
+        t2 = hashmap_search_ic(ctx->s, str, &ic); \
         break; \
     case VAR_BIN: \
-        t2 = hashmap_search(ctx->b, str); \
+        t2 = hashmap_search_ic(ctx->b, str, &ic); \
         break; \
     case VAR_OBJ: \
         ctx->lastapply = str; \
         if (t1->o) { \
-            t2 = hashmap_search(t1->o, str); \
+            t2 = hashmap_search_ic(t1->o, str, &ic); \
             if (t2) { \
                 COPY_VAR_TO(ctx, (r), t2); \
                 done = 1; \
             } \
         } \
         if (!done) { \
-            t2 = hashmap_search(ctx->o, str); \
+            t2 = hashmap_search_ic(ctx->o, str, &ic); \
         } \
         break; \
     default: \
@@ -1588,7 +1900,7 @@ typedef struct vmctx {
             push_var(ctx, t1, END/* dummy */, "", "", 0); \
             (r)->t = VAR_FNC; \
             (r)->f = t2->f; \
-            t1->push = 1; \
+            PUSHED(t1); \
         } else { \
             (r)->t = VAR_UNDEF; \
         } \
@@ -1596,6 +1908,17 @@ typedef struct vmctx {
 } \
 /**/
 
+#define OP_HASH_APPLYL_OBJ_IC(ctx, r, t1, str, ic) { \
+    vmvar *t2 = hashmap_search_ic((t1)->o, str, ic); \
+    if (!t2) { \
+        t2 = alcvar_int64(ctx, 0, 0); \
+        (t1)->o = hashmap_set(ctx, (t1)->o, str, t2); \
+    } \
+    (r)->t = VAR_LVALUE; \
+    (r)->a = t2; \
+} \
+/**/
+
 #define OP_HASH_APPLYL_OBJ(ctx, r, t1, str) { \
     vmvar *t2 = hashmap_search((t1)->o, str); \
     if (!t2) { \
@@ -1608,14 +1931,14 @@ typedef struct vmctx {
 /**/
 
 #define OP_HASH_APPLYL(ctx, r, v, str) { \
-    vmvar *t1 = ((v)->a) ? (v)->a : (v); \
+    static vmic ic = {0}; \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t != VAR_OBJ) { \
         (t1)->t = VAR_OBJ; \
-        if (!(t1)->o) { \
-            (t1)->o = alcobj(ctx); \
-        } \
+        (t1)->o = alcobj(ctx); \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
     } \
-    OP_HASH_APPLYL_OBJ(ctx, r, t1, str) \
+    OP_HASH_APPLYL_OBJ_IC(ctx, r, t1, str, &ic) \
 } \
 /**/
 
@@ -1628,8 +1951,18 @@ typedef struct vmctx {
         if (0 <= ii && ii < (v)->o->idxsz) { \
             vmvar *na = alcvar_obj(ctx, alcobj(ctx)); \
             int idxsz = (v)->o->idxsz; \
-            for (int i = ii; i < idxsz; ++i) { \
-                array_push(ctx, na->o, (v)->o->ary[i]); \
+            if ((v)->o->akind == ARRAY_KIND_I64) { \
+                for (int i = ii; i < idxsz; ++i) { \
+                    array_push_i(ctx, na->o, (v)->o->ai[i]); \
+                } \
+            } else if ((v)->o->akind == ARRAY_KIND_DBL) { \
+                for (int i = ii; i < idxsz; ++i) { \
+                    array_push_d(ctx, na->o, (v)->o->ad[i]); \
+                } \
+            } else { \
+                for (int i = ii; i < idxsz; ++i) { \
+                    array_push(ctx, na->o, (v)->o->ary[i]); \
+                } \
             } \
             SHCOPY_VAR_TO(ctx, r, na); \
         } else { \
@@ -1666,13 +1999,20 @@ typedef struct vmctx {
         } \
     } else if ((v)->t == VAR_OBJ) { \
         int ii = idx; \
-        OP_CALL_SPECIAL_OPERATOR_I_ALT(ctx, "[]", OP_LABEL(prefix, label), r, v, ii, {}, { \
-            int xlen = (v)->o->idxsz; \
+        OP_CALL_SPECIAL_OPERATOR_I_ALT(ctx, "[]", SPKEY_INDEX, OP_LABEL(prefix, label), r, v, ii, {}, { \
+            vmobj *o = (v)->o; \
+            int xlen = o->idxsz; \
             if (ii < 0) { \
                 do { ii += xlen; } while (ii < 0); \
             } \
-            if (0 <= ii && ii < xlen && (v)->o->ary[ii]) { \
-                COPY_VAR_TO(ctx, r, (v)->o->ary[ii]); \
+            if (ii < 0 || xlen <= ii) { \
+                (r)->t = VAR_UNDEF; \
+            } else if (o->akind == ARRAY_KIND_I64) { \
+                SET_I64(r, o->ai[ii]); \
+            } else if (o->akind == ARRAY_KIND_DBL) { \
+                SET_DBL(r, o->ad[ii]); \
+            } else if (o->ary[ii]) { \
+                COPY_VAR_TO(ctx, r, o->ary[ii]); \
             } else { \
                 (r)->t = VAR_UNDEF; \
             } \
@@ -1688,6 +2028,29 @@ typedef struct vmctx {
     OP_ARRAY_REF_I_X(ctx, r, v, idx, I, __LINE__) \
 } \
 /**/
+/* The array is checked by CHECK_ARRAY_LOOP before the loop, and idx is never negative. */
+#define OP_ARRAY_REF_F(ctx, r, v, idx) { \
+    vmobj *o = (v)->o; \
+    int64_t ii = idx; \
+    if (o->idxsz <= ii) { \
+        (r)->t = VAR_UNDEF; \
+    } else if (o->akind == ARRAY_KIND_I64) { \
+        SET_I64(r, o->ai[ii]); \
+    } else if (o->akind == ARRAY_KIND_DBL) { \
+        SET_DBL(r, o->ad[ii]); \
+    } else if (o->ary[ii]) { \
+        COPY_VAR_TO(ctx, r, o->ary[ii]); \
+    } else { \
+        (r)->t = VAR_UNDEF; \
+    } \
+} \
+/**/
+#define CHECK_ARRAY_LOOP(ctx, v, iv, name, label) { \
+    if ((v)->t != VAR_OBJ || !array_is_plain(ctx, (v)->o, name) || (iv)->t != VAR_INT64 || (iv)->i < 0) { \
+        goto label; \
+    } \
+} \
+/**/
 #define OP_ARRAY_REF(ctx, r, v, iv) { \
     switch ((iv)->t) { \
     case VAR_BOOL: \
@@ -1707,7 +2070,7 @@ typedef struct vmctx {
     } \
     default: \
         if ((v)->t == VAR_OBJ) { \
-            OP_CALL_SPECIAL_OPERATOR_ALT(ctx, "[]", OP_LABEL(OV, __LINE__), r, v, iv, {}, { \
+            OP_CALL_SPECIAL_OPERATOR_ALT(ctx, "[]", SPKEY_INDEX, OP_LABEL(OV, __LINE__), r, v, iv, {}, { \
                 e = throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL); \
             }) \
         } else { \
@@ -1719,28 +2082,26 @@ typedef struct vmctx {
 /**/
 
 #define OP_ARRAY_REFL_CHKV(ctx, t1, v) \
-    vmvar *t1 = ((v)->a) ? (v)->a : (v); \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t != VAR_OBJ) { \
         (t1)->t = VAR_OBJ; \
-        if (!(t1)->o) { \
-            (t1)->o = alcobj(ctx); \
-        } \
+        (t1)->o = alcobj(ctx); \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
     } \
 /**/
 
 #define OP_ARRAY_REFL_I(ctx, r, v, idx) { \
     if ((v)->t == VAR_STR) { \
         (r)->t = VAR_STRREF; \
-        (r)->i = idx; \
+        (r)->ri = idx; \
         (r)->s = (v)->s; \
-        (r)->a = r; \
     } else if ((v)->t == VAR_BIN) { \
         (r)->t = VAR_BINREF; \
-        (r)->i = idx; \
+        (r)->ri = idx; \
         (r)->bn = (v)->bn; \
-        (r)->a = r; \
     } else { \
         OP_ARRAY_REFL_CHKV(ctx, t1, v) \
+        array_generic(ctx, (t1)->o); \
         int ii = idx; \
         if (ii < 0) { \
             do { ii += (t1)->o->idxsz; } while (ii < 0); \
@@ -1759,6 +2120,24 @@ typedef struct vmctx {
 } \
 /**/
 
+/* OP_ARRAY_REFS is the reference only to store a value, which keeps packed elements as they are. */
+#define OP_ARRAY_REFS_I(ctx, r, v, idx) { \
+    vmvar *t0 = LVALUE_OF(v); \
+    int ii = idx; \
+    if ((t0)->t == VAR_OBJ && ((t0)->o->akind != ARRAY_KIND_GENERIC || (t0)->o->idxsz == 0) && \
+            (0 <= ii || 0 < (t0)->o->idxsz)) { \
+        if (ii < 0) { \
+            do { ii += (t0)->o->idxsz; } while (ii < 0); \
+        } \
+        (r)->t = VAR_ARYREF; \
+        (r)->ri = ii; \
+        (r)->o = (t0)->o; \
+    } else { \
+        OP_ARRAY_REFL_I(ctx, r, v, idx) \
+    } \
+} \
+/**/
+
 #define OP_ARRAY_REFL_S(ctx, r, v, s) { \
     OP_ARRAY_REFL_CHKV(ctx, t1, v) \
     OP_HASH_APPLYL_OBJ(ctx, r, t1, s) \
@@ -1789,6 +2168,26 @@ typedef struct vmctx {
 } \
 /**/
 
+#define OP_ARRAY_REFS(ctx, r, v, iv) { \
+    switch (iv->t) { \
+    case VAR_BOOL: \
+    case VAR_INT64: { \
+        int64_t i = iv->i; \
+        OP_ARRAY_REFS_I(ctx, r, v, i) \
+        break; \
+    } \
+    case VAR_DBL: { \
+        int64_t i = (int64_t)iv->d; \
+        OP_ARRAY_REFS_I(ctx, r, v, i) \
+        break; \
+    } \
+    default: \
+        OP_ARRAY_REFL(ctx, r, v, iv) \
+        break; \
+    } \
+} \
+/**/
+
 /* Increment/Decrement */
 
 #define OP_INC_SAME_I(ctx, r) { \
@@ -1799,6 +2198,7 @@ typedef struct vmctx {
         BigZ bi = BzFromInteger((r)->i); \
         (r)->t = VAR_BIG; \
         (r)->bi = alcbgi_bigz(ctx, BzAdd(bi, b2)); \
+        GC_WRITE_BARRIER_VAR(ctx, r); \
         BzFree(bi); \
         BzFree(b2); \
     } \
@@ -1839,6 +2239,7 @@ typedef struct vmctx {
         BigZ bi = BzFromInteger((r)->i); \
         (r)->t = VAR_BIG; \
         (r)->bi = alcbgi_bigz(ctx, BzAdd(bi, b2)); \
+        GC_WRITE_BARRIER_VAR(ctx, r); \
         BzFree(bi); \
         BzFree(b2); \
     } \
@@ -1871,7 +2272,7 @@ typedef struct vmctx {
 /**/
 
 #define OP_INC(ctx, r, v, label, func, file, line) { \
-    vmvar *t1 = (v)->a ? (v)->a : (v); \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t == VAR_INT64) { \
         OP_INC_SAME_I(ctx, t1) \
         SHCOPY_VAR_TO(ctx, r, t1) \
@@ -1883,14 +2284,15 @@ typedef struct vmctx {
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
         } \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
         COPY_VAR_TO(ctx, r, t1) \
     } \
-    if ((v)->t == VAR_LVALUE) (v)->t = VAR_UNDEF; (v)->a = NULL; \
+    if ((v)->t == VAR_LVALUE) { (v)->t = VAR_UNDEF; (v)->a = NULL; } \
 } \
 /**/
 
 #define OP_INCP(ctx, r, v, label, func, file, line) { \
-    vmvar *t1 = (v)->a ? (v)->a : (v); \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t == VAR_INT64) { \
         (r)->t = VAR_INT64; \
         (r)->i = ((t1)->i); \
@@ -1902,13 +2304,14 @@ typedef struct vmctx {
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
         } \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
     } \
-    if ((v)->t == VAR_LVALUE) (v)->t = VAR_UNDEF; (v)->a = NULL; \
+    if ((v)->t == VAR_LVALUE) { (v)->t = VAR_UNDEF; (v)->a = NULL; } \
 } \
 /**/
 
 #define OP_DEC(ctx, r, v, label, func, file, line) { \
-    vmvar *t1 = (v)->a ? (v)->a : (v); \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t == VAR_INT64) { \
         OP_DEC_SAME_I(ctx, t1) \
         SHCOPY_VAR_TO(ctx, r, t1) \
@@ -1918,14 +2321,15 @@ typedef struct vmctx {
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
         } \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
         COPY_VAR_TO(ctx, r, t1) \
     } \
-    if ((v)->t == VAR_LVALUE) (v)->t = VAR_UNDEF; (v)->a = NULL; \
+    if ((v)->t == VAR_LVALUE) { (v)->t = VAR_UNDEF; (v)->a = NULL; } \
 } \
 /**/
 
 #define OP_DECP(ctx, r, v, label, func, file, line) { \
-    vmvar *t1 = (v)->a ? (v)->a : (v); \
+    vmvar *t1 = LVALUE_OF(v); \
     if ((t1)->t == VAR_INT64) { \
         (r)->t = VAR_INT64; \
         (r)->i = ((t1)->i); \
@@ -1937,8 +2341,9 @@ typedef struct vmctx {
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
         } \
+        GC_WRITE_BARRIER_VAR(ctx, t1); \
     } \
-    if ((v)->t == VAR_LVALUE) (v)->t = VAR_UNDEF; (v)->a = NULL; \
+    if ((v)->t == VAR_LVALUE) { (v)->t = VAR_UNDEF; (v)->a = NULL; } \
 } \
 /**/
 
@@ -2418,6 +2823,43 @@ typedef struct vmctx {
 
 /* DIV */
 
+/* Dividing by zero makes *e the maximum value, and it will not limit the arguments for the pure function. */
+#define OP_NDIV_I_I(e, r, i0, i1, label) { \
+    if ((i1) == 0) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = ((double)(i0)) / (i1); \
+} \
+/**/
+
+#define OP_NDIV_D_I(e, r, d0, i1, label) { \
+    if ((i1) == 0) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = (d0) / (i1); \
+} \
+/**/
+
+#define OP_NDIV_I_D(e, r, i0, d1, label) { \
+    if ((d1) < DBL_EPSILON) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = (i0) / (d1); \
+} \
+/**/
+
+#define OP_NDIV_D_D(e, r, d0, d1, label) { \
+    if ((d1) < DBL_EPSILON) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = (d0) / (d1); \
+} \
+/**/
+
 #define OP_DIV_I_I(ctx, r, i0, i1, label, func, file, line) { \
     if (i1 == 0) { \
         e = throw_system_exception(__LINE__, ctx, EXCEPT_DIVIDE_BY_ZERO, NULL); \
@@ -2508,11 +2950,38 @@ typedef struct vmctx {
 
 /* MOD */
 
-#define OP_NMOD_I_I(e, n, r, i0, i1, label) { \
+#define OP_NMOD_I_I(e, r, i0, i1, label) { \
+    if ((i1) <= 0) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
     (r) = (i0) % (i1); \
 } \
 /**/
 
+#define OP_NMOD_D_I(e, r, d0, i1, label) { \
+    if ((i1) == 0) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = fmod((d0), (double)(i1)); \
+} \
+/**/
+
+#define OP_NMOD_I_D(e, r, i0, d1, label) { \
+    (r) = fmod((double)(i0), (d1)); \
+} \
+/**/
+
+#define OP_NMOD_D_D(e, r, d0, d1, label) { \
+    if ((d1) < DBL_EPSILON) { \
+        *e = INT64_MAX; \
+        goto label; \
+    } \
+    (r) = fmod((d0), (d1)); \
+} \
+/**/
+
 #define OP_MOD_I_I(ctx, r, i0, i1, label, func, file, line) { \
     if (i1 < DBL_EPSILON) { \
         e = throw_system_exception(__LINE__, ctx, EXCEPT_DIVIDE_BY_ZERO, NULL); \
@@ -2714,6 +3183,8 @@ typedef struct vmctx {
 
 /* EQEQ */
 
+#define OP_NEQEQ_D(d0, d1) ((d0) - (d1) < DBL_EPSILON && (d1) - (d0) < DBL_EPSILON)
+
 #define OP_EQEQ_I_I(ctx, r, i0, i1, label, func, file, line) { \
     (r)->t = VAR_BOOL; \
     (r)->i = (i0) == (i1); \
@@ -2793,6 +3264,8 @@ typedef struct vmctx {
 
 /* NEQ */
 
+#define OP_NNEQ_D(d0, d1) (DBL_EPSILON <= (d0) - (d1) || DBL_EPSILON <= (d1) - (d0))
+
 #define OP_NEQ_I_I(ctx, r, i0, i1, label, func, file, line) { \
     (r)->t = VAR_BOOL; \
     (r)->i = (i0) != (i1); \
@@ -3531,7 +4004,7 @@ typedef struct vmctx {
     } else if ((v0)->t == VAR_BIG) { \
         OP_BXOR_B_I(ctx, r, v0, i1, label, func, file, line) \
     } else { \
-        e = bor_v_i(ctx, r, v0, i1); \
+        e = bxor_v_i(ctx, r, v0, i1); \
         if (e == FLOW_EXCEPTION) { \
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
@@ -3546,7 +4019,7 @@ typedef struct vmctx {
     } else if ((v1)->t == VAR_BIG) { \
         OP_BXOR_I_B(ctx, r, i0, v1, label, func, file, line) \
     } else { \
-        e = bor_i_v(ctx, r, i0, v1); \
+        e = bxor_i_v(ctx, r, i0, v1); \
         if (e == FLOW_EXCEPTION) { \
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
@@ -3567,14 +4040,14 @@ typedef struct vmctx {
             (r)->t = VAR_BIG; \
             (r)->bi = alcbgi_bigz(ctx, BzXor((v0)->bi->b, (v1)->bi->b)); \
         } else { \
-            e = bor_v_v(ctx, r, v0, v1); \
+            e = bxor_v_v(ctx, r, v0, v1); \
             if (e == FLOW_EXCEPTION) { \
                 exception_addtrace(ctx, ctx->except, func, file, line); \
                 goto label; \
             } \
         } \
     } else { \
-        e = bor_v_v(ctx, r, v0, v1); \
+        e = bxor_v_v(ctx, r, v0, v1); \
         if (e == FLOW_EXCEPTION) { \
             exception_addtrace(ctx, ctx->except, func, file, line); \
             goto label; \
@@ -3596,6 +4069,8 @@ INLINE extern vmfnc *alcfnc(vmctx *ctx, void *f, vmfrm *lex, const char *name, i
 INLINE extern void pbakfnc(vmctx *ctx, vmfnc *p);
 INLINE extern vmfrm *alcfrm(vmctx *ctx, vmfrm *lex, int args);
 INLINE extern void pbakfrm(vmctx *ctx, vmfrm *p);
+INLINE extern vmfrm *heap_frm(vmctx *ctx, vmfrm *s, vmfnc *f);
+INLINE extern vmfrm *escape_frm(vmctx *ctx, vmfrm *s, int sp);
 INLINE extern vmstr *alcstr_allocated_str(vmctx *ctx, char *s, int alloclen);
 INLINE extern vmstr *alcstr_str(vmctx *ctx, const char *s);
 INLINE extern vmstr *alcstr_str_len(vmctx *ctx, const char *s, int len);
@@ -3604,6 +4079,10 @@ INLINE extern vmbin *alcbin_allocated_bin(vmctx *ctx, uint8_t *s, int alloclen);
 INLINE extern vmbin *alcbin_bin(vmctx *ctx, const uint8_t *s, int len);
 INLINE extern vmbin *alcbin(vmctx *ctx);
 INLINE extern void pbakbin(vmctx *ctx, vmbin *p);
+INLINE extern vmmap *alcmap(void *addr, int64_t size);
+INLINE extern void pbakmap(vmmap *m);
+INLINE extern vmstr *alcstr_map(vmctx *ctx, vmmap *m, int64_t off);
+INLINE extern vmbin *alcbin_map(vmctx *ctx, vmmap *m, int64_t off, int len);
 INLINE extern vmbgi *alcbgi_bigz(vmctx *ctx, BigZ bz);
 INLINE extern void pbakbgi(vmctx *ctx, vmbgi *p);
 INLINE extern vmobj *alcobj(vmctx *ctx);
@@ -3619,13 +4098,32 @@ INLINE extern vmvar *alcvar_str(vmctx *ctx, const char *s);
 INLINE extern vmvar *alcvar_sv(vmctx *ctx, vmstr *sv);
 INLINE extern vmvar *alcvar_bin(vmctx *ctx, const uint8_t *s, int len);
 INLINE extern vmvar *alcvar_bgistr(vmctx *ctx, const char *s, int radix);
+INLINE extern vmvar *alcvar_voidp(vmctx *ctx, void *p, freep_func freep);
 INLINE extern void pbakvar(vmctx *ctx, vmvar *p);
 INLINE extern vmvar *copy_var(vmctx *ctx, vmvar *src, int hold);
 INLINE extern void copy_var_to(vmctx *ctx, vmvar *dst, vmvar *src);
 
-INLINE extern void initialize_allocators(vmctx *ctx);
+INLINE extern void adjust_allocators(vmctx *ctx, int major);
+INLINE extern int slab_ctz(uint64_t x);
+INLINE extern int slab_popcount(uint64_t x);
 INLINE extern void mark_and_sweep(vmctx *ctx);
+INLINE extern void minor_gc(vmctx *ctx);
+INLINE extern void collect_garbage(vmctx *ctx);
+INLINE extern void gc_remember_obj(vmctx *ctx, vmobj *o);
+INLINE extern void gc_remember_fnc(vmctx *ctx, vmfnc *f);
+INLINE extern void gc_remember_var(vmctx *ctx, vmvar *v);
+INLINE extern void gc_snapshot(vmctx *ctx, vmgcstat *st);
+INLINE extern double gc_hist_bound(int i);
 INLINE extern void count(vmctx *ctx);
+
+/* Provided by the platform layer. */
+extern void *SystemTimer_init(void);
+extern void SystemTimer_restart_impl(void *p);
+extern double SystemTimer_elapsed_impl(void *p);
+extern void *File_map_impl(const char *path, int64_t *size);
+extern void File_unmap_impl(void *addr, int64_t size);
+extern void *Slab_alloc_impl(size_t size);
+extern void Slab_free_impl(void *p, size_t size);
 INLINE extern vmfrm *get_lex(vmfrm* lex, int c);
 INLINE extern int get_min2(int a0, int a1);
 INLINE extern int get_min3(int a0, int a1, int a2);
@@ -3665,6 +4163,7 @@ INLINE extern vmstr *str_from_i64(vmctx *ctx, int64_t i);
 INLINE extern vmstr *str_from_dbl(vmctx *ctx, double *d);
 INLINE extern vmstr *str_make_double(vmctx *ctx, vmstr *vs);
 INLINE extern vmstr *str_make_ntimes(vmctx *ctx, vmstr *vs, int n);
+INLINE extern vmstr *str_reserve(vmctx *ctx, vmstr *vs, int len);
 INLINE extern vmstr *str_append(vmctx *ctx, vmstr *vs, const char *s, int len);
 INLINE extern vmstr *str_append_ch(vmctx *ctx, vmstr *vs, const char ch);
 INLINE extern vmstr *str_append_cp(vmctx *ctx, vmstr *vs, const char *s);
@@ -3679,6 +4178,7 @@ INLINE extern vmstr *str_make_i64_path(vmctx *ctx, int64_t i, vmstr *v0);
 INLINE extern vmstr *str_trim(vmctx *ctx, vmstr *vs, const char *ch);
 INLINE extern vmstr *str_ltrim(vmctx *ctx, vmstr *vs, const char *ch);
 INLINE extern vmstr *str_rtrim(vmctx *ctx, vmstr *vs, const char *ch);
+INLINE extern void str_unmap(vmstr *vs);
 
 INLINE extern int bin_set_i(vmbin *vs, int idx, int64_t i);
 INLINE extern int bin_set_d(vmbin *vs, int idx, double *d);
@@ -3688,6 +4188,7 @@ INLINE extern vmbin *bin_append_bin(vmctx *ctx, vmbin *vs, vmbin *s2);
 INLINE extern vmbin *bin_append_ch(vmctx *ctx, vmbin *vs, const uint8_t ch);
 INLINE extern vmbin *bin_clear(vmbin *vs);
 INLINE extern vmbin *bin_dup(vmctx *ctx, vmbin *vs);
+INLINE extern void bin_unmap(vmbin *vs);
 INLINE extern void print_bin(vmctx *ctx, vmbin *vs);
 INLINE extern void fprint_bin(vmctx *ctx, vmbin *vs, FILE *fp);
 
@@ -3700,11 +4201,23 @@ INLINE extern vmobj *hashmap_create(vmobj *h, int sz);
 INLINE extern vmobj *hashmap_set(vmctx *ctx, vmobj *obj, const char *s, vmvar *v);
 INLINE extern vmobj *hashmap_remove(vmctx *ctx, vmobj *obj, const char *s);
 INLINE extern vmvar *hashmap_search(vmobj *obj, const char *s);
+INLINE extern vmvar *hashmap_search_ic(vmobj *obj, const char *s, vmic *ic);
 INLINE extern vmobj *hashmap_append(vmctx *ctx, vmobj *obj, vmobj *src);
 INLINE extern vmobj *hashmap_copy(vmctx *ctx, vmobj *h);
 INLINE extern vmobj *hashmap_copy_method(vmctx *ctx, vmobj *src);
 INLINE extern vmobj *array_create(vmobj *obj, int asz);
+INLINE extern void array_generic(vmctx *ctx, vmobj *obj);
+INLINE extern vmobj *array_set_i(vmctx *ctx, vmobj *obj, int64_t idx, int64_t i);
+INLINE extern vmobj *array_set_d(vmctx *ctx, vmobj *obj, int64_t idx, double d);
+INLINE extern vmobj *array_push_i(vmctx *ctx, vmobj *obj, int64_t i);
+INLINE extern vmobj *array_push_d(vmctx *ctx, vmobj *obj, double d);
+INLINE extern vmobj *array_push_v(vmctx *ctx, vmobj *obj, vmvar *v);
+INLINE extern vmvar *array_ref_var(vmctx *ctx, vmvar *ref);
+INLINE extern vmvar *array_at(vmobj *obj, int64_t idx, vmvar *tmp);
+INLINE extern int array_is_plain(vmctx *ctx, vmobj *obj, const char *name);
+INLINE extern int array_is_native_loop(vmctx *ctx, vmvar *a, vmvar *m);
 INLINE extern vmobj *array_set(vmctx *ctx, vmobj *obj, int64_t idx, vmvar *vs);
+INLINE extern vmobj *array_reserve(vmctx *ctx, vmobj *obj, int64_t n);
 INLINE extern vmobj *array_unshift(vmctx *ctx, vmobj *obj, vmvar *vs);
 INLINE extern vmvar *array_shift(vmctx *ctx, vmobj *obj);
 INLINE extern vmobj *array_shift_array(vmctx *ctx, vmobj *obj, int n);
@@ -3720,6 +4233,9 @@ INLINE extern vmobj *object_get_keys(vmctx *ctx, vmobj *src);
 
 INLINE extern int run_global(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
 INLINE extern int throw_system_exception(int line, vmctx *ctx, int id, const char *msg);
+INLINE extern void module_export(vmctx *ctx, const char *name, vmvar *v);
+INLINE extern int module_import(vmctx *ctx, vmvar *r, const char *name);
+INLINE extern void pgo_write(const char *file, int n, int64_t (*c)[3], void **target, const char **key, int fn, void **fp, const char **fname);
 INLINE extern int exception_addtrace(vmctx *ctx, vmvar *e, const char *funcname, const char *filename, int linenum);
 INLINE extern int exception_printtrace(vmctx *ctx, vmvar *e);
 INLINE extern int exception_uncaught(vmctx *ctx, vmvar *e);
@@ -238,6 +238,147 @@ double SystemTimer_elapsed_impl(void *p)
 
 #endif
 
+#ifndef __MIRC__
+
+/*
+ * A file is mapped as read only for File.mmap(), and at least one zero byte always follows the content
+ * so that the mapped area can be used as a string directly.
+ */
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+
+static int64_t file_map_page(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int64_t)info.dwPageSize;
+}
+
+void *File_map_impl(const char *path, int64_t *size)
+{
+    HANDLE h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(h, &li)) {
+        CloseHandle(h);
+        return NULL;
+    }
+    *size = (int64_t)li.QuadPart;
+
+    void *addr = NULL;
+    if (*size % file_map_page() != 0) {
+        /* The rest of the last page is filled by zero. */
+        HANDLE m = CreateFileMappingA(h, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (m) {
+            addr = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(m);
+        }
+    } else {
+        /* There is no room for a zero byte in the view, so the content is read into the memory. */
+        addr = VirtualAlloc(NULL, (SIZE_T)(*size + 1), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        DWORD n = 0;
+        for (int64_t pos = 0; addr && pos < *size; pos += n) {
+            DWORD chunk = (*size - pos) < 0x40000000 ? (DWORD)(*size - pos) : 0x40000000;
+            if (!ReadFile(h, (char *)addr + pos, chunk, &n, NULL) || n == 0) {
+                VirtualFree(addr, 0, MEM_RELEASE);
+                addr = NULL;
+            }
+        }
+    }
+    CloseHandle(h);
+    return addr;
+}
+
+void File_unmap_impl(void *addr, int64_t size)
+{
+    if (size % file_map_page() != 0) {
+        UnmapViewOfFile(addr);
+    } else {
+        VirtualFree(addr, 0, MEM_RELEASE);
+    }
+}
+
+/* The allocation granularity is 64KB, so a slab is aligned by its size. */
+void *Slab_alloc_impl(size_t size)
+{
+    return VirtualAlloc(NULL, (SIZE_T)size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+void Slab_free_impl(void *p, size_t size)
+{
+    VirtualFree(p, 0, MEM_RELEASE);
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t file_map_reserved(int64_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return ((size_t)size / page + 1) * page;
+}
+
+void *File_map_impl(const char *path, int64_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    *size = (int64_t)st.st_size;
+
+    /* The area is reserved with a zero page after the content, and then the file is mapped onto it. */
+    size_t reserved = file_map_reserved(*size);
+    void *addr = mmap(NULL, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (*size > 0 && mmap(addr, (size_t)*size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(addr, reserved);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    return addr;
+}
+
+void File_unmap_impl(void *addr, int64_t size)
+{
+    munmap(addr, file_map_reserved(size));
+}
+
+/* The area is reserved twice as large, and the parts out of the block aligned by the size are unmapped. */
+void *Slab_alloc_impl(size_t size)
+{
+    char *p = (char *)mmap(NULL, size * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    size_t head = (size - (size_t)p % size) % size;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    munmap(p + head + size, size - head);
+    return p + head;
+}
+
+void Slab_free_impl(void *p, size_t size)
+{
+    munmap(p, size);
+}
+#endif
+
+#endif  /* !__MIRC__ */
+
 #ifndef __MIRC__
 #include "../lib.h"
 
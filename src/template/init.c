@@ -19,7 +19,8 @@ vmctx *initialize(void)
     ctx->vstkp = 0;
     ctx->vstk = (vmvar *)calloc(VAR_STACK_SIZE, sizeof(vmvar));
 
-    initialize_allocators(ctx);
+    ctx->gcstat.timer = SystemTimer_init();
+
     bi_initialize();
     return ctx;
 }
@@ -29,25 +30,33 @@ void finalize(vmctx *ctx)
     bi_finalize();
 
     #define FREELIST(mem, blk) {\
-        vm##mem *v = ctx->alc.mem.chn;\
-        while (v) {\
-            vm##mem *n = v->chn;\
-            blk;\
-            free(v);\
-            v = n;\
+        vmslab *sl = ctx->slab.mem;\
+        while (sl) {\
+            vmslab *n = sl->next;\
+            vm##mem *objs = (vm##mem *)sl->objs;\
+            for (int i = 0; i < sl->n; ++i) {\
+                vm##mem *v = &(objs[i]);\
+                blk;\
+            }\
+            Slab_free_impl(sl, SLAB_SIZE);\
+            sl = n;\
         }\
     }\
     /**/
     FREELIST(var, {
-        if (v->p) {
-            if (v->freep) {
-                v->freep(v->p);
-            } else {
-                free(v->p);
+        if (v->t == VAR_VOIDP && v->vp) {
+            if (v->vp->p) {
+                if (v->vp->freep) {
+                    v->vp->freep(v->vp->p);
+                } else {
+                    free(v->vp->p);
+                }
             }
+            free(v->vp);
         }
     });
-    FREELIST(str, { if (v->s) free(v->s); });
+    FREELIST(str, { if (v->map) pbakmap(v->map); else if (v->s) free(v->s); });
+    FREELIST(bin, { if (v->map) pbakmap(v->map); else if (v->s) free(v->s); });
     FREELIST(bgi, { if (v->b) BzFree(v->b); });
     FREELIST(fnc, {});
     FREELIST(frm, { free(v->v); });
@@ -65,6 +74,13 @@ void finalize(vmctx *ctx)
         }
     }
 
+    if (ctx->gcstat.trace) {
+        fclose(ctx->gcstat.trace);
+    }
+    free(ctx->gcstat.timer);
+    free(ctx->gc.robj);
+    free(ctx->gc.rfnc);
+    free(ctx->gc.rvar);
     free(ctx->fstk);
     free(ctx->vstk);
     free(ctx);
@@ -59,7 +59,7 @@ void Regex_free(void *p)
     if (0 < ro->o->idxsz && ro->o->ary[0]) { \
         rpack = ro->o->ary[0]; \
         if (rpack->t == VAR_VOIDP) { \
-            rp = rpack->p; \
+            rp = rpack->vp->p; \
         } \
     } \
 } \
@@ -388,12 +388,9 @@ int Regex_create(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 
     vmobj *o = alcobj(ctx);
     o->is_sysobj = 1;
-    vmvar *rpack = alcvar(ctx, VAR_VOIDP, 0);
     vmstr *sv = alcstr_str(ctx, pattern);
     int32_t flags = make_pattern_string(ctx, pattern, flagsv->t == VAR_STR ? flagsv->s->hd : "");
-
-    rpack->p = Regex_compile(sv->s, flags);
-    rpack->freep = Regex_free;
+    vmvar *rpack = alcvar_voidp(ctx, Regex_compile(sv->s, flags), Regex_free);
     array_push(ctx, o, rpack);
 
     KL_SET_METHOD(o, reset, Regex_reset, lex, 2);
@@ -6,10 +6,6 @@
 /* This is the prototype that the functions written here will need. */
 
 extern void sleep_ms(int msec);
-extern void *SystemTimer_init(void);
-extern void SystemTimer_restart_impl(void *p);
-extern double SystemTimer_elapsed_impl(void *p);
-extern int Array_sort(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
 extern int System_try(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
 
 /* Basic functions */
@@ -336,6 +332,50 @@ int throw_system_exception(int line, vmctx *ctx, int id, const char *msg)
     return FLOW_EXCEPTION;
 }
 
+/* Module */
+
+void module_export(vmctx *ctx, const char *name, vmvar *v)
+{
+    if (!ctx->exports) {
+        ctx->exports = alcobj(ctx);
+    }
+    hashmap_set(ctx, ctx->exports, name, copy_var(ctx, v, 0));
+}
+
+int module_import(vmctx *ctx, vmvar *r, const char *name)
+{
+    vmvar *v = ctx->exports ? hashmap_search(ctx->exports, name) : NULL;
+    if (!v) {
+        char buf[256] = {0};
+        snprintf(buf, 240, "No module exports '%s'", name);
+        return throw_system_exception(__LINE__, ctx, EXCEPT_RUNTIME_EXCEPTION, buf);
+    }
+    COPY_VAR_TO(ctx, r, v);
+    return 0;
+}
+
+/* Profile */
+
+void pgo_write(const char *file, int n, int64_t (*c)[3], void **target, const char **key, int fn, void **fp, const char **fname)
+{
+    FILE *f = fopen(file, "w");
+    if (!f) {
+        return;
+    }
+    fprintf(f, "# kilite profile\n");
+    for (int i = 0; i < n; ++i) {
+        const char *name = "-";
+        for (int j = 0; target[i] && j < fn; ++j) {
+            if (fp[j] == target[i]) {
+                name = fname[j];
+                break;
+            }
+        }
+        fprintf(f, "%s %lld %lld %lld %s\n", key[i], (long long)c[i][0], (long long)c[i][1], (long long)c[i][2], name);
+    }
+    fclose(f);
+}
+
 /* True/False */
 
 int True(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
@@ -380,11 +420,9 @@ static vmvar *System_try_to_string(vmctx *ctx, vmvar *r, vmvar *v)
         vmvar *fv = hashmap_search((v)->o, "toString");
         if (fv && fv->t == VAR_FNC) {
             vmfnc *f1 = fv->f;
+            int e = 0;
             int p = vstackp(ctx);
-            vmfnc *callee = ctx->callee;
-            ctx->callee = f1;
-            int e = ((vmfunc_t)(f1->f))(ctx, f1->lex, r, 0);
-            ctx->callee = callee;
+            NATIVE_CALL(r, f1, r, 0)
             restore_vstackp(ctx, p);
             return r;
         }
@@ -415,6 +453,94 @@ static int System_println(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     return 0;
 }
 
+static vmobj *System_gc_counts(vmctx *ctx, vmgcstat *st)
+{
+    vmobj *o = alcobj(ctx);
+    #define GC_COUNT_OBJ(type) { \
+        vmobj *t = alcobj(ctx); \
+        KL_SET_PROPERTY_I(t, live, st->live.type) \
+        KL_SET_PROPERTY_I(t, free, st->fre.type) \
+        KL_SET_PROPERTY_O(o, type, t) \
+    } \
+    /**/
+    GC_COUNT_OBJ(var)
+    GC_COUNT_OBJ(fnc)
+    GC_COUNT_OBJ(frm)
+    GC_COUNT_OBJ(str)
+    GC_COUNT_OBJ(bin)
+    GC_COUNT_OBJ(bgi)
+    GC_COUNT_OBJ(obj)
+    #undef GC_COUNT_OBJ
+    return o;
+}
+
+static vmobj *System_gc_stats(vmctx *ctx, vmgcstat *st)
+{
+    vmobj *o = alcobj(ctx);
+    KL_SET_PROPERTY_I(o, collections, st->count)
+    KL_SET_PROPERTY_I(o, minor, st->minor)
+    KL_SET_PROPERTY_I(o, major, st->major)
+    KL_SET_PROPERTY_D(o, totalPause, st->total)
+    KL_SET_PROPERTY_D(o, maxPause, st->max)
+    KL_SET_PROPERTY_I(o, strBytes, st->strbytes)
+    KL_SET_PROPERTY_I(o, binBytes, st->binbytes)
+    KL_SET_PROPERTY_O(o, count, System_gc_counts(ctx, st))
+    vmobj *hist = alcobj(ctx);
+    for (int i = 0; i < GC_HIST_SIZE; ++i) {
+        vmobj *b = alcobj(ctx);
+        double bound = gc_hist_bound(i);
+        if (bound > 0) {
+            KL_SET_PROPERTY_D(b, upto, bound)
+        }
+        KL_SET_PROPERTY_I(b, count, st->hist[i])
+        array_push(ctx, hist, alcvar_obj(ctx, b));
+    }
+    KL_SET_PROPERTY_O(o, histogram, hist)
+    return o;
+}
+
+static int System_gcStats(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmgcstat st;
+    gc_snapshot(ctx, &st);
+    SET_OBJ(r, System_gc_stats(ctx, &st));
+    return 0;
+}
+
+static int System_gc(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmgcstat st0, st1;
+    gc_snapshot(ctx, &st0);
+    mark_and_sweep(ctx);
+    gc_snapshot(ctx, &st1);
+
+    /* Returns the difference made by this collection, and maxPause is its own pause time. */
+    st1.count -= st0.count;
+    st1.minor -= st0.minor;
+    st1.major -= st0.major;
+    st1.max = st1.total - st0.total;
+    st1.total = st1.max;
+    for (int i = 0; i < GC_HIST_SIZE; ++i) {
+        st1.hist[i] -= st0.hist[i];
+    }
+    st1.strbytes -= st0.strbytes;
+    st1.binbytes -= st0.binbytes;
+    #define GC_DELTA(type) \
+        st1.live.type -= st0.live.type; \
+        st1.fre.type -= st0.fre.type; \
+    /**/
+    GC_DELTA(var)
+    GC_DELTA(fnc)
+    GC_DELTA(frm)
+    GC_DELTA(str)
+    GC_DELTA(bin)
+    GC_DELTA(bgi)
+    GC_DELTA(obj)
+    #undef GC_DELTA
+    SET_OBJ(r, System_gc_stats(ctx, &st1));
+    return 0;
+}
+
 int System(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     vmobj *o = alcobj(ctx);
@@ -424,6 +550,8 @@ int System(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     KL_SET_METHOD(o, try, System_try, lex, 1)
     KL_SET_METHOD(o, abort, System_abort, lex, 0)
     KL_SET_METHOD(o, halt, System_halt, lex, 0)
+    KL_SET_METHOD(o, gc, System_gc, lex, 0)
+    KL_SET_METHOD(o, gcStats, System_gcStats, lex, 0)
     SET_OBJ(r, o);
     return 0;
 }
@@ -435,7 +563,7 @@ static int SystemTimer_elapsed(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     vmvar *a0 = local_var(ctx, 0);
     if (a0->t == VAR_OBJ && 0 < a0->o->idxsz && a0->o->ary[0]->t == VAR_VOIDP) {
         r->t = VAR_DBL;
-        r->d = SystemTimer_elapsed_impl(a0->o->ary[0]->p);
+        r->d = SystemTimer_elapsed_impl(a0->o->ary[0]->vp->p);
     }
     return 0;
 }
@@ -446,7 +574,7 @@ static int SystemTimer_restart(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     if (a0->t == VAR_OBJ && 0 < a0->o->idxsz && a0->o->ary[0]->t == VAR_VOIDP) {
         r->t = VAR_INT64;
         r->i = 0;
-        SystemTimer_restart_impl(a0->o->ary[0]->p);
+        SystemTimer_restart_impl(a0->o->ary[0]->vp->p);
     }
     return 0;
 }
@@ -455,8 +583,7 @@ int SystemTimer_create(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     vmobj *o = alcobj(ctx);
     o->is_sysobj = 1;
-    vmvar *timer = alcvar(ctx, VAR_VOIDP, 0);
-    timer->p = SystemTimer_init();
+    vmvar *timer = alcvar_voidp(ctx, SystemTimer_init(), NULL);
     array_set(ctx, o, 0, timer);
     KL_SET_METHOD(o, elapsed, SystemTimer_elapsed, lex, 1)
     KL_SET_METHOD(o, restart, SystemTimer_restart, lex, 1)
@@ -516,10 +643,7 @@ static int Fiber_resume(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
         }
     }
     int p = vstackp(ctx);
-    vmfnc *callee = ctx->callee;
-    ctx->callee = f1;
-    e = ((vmfunc_t)(f1->f))(ctx, f1->lex, r, args);
-    ctx->callee = callee;
+    NATIVE_CALL(r, f1, r, args)
     restore_vstackp(ctx, p);
     if (e == FLOW_YIELD) {
         e = 0;
@@ -744,10 +868,7 @@ static int iRange_sort(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     }
     vmfnc *f1 = sort->f;
 
-    vmfnc *callee = ctx->callee;
-    ctx->callee = f1;
-    e = ((vmfunc_t)(f1->f))(ctx, f1->lex, r, 2);
-    ctx->callee = callee;
+    NATIVE_CALL(r, f1, r, 2)
 
 L0:;
     restore_vstackp(ctx, pp);
@@ -973,7 +1094,8 @@ static int IteratorArray_next(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
         vmvar *n = a0->o->ary[0];
         int idx = e->i;
         if (n->t == VAR_OBJ && idx < n->o->idxsz) {
-            vmvar *v = n->o->ary[idx];
+            vmvar tmp;
+            vmvar *v = array_at(n->o, idx, &tmp);
             COPY_VAR_TO(ctx, r, v);
         } else {
             SET_I64(r, 0);
@@ -1415,6 +1537,13 @@ static int String_subString(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     DEF_ARG_OR_UNDEF(lv, 2, VAR_INT64);
     int len = lv->t == VAR_UNDEF ? -1 : lv->i;
 
+    vmstr *s0 = sv0->s;
+    if (s0->map && len < 0 && 0 <= beg && beg <= s0->len) {
+        /* The rest of the content of File.mmap() is also terminated by zero, so it's shared. */
+        SET_SV(r, alcstr_map(ctx, s0->map, (s0->hd - (char *)s0->map->addr) + beg));
+        return 0;
+    }
+
     vmstr *sv = len < 0 ? alcstr_str(ctx, str + beg) : alcstr_str_len(ctx, str + beg, len);
     SET_SV(r, sv);
     return 0;
@@ -1806,12 +1935,151 @@ int String(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     return 0;
 }
 
+/* StringBuilder */
+
+/*
+ * The buffer is held in the 1st element of the object, and it is never shared by any variable.
+ * So that appending is done in place, and the capacity is doubled when it's not enough.
+ */
+#define StringBuilderBuffer(a0, sv) vmvar *sv = NULL; { \
+    vmobj *o = a0->o; \
+    if (o->idxsz < 1 || !o->ary[0] || o->ary[0]->t != VAR_STR) { \
+        return throw_system_exception(__LINE__, ctx, EXCEPT_TYPE_MISMATCH, "Invalid StringBuilder object"); \
+    } \
+    sv = o->ary[0]; \
+} \
+/**/
+
+static int StringBuilder_append(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    StringBuilderBuffer(a0, sv);
+    for (int i = 1; i < ac; ++i) {
+        vmvar *aa = local_var(ctx, i);
+        if (aa->t == VAR_UNDEF) {
+            continue;
+        }
+        int e = add_v_v(ctx, sv, sv, aa);
+        if (e != 0) {
+            return e;
+        }
+    }
+    SET_OBJ(r, a0->o);
+    return 0;
+}
+
+static int StringBuilder_reserve(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    DEF_ARG(a1, 1, VAR_INT64);
+    StringBuilderBuffer(a0, sv);
+    if (a1->i < 0 || INT32_MAX <= a1->i) {
+        return throw_system_exception(__LINE__, ctx, EXCEPT_OUT_OF_RANGE_ERROR, NULL);
+    }
+    str_reserve(ctx, sv->s, (int)a1->i);
+    SET_OBJ(r, a0->o);
+    return 0;
+}
+
+static int StringBuilder_length(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    StringBuilderBuffer(a0, sv);
+    SET_I64(r, sv->s->len);
+    return 0;
+}
+
+static int StringBuilder_clear(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    StringBuilderBuffer(a0, sv);
+    if (IS_SHARED(sv->s)) {
+        sv->s = alcstr_str(ctx, "");
+    } else {
+        str_clear(sv->s);
+    }
+    SET_OBJ(r, a0->o);
+    return 0;
+}
+
+static int StringBuilder_toString(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    StringBuilderBuffer(a0, sv);
+    SET_SV(r, str_dup(ctx, sv->s));
+    return 0;
+}
+
+static int StringBuilder_create(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmobj *o = alcobj(ctx);
+    o->is_sysobj = 1;
+    array_push(ctx, o, alcvar_str(ctx, ""));
+    KL_SET_METHOD(o, append, StringBuilder_append, lex, 1)
+    KL_SET_METHOD(o, reserve, StringBuilder_reserve, lex, 1)
+    KL_SET_METHOD(o, length, StringBuilder_length, lex, 0)
+    KL_SET_METHOD(o, clear, StringBuilder_clear, lex, 0)
+    KL_SET_METHOD(o, toString, StringBuilder_toString, lex, 0)
+    for (int i = 0; i < ac; ++i) {
+        vmvar *aa = local_var(ctx, i);
+        if (aa->t != VAR_UNDEF) {
+            int e = add_v_v(ctx, o->ary[0], o->ary[0], aa);
+            if (e != 0) {
+                return e;
+            }
+        }
+    }
+    SET_OBJ(r, o);
+    return 0;
+}
+
+int StringBuilder(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmobj *o = alcobj(ctx);
+    KL_SET_METHOD(o, create, StringBuilder_create, lex, 1)
+    SET_OBJ(r, o);
+    return 0;
+}
+
 /* Binary */
 
+static int Binary_length(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(bv0, 0, VAR_BIN);
+    SET_I64(r, bv0->bn->len);
+    return 0;
+}
+
+static int Binary_subBinary(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(bv0, 0, VAR_BIN);
+    vmbin *bn = bv0->bn;
+    DEF_ARG(bv, 1, VAR_INT64);
+    int beg = bv->i;
+    DEF_ARG_OR_UNDEF(lv, 2, VAR_INT64);
+    int len = lv->t == VAR_UNDEF ? -1 : lv->i;
+
+    if (beg < 0 || bn->len < beg) {
+        beg = bn->len;
+    }
+    if (len < 0 || bn->len - beg < len) {
+        len = bn->len - beg;
+    }
+    if (bn->map) {
+        /* A part of the content of File.mmap() is shared without copying. */
+        SET_BIN(r, alcbin_map(ctx, bn->map, (bn->hd - (uint8_t *)bn->map->addr) + beg, len));
+        return 0;
+    }
+    SET_BIN(r, alcbin_bin(ctx, bn->hd + beg, len));
+    return 0;
+}
+
 int Binary(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     vmobj *o = alcobj(ctx);
     ctx->b = o;
+    KL_SET_METHOD(o, length, Binary_length, lex, 1)
+    KL_SET_METHOD(o, subBinary, Binary_subBinary, lex, 2)
     SET_OBJ(r, o);
     return 0;
 }
@@ -1833,6 +2101,16 @@ static int Array_size(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     return 0;
 }
 
+/* Returns 1 if the index operator and the size method of the object are the builtin ones. */
+int array_is_plain(vmctx *ctx, vmobj *obj, const char *name)
+{
+    if (!obj || (obj->spkey & SPKEY_INDEX) || (obj->hcnt > 0 && hashmap_search(obj, name))) {
+        return 0;
+    }
+    vmvar *m = hashmap_search(ctx->o, name);
+    return m && m->t == VAR_FNC && m->f->f == (void *)Array_size;
+}
+
 static int Array_join(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     DEF_ARG(a0, 0, VAR_OBJ);
@@ -1841,10 +2119,20 @@ static int Array_join(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     vmobj *o = a0->o;
     int n = o->idxsz;
     if (n > 0) {
-        add_v_v(ctx, r, r, o->ary[0]);
+        /* The buffer is reserved once by the total length of strings, and others are appended to it. */
+        vmvar tmp;
+        int len = a1->s->len * (n - 1);
+        for (int i = 0; i < n; ++i) {
+            vmvar *v = array_at(o, i, &tmp);
+            if (v && v->t == VAR_STR) {
+                len += v->s->len;
+            }
+        }
+        str_reserve(ctx, r->s, len);
+        add_v_v(ctx, r, r, array_at(o, 0, &tmp));
         for (int i = 1; i < n; ++i) {
-            add_v_v(ctx, r, r, a1);
-            add_v_v(ctx, r, r, o->ary[i]);
+            str_append_str(ctx, r->s, a1->s);
+            add_v_v(ctx, r, r, array_at(o, i, &tmp));
         }
     }
     return 0;
@@ -1881,7 +2169,7 @@ static int Array_push(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     vmobj *o = a0->o;
     for (int i = 1; i < ac; ++i) {
         vmvar *aa = local_var(ctx, i);
-        array_push(ctx, o, copy_var(ctx, aa, 0));
+        array_push_v(ctx, o, aa);
     }
     return 0;
 }
@@ -1916,7 +2204,8 @@ static int Array_flatten_impl(vmctx *ctx, vmvar *r, vmvar *a0, int level)
     case VAR_OBJ: {
         vmobj *o = a0->o;
         for (int i = 0; i < o->idxsz; ++i) {
-            int e = Array_flatten_impl(ctx, r, o->ary[i], level + 1);
+            vmvar tmp;
+            int e = Array_flatten_impl(ctx, r, array_at(o, i, &tmp), level + 1);
             if (e != 0) {
                 return e;
             }
@@ -1944,12 +2233,1074 @@ static int Array_reverse(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     vmobj *n = alcobj(ctx);
     int len = o->idxsz;
     for (int i = len - 1; i >= 0; --i) {
-        array_push(ctx, n, copy_var(ctx, o->ary[i], 0));
+        vmvar tmp;
+        array_push_v(ctx, n, array_at(o, i, &tmp));
     }
     SET_OBJ(r, n);
     return 0;
 }
 
+/* Array iteration */
+
+/*
+ * The callback is called directly with its arguments placed on the same stack slots for every element.
+ * When the callback yields, the loop is saved into the vars of this method in the same way as a translated function,
+ * and the next call resumes the callback and continues the loop.
+ * The object which has its own size method or index operator is handled by the script version in array.klt.
+ */
+
+#define ARRAY_LOOP_EACH         (0)
+#define ARRAY_LOOP_MAP          (1)
+#define ARRAY_LOOP_FLATMAP      (2)
+#define ARRAY_LOOP_FILTER       (3)
+#define ARRAY_LOOP_REJECT       (4)
+#define ARRAY_LOOP_REDUCE       (5)
+#define ARRAY_LOOP_ALL          (6)
+#define ARRAY_LOOP_ANY          (7)
+#define ARRAY_LOOP_PARTITION    (8)     /* The kinds after this call the callback with only an element. */
+#define ARRAY_LOOP_TAKEWHILE    (9)
+#define ARRAY_LOOP_DROPWHILE    (10)
+
+#define ARRAY_LOOP_SLOTS        (5)     /* The array, the callback, the result, the extra result, and the return value. */
+#define ARRAY_LOOP_VARS         (6)     /* The array, the callback, the result, the extra result, the index, and the size. */
+#define ARRAY_LOOP_YIELD        (1)     /* The callback has yielded. */
+#define ARRAY_LOOP_YIELD_SCRIPT (2)     /* The script version has yielded. */
+
+extern int Array_each_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_map_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_filter_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_reject_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_flatMap_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_reduce_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_all_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_any_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_partition_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_take_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_takeWhile_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_drop_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int Array_dropWhile_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+
+static int array_loop_true(vmvar *v)
+{
+    OP_JMP_IF_FALSE(v, L0);
+    return 1;
+L0:;
+    return 0;
+}
+
+/* A hole or an element removed by the callback is undefined. */
+static vmvar *array_loop_at(vmobj *o, int64_t i, vmvar *tmp)
+{
+    return i < o->idxsz ? array_at(o, i, tmp) : NULL;
+}
+
+static void array_loop_push(vmctx *ctx, vmobj *o, vmvar *v)
+{
+    if (v) {
+        array_push_v(ctx, o, v);
+    } else {
+        array_push(ctx, o, alcvar_initial(ctx));
+    }
+}
+
+static void array_loop_push_range(vmctx *ctx, vmobj *r, vmobj *o, int64_t i, int64_t n)
+{
+    if (n > o->idxsz) {
+        n = o->idxsz;
+    }
+    if (i >= n) {
+        return;
+    }
+    /* The kind of the result is fixed by the first element, and then it's presized. */
+    vmvar tmp;
+    array_loop_push(ctx, r, array_at(o, i++, &tmp));
+    array_reserve(ctx, r, r->idxsz + n - i);
+    if (o->akind != ARRAY_KIND_GENERIC && r->akind == o->akind) {
+        memcpy(r->ai + r->idxsz, o->ai + i, (n - i) * sizeof(int64_t));
+        r->idxsz += n - i;
+        return;
+    }
+    for ( ; i < n; ++i) {
+        array_loop_push(ctx, r, array_at(o, i, &tmp));
+    }
+}
+
+/* The script version is called through its own function object so that it can keep its own yield state. */
+static int array_loop_script(vmctx *ctx, vmfrm *lex, vmvar *r, int ac, void *script, const char *name)
+{
+    int e = 0;
+    vmfnc *self = ctx->callee;
+    vmfnc *f = self->yfnc;
+    if (self->yield != ARRAY_LOOP_YIELD_SCRIPT) {
+        f = alcfnc(ctx, script, lex, name, ac);
+        f->yield = 0;
+    }
+    NATIVE_CALL(r, f, r, ac)
+    if (e == FLOW_YIELD) {
+        GC_WRITE_BARRIER_FNC(ctx, self);
+        self->yield = ARRAY_LOOP_YIELD_SCRIPT;
+        self->yfnc = f;
+    } else {
+        self->yield = 0;
+    }
+    return e;
+}
+
+static void array_loop_args(vmctx *ctx, int kind, vmvar *sv, vmvar *arg0, int64_t i)
+{
+    vmobj *o = sv[0].o;
+    vmvar tmp;
+    vmvar *v;
+    if (kind == ARRAY_LOOP_EACH && sv[3].t == VAR_OBJ) {
+        /* Each for a hash is called with a pair of a key and a value. */
+        vmvar *key = sv[3].o->ary[i];
+        vmobj *pair = alcobj(ctx);
+        array_push(ctx, pair, copy_var(ctx, key, 0));
+        array_loop_push(ctx, pair, hashmap_search(o, key->s->hd));
+        SET_OBJ(&tmp, pair);
+        v = &tmp;
+    } else {
+        v = array_loop_at(o, i, &tmp);
+    }
+    switch (kind) {
+    case ARRAY_LOOP_REDUCE:
+        SHCOPY_VAR_TO(ctx, arg0, &sv[2]);
+        SHCOPY_VAR_TO(ctx, arg0 - 1, v);
+        SET_I64(arg0 - 2, i);
+        break;
+    case ARRAY_LOOP_PARTITION:
+    case ARRAY_LOOP_TAKEWHILE:
+    case ARRAY_LOOP_DROPWHILE:
+        SHCOPY_VAR_TO(ctx, arg0, v);
+        break;
+    default:
+        SHCOPY_VAR_TO(ctx, arg0, v);
+        SET_I64(arg0 - 1, i);
+        break;
+    }
+}
+
+/* Applies the return value of the callback for the i-th element, and returns 1 to stop the loop. */
+static int array_loop_step(vmctx *ctx, int kind, vmvar *sv, int64_t i, int64_t n)
+{
+    vmobj *o = sv[0].o;
+    vmvar *rv = &sv[4];
+    vmvar tmp;
+    switch (kind) {
+    case ARRAY_LOOP_EACH:
+        return rv->t != VAR_UNDEF && !array_loop_true(rv);
+    case ARRAY_LOOP_MAP:
+    case ARRAY_LOOP_FLATMAP:
+        array_push_v(ctx, sv[2].o, rv);
+        if (sv[2].o->idxsz == 1) {
+            /* The kind of the result is fixed by the first element, and then it's presized. */
+            array_reserve(ctx, sv[2].o, n);
+        }
+        break;
+    case ARRAY_LOOP_FILTER:
+        if (array_loop_true(rv)) {
+            array_loop_push(ctx, sv[2].o, array_loop_at(o, i, &tmp));
+        }
+        break;
+    case ARRAY_LOOP_REJECT:
+        if (!array_loop_true(rv)) {
+            array_loop_push(ctx, sv[2].o, array_loop_at(o, i, &tmp));
+        }
+        break;
+    case ARRAY_LOOP_REDUCE:
+        SHCOPY_VAR_TO(ctx, &sv[2], rv);
+        break;
+    case ARRAY_LOOP_ALL:
+        if (rv->t != VAR_UNDEF && !array_loop_true(rv)) {
+            SET_BOOL(&sv[3], 0);
+            return 1;
+        }
+        break;
+    case ARRAY_LOOP_ANY:
+        if (rv->t != VAR_UNDEF && array_loop_true(rv)) {
+            SET_BOOL(&sv[3], 1);
+            return 1;
+        }
+        break;
+    case ARRAY_LOOP_PARTITION:
+        array_loop_push(ctx, array_loop_true(rv) ? sv[2].o : sv[3].o, array_loop_at(o, i, &tmp));
+        break;
+    case ARRAY_LOOP_TAKEWHILE:
+        if (!array_loop_true(rv)) {
+            return 1;
+        }
+        array_loop_push(ctx, sv[2].o, array_loop_at(o, i, &tmp));
+        break;
+    case ARRAY_LOOP_DROPWHILE:
+        if (!array_loop_true(rv)) {
+            array_loop_push_range(ctx, sv[2].o, o, i, n);
+            return 1;
+        }
+        break;
+    }
+    return 0;
+}
+
+static int array_loop_result(vmctx *ctx, int kind, vmvar *sv, vmvar *r)
+{
+    switch (kind) {
+    case ARRAY_LOOP_EACH:
+        break;
+    case ARRAY_LOOP_FLATMAP:
+        SET_OBJ(r, alcobj(ctx));
+        return Array_flatten_impl(ctx, r, &sv[2], 0);
+    case ARRAY_LOOP_ALL:
+    case ARRAY_LOOP_ANY:
+        SHCOPY_VAR_TO(ctx, r, &sv[3]);
+        break;
+    case ARRAY_LOOP_PARTITION: {
+        vmobj *o = alcobj(ctx);
+        array_push(ctx, o, alcvar_obj(ctx, sv[2].o));
+        array_push(ctx, o, alcvar_obj(ctx, sv[3].o));
+        SET_OBJ(r, o);
+        break;
+    }
+    default:
+        SHCOPY_VAR_TO(ctx, r, &sv[2]);
+        break;
+    }
+    return 0;
+}
+
+static int array_loop(vmctx *ctx, vmfrm *lex, vmvar *r, int ac, int kind, void *script, const char *name)
+{
+    vmfnc *self = ctx->callee;
+    int yield = self->yield;
+    if (yield == ARRAY_LOOP_YIELD_SCRIPT) {
+        return array_loop_script(ctx, lex, r, ac, script, name);
+    }
+    if (yield == 0) {
+        vmvar *a0 = ac > 0 ? local_var(ctx, 0) : NULL;
+        vmvar *a1 = ac > 1 ? local_var(ctx, 1) : NULL;
+        if (!a0 || a0->t != VAR_OBJ || !a1 || a1->t != VAR_FNC || !array_is_plain(ctx, a0->o, "size")) {
+            return array_loop_script(ctx, lex, r, ac, script, name);
+        }
+    }
+
+    int e = 0;
+    int nargs = kind == ARRAY_LOOP_REDUCE ? 3 : (kind >= ARRAY_LOOP_PARTITION ? 1 : 2);
+    vmvar resume = {0};
+    vmvar *ra = &resume;    /* The value given by resume, which is pushed again above the slots. */
+    if (yield > 0 && ac > 0) {
+        SHCOPY_VAR_TO(ctx, ra, local_var(ctx, 0));
+    }
+    int p = vstackp(ctx);
+    alloc_var(ctx, ARRAY_LOOP_SLOTS + nargs, L0, name, __FILE__, __LINE__);
+    int top = vstackp(ctx);
+    vmvar *sv = &(ctx->vstk[p]);
+    vmvar *arg0 = &(ctx->vstk[top - 1]);
+    int64_t i = 0;
+    int64_t n = 0;
+    vmfnc *f;
+    int fac;
+
+    if (yield > 0) {
+        for (int k = 0; k < 4; ++k) {
+            SHCOPY_VAR_TO(ctx, &sv[k], self->vars[k]);
+        }
+        i = self->vars[4]->i;
+        n = self->vars[5]->i;
+        f = self->yfnc;
+        fac = ac;
+        if (ac > 0) {
+            push_var(ctx, ra, L0, name, __FILE__, __LINE__);
+        }
+    } else {
+        SHCOPY_VAR_TO(ctx, &sv[0], local_var(ctx, ARRAY_LOOP_SLOTS + nargs));
+        SHCOPY_VAR_TO(ctx, &sv[1], local_var(ctx, ARRAY_LOOP_SLOTS + nargs + 1));
+        vmobj *o = sv[0].o;
+        n = o->idxsz;
+        switch (kind) {
+        case ARRAY_LOOP_EACH:
+            if (n == 0) {
+                vmobj *keys = object_get_keys(ctx, o);
+                SET_OBJ(&sv[3], keys);
+                n = keys->idxsz;
+            }
+            break;
+        case ARRAY_LOOP_REDUCE:
+            if (ac > 2) {
+                SHCOPY_VAR_TO(ctx, &sv[2], local_var(ctx, ARRAY_LOOP_SLOTS + nargs + 2));
+            }
+            break;
+        case ARRAY_LOOP_ALL:
+            SET_BOOL(&sv[3], 1);
+            break;
+        case ARRAY_LOOP_ANY:
+            SET_BOOL(&sv[3], 0);
+            break;
+        case ARRAY_LOOP_PARTITION:
+            SET_OBJ(&sv[3], alcobj(ctx));
+            /* fallthrough */
+        default:
+            SET_OBJ(&sv[2], alcobj(ctx));
+            break;
+        }
+        if (n == 0) {
+            goto DONE;
+        }
+        f = sv[1].f;
+        fac = nargs;
+        array_loop_args(ctx, kind, sv, arg0, 0);
+    }
+
+    for (;;) {
+        NATIVE_CALL(r, f, &sv[4], fac)
+        restore_vstackp(ctx, top);
+        if (e == FLOW_YIELD) {
+            GC_WRITE_BARRIER_FNC(ctx, self);
+            self->yield = ARRAY_LOOP_YIELD;
+            self->yfnc = f;
+            if (self->vars == NULL) {
+                self->vars = (vmvar**)calloc(ARRAY_LOOP_VARS, sizeof(vmvar*));
+                for (int k = 0; k < ARRAY_LOOP_VARS; ++k) {
+                    self->vars[k] = alcvar_initial(ctx);
+                }
+            }
+            self->varcnt = ARRAY_LOOP_VARS;
+            for (int k = 0; k < 4; ++k) {
+                SHCOPY_VAR_TO(ctx, self->vars[k], &sv[k]);
+            }
+            SET_I64(self->vars[4], i);
+            SET_I64(self->vars[5], n);
+            SHCOPY_VAR_TO(ctx, r, &sv[4]);
+            goto L0;
+        }
+        if (e != 0 || array_loop_step(ctx, kind, sv, i, n) || ++i >= n) {
+            break;
+        }
+        f = sv[1].f;
+        fac = nargs;
+        array_loop_args(ctx, kind, sv, arg0, i);
+    }
+
+DONE:;
+    if (e == 0) {
+        e = array_loop_result(ctx, kind, sv, r);
+    }
+
+L0:;
+    restore_vstackp(ctx, p);
+    if (e != FLOW_YIELD) {
+        self->yield = 0;
+    }
+    return e;
+}
+
+static int Array_each(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_EACH, Array_each_script, "each");
+}
+
+static int Array_map(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_MAP, Array_map_script, "map");
+}
+
+static int Array_flatMap(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_FLATMAP, Array_flatMap_script, "flatMap");
+}
+
+static int Array_filter(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_FILTER, Array_filter_script, "filter");
+}
+
+static int Array_reject(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_REJECT, Array_reject_script, "reject");
+}
+
+static int Array_reduce(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_REDUCE, Array_reduce_script, "reduce");
+}
+
+static int Array_all(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_ALL, Array_all_script, "all");
+}
+
+static int Array_any(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_ANY, Array_any_script, "any");
+}
+
+static int Array_partition(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_PARTITION, Array_partition_script, "partition");
+}
+
+static int Array_takeWhile(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_TAKEWHILE, Array_takeWhile_script, "takeWhile");
+}
+
+static int Array_dropWhile(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    return array_loop(ctx, lex, r, ac, ARRAY_LOOP_DROPWHILE, Array_dropWhile_script, "dropWhile");
+}
+
+/* Returns 1 if the method of the plain array runs by array_loop, which never holds the callback after returning. */
+int array_is_native_loop(vmctx *ctx, vmvar *a, vmvar *m)
+{
+    if (a->t != VAR_OBJ || m->t != VAR_FNC || !array_is_plain(ctx, a->o, "size")) {
+        return 0;
+    }
+    void *f = m->f->f;
+    return f == (void *)Array_each || f == (void *)Array_map || f == (void *)Array_flatMap ||
+        f == (void *)Array_filter || f == (void *)Array_reject || f == (void *)Array_reduce ||
+        f == (void *)Array_all || f == (void *)Array_any || f == (void *)Array_partition ||
+        f == (void *)Array_takeWhile || f == (void *)Array_dropWhile;
+}
+
+static int Array_take(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmvar *a0 = ac > 0 ? local_var(ctx, 0) : NULL;
+    vmvar *a1 = ac > 1 ? local_var(ctx, 1) : NULL;
+    if (ctx->callee->yield > 0 || !a0 || a0->t != VAR_OBJ || !a1 || a1->t != VAR_INT64 || !array_is_plain(ctx, a0->o, "size")) {
+        return array_loop_script(ctx, lex, r, ac, Array_take_script, "take");
+    }
+    vmobj *o = alcobj(ctx);
+    array_loop_push_range(ctx, o, a0->o, 0, a1->i);
+    SET_OBJ(r, o);
+    return 0;
+}
+
+static int Array_drop(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    vmvar *a0 = ac > 0 ? local_var(ctx, 0) : NULL;
+    vmvar *a1 = ac > 1 ? local_var(ctx, 1) : NULL;
+    if (ctx->callee->yield > 0 || !a0 || a0->t != VAR_OBJ || !a1 || a1->t != VAR_INT64 || !array_is_plain(ctx, a0->o, "size")) {
+        return array_loop_script(ctx, lex, r, ac, Array_drop_script, "drop");
+    }
+    vmobj *o = alcobj(ctx);
+    array_loop_push_range(ctx, o, a0->o, a1->i < 0 ? 0 : a1->i, a0->o->idxsz);
+    SET_OBJ(r, o);
+    return 0;
+}
+
+/* Array sort */
+
+/*
+ * Array.sort() is a pattern-defeating quicksort, and Array.stableSort() and Array.sortBy() are a merge sort.
+ * A short range is sorted by an insertion sort in both of them.
+ * The comparator is called only when it's given, otherwise the elements are compared directly
+ * when all of them are integers, doubles, or strings.
+ * All loops check the range by themselves, so a broken comparator never makes it go out of the array.
+ * A sort can't be resumed in the middle, so a yield from the comparator or the key function is an exception.
+ */
+
+#define SORT_INSERTION_LIMIT (24)
+#define SORT_NINTHER_LIMIT (128)
+#define SORT_PARTIAL_LIMIT (8)
+#define SORT_BLOCK_SIZE (64)
+
+typedef struct sortctx {
+    vmctx *ctx;
+    vmvar *r;   /* The result of the native function holding the array being sorted. */
+    vmfnc *f;   /* The comparator, or NULL to compare by the <=> operator. */
+    int e;      /* Not 0 after the comparison has thrown an exception. */
+} sortctx;
+
+typedef struct sortpair {
+    vmvar *k;   /* The key made by the function of sortBy. */
+    vmvar *v;
+} sortpair;
+
+#define SORT_SWAP(T, a, i, j) { T t_ = (a)[i]; (a)[i] = (a)[j]; (a)[j] = t_; }
+
+#define SORT_LESS_I64(sc, x, y)  ((x) < (y))
+#define SORT_LESS_DBL(sc, x, y)  ((x) < (y))
+#define SORT_LESS_VI64(sc, x, y) ((x)->i < (y)->i)
+#define SORT_LESS_VDBL(sc, x, y) ((x)->d < (y)->d)
+#define SORT_LESS_VSTR(sc, x, y) (strcmp((x)->s->hd, (y)->s->hd) < 0)
+#define SORT_LESS_VAR(sc, x, y)  sort_less(sc, x, y)
+#define SORT_LESS_PI64(sc, x, y) ((x).k->i < (y).k->i)
+#define SORT_LESS_PDBL(sc, x, y) ((x).k->d < (y).k->d)
+#define SORT_LESS_PSTR(sc, x, y) (strcmp((x).k->s->hd, (y).k->s->hd) < 0)
+#define SORT_LESS_PVAR(sc, x, y) sort_less(sc, (x).k, (y).k)
+
+/* Returns 1 if x should be placed before y. */
+static int sort_less(sortctx *sc, vmvar *x, vmvar *y)
+{
+    if (sc->e) {
+        return 0;
+    }
+
+    vmctx *ctx = sc->ctx;
+    vmvar undef = {0};
+    vmvar rv = {0};
+    if (!x) {
+        x = &undef;
+    }
+    if (!y) {
+        y = &undef;
+    }
+    int e = 0;
+    int p = vstackp(ctx);
+    if (!sc->f) {
+        /* The <=> operator of an object is also a function call. */
+        GC_WRITE_BARRIER_VAR(ctx, sc->r);
+        OP_LGE(ctx, &rv, x, y, L0, "Array_sort", __FILE__, 0)
+    } else {
+        push_var(ctx, y, L0, "Array_sort", __FILE__, 0);
+        push_var(ctx, x, L0, "Array_sort", __FILE__, 0);
+        NATIVE_CALL(sc->r, sc->f, &rv, 2)
+        if (e == FLOW_YIELD) {
+            /* The sort can't be resumed in the middle, so the comparator is reset and the yield is an error. */
+            sc->f->yield = 0;
+            e = throw_system_exception(__LINE__, ctx, EXCEPT_INVALID_FIBER_STATE, "The comparator of sort can't yield");
+        }
+    }
+L0:;
+    restore_vstackp(ctx, p);
+    if (e) {
+        sc->e = e;
+        return 0;
+    }
+
+    switch (rv.t) {
+    case VAR_BOOL:
+    case VAR_INT64:
+        return rv.i < 0;
+    case VAR_DBL:
+        return rv.d < 0;
+    default: {
+        vmvar b = {0};
+        sc->e = lt_v_i(ctx, &b, &rv, 0);
+        return !sc->e && b.i;
+    }
+    }
+    return 0;
+}
+
+static int sort_depth_limit(int64_t n)
+{
+    int depth = 0;
+    while (n > 1) {
+        n >>= 1;
+        ++depth;
+    }
+    return depth;
+}
+
+#define KL_DEF_SORT_INSERTION(name, T, LESS) \
+static void name##_insertion(sortctx *sc, T *a, int64_t n) \
+{ \
+    for (int64_t i = 1; i < n; ++i) { \
+        T t = a[i]; \
+        int64_t j = i; \
+        while (j > 0 && LESS(sc, t, a[j - 1])) { \
+            a[j] = a[j - 1]; \
+            --j; \
+        } \
+        a[j] = t; \
+    } \
+} \
+/**/
+
+/* Puts the elements less than the pivot a[0] to the left, and returns the pivot position. */
+#define KL_DEF_SORT_PARTITION(name, T, LESS) \
+static int64_t name##_partition_right(sortctx *sc, T *a, int64_t n, int *done) \
+{ \
+    T pivot = a[0]; \
+    int64_t i = 1, j = n - 1; \
+    while (i <= j && LESS(sc, a[i], pivot)) ++i; \
+    while (i <= j && !LESS(sc, a[j], pivot)) --j; \
+    *done = i > j; \
+    while (i < j) { \
+        SORT_SWAP(T, a, i, j) \
+        ++i; \
+        --j; \
+        while (i <= j && LESS(sc, a[i], pivot)) ++i; \
+        while (i <= j && !LESS(sc, a[j], pivot)) --j; \
+    } \
+    a[0] = a[i - 1]; \
+    a[i - 1] = pivot; \
+    return i - 1; \
+} \
+/**/
+
+/*
+ * The partition without branches for the comparison, which is the BlockQuicksort used by pdqsort.
+ * The offsets of the elements in the wrong side are collected in a block at first, and then swapped.
+ */
+#define KL_DEF_SORT_PARTITION_BLOCK(name, T, LESS) \
+static void name##_swap_offsets(T *l0, T *r0, unsigned char *offl, unsigned char *offr, int64_t num, int swaps) \
+{ \
+    if (swaps) { \
+        for (int64_t i = 0; i < num; ++i) { \
+            T t = l0[offl[i]]; \
+            l0[offl[i]] = r0[-(int64_t)offr[i]]; \
+            r0[-(int64_t)offr[i]] = t; \
+        } \
+    } else if (num > 0) { \
+        T *l = l0 + offl[0]; \
+        T *r = r0 - offr[0]; \
+        T t = *l; \
+        *l = *r; \
+        for (int64_t i = 1; i < num; ++i) { \
+            l = l0 + offl[i]; \
+            *r = *l; \
+            r = r0 - offr[i]; \
+            *l = *r; \
+        } \
+        *r = t; \
+    } \
+} \
+static int64_t name##_partition_right(sortctx *sc, T *a, int64_t n, int *done) \
+{ \
+    T pivot = a[0]; \
+    T *first = a + 1; \
+    T *last = a + n; \
+    while (first < last && LESS(sc, *first, pivot)) ++first; \
+    while (first < last && !LESS(sc, *(last - 1), pivot)) --last; \
+    *done = first >= last; \
+    if (!*done) { \
+        --last; \
+        T t = *first; \
+        *first = *last; \
+        *last = t; \
+        ++first; \
+        unsigned char offl[SORT_BLOCK_SIZE]; \
+        unsigned char offr[SORT_BLOCK_SIZE]; \
+        T *l0 = first; \
+        T *r0 = last; \
+        int64_t nl = 0, nr = 0, sl = 0, sr = 0; \
+        while (first < last) { \
+            int64_t unknown = last - first; \
+            int64_t lsplit = nl == 0 ? (nr == 0 ? unknown / 2 : unknown) : 0; \
+            int64_t rsplit = nr == 0 ? (unknown - lsplit) : 0; \
+            if (lsplit > SORT_BLOCK_SIZE) { \
+                lsplit = SORT_BLOCK_SIZE; \
+            } \
+            if (rsplit > SORT_BLOCK_SIZE) { \
+                rsplit = SORT_BLOCK_SIZE; \
+            } \
+            for (int64_t i = 0; i < lsplit; ++i) { \
+                offl[nl] = (unsigned char)i; \
+                nl += !LESS(sc, *first, pivot); \
+                ++first; \
+            } \
+            for (int64_t i = 0; i < rsplit; ) { \
+                offr[nr] = (unsigned char)++i; \
+                nr += LESS(sc, *--last, pivot); \
+            } \
+            int64_t num = nl < nr ? nl : nr; \
+            name##_swap_offsets(l0, r0, offl + sl, offr + sr, num, nl == nr); \
+            nl -= num; \
+            nr -= num; \
+            sl += num; \
+            sr += num; \
+            if (nl == 0) { \
+                sl = 0; \
+                l0 = first; \
+            } \
+            if (nr == 0) { \
+                sr = 0; \
+                r0 = last; \
+            } \
+        } \
+        if (nl) { \
+            while (nl--) { \
+                T *l = l0 + offl[sl + nl]; \
+                --last; \
+                T t = *l; \
+                *l = *last; \
+                *last = t; \
+            } \
+            first = last; \
+        } \
+        if (nr) { \
+            while (nr--) { \
+                T *r = r0 - offr[sr + nr]; \
+                T t = *r; \
+                *r = *first; \
+                *first = t; \
+                ++first; \
+            } \
+        } \
+    } \
+    T *p = first - 1; \
+    a[0] = *p; \
+    *p = pivot; \
+    return p - a; \
+} \
+/**/
+
+#define KL_DEF_SORT_PDQ(name, T, LESS) \
+static int name##_partial_insertion(sortctx *sc, T *a, int64_t n) \
+{ \
+    int64_t moved = 0; \
+    for (int64_t i = 1; i < n; ++i) { \
+        T t = a[i]; \
+        int64_t j = i; \
+        while (j > 0 && LESS(sc, t, a[j - 1])) { \
+            a[j] = a[j - 1]; \
+            --j; \
+        } \
+        a[j] = t; \
+        moved += i - j; \
+        if (moved > SORT_PARTIAL_LIMIT) { \
+            return 0; \
+        } \
+    } \
+    return 1; \
+} \
+static void name##_sort3(sortctx *sc, T *a, int64_t i, int64_t j, int64_t k) \
+{ \
+    if (LESS(sc, a[j], a[i])) SORT_SWAP(T, a, i, j) \
+    if (LESS(sc, a[k], a[j])) SORT_SWAP(T, a, j, k) \
+    if (LESS(sc, a[j], a[i])) SORT_SWAP(T, a, i, j) \
+} \
+static void name##_sift(sortctx *sc, T *a, int64_t i, int64_t n) \
+{ \
+    for (;;) { \
+        int64_t c = i * 2 + 1; \
+        if (c >= n) { \
+            break; \
+        } \
+        if (c + 1 < n && LESS(sc, a[c], a[c + 1])) { \
+            ++c; \
+        } \
+        if (!LESS(sc, a[i], a[c])) { \
+            break; \
+        } \
+        SORT_SWAP(T, a, i, c) \
+        i = c; \
+    } \
+} \
+static void name##_heapsort(sortctx *sc, T *a, int64_t n) \
+{ \
+    for (int64_t i = n / 2 - 1; i >= 0; --i) { \
+        name##_sift(sc, a, i, n); \
+    } \
+    for (int64_t i = n - 1; i > 0; --i) { \
+        SORT_SWAP(T, a, 0, i) \
+        name##_sift(sc, a, 0, i); \
+    } \
+} \
+/* Puts the elements equal to the pivot a[0] to the left, and returns the pivot position. */ \
+static int64_t name##_partition_left(sortctx *sc, T *a, int64_t n) \
+{ \
+    T pivot = a[0]; \
+    int64_t i = 1, j = n - 1; \
+    while (i <= j && !LESS(sc, pivot, a[i])) ++i; \
+    while (i <= j && LESS(sc, pivot, a[j])) --j; \
+    while (i < j) { \
+        SORT_SWAP(T, a, i, j) \
+        ++i; \
+        --j; \
+        while (i <= j && !LESS(sc, pivot, a[i])) ++i; \
+        while (i <= j && LESS(sc, pivot, a[j])) --j; \
+    } \
+    a[0] = a[i - 1]; \
+    a[i - 1] = pivot; \
+    return i - 1; \
+} \
+static void name##_pdqsort(sortctx *sc, T *a, int64_t n, int bad, int leftmost) \
+{ \
+    while (!sc->e) { \
+        if (n < SORT_INSERTION_LIMIT) { \
+            name##_insertion(sc, a, n); \
+            return; \
+        } \
+        int64_t h = n / 2; \
+        if (n > SORT_NINTHER_LIMIT) { \
+            name##_sort3(sc, a, 0, h, n - 1); \
+            name##_sort3(sc, a, 1, h - 1, n - 2); \
+            name##_sort3(sc, a, 2, h + 1, n - 3); \
+            name##_sort3(sc, a, h - 1, h, h + 1); \
+            SORT_SWAP(T, a, 0, h) \
+        } else { \
+            name##_sort3(sc, a, h, 0, n - 1); \
+        } \
+        /* The pivot equal to the previous one means many equal elements, so skip all of them. */ \
+        if (!leftmost && !LESS(sc, a[-1], a[0])) { \
+            int64_t p = name##_partition_left(sc, a, n); \
+            a += p + 1; \
+            n -= p + 1; \
+            continue; \
+        } \
+        int done = 0; \
+        int64_t p = name##_partition_right(sc, a, n, &done); \
+        int64_t ls = p; \
+        int64_t rs = n - p - 1; \
+        if (ls < n / 8 || rs < n / 8) { \
+            /* Too unbalanced, so break the pattern, or give up and use a heapsort. */ \
+            if (--bad == 0) { \
+                name##_heapsort(sc, a, n); \
+                return; \
+            } \
+            if (ls >= SORT_INSERTION_LIMIT) { \
+                SORT_SWAP(T, a, 0, ls / 4) \
+                SORT_SWAP(T, a, p - 1, p - ls / 4) \
+                if (ls > SORT_NINTHER_LIMIT) { \
+                    SORT_SWAP(T, a, 1, ls / 4 + 1) \
+                    SORT_SWAP(T, a, 2, ls / 4 + 2) \
+                    SORT_SWAP(T, a, p - 2, p - (ls / 4 + 1)) \
+                    SORT_SWAP(T, a, p - 3, p - (ls / 4 + 2)) \
+                } \
+            } \
+            if (rs >= SORT_INSERTION_LIMIT) { \
+                SORT_SWAP(T, a, p + 1, p + 1 + rs / 4) \
+                SORT_SWAP(T, a, n - 1, n - rs / 4) \
+                if (rs > SORT_NINTHER_LIMIT) { \
+                    SORT_SWAP(T, a, p + 2, p + 2 + rs / 4) \
+                    SORT_SWAP(T, a, p + 3, p + 3 + rs / 4) \
+                    SORT_SWAP(T, a, n - 2, n - (1 + rs / 4)) \
+                    SORT_SWAP(T, a, n - 3, n - (2 + rs / 4)) \
+                } \
+            } \
+        } else if (done && name##_partial_insertion(sc, a, ls) && name##_partial_insertion(sc, a + p + 1, rs)) { \
+            /* It was already partitioned and both sides are almost sorted. */ \
+            return; \
+        } \
+        name##_pdqsort(sc, a, ls, bad, leftmost); \
+        a += p + 1; \
+        n = rs; \
+        leftmost = 0; \
+    } \
+} \
+/**/
+
+#define KL_DEF_SORT_MERGE(name, T, LESS) \
+static void name##_mergesort(sortctx *sc, T *a, T *w, int64_t n) \
+{ \
+    if (n < SORT_INSERTION_LIMIT) { \
+        name##_insertion(sc, a, n); \
+        return; \
+    } \
+    int64_t h = n / 2; \
+    name##_mergesort(sc, a, w, h); \
+    name##_mergesort(sc, a + h, w, n - h); \
+    if (sc->e || !LESS(sc, a[h], a[h - 1])) { \
+        return; \
+    } \
+    memcpy(w, a, h * sizeof(T)); \
+    int64_t i = 0, j = h, k = 0; \
+    while (i < h && j < n) { \
+        if (LESS(sc, a[j], w[i])) { \
+            a[k++] = a[j++]; \
+        } else { \
+            a[k++] = w[i++]; \
+        } \
+    } \
+    while (i < h) { \
+        a[k++] = w[i++]; \
+    } \
+} \
+/**/
+
+KL_DEF_SORT_INSERTION(sort_i64, int64_t, SORT_LESS_I64)
+KL_DEF_SORT_PARTITION_BLOCK(sort_i64, int64_t, SORT_LESS_I64)
+KL_DEF_SORT_PDQ(sort_i64, int64_t, SORT_LESS_I64)
+KL_DEF_SORT_INSERTION(sort_dbl, double, SORT_LESS_DBL)
+KL_DEF_SORT_PARTITION_BLOCK(sort_dbl, double, SORT_LESS_DBL)
+KL_DEF_SORT_PDQ(sort_dbl, double, SORT_LESS_DBL)
+KL_DEF_SORT_MERGE(sort_dbl, double, SORT_LESS_DBL)
+KL_DEF_SORT_INSERTION(sort_vi64, vmvar *, SORT_LESS_VI64)
+KL_DEF_SORT_PARTITION(sort_vi64, vmvar *, SORT_LESS_VI64)
+KL_DEF_SORT_PDQ(sort_vi64, vmvar *, SORT_LESS_VI64)
+KL_DEF_SORT_INSERTION(sort_vdbl, vmvar *, SORT_LESS_VDBL)
+KL_DEF_SORT_PARTITION(sort_vdbl, vmvar *, SORT_LESS_VDBL)
+KL_DEF_SORT_PDQ(sort_vdbl, vmvar *, SORT_LESS_VDBL)
+KL_DEF_SORT_MERGE(sort_vdbl, vmvar *, SORT_LESS_VDBL)
+KL_DEF_SORT_INSERTION(sort_vstr, vmvar *, SORT_LESS_VSTR)
+KL_DEF_SORT_PARTITION(sort_vstr, vmvar *, SORT_LESS_VSTR)
+KL_DEF_SORT_PDQ(sort_vstr, vmvar *, SORT_LESS_VSTR)
+KL_DEF_SORT_INSERTION(sort_var, vmvar *, SORT_LESS_VAR)
+KL_DEF_SORT_PARTITION(sort_var, vmvar *, SORT_LESS_VAR)
+KL_DEF_SORT_PDQ(sort_var, vmvar *, SORT_LESS_VAR)
+KL_DEF_SORT_MERGE(sort_var, vmvar *, SORT_LESS_VAR)
+KL_DEF_SORT_INSERTION(sort_pi64, sortpair, SORT_LESS_PI64)
+KL_DEF_SORT_MERGE(sort_pi64, sortpair, SORT_LESS_PI64)
+KL_DEF_SORT_INSERTION(sort_pdbl, sortpair, SORT_LESS_PDBL)
+KL_DEF_SORT_MERGE(sort_pdbl, sortpair, SORT_LESS_PDBL)
+KL_DEF_SORT_INSERTION(sort_pstr, sortpair, SORT_LESS_PSTR)
+KL_DEF_SORT_MERGE(sort_pstr, sortpair, SORT_LESS_PSTR)
+KL_DEF_SORT_INSERTION(sort_pvar, sortpair, SORT_LESS_PVAR)
+KL_DEF_SORT_MERGE(sort_pvar, sortpair, SORT_LESS_PVAR)
+
+/* Returns the type if all elements are the same type to be compared directly, otherwise VAR_UNDEF. */
+static int sort_direct_type(vmvar **ary, int64_t n)
+{
+    int t = ary[0] ? ary[0]->t : VAR_UNDEF;
+    if (t != VAR_INT64 && t != VAR_DBL && t != VAR_STR) {
+        return VAR_UNDEF;
+    }
+    for (int64_t i = 1; i < n; ++i) {
+        if (!ary[i] || ary[i]->t != t) {
+            return VAR_UNDEF;
+        }
+    }
+    return t;
+}
+
+/* Sorts the array in place, which should be rooted by the caller because the comparator could run the GC. */
+static int Array_sort_impl(vmctx *ctx, vmvar *r, vmobj *o, vmfnc *f, int stable)
+{
+    int64_t n = o->idxsz;
+    if (n < 2) {
+        return 0;
+    }
+
+    sortctx sc = { .ctx = ctx, .r = r, .f = f, .e = 0 };
+    int depth = sort_depth_limit(n);
+    if (!f) {
+        if (o->akind == ARRAY_KIND_I64) {
+            sort_i64_pdqsort(&sc, o->ai, n, depth, 1);
+            return 0;
+        }
+        if (o->akind == ARRAY_KIND_DBL) {
+            if (stable) {
+                double *w = (double *)malloc((n / 2 + 1) * sizeof(double));
+                sort_dbl_mergesort(&sc, o->ad, w, n);
+                free(w);
+            } else {
+                sort_dbl_pdqsort(&sc, o->ad, n, depth, 1);
+            }
+            return 0;
+        }
+    }
+    array_generic(ctx, o);
+
+    /* The elements are kept in the array during the sort because the comparator could run the GC. */
+    vmvar **a = (vmvar **)malloc((n + n / 2 + 1) * sizeof(vmvar *));
+    memcpy(a, o->ary, n * sizeof(vmvar *));
+    switch (f ? VAR_UNDEF : sort_direct_type(a, n)) {
+    case VAR_INT64:
+        sort_vi64_pdqsort(&sc, a, n, depth, 1);
+        break;
+    case VAR_DBL:
+        if (stable) {
+            sort_vdbl_mergesort(&sc, a, a + n, n);
+        } else {
+            sort_vdbl_pdqsort(&sc, a, n, depth, 1);
+        }
+        break;
+    case VAR_STR:
+        sort_vstr_pdqsort(&sc, a, n, depth, 1);
+        break;
+    default:
+        if (stable) {
+            sort_var_mergesort(&sc, a, a + n, n);
+        } else {
+            sort_var_pdqsort(&sc, a, n, depth, 1);
+        }
+        break;
+    }
+    if (!sc.e) {
+        memcpy(o->ary, a, n * sizeof(vmvar *));
+    }
+    free(a);
+    return sc.e;
+}
+
+static int Array_sort(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    DEF_ARG_OR_UNDEF(a1, 1, VAR_FNC);
+    vmobj *o = object_copy(ctx, a0->o);
+    SET_OBJ(r, o);
+    return Array_sort_impl(ctx, r, o, a1->t == VAR_FNC ? a1->f : NULL, 0);
+}
+
+static int Array_stableSort(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    DEF_ARG_OR_UNDEF(a1, 1, VAR_FNC);
+    vmobj *o = object_copy(ctx, a0->o);
+    SET_OBJ(r, o);
+    return Array_sort_impl(ctx, r, o, a1->t == VAR_FNC ? a1->f : NULL, 1);
+}
+
+static int Array_sortBy(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(a0, 0, VAR_OBJ);
+    DEF_ARG(a1, 1, VAR_FNC);
+    vmobj *o = object_copy(ctx, a0->o);
+    SET_OBJ(r, o);
+    int64_t n = o->idxsz;
+    if (n < 2) {
+        return 0;
+    }
+    array_generic(ctx, o);
+
+    /* The holder keeps the copy and the keys alive while calling the function. */
+    vmobj *holder = alcobj(ctx);
+    array_push(ctx, holder, alcvar_obj(ctx, o));
+    SET_OBJ(r, holder);
+
+    int e = 0;
+    vmfnc *f = a1->f;
+    int p = vstackp(ctx);
+    push_var_i(ctx, 0, L0, "Array_sortBy", __FILE__, 0);
+    vmvar *kv = local_var(ctx, 0);
+    for (int64_t i = 0; i < n; ++i) {
+        vmvar tmp;
+        vmvar *v = array_at(o, i, &tmp);
+        int pp = vstackp(ctx);
+        push_var(ctx, v, L0, "Array_sortBy", __FILE__, 0);
+        NATIVE_CALL(r, f, kv, 1)
+        restore_vstackp(ctx, pp);
+        if (e == FLOW_YIELD) {
+            f->yield = 0;
+            e = throw_system_exception(__LINE__, ctx, EXCEPT_INVALID_FIBER_STATE, "The key function of sortBy can't yield");
+        }
+        if (e) {
+            goto L0;
+        }
+        vmvar *k = alcvar_initial(ctx);
+        SHCOPY_VAR_TO(ctx, k, kv);
+        array_push(ctx, holder, k);
+    }
+
+    sortpair *a = (sortpair *)malloc((n + n / 2 + 1) * sizeof(sortpair));
+    int t = holder->ary[1]->t;
+    for (int64_t i = 0; i < n; ++i) {
+        a[i].k = holder->ary[i + 1];
+        a[i].v = o->ary[i];
+        if (a[i].k->t != t) {
+            t = VAR_UNDEF;
+        }
+    }
+    sortctx sc = { .ctx = ctx, .r = r, .f = NULL, .e = 0 };
+    switch (t) {
+    case VAR_INT64:
+        sort_pi64_mergesort(&sc, a, a + n, n);
+        break;
+    case VAR_DBL:
+        sort_pdbl_mergesort(&sc, a, a + n, n);
+        break;
+    case VAR_STR:
+        sort_pstr_mergesort(&sc, a, a + n, n);
+        break;
+    default:
+        sort_pvar_mergesort(&sc, a, a + n, n);
+        break;
+    }
+    if (!sc.e) {
+        for (int64_t i = 0; i < n; ++i) {
+            o->ary[i] = a[i].v;
+        }
+        SET_OBJ(r, o);
+    }
+    free(a);
+    e = sc.e;
+
+L0:;
+    restore_vstackp(ctx, p);
+    return e;
+}
+
 static int Object_keys(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     DEF_ARG(a0, 0, VAR_OBJ);
@@ -1958,21 +3309,6 @@ static int Object_keys(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     return 0;
 }
 
-extern int Array_each(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_map(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_filter(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_reject(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_flatMap(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_findAll(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_reduce(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_all(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_any(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_partition(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_take(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_takeWhile(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_drop(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-extern int Array_dropWhile(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
-
 int Array(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     vmobj *o = alcobj(ctx);
@@ -1990,8 +3326,8 @@ int Array(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     KL_SET_METHOD(o, flatten, Array_flatten, lex, 2)
     KL_SET_METHOD(o, flatMap, Array_flatMap, lex, 2)
     KL_SET_METHOD(o, collectConcat, Array_flatMap, lex, 2)
-    KL_SET_METHOD(o, findAll, Array_findAll, lex, 2)
-    KL_SET_METHOD(o, select, Array_findAll, lex, 2)
+    KL_SET_METHOD(o, findAll, Array_filter, lex, 2)
+    KL_SET_METHOD(o, select, Array_filter, lex, 2)
     KL_SET_METHOD(o, reduce, Array_reduce, lex, 3)
     KL_SET_METHOD(o, inject, Array_reduce, lex, 3)
     KL_SET_METHOD(o, all, Array_all, lex, 2)
@@ -2002,6 +3338,8 @@ int Array(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     KL_SET_METHOD(o, drop, Array_drop, lex, 2)
     KL_SET_METHOD(o, dropWhile, Array_dropWhile, lex, 2)
     KL_SET_METHOD(o, sort, Array_sort, lex, 2)
+    KL_SET_METHOD(o, stableSort, Array_stableSort, lex, 2)
+    KL_SET_METHOD(o, sortBy, Array_sortBy, lex, 2)
     KL_SET_METHOD(o, clone, Array_clone, lex, 1)
     KL_SET_METHOD(o, keys, Object_keys, lex, 1)
     KL_SET_METHOD(o, keySet, Object_keys, lex, 1)
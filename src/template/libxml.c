@@ -668,6 +668,7 @@ static int xmldom_replace_node_from_parent(vmctx *ctx, vmobj *po, vmobj *node1,
     }
     vmvar *children = hashmap_search(po, "children");
     if (children && children->t == VAR_OBJ && pos < children->o->idxsz) {
+        GC_WRITE_BARRIER(ctx, children->o);
         children->o->ary[pos] = po->ary[pos];
     }
     if (pos == 0) {
@@ -944,7 +945,7 @@ static int xmldomwriter_print_hook(vmctx *ctx, vmvar *r, vmfnc *f, const char *s
     vmstr *sv = alcstr_str(ctx, s);
     HOLD(sv);
     push_var_sv(ctx, sv, L0, __func__, __FILE__, 0);
-    ((vmfunc_t)(f->f))(ctx, f->lex, r, 1);
+    NATIVE_CALL(r, f, r, 1)
 
 L0:;
     reduce_vstackp(ctx, 1);
@@ -3749,6 +3750,7 @@ static int xpath_evaluate_step(vmctx *ctx, vmvar *r, vmvar *xpath, vmvar *root,
         break;
     case VAR_STR:
         SET_SV(r, xpath->s);
+        SHARE(r->s);
         break;
     case VAR_OBJ: {
         vmobj *xobj = xpath->o;
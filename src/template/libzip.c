@@ -4,6 +4,7 @@
 #endif
 
 extern int File_create(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
+extern int File_eachLine(vmctx *ctx, vmfrm *lex, vmvar *r, int ac);
 
 /* General */
 
@@ -166,22 +167,250 @@ static void close_file_pointer(void *fp)
     if (0 < fo->o->idxsz && fo->o->ary[0]) { \
         f = fo->o->ary[0]; \
         if (f->t == VAR_VOIDP) { \
-            fp = f->p; \
+            fp = f->vp->p; \
         } \
     } \
 } \
 /**/
 
+/*
+ * The reader of a readable file has a large buffer aligned to the page, and the data is read by a block.
+ * A line is found by memchr in the buffer and it's copied to a string at once. The buffer is reused for
+ * the next lines, and it grows only when a line is longer than the buffer.
+ */
+#define FILE_READER_UNIT (256 * 1024)
+#define FILE_READER_ALIGN (4096)
+
+typedef struct file_reader {
+    char *mem;                          //  The allocated memory.
+    char *buf;                          //  The aligned buffer in the memory.
+    int64_t cap;                        //  The size of the buffer.
+    int64_t head;                       //  The position of the next character.
+    int64_t tail;                       //  The end of the data read.
+    int eof;
+    char *name;                         //  The file name to get the file size.
+} file_reader;
+
+#define FileReader(fo, rd) file_reader *rd = NULL; { \
+    if (1 < fo->o->idxsz && fo->o->ary[1] && fo->o->ary[1]->t == VAR_VOIDP) { \
+        rd = fo->o->ary[1]->vp->p; \
+    } \
+} \
+/**/
+
+static void file_reader_alloc(file_reader *rd, int64_t cap)
+{
+    char *mem = (char *)malloc(cap + FILE_READER_ALIGN);
+    char *buf = mem + ((FILE_READER_ALIGN - ((size_t)mem & (FILE_READER_ALIGN - 1))) & (FILE_READER_ALIGN - 1));
+    int64_t len = rd->tail - rd->head;
+    if (len > 0) {
+        memcpy(buf, rd->buf + rd->head, len);
+    }
+    free(rd->mem);
+    rd->mem = mem;
+    rd->buf = buf;
+    rd->cap = cap;
+    rd->head = 0;
+    rd->tail = len;
+}
+
+static file_reader *file_reader_new(const char *name)
+{
+    file_reader *rd = (file_reader *)calloc(1, sizeof(file_reader));
+    int len = strlen(name);
+    rd->name = (char *)calloc(len + 1, sizeof(char));
+    memcpy(rd->name, name, len);
+    return rd;
+}
+
+static void file_reader_free(void *p)
+{
+    file_reader *rd = (file_reader *)p;
+    if (rd) {
+        free(rd->mem);
+        free(rd->name);
+        free(rd);
+    }
+}
+
+/* The rest of the data is moved to the top of the buffer, and the next block is read after it. */
+static void file_reader_fill(file_reader *rd, FILE *fp)
+{
+    if (!rd->mem) {
+        file_reader_alloc(rd, FILE_READER_UNIT);
+    } else if (rd->head == 0 && rd->tail == rd->cap) {
+        file_reader_alloc(rd, rd->cap * 2);
+    } else if (rd->head > 0) {
+        int64_t len = rd->tail - rd->head;
+        if (len > 0) {
+            memmove(rd->buf, rd->buf + rd->head, len);
+        }
+        rd->head = 0;
+        rd->tail = len;
+    }
+    int64_t n = fread(rd->buf + rd->tail, 1, rd->cap - rd->tail, fp);
+    if (n <= 0) {
+        rd->eof = 1;
+    } else {
+        rd->tail += n;
+    }
+}
+
+/* Returns the head of the line in the buffer without a newline, or NULL at the end of the file. */
+static const char *file_reader_line(file_reader *rd, FILE *fp, int64_t *len)
+{
+    int64_t checked = 0;
+    for ( ; ; ) {
+        char *s = rd->buf + rd->head;
+        int64_t n = rd->tail - rd->head;
+        char *nl = n > checked ? (char *)memchr(s + checked, '\n', n - checked) : NULL;
+        if (nl || (rd->eof && n > 0)) {
+            int64_t l = nl ? nl - s : n;
+            rd->head += nl ? l + 1 : l;
+            if (l > 0 && s[l - 1] == '\r') {
+                --l;
+            }
+            *len = l;
+            return s;
+        }
+        if (rd->eof) {
+            return NULL;
+        }
+        checked = n;
+        file_reader_fill(rd, fp);
+    }
+}
+
+static int check_file_reader(vmctx *ctx, vmvar *fo, FILE **fpp, file_reader **rdp)
+{
+    int mode = hashmap_getint(fo->o, "mode", 0);
+    if (!isReadable(mode)) {
+        return zip_error(ctx, EXCEPT_FILE_ERROR, MZ_WRITEONLY_ERROR, NULL);
+    }
+    FilePointer(fo, f, fp);
+    FileReader(fo, rd);
+    *fpp = fp;
+    *rdp = rd;
+    return 0;
+}
+
 int File_close(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     DEF_ARG(fo, 0, VAR_OBJ);
     FilePointer(fo, f, fp);
     if (f && fp) {
         fclose(fp);
-        f->p = NULL;
-        f->freep = NULL;
+        f->vp->p = NULL;
+        f->vp->freep = NULL;
+    }
+    if (1 < fo->o->idxsz && fo->o->ary[1] && fo->o->ary[1]->t == VAR_VOIDP) {
+        vmvar *rv = fo->o->ary[1];
+        file_reader_free(rv->vp->p);
+        rv->vp->p = NULL;
+        rv->vp->freep = NULL;
+    }
+
+    return 0;
+}
+
+static int File_readLine(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(fo, 0, VAR_OBJ);
+    FILE *fp = NULL;
+    file_reader *rd = NULL;
+    int e = check_file_reader(ctx, fo, &fp, &rd);
+    if (e) {
+        return e;
     }
 
+    r->t = VAR_UNDEF;
+    if (fp && rd) {
+        int64_t len = 0;
+        const char *s = file_reader_line(rd, fp, &len);
+        if (s) {
+            SET_SV(r, alcstr_str_len(ctx, s, (int)len));
+        }
+    }
+    return 0;
+}
+
+static int File_load(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(fo, 0, VAR_OBJ);
+    FILE *fp = NULL;
+    file_reader *rd = NULL;
+    int e = check_file_reader(ctx, fo, &fp, &rd);
+    if (e) {
+        return e;
+    }
+
+    r->t = VAR_UNDEF;
+    if (fp && rd) {
+        /* The size of the file is used as the capacity, and the rest is read into the string directly. */
+        int64_t size = mz_os_get_file_size(rd->name);
+        int64_t len = rd->tail - rd->head;
+        int64_t cap = (size > 0 ? size : FILE_READER_UNIT) + len + 1;
+        char *s = (char *)malloc(cap);
+        if (len > 0) {
+            memcpy(s, rd->buf + rd->head, len);
+        }
+        rd->head = rd->tail = 0;
+        while (!rd->eof) {
+            if (len == cap - 1) {
+                cap *= 2;
+                s = (char *)realloc(s, cap);
+            }
+            int64_t n = fread(s + len, 1, cap - 1 - len, fp);
+            if (n <= 0) {
+                rd->eof = 1;
+            } else {
+                len += n;
+            }
+        }
+        s[len] = 0;
+        vmstr *str = alcstr_allocated_str(ctx, s, (int)cap);
+        str->len = (int)len;
+        SET_SV(r, str);
+    }
+    return 0;
+}
+
+static int File_getch(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(fo, 0, VAR_OBJ);
+    FILE *fp = NULL;
+    file_reader *rd = NULL;
+    int e = check_file_reader(ctx, fo, &fp, &rd);
+    if (e) {
+        return e;
+    }
+
+    SET_I64(r, -1);
+    if (fp && rd) {
+        if (rd->head == rd->tail && !rd->eof) {
+            file_reader_fill(rd, fp);
+        }
+        if (rd->head < rd->tail) {
+            SET_I64(r, (uint8_t)rd->buf[rd->head++]);
+        }
+    }
+    return 0;
+}
+
+static int File_putch(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(fo, 0, VAR_OBJ);
+    DEF_ARG(ch, 1, VAR_INT64);
+    int mode = hashmap_getint(fo->o, "mode", 0);
+    if (!isWritable(mode)) {
+        return zip_error(ctx, EXCEPT_FILE_ERROR, MZ_READONLY_ERROR, NULL);
+    }
+
+    FilePointer(fo, f, fp);
+    if (fp) {
+        fputc((int)ch->i, fp);
+    }
+    r->t = VAR_UNDEF;
     return 0;
 }
 
@@ -233,18 +462,21 @@ int File_open(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 
     vmobj *o = alcobj(ctx);
     o->is_sysobj = 1;
-    vmvar *f = alcvar(ctx, VAR_VOIDP, 0);
     char modechar[3] = {0};
     set_mode_char(mode, modechar);
 
-    f->p = fopen(filename, modechar);
-    f->freep = close_file_pointer;
+    vmvar *f = alcvar_voidp(ctx, fopen(filename, modechar), close_file_pointer);
     array_push(ctx, o, f);
+    if (isReadable(mode)) {
+        vmvar *rv = alcvar_voidp(ctx, file_reader_new(filename), file_reader_free);
+        array_push(ctx, o, rv);
+    }
     KL_SET_PROPERTY_I(o, mode, mode)
-    // KL_SET_METHOD(o, load, File_load, lex, 0)
-    // KL_SET_METHOD(o, readLine, File_readLine, lex, 0)
-    // KL_SET_METHOD(o, getch, File_getch, lex, 0)
-    // KL_SET_METHOD(o, putch, File_putch, lex, 0)
+    KL_SET_METHOD(o, load, File_load, lex, 0)
+    KL_SET_METHOD(o, readLine, File_readLine, lex, 0)
+    KL_SET_METHOD(o, eachLine, File_eachLine, lex, 0)
+    KL_SET_METHOD(o, getch, File_getch, lex, 0)
+    KL_SET_METHOD(o, putch, File_putch, lex, 0)
     KL_SET_METHOD(o, print, File_print, lex, 0)
     KL_SET_METHOD(o, println, File_println, lex, 0)
     KL_SET_METHOD(o, close, File_close, lex, 0)
@@ -253,6 +485,33 @@ int File_open(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     return 0;
 }
 
+/* The view shares the mapping, so it's not read until it's accessed and it's unmapped after the last view is collected. */
+int File_mmap(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
+{
+    DEF_ARG(name, 0, VAR_STR);
+    DEF_ARG_OR_UNDEF(param, 1, VAR_INT64);
+    const char *filename = name->s->hd;
+    int mode = param->t == VAR_UNDEF ? FILE_BINARY : (int)param->i;
+
+    int64_t size = 0;
+    void *addr = File_map_impl(filename, &size);
+    if (!addr) {
+        return zip_error(ctx, EXCEPT_FILE_ERROR, MZ_OPEN_ERROR, filename);
+    }
+    if (size > 0x7fffffff) {
+        File_unmap_impl(addr, size);
+        return zip_error(ctx, EXCEPT_FILE_ERROR, MZ_SUPPORT_ERROR, filename);
+    }
+
+    vmmap *m = alcmap(addr, size);
+    if ((mode & FILE_TEXT) == FILE_TEXT) {
+        SET_SV(r, alcstr_map(ctx, m, 0));
+    } else {
+        SET_BIN(r, alcbin_map(ctx, m, 0, (int)size));
+    }
+    return 0;
+}
+
 int File_rename(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
 {
     DEF_ARG(oldpath, 0, VAR_STR)
@@ -436,6 +695,7 @@ int File(vmctx *ctx, vmfrm *lex, vmvar *r, int ac)
     KL_SET_METHOD(o, create, File_create, lex, 0)
     KL_SET_METHOD(o, _open, File_open, lex, 0)
     KL_SET_METHOD(o, _close, File_close, lex, 0)
+    KL_SET_METHOD(o, mmap, File_mmap, lex, 0)
 
     KL_SET_METHOD(o, rename, File_rename, lex, 0)
     KL_SET_METHOD(o, unlink, File_unlink, lex, 0)
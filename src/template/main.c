@@ -31,6 +31,7 @@ int main(int ac, char **av)
     vmvar *r = alcvar_initial(ctx);
     HOLD(r);
     ctx->callee = alcfnc(ctx, run_global, NULL, "run_global", 0); // dummy.
+    HOLD(ctx->callee);  /* ctx->callee is not a root while another function is called. */
     int e = run_global(ctx, NULL, r, 0);
     ctx->callee = NULL;
     if (e) {
@@ -2,15 +2,159 @@
 #include "common.h"
 #endif
 
-static vmobj *hashmap_extend(vmctx *ctx, vmobj *obj);
+/*
+ * The hashmap keeps entries in a dense array in the inserted order, and finds them by an index table.
+ * The index table is open-addressing with a control byte per slot, which has the lower 7 bits of the hash,
+ * or HASH_CTRL_EMPTY/HASH_CTRL_REMVD. Control bytes are packed in uint64_t so that 8 slots are checked at once.
+ * The key is always interned by vmconst_str(), so the key is compared by a pointer first.
+*/
+#define HASH_CTRL_EMPTY (0x80)
+#define HASH_CTRL_REMVD (0xFE)
+#define HASH_GROUP_BITS (0x8080808080808080ULL)
+#define HASH_GROUP_ONES (0x0101010101010101ULL)
+#define HASH_H2(h) ((h) & 0x7F)
+#define HASH_H1(h) ((h) >> 7)
 
-static inline unsigned int hashcode(const char *s, int hsz)
+static inline uint32_t hashcode(const char *s)
 {
-    unsigned int h = (int)*s;
-    if (h) for (++s ; *s; ++s) {
-        h = (h << 5) - h + (int)*s;
+    uint32_t h = 2166136261u;
+    for ( ; *s; ++s) {
+        h = (h ^ (uint8_t)*s) * 16777619u;
     }
-    return h % hsz;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static inline uint64_t hash_group_match(uint64_t g, uint32_t h2)
+{
+    /* This could have a false positive, but the key is checked after that anyway. */
+    uint64_t x = g ^ (HASH_GROUP_ONES * h2);
+    return (x - HASH_GROUP_ONES) & ~x & HASH_GROUP_BITS;
+}
+
+static inline uint64_t hash_group_empty(uint64_t g)
+{
+    /* Only HASH_CTRL_EMPTY has both the bit 7 on and the bit 1 off. */
+    return g & (~g << 6) & HASH_GROUP_BITS;
+}
+
+static int32_t hashmap_spkey(const char *s)
+{
+    static const struct { const char *k; int32_t bit; } spkeys[] = {
+        { "_False", SPKEY_FALSE }, { "methodMissing", SPKEY_MMISSING }, { "()", SPKEY_CALL }, { "[]", SPKEY_INDEX },
+        { "+", SPKEY_ADD }, { "-", SPKEY_SUB }, { "*", SPKEY_MUL }, { "/", SPKEY_DIV }, { "%", SPKEY_MOD },
+        { "==", SPKEY_EQEQ }, { "!=", SPKEY_NEQ }, { "<", SPKEY_LT }, { "<=", SPKEY_LE }, { ">", SPKEY_GT },
+        { ">=", SPKEY_GE }, { "<=>", SPKEY_LGE }, { "<<", SPKEY_LSH }, { ">>", SPKEY_RSH },
+    };
+
+    /* Most keys are usual names, which are rejected quickly. */
+    char c = s[0];
+    if (('a' <= c && c <= 'z' && c != 'm') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9')) {
+        return 0;
+    }
+    for (int i = 0; i < sizeof(spkeys) / sizeof(spkeys[0]); ++i) {
+        if (strcmp(s, spkeys[i].k) == 0) {
+            return spkeys[i].bit;
+        }
+    }
+    return 0;
+}
+
+static inline void hash_set_ctrl(vmobj *obj, int64_t slot, uint64_t c)
+{
+    int sh = (slot & 7) << 3;
+    uint64_t *g = &(obj->ctrl[slot >> 3]);
+    *g = (*g & ~(0xFFULL << sh)) | (c << sh);
+}
+
+/* The hash of each entry is placed right after the entries, which is read only to reindex them. */
+#define HASHMAP_HASHES(obj) ((uint32_t *)((obj)->map + (obj)->hcap))
+
+static void hashmap_rebuild(vmobj *obj, vmobj *src, int64_t n)
+{
+    /* Compacts the removed entries of src out and reindexes all with the stored hash. */
+    int64_t hcap = HASH_SIZE;
+    while (hcap < n) {
+        hcap <<= 1;
+    }
+    vmhent *map = (vmhent *)calloc(hcap, sizeof(vmhent) + sizeof(uint32_t));
+    uint32_t *hv = (uint32_t *)(map + hcap);
+    int64_t hsz = 0;
+    if (src->map) {
+        uint32_t *shv = HASHMAP_HASHES(src);
+        for (int64_t i = 0; i < src->hsz; ++i) {
+            if (src->map[i].k) {
+                hv[hsz] = shv[i];
+                map[hsz++] = src->map[i];
+            }
+        }
+    }
+    if (src == obj) {
+        free(obj->map);
+        free(obj->hidx);
+    }
+    obj->map = map;
+    obj->hsz = hsz;
+    obj->hcap = hcap;
+    obj->hcnt = hsz;
+
+    int64_t icap = hcap << 1;
+    obj->icap = icap;
+    obj->hidx = (int32_t *)malloc(icap * sizeof(int32_t) + (icap >> 3) * sizeof(uint64_t));
+    obj->ctrl = (uint64_t *)(obj->hidx + icap);
+    for (int64_t i = 0; i < (icap >> 3); ++i) {
+        obj->ctrl[i] = HASH_CTRL_EMPTY * HASH_GROUP_ONES;
+    }
+    int64_t gmask = (icap >> 3) - 1;
+    for (int64_t i = 0; i < hsz; ++i) {
+        uint32_t h = hv[i];
+        int64_t gi = HASH_H1(h) & gmask;
+        for (int64_t step = 1; ; ++step) {
+            uint64_t m = hash_group_empty(obj->ctrl[gi]);
+            if (m) {
+                int b = 0;
+                while (!(m & (0x80ULL << (b << 3)))) {
+                    ++b;
+                }
+                int64_t slot = (gi << 3) + b;
+                hash_set_ctrl(obj, slot, HASH_H2(h));
+                obj->hidx[slot] = (int32_t)i;
+                break;
+            }
+            gi = (gi + step) & gmask;
+        }
+    }
+}
+
+static int64_t hashmap_find_slot(vmobj *obj, const char *s, uint32_t h)
+{
+    int64_t gmask = (obj->icap >> 3) - 1;
+    int64_t gi = HASH_H1(h) & gmask;
+    uint32_t h2 = HASH_H2(h);
+    for (int64_t step = 1; step <= gmask + 1; ++step) {
+        uint64_t g = obj->ctrl[gi];
+        uint64_t m = hash_group_match(g, h2);
+        for (int b = 0; m; ++b) {
+            uint64_t bit = 0x80ULL << (b << 3);
+            if (m & bit) {
+                m &= ~bit;
+                int64_t slot = (gi << 3) + b;
+                /* The 7-bit tag has matched, and the key is almost always the same interned pointer. */
+                vmhent *e = &(obj->map[obj->hidx[slot]]);
+                if (e->k && (e->k == s || strcmp(e->k, s) == 0)) {
+                    return slot;
+                }
+            }
+        }
+        if (hash_group_empty(g)) {
+            break;
+        }
+        /* Triangular probing visits all groups because the number of groups is a power of 2. */
+        gi = (gi + step) & gmask;
+    }
+    return -1;
 }
 
 static void hashmap_fprint_indent(int indent, FILE *fp)
@@ -30,7 +174,19 @@ static void hashmap_objfprint_impl(vmobj *obj, int indent, FILE *fp)
 
     int idt = indent >= 0;
     int lsz = obj->idxsz - 1;
-    if (lsz >= 0) {
+    if (lsz >= 0 && obj->akind == ARRAY_KIND_I64) {
+        fprintf(fp, "[");
+        for (int i = 0; i <= lsz; ++i) {
+            fprintf(fp, (i < lsz) ? "%" PRId64 ", " : "%" PRId64, obj->ai[i]);
+        }
+        fprintf(fp, "]");
+    } else if (lsz >= 0 && obj->akind == ARRAY_KIND_DBL) {
+        fprintf(fp, "[");
+        for (int i = 0; i <= lsz; ++i) {
+            fprintf(fp, (i < lsz) ? "%.16g, " : "%.16g", obj->ad[i]);
+        }
+        fprintf(fp, "]");
+    } else if (lsz >= 0) {
         fprintf(fp, "[");
         for (int i = 0; i <= lsz; ++i) {
             vmvar *v = obj->ary[i];
@@ -90,18 +246,18 @@ static void hashmap_objfprint_impl(vmobj *obj, int indent, FILE *fp)
         }
         fprintf(fp, "]");
     }
-    int hsz = obj->hsz;
-    if (hsz <= 0) {
+    if (!obj->map) {
         if (lsz < 0) {
             fprintf(fp, "{}");
         }
     } else {
         if (idt && lsz > 0) fprintf(fp, "\n");
         int count = 0;
-        vmvar *map = obj->map;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
+        int64_t hsz = obj->hsz;
+        vmhent *map = obj->map;
+        for (int64_t i = 0; i < hsz; ++i) {
+            vmhent *v = &(map[i]);
+            if (v->k) {
                 vmvar *va = v->a;
                 // Function information seems not to be needed for users, so now it was made hidden.
                 if (va && va->t != VAR_FNC) {
@@ -112,55 +268,53 @@ static void hashmap_objfprint_impl(vmobj *obj, int indent, FILE *fp)
         if (idt) fprintf(fp, "{\n");
         else     fprintf(fp, "{ ");
         int c = 0;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
-                if (v->k) {
-                    vmvar *va = v->a;
-                    if (!va) {
-                        hashmap_fprint_indent(idt ? indent + 1 : -1, fp);
-                        fprintf(fp, "\"%s\": null", v->k);
-                    } else if (va->t != VAR_FNC) {
-                        ++c;
-                        hashmap_fprint_indent(idt ? indent + 1 : -1, fp);
-                        fprintf(fp, "\"%s\": ", v->k);
-                        switch (va->t) {
-                        case VAR_UNDEF:
-                            fprintf(fp, "null");
-                            break;
-                        case VAR_BOOL:
-                            fprintf(fp, "%s", va->i ? "true" : "false");
-                            break;
-                        case VAR_INT64:
-                            fprintf(fp, "%" PRId64, va->i);
-                            break;
-                        case VAR_DBL:
-                            fprintf(fp, "%.16g", va->d);
-                            break;
-                        case VAR_BIG: {
-                            char *bs = BzToString(va->bi->b, 10, 0);
-                            fprintf(fp, "%s", bs);
-                            BzFreeString(bs);
-                            break;
-                        }
-                        case VAR_STR:
-                            fprintf(fp, "\"");
-                            fprint_escape_str(va->s, fp);
-                            fprintf(fp, "\"");
-                            break;
-                        case VAR_OBJ:
-                            hashmap_objfprint_impl(va->o, idt ? indent + 1 : -1, fp);
-                            break;
-                        }
+        for (int64_t i = 0; i < hsz; ++i) {
+            vmhent *v = &(map[i]);
+            if (v->k) {
+                vmvar *va = v->a;
+                if (!va) {
+                    hashmap_fprint_indent(idt ? indent + 1 : -1, fp);
+                    fprintf(fp, "\"%s\": null", v->k);
+                } else if (va->t != VAR_FNC) {
+                    ++c;
+                    hashmap_fprint_indent(idt ? indent + 1 : -1, fp);
+                    fprintf(fp, "\"%s\": ", v->k);
+                    switch (va->t) {
+                    case VAR_UNDEF:
+                        fprintf(fp, "null");
+                        break;
+                    case VAR_BOOL:
+                        fprintf(fp, "%s", va->i ? "true" : "false");
+                        break;
+                    case VAR_INT64:
+                        fprintf(fp, "%" PRId64, va->i);
+                        break;
+                    case VAR_DBL:
+                        fprintf(fp, "%.16g", va->d);
+                        break;
+                    case VAR_BIG: {
+                        char *bs = BzToString(va->bi->b, 10, 0);
+                        fprintf(fp, "%s", bs);
+                        BzFreeString(bs);
+                        break;
                     }
-                    if (idt) {
-                        if (c < count) fprintf(fp, ",\n");
-                        else           fprintf(fp, "\n");
-                    } else {
-                        if (c < count) fprintf(fp, ", ");
-                        else           fprintf(fp, " ");
+                    case VAR_STR:
+                        fprintf(fp, "\"");
+                        fprint_escape_str(va->s, fp);
+                        fprintf(fp, "\"");
+                        break;
+                    case VAR_OBJ:
+                        hashmap_objfprint_impl(va->o, idt ? indent + 1 : -1, fp);
+                        break;
                     }
                 }
+                if (idt) {
+                    if (c < count) fprintf(fp, ",\n");
+                    else           fprintf(fp, "\n");
+                } else {
+                    if (c < count) fprintf(fp, ", ");
+                    else           fprintf(fp, " ");
+                }
             }
         }
         if (idt) {
@@ -180,7 +334,7 @@ void hashmap_objfprint(vmctx *ctx, vmobj *obj, FILE *fp)
             fprintf(fp, "%s", s->s);
         }
     } else {
-        vmvar *f = hashmap_search(obj, "_False");
+        vmvar *f = (obj->spkey & SPKEY_FALSE) ? hashmap_search(obj, "_False") : NULL;
         if (f) {
             fprintf(fp, "%s", (f->t == VAR_INT64 && f->i == 0) ? "true" : "false");
         } else {
@@ -197,28 +351,21 @@ void hashmap_objprint(vmctx *ctx, vmobj *obj)
 void hashmap_print(vmobj *obj)
 {
     printf("---------\n");
-    int hsz = obj->hsz;
-    vmvar *map = obj->map;
-    for (int i = 0; i < hsz; ++i) {
-        vmvar *v = &(map[i % hsz]);
-        if (IS_HASHITEM_REMVD(v)) {
-            printf("REMOVED ");
-        } else if (IS_HASHITEM_EXIST(v)) {
-            printf("EXISTS  ");
-        } else if (IS_HASHITEM_EMPTY(v)) {
-            printf("EMPTY   ");
-        }
+    int64_t hsz = obj->hsz;
+    vmhent *map = obj->map;
+    for (int64_t i = 0; i < hsz; ++i) {
+        vmhent *v = &(map[i]);
         if (v->k) {
-            printf("[%d], key(%s) => var(%p)", (int)v->i, v->k, v->a);
+            printf("EXISTS  [%08x], key(%s) => var(%p)\n", (unsigned int)HASHMAP_HASHES(obj)[i], v->k, v->a);
+        } else {
+            printf("REMOVED\n");
         }
-        printf("\n");
     }
 }
 
 vmobj *hashmap_create(vmobj *obj, int hsz)
 {
-    obj->map = (vmvar *)calloc(hsz, sizeof(vmvar));
-    obj->hsz = hsz;
+    hashmap_rebuild(obj, obj, hsz);
     return obj;
 }
 
@@ -238,40 +385,48 @@ const char *hashmap_getstr(vmobj *o, const char *optname)
 
 vmobj *hashmap_set(vmctx *ctx, vmobj *obj, const char *s, vmvar *vs)
 {
+    GC_WRITE_BARRIER(ctx, obj);
     if (!obj->map) {
         hashmap_create(obj, HASH_SIZE);
     }
-    int hsz = obj->hsz;
-    unsigned int h = hashcode(s, hsz);
-    unsigned int hc = h;
-    for (int i = 0; i < hsz; ++i) {
-        vmvar *v = &(obj->map[h]);
-        if (IS_HASHITEM_EXIST(v)) {
-            if (strcmp(v->k, s) == 0) {
-                /* if the key string has been already registered, overwrite it. */
-                v->i = hc;
-                v->a = vs;
-                return obj;
-            }
-        } else if (IS_HASHITEM_EMPTY(v) || IS_HASHITEM_REMVD(v)) {
-            /* The value can be registered to the place where is either empty or removed. */
-            HASHITEM_EXIST(v);
-            v->i = hc;
-            v->k = vmconst_str(ctx, s);
-            v->a = vs;
-            if (strcmp(s, "_False") == 0) {
-                obj->is_false = 1;
-            }
-            return obj;
-        }
-        ++h;
-        if (h >= hsz) {
-            h = 0;
-        }
+    uint32_t h = hashcode(s);
+    int64_t slot = hashmap_find_slot(obj, s, h);
+    if (slot >= 0) {
+        /* if the key string has been already registered, overwrite it. */
+        obj->map[obj->hidx[slot]].a = vs;
+        return obj;
     }
 
-    obj = hashmap_extend(ctx, obj);
-    return hashmap_set(ctx, obj, s, vs);
+    if (obj->hsz >= obj->hcap) {
+        /* Removed entries are just compacted if there are many, otherwise the map is extended. */
+        hashmap_rebuild(obj, obj, (obj->hcnt < (obj->hcap >> 1)) ? obj->hcap : (obj->hcap << 1));
+    }
+    int64_t gmask = (obj->icap >> 3) - 1;
+    int64_t gi = HASH_H1(h) & gmask;
+    for (int64_t step = 1; ; ++step) {
+        /* The removed slot can be reused. */
+        uint64_t m = obj->ctrl[gi] & HASH_GROUP_BITS;
+        if (m) {
+            int b = 0;
+            while (!(m & (0x80ULL << (b << 3)))) {
+                ++b;
+            }
+            slot = (gi << 3) + b;
+            break;
+        }
+        gi = (gi + step) & gmask;
+    }
+
+    int64_t i = obj->hsz++;
+    vmhent *e = &(obj->map[i]);
+    e->k = vmconst_str(ctx, s);
+    e->a = vs;
+    HASHMAP_HASHES(obj)[i] = h;
+    hash_set_ctrl(obj, slot, HASH_H2(h));
+    obj->hidx[slot] = (int32_t)i;
+    obj->hcnt++;
+    obj->spkey |= hashmap_spkey(s);
+    return obj;
 }
 
 vmobj *hashmap_remove(vmctx *ctx, vmobj *obj, const char *s)
@@ -280,28 +435,14 @@ vmobj *hashmap_remove(vmctx *ctx, vmobj *obj, const char *s)
         return obj;
     }
 
-    int hsz = obj->hsz;
-    if (hsz > 0) {
-        unsigned int h = hashcode(s, hsz);
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(obj->map[h]);
-            if (IS_HASHITEM_EXIST(v)) {
-                if (strcmp(v->k, s) == 0) {
-                    v->i = 0;
-                    v->k = NULL;
-                    v->a = NULL;
-                    HASHITEM_REMVD(v);
-                    if (strcmp(s, "_False") == 0) {
-                        obj->is_false = 0;
-                    }
-                    return obj;
-                }
-            }
-            ++h;
-            if (h >= hsz) {
-                h = 0;
-            }
-        }
+    int64_t slot = hashmap_find_slot(obj, s, hashcode(s));
+    if (slot >= 0) {
+        vmhent *e = &(obj->map[obj->hidx[slot]]);
+        e->k = NULL;
+        e->a = NULL;
+        hash_set_ctrl(obj, slot, HASH_CTRL_REMVD);
+        obj->hcnt--;
+        obj->spkey &= ~hashmap_spkey(s);
     }
     return obj;
 }
@@ -312,73 +453,49 @@ vmvar *hashmap_search(vmobj *obj, const char *s)
         return NULL;
     }
 
-    int hsz = obj->hsz;
-    if (hsz > 0) {
-        unsigned int h = hashcode(s, hsz);
-        unsigned int hc = h;
-        vmvar *map = obj->map;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(obj->map[h]);
-            if (IS_HASHITEM_EMPTY(v)) {
-                return NULL;
-            }
-            if (IS_HASHITEM_EXIST(v)) {
-                if (v->i == hc && strcmp(v->k, s) == 0) {
-                    return v->a;
-                }
-            }
-            ++h;
-            if (h >= hsz) {
-                h = 0;
-            }
-        }
-    }
-    return NULL;
+    int64_t slot = hashmap_find_slot(obj, s, hashcode(s));
+    return slot < 0 ? NULL : obj->map[obj->hidx[slot]].a;
 }
 
-static vmobj *hashmap_extend_n(vmctx *ctx, vmobj *obj, int n)
+vmvar *hashmap_search_ic(vmobj *obj, const char *s, vmic *ic)
 {
-    if (!obj->map) {
-        return hashmap_create(obj, n);
+    if (!obj || !obj->map) {
+        return NULL;
     }
-    int hsz = obj->hsz;
-    vmvar *map = obj->map;
 
-    obj->hsz = n;
-    obj->map = (vmvar *)calloc(obj->hsz, sizeof(vmvar));
-    for (int i = 0; i < hsz; ++i) {
-        vmvar *v = &(map[i]);
-        if (IS_HASHITEM_EXIST(v)) {
-            hashmap_set(ctx, obj, v->k, v->a);
+    /* The cached entry is valid only when it still has the same key, which is not NULL. */
+    const char *k = ic->k;
+    if (k) {
+        int32_t i0 = ic->idx[0];
+        if (i0 < obj->hsz && obj->map[i0].k == k) {
+            return obj->map[i0].a;
+        }
+        int32_t i1 = ic->idx[1];
+        if (i1 < obj->hsz && obj->map[i1].k == k) {
+            ic->idx[1] = i0;
+            ic->idx[0] = i1;
+            return obj->map[i1].a;
         }
     }
-    free(map);
 
-    return obj;
-}
-
-static vmobj *hashmap_extend(vmctx *ctx, vmobj *obj)
-{
-    if (!obj->map) {
-        return hashmap_create(obj, HASH_SIZE);
+    int64_t slot = hashmap_find_slot(obj, s, hashcode(s));
+    if (slot < 0) {
+        return NULL;
     }
-
-    return hashmap_extend_n(ctx, obj, (obj->hsz << 1) + 1);
+    int32_t i = obj->hidx[slot];
+    ic->k = obj->map[i].k;
+    ic->idx[1] = ic->idx[0];
+    ic->idx[0] = i;
+    return obj->map[i].a;
 }
 
 vmobj *hashmap_copy(vmctx *ctx, vmobj *src)
 {
     vmobj *obj = alcobj(ctx);
-    int hsz = src->hsz;
-    if (hsz > 0) {
-        hashmap_create(obj, hsz);
-        vmvar *map = src->map;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
-                hashmap_set(ctx, obj, v->k, v->a);
-            }
-        }
+    if (src->map) {
+        /* Entries can be copied as they are because the key is already interned and the hash is stored. */
+        hashmap_rebuild(obj, src, src->hcnt);
+        obj->spkey = src->spkey;
     }
 
     return obj;
@@ -386,30 +503,16 @@ vmobj *hashmap_copy(vmctx *ctx, vmobj *src)
 
 vmobj *hashmap_append(vmctx *ctx, vmobj *obj, vmobj *src)
 {
-    int hsz = src->hsz;
-    if (hsz > 0) {
-        int count = 0;
-        vmvar *map = src->map;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
-                count++;
-            }
-        }
-        int cur = obj->hsz;
-        for (int i = 0; i < cur; ++i) {
-            vmvar *v = &(obj->map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
-                count++;
-            }
-        }
-        if (cur < count) {
-            hashmap_extend_n(ctx, obj, (count << 1) + 1);
+    if (src->map) {
+        int64_t count = src->hcnt + (obj->map ? obj->hcnt : 0);
+        if (!obj->map || obj->hcap < count) {
+            hashmap_rebuild(obj, obj, count);
         }
 
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
+        vmhent *map = src->map;
+        for (int64_t i = 0; i < src->hsz; ++i) {
+            vmhent *v = &(map[i]);
+            if (v->k) {
                 hashmap_set(ctx, obj, v->k, v->a);
             }
         }
@@ -421,19 +524,16 @@ vmobj *hashmap_append(vmctx *ctx, vmobj *obj, vmobj *src)
 vmobj *hashmap_copy_method(vmctx *ctx, vmobj *src)
 {
     vmobj *obj = alcobj(ctx);
-    int hsz = src->hsz;
-    if (hsz > 0) {
-        hashmap_create(obj, hsz);
-        vmvar *map = src->map;
-        for (int i = 0; i < hsz; ++i) {
-            vmvar *v = &(map[i]);
-            if (IS_HASHITEM_EXIST(v)) {
-                if (v->k) {
-                    vmvar *va = v->a;
-                    if (va->t == VAR_FNC) {
-                        vmvar *nv = alcvar_fnc(ctx, v->a->f);
-                        hashmap_set(ctx, obj, v->k, nv);
-                    }
+    if (src->map) {
+        hashmap_create(obj, src->hcnt);
+        vmhent *map = src->map;
+        for (int64_t i = 0; i < src->hsz; ++i) {
+            vmhent *v = &(map[i]);
+            if (v->k) {
+                vmvar *va = v->a;
+                if (va->t == VAR_FNC) {
+                    vmvar *nv = alcvar_fnc(ctx, v->a->f);
+                    hashmap_set(ctx, obj, v->k, nv);
                 }
             }
         }
@@ -442,6 +542,137 @@ vmobj *hashmap_copy_method(vmctx *ctx, vmobj *src)
     return obj;
 }
 
+/*
+ * An array has packed elements of int64 or double when all elements are the same type of them.
+ * It starts packed when the first element is stored by a script into an empty array,
+ * and it is changed to the generic array of vmvar when an element of another type is stored.
+ * The functions which need vmvar elements have to call array_generic() before using ary.
+*/
+void array_generic(vmctx *ctx, vmobj *obj)
+{
+    if (obj->akind == ARRAY_KIND_GENERIC) {
+        return;
+    }
+
+    GC_WRITE_BARRIER(ctx, obj);
+    int64_t idxsz = obj->idxsz;
+    int asz = obj->asz < ARRAY_UNIT ? ARRAY_UNIT : obj->asz;
+    vmvar **ary = (vmvar **)calloc(asz, sizeof(vmvar*));
+    if (obj->akind == ARRAY_KIND_I64) {
+        for (int64_t i = 0; i < idxsz; ++i) {
+            ary[i] = alcvar_int64(ctx, obj->ai[i], 0);
+        }
+    } else {
+        for (int64_t i = 0; i < idxsz; ++i) {
+            ary[i] = alcvar_double(ctx, &(obj->ad[i]));
+        }
+    }
+    free(obj->ai);
+    obj->ai = NULL;
+    obj->ary = ary;
+    obj->asz = asz;
+    obj->akind = ARRAY_KIND_GENERIC;
+}
+
+static int array_packed_prepare(vmctx *ctx, vmobj *obj, int64_t idx, int kind)
+{
+    if (obj->akind != kind) {
+        if (obj->akind != ARRAY_KIND_GENERIC || obj->idxsz > 0) {
+            array_generic(ctx, obj);
+            return 0;
+        }
+        /* Only an empty array can start packed. */
+        free(obj->ary);
+        obj->ary = NULL;
+        obj->asz = 0;
+        obj->akind = kind;
+    }
+    if (obj->idxsz < idx) {
+        /* A hole can't be packed. */
+        array_generic(ctx, obj);
+        return 0;
+    }
+    if (obj->asz <= idx) {
+        int newasz = ARRAY_UNIT * ((idx / ARRAY_UNIT) + 1) * 2;
+        /* int64_t and double have the same size. */
+        obj->ai = (int64_t *)realloc(obj->ai, newasz * sizeof(int64_t));
+        obj->asz = newasz;
+    }
+    if (obj->idxsz <= idx) {
+        obj->idxsz = idx + 1;
+    }
+    return 1;
+}
+
+vmobj *array_set_i(vmctx *ctx, vmobj *obj, int64_t idx, int64_t i)
+{
+    if (array_packed_prepare(ctx, obj, idx, ARRAY_KIND_I64)) {
+        obj->ai[idx] = i;
+        return obj;
+    }
+    return array_set(ctx, obj, idx, alcvar_int64(ctx, i, 0));
+}
+
+vmobj *array_set_d(vmctx *ctx, vmobj *obj, int64_t idx, double d)
+{
+    if (array_packed_prepare(ctx, obj, idx, ARRAY_KIND_DBL)) {
+        obj->ad[idx] = d;
+        return obj;
+    }
+    return array_set(ctx, obj, idx, alcvar_double(ctx, &d));
+}
+
+vmobj *array_push_i(vmctx *ctx, vmobj *obj, int64_t i)
+{
+    return array_set_i(ctx, obj, obj->idxsz, i);
+}
+
+vmobj *array_push_d(vmctx *ctx, vmobj *obj, double d)
+{
+    return array_set_d(ctx, obj, obj->idxsz, d);
+}
+
+vmobj *array_push_v(vmctx *ctx, vmobj *obj, vmvar *v)
+{
+    if (v->t == VAR_INT64) {
+        return array_push_i(ctx, obj, v->i);
+    }
+    if (v->t == VAR_DBL) {
+        return array_push_d(ctx, obj, v->d);
+    }
+    return array_push(ctx, obj, copy_var(ctx, v, 0));
+}
+
+vmvar *array_ref_var(vmctx *ctx, vmvar *ref)
+{
+    /* The reference to a packed element is changed to the actual element when storing other than a number. */
+    vmobj *obj = ref->o;
+    int64_t idx = ref->ri;
+    array_generic(ctx, obj);
+    vmvar *v = (idx < obj->idxsz) ? obj->ary[idx] : NULL;
+    if (!v) {
+        v = alcvar_initial(ctx);
+        array_set(ctx, obj, idx, v);
+    }
+    return v;
+}
+
+vmvar *array_at(vmobj *obj, int64_t idx, vmvar *tmp)
+{
+    /* tmp is used to hold a packed element. */
+    switch (obj->akind) {
+    case ARRAY_KIND_I64:
+        SET_I64(tmp, obj->ai[idx]);
+        return tmp;
+    case ARRAY_KIND_DBL:
+        SET_DBL(tmp, obj->ad[idx]);
+        return tmp;
+    default:
+        break;
+    }
+    return obj->ary[idx];
+}
+
 vmobj *array_create(vmobj *obj, int asz)
 {
     if (asz < ARRAY_UNIT) asz = ARRAY_UNIT;
@@ -468,8 +699,32 @@ static vmobj *array_extend(vmctx *ctx, vmobj *obj, int64_t idx)
     return obj;
 }
 
+vmobj *array_reserve(vmctx *ctx, vmobj *obj, int64_t n)
+{
+    /* The elements are kept, and only the buffer is made large enough for n elements. */
+    if (n <= obj->asz) {
+        return obj;
+    }
+    if (obj->akind != ARRAY_KIND_GENERIC) {
+        obj->ai = (int64_t *)realloc(obj->ai, n * sizeof(int64_t));
+        obj->asz = n;
+        return obj;
+    }
+    if (!obj->ary) {
+        return array_create(obj, n);
+    }
+    vmvar **ary = (vmvar **)calloc(n, sizeof(vmvar*));
+    memcpy(ary, obj->ary, obj->idxsz * sizeof(vmvar*));
+    free(obj->ary);
+    obj->ary = ary;
+    obj->asz = n;
+    return obj;
+}
+
 vmobj *array_set(vmctx *ctx, vmobj *obj, int64_t idx, vmvar *vs)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int asz = obj->asz;
     if (asz <= idx) {
         array_extend(ctx, obj, idx + 1);
@@ -484,6 +739,8 @@ vmobj *array_set(vmctx *ctx, vmobj *obj, int64_t idx, vmvar *vs)
 
 vmobj *array_unshift(vmctx *ctx, vmobj *obj, vmvar *vs)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int64_t idx = obj->idxsz;
     int asz = obj->asz;
     if (asz <= idx) {
@@ -504,7 +761,11 @@ vmvar *array_shift(vmctx *ctx, vmobj *obj)
 {
     int64_t idx = obj->idxsz;
     vmvar *r = NULL;
-    if (idx > 0) {
+    if (idx > 0 && obj->akind != ARRAY_KIND_GENERIC) {
+        r = (obj->akind == ARRAY_KIND_I64) ? alcvar_int64(ctx, obj->ai[0], 0) : alcvar_double(ctx, &(obj->ad[0]));
+        memmove(obj->ai, obj->ai + 1, (idx - 1) * sizeof(int64_t));
+        obj->idxsz--;
+    } else if (idx > 0) {
         r = obj->ary[0];
         for (int i = 1; i < idx; ++i) {
             obj->ary[i - 1] = obj->ary[i];
@@ -516,6 +777,7 @@ vmvar *array_shift(vmctx *ctx, vmobj *obj)
 
 vmobj *array_shift_array(vmctx *ctx, vmobj *obj, int n)
 {
+    array_generic(ctx, obj);
     int64_t idx = obj->idxsz;
     vmobj *o = alcobj(ctx);
     if (idx > 0) {
@@ -533,6 +795,8 @@ vmobj *array_shift_array(vmctx *ctx, vmobj *obj, int n)
 
 vmobj *array_push(vmctx *ctx, vmobj *obj, vmvar *vs)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int64_t idx = obj->idxsz;
     int asz = obj->asz;
     if (asz <= idx) {
@@ -550,7 +814,10 @@ vmvar *array_pop(vmctx *ctx, vmobj *obj)
 {
     int64_t idx = obj->idxsz;
     vmvar *r = NULL;
-    if (idx > 0) {
+    if (idx > 0 && obj->akind != ARRAY_KIND_GENERIC) {
+        r = (obj->akind == ARRAY_KIND_I64) ? alcvar_int64(ctx, obj->ai[idx - 1], 0) : alcvar_double(ctx, &(obj->ad[idx - 1]));
+        obj->idxsz--;
+    } else if (idx > 0) {
         r = obj->ary[idx - 1];
         obj->idxsz--;
     }
@@ -559,6 +826,7 @@ vmvar *array_pop(vmctx *ctx, vmobj *obj)
 
 vmobj *array_pop_array(vmctx *ctx, vmobj *obj, int n)
 {
+    array_generic(ctx, obj);
     int64_t idx = obj->idxsz;
     vmobj *o = alcobj(ctx);
     if (idx > 0) {
@@ -573,6 +841,11 @@ vmobj *array_pop_array(vmctx *ctx, vmobj *obj, int n)
 
 vmobj *array_remove_obj(vmobj *obj, vmobj *rmv)
 {
+    if (obj->akind != ARRAY_KIND_GENERIC) {
+        /* Packed elements are never an object, and all of them are removed. */
+        obj->idxsz = 0;
+        return obj;
+    }
     int n = obj->idxsz;
     for (int i = 0, j = 0; i < n; ++i) {
         vmvar *c = obj->ary[i];
@@ -590,6 +863,8 @@ vmobj *array_remove_obj(vmobj *obj, vmobj *rmv)
 
 int array_replace_obj(vmctx *ctx, vmobj *obj, vmobj *obj1, vmobj *obj2)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int n = obj->idxsz;
     for (int i = 0; i < n; ++i) {
         vmvar *c = obj->ary[i];
@@ -603,6 +878,8 @@ int array_replace_obj(vmctx *ctx, vmobj *obj, vmobj *obj1, vmobj *obj2)
 
 int array_insert_before_obj(vmctx *ctx, vmobj *obj, vmobj *key, vmobj* ins)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int64_t idx = obj->idxsz;
     int asz = obj->asz;
     if (asz <= idx) {
@@ -632,6 +909,8 @@ int array_insert_before_obj(vmctx *ctx, vmobj *obj, vmobj *key, vmobj* ins)
 
 int array_insert_after_obj(vmctx *ctx, vmobj *obj, vmobj *key, vmobj* ins)
 {
+    array_generic(ctx, obj);
+    GC_WRITE_BARRIER(ctx, obj);
     int n = obj->idxsz;
     int64_t idx = obj->idxsz;
     int asz = obj->asz;
@@ -664,6 +943,14 @@ vmobj *object_copy(vmctx *ctx, vmobj *src)
 {
     vmobj *obj = hashmap_copy(ctx, src);
     int idxsz = src->idxsz;
+    if (src->akind != ARRAY_KIND_GENERIC) {
+        obj->akind = src->akind;
+        obj->asz = src->asz;
+        obj->ai = (int64_t *)malloc(src->asz * sizeof(int64_t));
+        memcpy(obj->ai, src->ai, idxsz * sizeof(int64_t));
+        obj->idxsz = idxsz;
+        return obj;
+    }
     int asz = obj->asz;
     if (asz < idxsz) {
         array_extend(ctx, obj, idxsz);
@@ -687,15 +974,13 @@ static int compkeys(const void * n1, const void * n2)
 vmobj *object_get_keys(vmctx *ctx, vmobj *src)
 {
     vmobj *obj = alcobj(ctx);
-    int hsz = src->hsz;
-    vmvar *map = src->map;
+    int64_t hsz = src->hsz;
+    vmhent *map = src->map;
 
-    for (int i = 0; i < hsz; ++i) {
-        vmvar *v = &(map[i]);
-        if (IS_HASHITEM_EXIST(v)) {
-            if (v->k) {
-                array_push(ctx, obj, alcvar_str(ctx, v->k));
-            }
+    for (int64_t i = 0; i < hsz; ++i) {
+        vmhent *v = &(map[i]);
+        if (v->k) {
+            array_push(ctx, obj, alcvar_str(ctx, v->k));
         }
     }
 
@@ -52,7 +52,7 @@ int not_v(vmctx *ctx, vmvar *r, vmvar *v)
     case VAR_FNC:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
     case VAR_OBJ: {
-        vmvar *f = hashmap_search(v->o, "_False");
+        vmvar *f = (v->o && (v->o->spkey & SPKEY_FALSE)) ? hashmap_search(v->o, "_False") : NULL;
         if (f) {
             r->t = VAR_BOOL;
             r->i = f->t == VAR_INT64 ? f->i : 0;
@@ -70,6 +70,18 @@ int not_v(vmctx *ctx, vmvar *r, vmvar *v)
 
 /* ADD */
 
+/*
+ * The string is appended in place like `s = s + x` when no other variable refers to it,
+ * and otherwise it is copied first because a string is a value.
+ */
+static inline vmstr *str_for_append(vmctx *ctx, vmvar *r, vmvar *v0, vmstr *s1)
+{
+    if (r == v0 && !IS_SHARED(v0->s) && s1 != v0->s) {
+        return v0->s;
+    }
+    return str_dup(ctx, v0->s);
+}
+
 int add_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     /* v's type should not be INT and BIGINT. */
@@ -86,13 +98,15 @@ int add_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         r->t = VAR_DBL;
         r->d = v->d + (double)i;
         break;
-    case VAR_STR:
+    case VAR_STR: {
+        vmstr *s = str_for_append(ctx, r, v, NULL);
+        str_append_i64(ctx, s, i);
         r->t = VAR_STR;
-        r->s = str_dup(ctx, v->s);
-        str_append_i64(ctx, r->s, i);
+        r->s = s;
         break;
+    }
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "+", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "+", SPKEY_ADD, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -159,7 +173,7 @@ int add_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_UNDEF:
             r->t = VAR_INT64;
-            r->i = v1->i;
+            r->i = v0->i;
             break;
         case VAR_BOOL:
         case VAR_INT64:
@@ -246,30 +260,38 @@ int add_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->t = VAR_STR;
             r->s = str_dup(ctx, v0->s);
             break;
-        case VAR_BOOL:
+        case VAR_BOOL: {
+            vmstr *s = str_for_append(ctx, r, v0, NULL);
+            str_append_cp(ctx, s, v1->i ? "true" : "false");
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
-            str_append_cp(ctx, r->s, v1->i ? "true" : "false");
+            r->s = s;
             break;
-        case VAR_INT64:
+        }
+        case VAR_INT64: {
+            vmstr *s = str_for_append(ctx, r, v0, NULL);
+            str_append_i64(ctx, s, v1->i);
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
-            str_append_i64(ctx, r->s, v1->i);
+            r->s = s;
             break;
-        case VAR_BIG:
-            r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
+        }
+        case VAR_BIG: {
+            vmstr *s = str_for_append(ctx, r, v0, NULL);
             char *bs = BzToString(v1->bi->b, 10, 0);
-            str_append_cp(ctx, r->s, bs);
+            str_append_cp(ctx, s, bs);
             BzFreeString(bs);
+            r->t = VAR_STR;
+            r->s = s;
             break;
-        case VAR_DBL:
+        }
+        case VAR_DBL: {
+            vmstr *s = str_for_append(ctx, r, v0, NULL);
+            str_append_dbl(ctx, s, &(v1->d));
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
-            str_append_dbl(ctx, r->s, &(v1->d));
+            r->s = s;
             break;
+        }
         case VAR_STR: {
-            vmstr *s = str_dup(ctx, v0->s);
+            vmstr *s = str_for_append(ctx, r, v0, v1->s);
             str_append_str(ctx, s, v1->s);
             r->t = VAR_STR;
             r->s = s;
@@ -301,7 +323,7 @@ int add_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "+", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "+", SPKEY_ADD, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -321,14 +343,14 @@ int sub_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         break;
     case VAR_BOOL:
         r->t = VAR_INT64;
-        r->d = v->i - i;
+        r->i = v->i - i;
         break;
     case VAR_DBL:
         r->t = VAR_DBL;
         r->d = v->d - (double)i;
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "-", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "-", SPKEY_SUB, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -346,7 +368,7 @@ int sub_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
         break;
     case VAR_BOOL:
         r->t = VAR_INT64;
-        r->d = i - v->i;
+        r->i = i - v->i;
         break;
     case VAR_DBL:
         r->t = VAR_DBL;
@@ -382,7 +404,7 @@ int sub_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_UNDEF:
             r->t = VAR_INT64;
-            r->i = v1->i;
+            r->i = v0->i;
             break;
         case VAR_BOOL:
         case VAR_INT64:
@@ -446,7 +468,7 @@ int sub_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "-", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "-", SPKEY_SUB, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -478,7 +500,7 @@ int mul_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         str_make_ntimes(ctx, r->s, i);
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "*", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "*", SPKEY_MUL, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -541,7 +563,7 @@ int mul_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_BOOL:
         case VAR_INT64:
-            r->t = VAR_DBL;
+            r->t = VAR_INT64;
             r->i = v0->i * v1->i;
             break;
         case VAR_DBL:
@@ -600,12 +622,14 @@ int mul_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->t = VAR_DBL;
             r->d = v0->d * v1->d;
             break;
-        case VAR_STR:
+        case VAR_STR: {
             /* double value can be used as an int in some cases. */
+            vmstr *s = str_dup(ctx, v1->s);
+            str_make_ntimes(ctx, s, (int64_t)(v0->d));
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v1->s);
-            str_make_ntimes(ctx, r->s, (int64_t)(v0->d));
+            r->s = s;
             break;
+        }
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
         }
@@ -629,18 +653,20 @@ int mul_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         case VAR_BIG:
             /* Unsupported because big int could be so big! */
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
-        case VAR_DBL:
+        case VAR_DBL: {
             /* double value can be used as an int in some cases. */
+            vmstr *s = str_dup(ctx, v0->s);
+            str_make_ntimes(ctx, s, (int64_t)(v1->d));
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
-            str_make_ntimes(ctx, r->s, (int64_t)(v1->d));
+            r->s = s;
             break;
+        }
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "*", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "*", SPKEY_MUL, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -670,7 +696,7 @@ int div_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         str_make_path_i64(ctx, r->s, i);
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "/", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "/", SPKEY_DIV, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -780,12 +806,14 @@ int div_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->t = VAR_DBL;
             r->d = v0->d / v1->d;
             break;
-        case VAR_STR:
+        case VAR_STR: {
             /* double value can be used as an int in some cases. */
+            vmstr *s = str_dup(ctx, v1->s);
+            str_make_i64_path(ctx, (int64_t)(v0->d), s);
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v1->s);
-            str_make_i64_path(ctx, (int64_t)(v0->d), r->s);
+            r->s = s;
             break;
+        }
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
         }
@@ -804,12 +832,14 @@ int div_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         case VAR_BIG:
             /* Unsupported because big int could be so big! */
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
-        case VAR_DBL:
+        case VAR_DBL: {
             /* double value can be used as an int in some cases. */
+            vmstr *s = str_dup(ctx, v0->s);
+            str_make_path_i64(ctx, s, (int64_t)(v1->d));
             r->t = VAR_STR;
-            r->s = str_dup(ctx, v0->s);
-            str_make_path_i64(ctx, r->s, (int64_t)(v1->d));
+            r->s = s;
             break;
+        }
         case VAR_STR: {
             vmstr *s = str_dup(ctx, v0->s);
             str_make_path(ctx, s, v1->s);
@@ -822,7 +852,7 @@ int div_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "/", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "/", SPKEY_DIV, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -853,7 +883,7 @@ int mod_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         break;
     case VAR_OBJ:
         if (!v->o->is_formatter) {
-            OP_CALL_SPECIAL_OPERATOR_I(ctx, "%", __LINE__, r, v, i);
+            OP_CALL_SPECIAL_OPERATOR_I(ctx, "%", SPKEY_MOD, __LINE__, r, v, i);
         } else {
             r->t = VAR_OBJ;
             r->o = v->o;
@@ -986,7 +1016,7 @@ int mod_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         break;
     case VAR_OBJ:
         if (!v0->o->is_formatter) {
-            OP_CALL_SPECIAL_OPERATOR(ctx, "%", __LINE__, r, v0, v1);
+            OP_CALL_SPECIAL_OPERATOR(ctx, "%", SPKEY_MOD, __LINE__, r, v0, v1);
         } else {
             r->t = VAR_OBJ;
             r->o = v0->o;
@@ -1137,7 +1167,7 @@ int eqeq_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         break;
     }
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "==", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "==", SPKEY_EQEQ, __LINE__, r, v, i);
         break;
     default:
         r->t = VAR_BOOL;
@@ -1227,6 +1257,7 @@ int eqeq_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = 0;
             break;
         case VAR_DBL:
+            r->t = VAR_BOOL;
             r->i = fabs(v0->d - v1->d) < DBL_EPSILON;
             break;
         case VAR_STR: {
@@ -1302,7 +1333,7 @@ int eqeq_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         r->i = v1->t == VAR_FNC && v0->f->f == v1->f->f;
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "==", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "==", SPKEY_EQEQ, __LINE__, r, v0, v1);
         break;
     }
     return e;
@@ -1313,7 +1344,7 @@ int eqeq_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 int neq_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     if (v->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "!=", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "!=", SPKEY_NEQ, __LINE__, r, v, i);
     } else {
         int e = eqeq_v_i(ctx, r, v, i);
         r->i = !(r->i);
@@ -1330,7 +1361,7 @@ int neq_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
 int neq_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 {
     if (v0->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR(ctx, "!=", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "!=", SPKEY_NEQ, __LINE__, r, v0, v1);
     } else {
         int e = eqeq_v_v(ctx, r, v0, v1);
         r->i = !(r->i);
@@ -1358,7 +1389,7 @@ int lt_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         r->i = v->d < (double)i;
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<", SPKEY_LT, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1433,11 +1464,11 @@ int lt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_UNDEF:
             r->t = VAR_BOOL;
-            r->i = BzGetSign(v1->bi->b) == BZ_MINUS;
+            r->i = BzGetSign(v0->bi->b) == BZ_MINUS;
             break;
         case VAR_INT64:
             r->t = VAR_BOOL;
-            r->i = BzGetSign(v1->bi->b) == BZ_MINUS;
+            r->i = BzGetSign(v0->bi->b) == BZ_MINUS;
             break;
         case VAR_DBL:
             r->t = VAR_BOOL;
@@ -1463,6 +1494,7 @@ int lt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = v0->d < BzToDouble(v1->bi->b);
             break;
         case VAR_DBL:
+            r->t = VAR_BOOL;
             r->i = v0->d < v1->d;
             break;
         default:
@@ -1473,14 +1505,14 @@ int lt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_STR:
             r->t = VAR_BOOL;
-            r->i = strcmp(v0->s->hd, v1->s->hd) == -1;
+            r->i = strcmp(v0->s->hd, v1->s->hd) < 0;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "<", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "<", SPKEY_LT, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1493,7 +1525,7 @@ int lt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 int le_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     if (v->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<=", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<=", SPKEY_LE, __LINE__, r, v, i);
     } else {
         int e = lt_i_v(ctx, r, i, v);
         r->i = !(r->i);
@@ -1512,7 +1544,7 @@ int le_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
 int le_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 {
     if (v0->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR(ctx, "<=", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "<=", SPKEY_LE, __LINE__, r, v0, v1);
     } else {
         int e = lt_v_v(ctx, r, v1, v0);
         r->i = !(r->i);
@@ -1526,7 +1558,7 @@ int le_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 int gt_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     if (v->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">", SPKEY_GT, __LINE__, r, v, i);
     } else {
         return lt_i_v(ctx, r, i, v);
     }
@@ -1541,7 +1573,7 @@ int gt_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
 int gt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 {
     if (v0->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR(ctx, ">", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, ">", SPKEY_GT, __LINE__, r, v0, v1);
     } else {
         return lt_v_v(ctx, r, v1, v0);
     }
@@ -1553,7 +1585,7 @@ int gt_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 int ge_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     if (v->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">=", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">=", SPKEY_GE, __LINE__, r, v, i);
     } else {
         return le_i_v(ctx, r, i, v);
     }
@@ -1568,7 +1600,7 @@ int ge_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
 int ge_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 {
     if (v0->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR(ctx, ">=", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, ">=", SPKEY_GE, __LINE__, r, v0, v1);
     } else {
         return le_v_v(ctx, r, v1, v0);
     }
@@ -1580,7 +1612,7 @@ int ge_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 int lge_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
 {
     if (v->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<=>", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<=>", SPKEY_LGE, __LINE__, r, v, i);
     } else {
         int e = eqeq_v_i(ctx, r, v, i);
         if (r->i) {
@@ -1617,14 +1649,22 @@ int lge_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
 int lge_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
 {
     if (v0->t == VAR_OBJ) {
-        OP_CALL_SPECIAL_OPERATOR(ctx, "<=>", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "<=>", SPKEY_LGE, __LINE__, r, v0, v1);
     } else {
         int e = eqeq_v_v(ctx, r, v0, v1);
+        if (e) {
+            return e;
+        }
+        r->t = VAR_INT64;
         if (r->i) {
             r->i = 0;
             return e;
         }
         e = lt_v_v(ctx, r, v0, v1);
+        if (e) {
+            return e;
+        }
+        r->t = VAR_INT64;
         if (r->i) {
             r->i = -1;
             return e;
@@ -1665,7 +1705,7 @@ int band_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
         break;
     case VAR_DBL:
         r->t = VAR_INT64;
-        r->d = i & (int64_t)v->d;
+        r->i = i & (int64_t)v->d;
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1684,8 +1724,8 @@ int band_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = 0;
             break;
         case VAR_DBL:
-            r->t = VAR_DBL;
-            r->d = - v1->d;
+            r->t = VAR_INT64;
+            r->i = 0;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1699,7 +1739,7 @@ int band_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL:
             r->t = VAR_INT64;
-            r->d = v0->i & (int64_t)v1->d;
+            r->i = v0->i & (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1712,7 +1752,7 @@ int band_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = 0;
             break;
         case VAR_DBL: {
-            BigZ b1 = BzFromInteger((int64_t)v0->d);
+            BigZ b1 = BzFromInteger((int64_t)v1->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzAnd((v0)->bi->b, b1));
             BzFree(b1);
@@ -1734,7 +1774,7 @@ int band_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = (int64_t)v0->d & v1->i;
             break;
         case VAR_BIG: {
-            BigZ b0 = BzFromInteger((int64_t)v1->d);
+            BigZ b0 = BzFromInteger((int64_t)v0->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzAnd(b0, (v1)->bi->b));
             BzFree(b0);
@@ -1785,7 +1825,7 @@ int bor_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
         break;
     case VAR_DBL:
         r->t = VAR_INT64;
-        r->d = i | (int64_t)v->d;
+        r->i = i | (int64_t)v->d;
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1804,8 +1844,8 @@ int bor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = v1->i;
             break;
         case VAR_DBL:
-            r->t = VAR_DBL;
-            r->d = - v1->d;
+            r->t = VAR_INT64;
+            r->i = (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1819,7 +1859,7 @@ int bor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL:
             r->t = VAR_INT64;
-            r->d = v0->i | (int64_t)v1->d;
+            r->i = v0->i | (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1832,7 +1872,7 @@ int bor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->bi = alcbgi_bigz(ctx, BzCopy((v0)->bi->b));
             break;
         case VAR_DBL: {
-            BigZ b1 = BzFromInteger((int64_t)v0->d);
+            BigZ b1 = BzFromInteger((int64_t)v1->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzOr((v0)->bi->b, b1));
             BzFree(b1);
@@ -1854,7 +1894,7 @@ int bor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             r->i = (int64_t)v0->d | v1->i;
             break;
         case VAR_BIG: {
-            BigZ b0 = BzFromInteger((int64_t)v1->d);
+            BigZ b0 = BzFromInteger((int64_t)v0->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzOr(b0, (v1)->bi->b));
             BzFree(b0);
@@ -1883,7 +1923,7 @@ int bxor_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
     switch (v->t) {
     case VAR_UNDEF:
         r->t = VAR_INT64;
-        r->i = 0;
+        r->i = i;
         break;
     case VAR_DBL:
         r->t = VAR_INT64;
@@ -1901,7 +1941,7 @@ int bxor_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
     switch (v->t) {
     case VAR_UNDEF:
         r->t = VAR_INT64;
-        r->i = 0;
+        r->i = i;
         break;
     case VAR_DBL:
         r->t = VAR_INT64;
@@ -1921,11 +1961,11 @@ int bxor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_INT64:
             r->t = VAR_INT64;
-            r->i = 0;
+            r->i = v1->i;
             break;
         case VAR_DBL:
-            r->t = VAR_DBL;
-            r->i = v0->i ^ (int64_t)v1->d;
+            r->t = VAR_INT64;
+            r->i = (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -1935,7 +1975,7 @@ int bxor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_UNDEF:
             r->t = VAR_INT64;
-            r->i = 0;
+            r->i = v0->i;
             break;
         case VAR_DBL:
             r->t = VAR_INT64;
@@ -1948,11 +1988,11 @@ int bxor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
     case VAR_BIG:
         switch (v1->t) {
         case VAR_UNDEF:
-            r->t = VAR_INT64;
-            r->i = 0;
+            r->t = VAR_BIG;
+            r->bi = alcbgi_bigz(ctx, BzCopy((v0)->bi->b));
             break;
         case VAR_DBL: {
-            BigZ b1 = BzFromInteger((int64_t)v0->d);
+            BigZ b1 = BzFromInteger((int64_t)v1->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzXor((v0)->bi->b, b1));
             BzFree(b1);
@@ -1967,14 +2007,14 @@ int bxor_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         switch (v1->t) {
         case VAR_UNDEF:
             r->t = VAR_INT64;
-            r->i = 0;
+            r->i = (int64_t)v0->d;
             break;
         case VAR_INT64:
             r->t = VAR_INT64;
             r->i = (int64_t)v0->d ^ v1->i;
             break;
         case VAR_BIG: {
-            BigZ b0 = BzFromInteger((int64_t)v1->d);
+            BigZ b0 = BzFromInteger((int64_t)v0->d);
             r->t = VAR_BIG;
             r->bi = alcbgi_bigz(ctx, BzXor(b0, (v1)->bi->b));
             BzFree(b0);
@@ -2010,7 +2050,7 @@ int bshl_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         r->i = (int64_t)v->d << i;
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<<", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, "<<", SPKEY_LSH, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2023,10 +2063,13 @@ int bshl_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
     /* v's type should not be INT and BIGINT. */
     switch (v->t) {
     case VAR_UNDEF:
-    case VAR_DBL:
         r->t = VAR_INT64;
         r->i = i;
         break;
+    case VAR_DBL:
+        r->t = VAR_INT64;
+        r->i = i << (int64_t)v->d;
+        break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
     }
@@ -2056,7 +2099,7 @@ int bshl_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL:
             r->t = VAR_INT64;
-            r->d = v0->i << (int64_t)v1->d;
+            r->i = v0->i << (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2070,7 +2113,7 @@ int bshl_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL: {
             r->t = VAR_BIG;
-            r->bi = alcbgi_bigz(ctx, BzAsh((v0)->bi->b, (int64_t)v0->d));
+            r->bi = alcbgi_bigz(ctx, BzAsh((v0)->bi->b, (int64_t)v1->d));
             break;
         }
         default:
@@ -2099,7 +2142,7 @@ int bshl_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, "<<", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, "<<", SPKEY_LSH, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2122,7 +2165,7 @@ int bshr_v_i(vmctx *ctx, vmvar *r, vmvar *v, int64_t i)
         r->i = (int64_t)v->d >> i;
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">>", __LINE__, r, v, i);
+        OP_CALL_SPECIAL_OPERATOR_I(ctx, ">>", SPKEY_RSH, __LINE__, r, v, i);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2135,10 +2178,13 @@ int bshr_i_v(vmctx *ctx, vmvar *r, int64_t i, vmvar *v)
     /* v's type should not be INT and BIGINT. */
     switch (v->t) {
     case VAR_UNDEF:
-    case VAR_DBL:
         r->t = VAR_INT64;
         r->i = i;
         break;
+    case VAR_DBL:
+        r->t = VAR_INT64;
+        r->i = i >> (int64_t)v->d;
+        break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
     }
@@ -2168,7 +2214,7 @@ int bshr_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL:
             r->t = VAR_INT64;
-            r->d = v0->i >> (int64_t)v1->d;
+            r->i = v0->i >> (int64_t)v1->d;
             break;
         default:
             return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2182,7 +2228,7 @@ int bshr_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
             break;
         case VAR_DBL: {
             r->t = VAR_BIG;
-            r->bi = alcbgi_bigz(ctx, BzAsh((v0)->bi->b, -((int64_t)v0->d)));
+            r->bi = alcbgi_bigz(ctx, BzAsh((v0)->bi->b, -((int64_t)v1->d)));
             bi_normalize(r);
             break;
         }
@@ -2212,7 +2258,7 @@ int bshr_v_v(vmctx *ctx, vmvar *r, vmvar *v0, vmvar *v1)
         }
         break;
     case VAR_OBJ:
-        OP_CALL_SPECIAL_OPERATOR(ctx, ">>", __LINE__, r, v0, v1);
+        OP_CALL_SPECIAL_OPERATOR(ctx, ">>", SPKEY_RSH, __LINE__, r, v0, v1);
         break;
     default:
         return throw_system_exception(__LINE__, ctx, EXCEPT_UNSUPPORTED_OPERATION, NULL);
@@ -2298,11 +2344,13 @@ int uminus_v(vmctx *ctx, vmvar *r, vmvar *v)
 int uconv_v(vmctx *ctx, vmvar *r, vmvar *v)
 {
     switch (v->t) {
-    case VAR_INT64:
+    case VAR_INT64: {
+        int ch = (int)v->i;     /* r can be v. */
         r->t = VAR_STR;
         r->s = alcstr_str(ctx, "0");
-        r->s->hd[0] = (int)v->i;
+        r->s->hd[0] = ch;
         break;
+    }
     case VAR_BIN: {
         char *buf = alloca(v->bn->len + 1);
         for (int i = 0; i < v->bn->len; ++i) {
@@ -2313,15 +2361,18 @@ int uconv_v(vmctx *ctx, vmvar *r, vmvar *v)
         r->s = alcstr_str(ctx, buf);
         break;
     }
-    case VAR_STR:
-        r->t = VAR_OBJ;
-        r->o = alcobj(ctx);
+    case VAR_STR: {
+        vmobj *o = alcobj(ctx);
         for (int i = 0; i < v->s->len; ++i) {
-            array_push(ctx, r->o, alcvar_int64(ctx, v->s->hd[i], 0));
+            array_push(ctx, o, alcvar_int64(ctx, v->s->hd[i], 0));
         }
+        r->t = VAR_OBJ;
+        r->o = o;
         break;
+    }
     case VAR_OBJ: {
         vmobj *obj = v->o;
+        array_generic(ctx, obj);
         vmvar **ary = obj->ary;
         r->t = VAR_STR;
         if (obj->idxsz > 0) {
@@ -12,8 +12,24 @@ static inline char str_last_ch(vmstr *vs)
     return (vs->len == 0) ? 0 : (vs->s[vs->len-1]);
 }
 
+/* The content of File.mmap() is copied out to the own buffer before it's modified. */
+void str_unmap(vmstr *vs)
+{
+    int xlen = vs->len + 1;
+    int cap = (xlen < STR_UNIT) ? STR_UNIT : ((xlen / STR_UNIT) * (STR_UNIT << 1));
+    char *ns = (char *)calloc(cap, sizeof(char));
+    memcpy(ns, vs->hd, vs->len);
+    pbakmap(vs->map);
+    vs->map = NULL;
+    vs->s = vs->hd = ns;
+    vs->cap = cap;
+}
+
 static inline vmstr *str_append_impl(vmctx *ctx, vmstr *vs, const char *s, int l)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     if (vs->s < vs->hd) {
         char *sp = vs->s;
         char *hp = vs->hd;
@@ -96,6 +112,9 @@ vmstr *str_append_str(vmctx *ctx, vmstr *vs, vmstr *s2)
 
 vmstr *str_append_fmt(vmctx *ctx, vmstr *vs, const char *fmt, ...)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     if (vs->s < vs->hd) {
         char *sp = vs->s;
         char *hp = vs->hd;
@@ -132,6 +151,27 @@ vmstr *str_append_fmt(vmctx *ctx, vmstr *vs, const char *fmt, ...)
     return vs;
 }
 
+/* Makes the buffer large enough for len characters, so that appending up to that does not reallocate it. */
+vmstr *str_reserve(vmctx *ctx, vmstr *vs, int len)
+{
+    if (vs->map) {
+        str_unmap(vs);
+    }
+    int xlen = len + 1;
+    if (xlen < vs->cap) {
+        return vs;
+    }
+    int cap = ((xlen / STR_UNIT) + 1) * STR_UNIT;
+    char *ns = (char *)calloc(cap, sizeof(char));
+    if (vs->hd) {
+        memcpy(ns, vs->hd, vs->len);
+    }
+    free(vs->s);
+    vs->hd = vs->s = ns;
+    vs->cap = cap;
+    return vs;
+}
+
 vmstr *str_append_ch(vmctx *ctx, vmstr *vs, const char ch)
 {
     char buf[2] = {ch, 0};
@@ -159,6 +199,9 @@ vmstr *str_append_i64(vmctx *ctx, vmstr *vs, int64_t i)
 
 vmstr *str_clear(vmstr *vs)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     vs->s[0] = vs->hd[0] = 0;
     vs->len = 0;
     return vs;
@@ -166,6 +209,9 @@ vmstr *str_clear(vmstr *vs)
 
 vmstr *str_set(vmctx *ctx, vmstr *vs, const char *s, int len)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     vs->s[0] = vs->hd[0] = 0;
     vs->len = 0;
     str_append_impl(ctx, vs, s, len);
@@ -174,6 +220,9 @@ vmstr *str_set(vmctx *ctx, vmstr *vs, const char *s, int len)
 
 vmstr *str_set_cp(vmctx *ctx, vmstr *vs, const char *s)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     vs->s[0] = vs->hd[0] = 0;
     vs->len = 0;
     str_append_impl(ctx, vs, s, strlen(s));
@@ -199,6 +248,9 @@ vmstr *str_from_dbl(vmctx *ctx, double *d)
 
 vmstr *str_make_double(vmctx *ctx, vmstr *vs)
 {
+    if (vs->map) {
+        str_unmap(vs);
+    }
     int len = vs->len;
     int len2 = len * 2;
     if (len2 < vs->cap) {
@@ -326,6 +378,9 @@ vmstr *str_rtrim(vmctx *ctx, vmstr *vs, const char *ch)
     if (!ch || *ch == 0) {
         return vs;
     }
+    if (vs->map) {
+        str_unmap(vs);
+    }
     char *p = vs->hd + vs->len - 1;
     for ( ; vs->hd < p; --p) {
         int matched = 0;
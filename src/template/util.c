@@ -18,6 +18,7 @@ DEF_COUNT(vmvar, var)
 
 void count(vmctx *ctx)
 {
+    printf("gc minor = %d, major = %d\n", ctx->gc.minor, ctx->gc.major);
     count_str(ctx);
     count_bgi(ctx);
     count_obj(ctx);